@@ -0,0 +1,583 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Asynchronous file reads for a libev event loop.
+//
+// A pread() of a cold file blocks the loop thread, and with it every
+// connection, for as long as the disk takes. Reads submitted here run in
+// the background and complete through an eventfd watched by the loop:
+//
+//   loop thread --submit--> io_uring (or worker threads) --> eventfd
+//                                                              |
+//   loop thread <--done-- ev_io <------------------------------+
+//
+// The io_uring backend talks to the kernel through the raw system calls
+// (no liburing needed) and has the eventfd registered with the ring. Where
+// io_uring is not available (old kernel, seccomp, io_uring_disabled) a
+// small thread pool doing pread() is used instead. With zero threads reads
+// are done inline at submit time but still completed from the eventfd
+// callback, so callers have a single code path.
+//
+// TQUIC_FILE_IO selects the backend: "uring" (default, falls back to
+// threads), "threads" or "sync". TQUIC_FILE_IO_THREADS sets the pool size
+// (default 4).
+//
+// Requests and their buffers belong to the caller and must stay valid
+// until `done` has run. `done` always runs on the loop thread.
+
+#ifndef ASYNC_READ_H
+#define ASYNC_READ_H
+
+#include <errno.h>
+#include <ev.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define ASYNC_READ_HAVE_URING 1
+#endif
+#endif
+
+#define ASYNC_READ_ENV_BACKEND "TQUIC_FILE_IO"
+#define ASYNC_READ_ENV_THREADS "TQUIC_FILE_IO_THREADS"
+#define ASYNC_READ_DEFAULT_THREADS 4
+#define ASYNC_READ_URING_ENTRIES 256
+
+struct async_read_req;
+
+// Runs on the loop thread once the read has finished.
+typedef void (*async_read_done_fn)(struct async_read_req *req);
+
+// Runs on the loop thread after a batch of completions, e.g. to flush
+// packets queued by the done callbacks.
+typedef void (*async_read_flush_fn)(void *ctx);
+
+struct async_read_req {
+    int fd;
+    uint8_t *buf;
+    size_t len;
+    uint64_t offset;
+    async_read_done_fn done;
+    void *ctx;
+
+    // Bytes read (short only at end of file), or -errno
+    ssize_t result;
+
+    // Internal
+    struct iovec iov;
+    uint64_t submitted_ns;
+    struct async_read_req *next;
+};
+
+enum async_read_backend {
+    ASYNC_READ_URING,
+    ASYNC_READ_THREADS,
+};
+
+struct async_read_stats {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t failed;
+    uint64_t in_flight;
+    uint64_t max_in_flight;
+    uint64_t total_ns;  // Submit to completion, summed
+    uint64_t max_ns;
+};
+
+#ifdef ASYNC_READ_HAVE_URING
+struct async_read_uring {
+    int ring_fd;
+    void *sq_ptr;
+    size_t sq_ptr_len;
+    void *cq_ptr;
+    size_t cq_ptr_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned cq_entries;
+    unsigned in_ring;                 // Submitted and not yet reaped
+    struct async_read_req *backlog;   // Waiting for ring space, FIFO
+    struct async_read_req *backlog_tail;
+};
+#endif
+
+struct async_read {
+    struct ev_loop *loop;
+    enum async_read_backend backend;
+    int efd;
+    ev_io watcher;
+
+#ifdef ASYNC_READ_HAVE_URING
+    struct async_read_uring uring;
+#endif
+
+    // Thread pool
+    pthread_t *threads;
+    size_t thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct async_read_req *queue;  // LIFO is fine: reads are independent
+    struct async_read_req *done;
+    bool stopping;
+
+    async_read_flush_fn flush;
+    void *flush_ctx;
+
+    struct async_read_stats stats;
+};
+
+static inline uint64_t async_read_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// pread() the whole request unless the file ends first.
+static inline ssize_t async_read_pread_full(struct async_read_req *req) {
+    size_t total = 0;
+    while (total < req->len) {
+        ssize_t n = pread(req->fd, req->buf + total, req->len - total,
+                          req->offset + total);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (n == 0) {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+static inline void async_read_complete(struct async_read *ar,
+                                       struct async_read_req *req) {
+    uint64_t elapsed = async_read_now_ns() - req->submitted_ns;
+    ar->stats.completed++;
+    ar->stats.in_flight--;
+    ar->stats.total_ns += elapsed;
+    if (elapsed > ar->stats.max_ns) {
+        ar->stats.max_ns = elapsed;
+    }
+    if (req->result < 0) {
+        ar->stats.failed++;
+    }
+    req->done(req);
+}
+
+#ifdef ASYNC_READ_HAVE_URING
+
+static inline int async_read_uring_init(struct async_read *ar) {
+    struct async_read_uring *u = &ar->uring;
+    struct io_uring_params params;
+    memset(u, 0, sizeof(*u));
+    memset(&params, 0, sizeof(params));
+
+    u->ring_fd = syscall(__NR_io_uring_setup, ASYNC_READ_URING_ENTRIES, &params);
+    if (u->ring_fd < 0) {
+        return -1;
+    }
+
+    u->sq_ptr_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    u->cq_ptr_len =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && u->cq_ptr_len > u->sq_ptr_len) {
+        u->sq_ptr_len = u->cq_ptr_len;
+    }
+
+    u->sq_ptr = mmap(NULL, u->sq_ptr_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) {
+        goto FAIL;
+    }
+    if (single_mmap) {
+        u->cq_ptr = u->sq_ptr;
+    } else {
+        u->cq_ptr = mmap(NULL, u->cq_ptr_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, u->ring_fd,
+                         IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED) {
+            goto FAIL;
+        }
+    }
+    u->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        goto FAIL;
+    }
+
+    uint8_t *sq = u->sq_ptr;
+    uint8_t *cq = u->cq_ptr;
+    u->sq_head = (unsigned *)(sq + params.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + params.sq_off.array);
+    u->sq_entries = params.sq_entries;
+    u->cq_head = (unsigned *)(cq + params.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    u->cq_entries = params.cq_entries;
+
+    if (syscall(__NR_io_uring_register, u->ring_fd, IORING_REGISTER_EVENTFD,
+                &ar->efd, 1) != 0) {
+        goto FAIL;
+    }
+    return 0;
+
+FAIL:
+    if (u->sqes != NULL && u->sqes != MAP_FAILED) {
+        munmap(u->sqes, u->sqes_len);
+    }
+    if (u->cq_ptr != NULL && u->cq_ptr != MAP_FAILED && u->cq_ptr != u->sq_ptr) {
+        munmap(u->cq_ptr, u->cq_ptr_len);
+    }
+    if (u->sq_ptr != NULL && u->sq_ptr != MAP_FAILED) {
+        munmap(u->sq_ptr, u->sq_ptr_len);
+    }
+    close(u->ring_fd);
+    u->ring_fd = -1;
+    return -1;
+}
+
+// Put one read on the submission queue and hand it to the kernel. The
+// number of reads in the ring is kept within the completion queue size.
+static inline void async_read_uring_push(struct async_read *ar,
+                                         struct async_read_req *req) {
+    struct async_read_uring *u = &ar->uring;
+    unsigned tail = *u->sq_tail;
+    unsigned index = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    req->iov.iov_base = req->buf;
+    req->iov.iov_len = req->len;
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = req->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&req->iov;
+    sqe->len = 1;
+    sqe->off = req->offset;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+    u->sq_array[index] = index;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->in_ring++;
+
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, u->ring_fd, 1, 0, 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        // The entry stays queued; the kernel picks it up on the next enter
+        fprintf(stderr, "io_uring_enter failed: %s\n", strerror(errno));
+    }
+}
+
+static inline bool async_read_uring_full(const struct async_read_uring *u) {
+    return u->in_ring >= u->sq_entries || u->in_ring >= u->cq_entries;
+}
+
+static inline void async_read_uring_submit(struct async_read *ar,
+                                           struct async_read_req *req) {
+    struct async_read_uring *u = &ar->uring;
+    if (u->backlog != NULL || async_read_uring_full(u)) {
+        req->next = NULL;
+        if (u->backlog_tail != NULL) {
+            u->backlog_tail->next = req;
+        } else {
+            u->backlog = req;
+        }
+        u->backlog_tail = req;
+        return;
+    }
+    async_read_uring_push(ar, req);
+}
+
+static inline void async_read_uring_reap(struct async_read *ar) {
+    struct async_read_uring *u = &ar->uring;
+    while (true) {
+        unsigned head = *u->cq_head;
+        if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        struct async_read_req *req = (struct async_read_req *)(uintptr_t)cqe->user_data;
+        req->result = cqe->res;
+        __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+        u->in_ring--;
+
+        // A short read before end of file: read the rest synchronously
+        // rather than complicating every caller
+        if (req->result > 0 && (size_t)req->result < req->len) {
+            struct async_read_req rest = *req;
+            rest.buf += req->result;
+            rest.len -= req->result;
+            rest.offset += req->result;
+            ssize_t more = async_read_pread_full(&rest);
+            req->result = more < 0 ? more : req->result + more;
+        }
+
+        while (u->backlog != NULL && !async_read_uring_full(u)) {
+            struct async_read_req *next = u->backlog;
+            u->backlog = next->next;
+            if (u->backlog == NULL) {
+                u->backlog_tail = NULL;
+            }
+            async_read_uring_push(ar, next);
+        }
+        async_read_complete(ar, req);
+    }
+}
+
+static inline void async_read_uring_free(struct async_read *ar) {
+    struct async_read_uring *u = &ar->uring;
+    munmap(u->sqes, u->sqes_len);
+    if (u->cq_ptr != u->sq_ptr) {
+        munmap(u->cq_ptr, u->cq_ptr_len);
+    }
+    munmap(u->sq_ptr, u->sq_ptr_len);
+    close(u->ring_fd);
+}
+
+#endif  // ASYNC_READ_HAVE_URING
+
+static inline void async_read_signal(struct async_read *ar) {
+    uint64_t one = 1;
+    while (write(ar->efd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+}
+
+static inline void *async_read_thread_main(void *arg) {
+    struct async_read *ar = arg;
+    pthread_mutex_lock(&ar->lock);
+    while (true) {
+        while (ar->queue == NULL && !ar->stopping) {
+            pthread_cond_wait(&ar->cond, &ar->lock);
+        }
+        if (ar->stopping) {
+            break;
+        }
+        struct async_read_req *req = ar->queue;
+        ar->queue = req->next;
+        pthread_mutex_unlock(&ar->lock);
+
+        req->result = async_read_pread_full(req);
+
+        pthread_mutex_lock(&ar->lock);
+        req->next = ar->done;
+        ar->done = req;
+        async_read_signal(ar);
+    }
+    pthread_mutex_unlock(&ar->lock);
+    return NULL;
+}
+
+static inline void async_read_threads_reap(struct async_read *ar) {
+    pthread_mutex_lock(&ar->lock);
+    struct async_read_req *list = ar->done;
+    ar->done = NULL;
+    pthread_mutex_unlock(&ar->lock);
+
+    while (list != NULL) {
+        struct async_read_req *req = list;
+        list = req->next;
+        async_read_complete(ar, req);
+    }
+}
+
+static inline void async_read_cb(EV_P_ ev_io *w, int revents) {
+    struct async_read *ar = w->data;
+    uint64_t count;
+    while (read(ar->efd, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+#ifdef ASYNC_READ_HAVE_URING
+    if (ar->backend == ASYNC_READ_URING) {
+        async_read_uring_reap(ar);
+    } else {
+        async_read_threads_reap(ar);
+    }
+#else
+    async_read_threads_reap(ar);
+#endif
+    if (ar->flush != NULL) {
+        ar->flush(ar->flush_ctx);
+    }
+}
+
+static inline const char *async_read_backend_name(const struct async_read *ar) {
+    if (ar->backend == ASYNC_READ_URING) {
+        return "io_uring";
+    }
+    return ar->thread_count > 0 ? "threads" : "sync";
+}
+
+static inline int async_read_start_threads(struct async_read *ar, size_t count) {
+    ar->backend = ASYNC_READ_THREADS;
+    if (count == 0) {
+        return 0;
+    }
+    ar->threads = calloc(count, sizeof(pthread_t));
+    if (ar->threads == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (pthread_create(&ar->threads[i], NULL, async_read_thread_main, ar) != 0) {
+            fprintf(stderr, "failed to start file I/O thread\n");
+            break;
+        }
+        ar->thread_count++;
+    }
+    return 0;
+}
+
+static inline int async_read_init(struct async_read *ar, struct ev_loop *loop,
+                                  async_read_flush_fn flush, void *flush_ctx) {
+    memset(ar, 0, sizeof(*ar));
+    ar->loop = loop;
+    ar->flush = flush;
+    ar->flush_ctx = flush_ctx;
+    pthread_mutex_init(&ar->lock, NULL);
+    pthread_cond_init(&ar->cond, NULL);
+
+    ar->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ar->efd < 0) {
+        fprintf(stderr, "failed to create eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    const char *backend = getenv(ASYNC_READ_ENV_BACKEND);
+    size_t threads = ASYNC_READ_DEFAULT_THREADS;
+    const char *value = getenv(ASYNC_READ_ENV_THREADS);
+    if (value != NULL && *value != '\0') {
+        threads = strtoul(value, NULL, 10);
+    }
+
+    int ret;
+    if (backend != NULL && strcmp(backend, "sync") == 0) {
+        ret = async_read_start_threads(ar, 0);
+    } else if (backend != NULL && strcmp(backend, "threads") == 0) {
+        ret = async_read_start_threads(ar, threads);
+    } else {
+#ifdef ASYNC_READ_HAVE_URING
+        ar->backend = ASYNC_READ_URING;
+        ret = async_read_uring_init(ar);
+        if (ret != 0) {
+            fprintf(stderr, "io_uring unavailable (%s), using %zu I/O threads\n",
+                    strerror(errno), threads);
+            ret = async_read_start_threads(ar, threads);
+        }
+#else
+        ret = async_read_start_threads(ar, threads);
+#endif
+    }
+    if (ret != 0) {
+        close(ar->efd);
+        return -1;
+    }
+
+    ev_io_init(&ar->watcher, async_read_cb, ar->efd, EV_READ);
+    ar->watcher.data = ar;
+    ev_io_start(loop, &ar->watcher);
+    fprintf(stderr, "file I/O backend: %s\n", async_read_backend_name(ar));
+    return 0;
+}
+
+// Start reading `req->len` bytes at `req->offset` of `req->fd` into
+// `req->buf`. `req->done` runs on the loop thread when it finishes.
+static inline void async_read_submit(struct async_read *ar,
+                                     struct async_read_req *req) {
+    req->submitted_ns = async_read_now_ns();
+    req->next = NULL;
+    ar->stats.submitted++;
+    if (++ar->stats.in_flight > ar->stats.max_in_flight) {
+        ar->stats.max_in_flight = ar->stats.in_flight;
+    }
+
+#ifdef ASYNC_READ_HAVE_URING
+    if (ar->backend == ASYNC_READ_URING) {
+        async_read_uring_submit(ar, req);
+        return;
+    }
+#endif
+    if (ar->thread_count == 0) {
+        req->result = async_read_pread_full(req);
+        req->next = ar->done;
+        ar->done = req;
+        async_read_signal(ar);
+        return;
+    }
+
+    pthread_mutex_lock(&ar->lock);
+    req->next = ar->queue;
+    ar->queue = req;
+    pthread_cond_signal(&ar->cond);
+    pthread_mutex_unlock(&ar->lock);
+}
+
+static inline void async_read_print_stats(const struct async_read *ar) {
+    const struct async_read_stats *s = &ar->stats;
+    fprintf(stderr,
+            "file I/O (%s): reads=%" PRIu64 " failed=%" PRIu64 " in_flight=%" PRIu64
+            " max_in_flight=%" PRIu64 " latency avg=%.3fms max=%.3fms\n",
+            async_read_backend_name(ar), s->submitted, s->failed, s->in_flight,
+            s->max_in_flight, s->completed ? s->total_ns / 1e6 / s->completed : 0.0,
+            s->max_ns / 1e6);
+}
+
+// Stop the backend. Reads still in flight never complete.
+static inline void async_read_free(struct async_read *ar) {
+    ev_io_stop(ar->loop, &ar->watcher);
+#ifdef ASYNC_READ_HAVE_URING
+    if (ar->backend == ASYNC_READ_URING) {
+        async_read_uring_free(ar);
+    }
+#endif
+    pthread_mutex_lock(&ar->lock);
+    ar->stopping = true;
+    pthread_cond_broadcast(&ar->cond);
+    pthread_mutex_unlock(&ar->lock);
+    for (size_t i = 0; i < ar->thread_count; i++) {
+        pthread_join(ar->threads[i], NULL);
+    }
+    free(ar->threads);
+    pthread_mutex_destroy(&ar->lock);
+    pthread_cond_destroy(&ar->cond);
+    close(ar->efd);
+}
+
+#endif  // ASYNC_READ_H
@@ -0,0 +1,370 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Content-coding negotiation and an on-first-hit gzip cache for the static
+// file server.
+//
+// accept_encoding_parse() reads an `accept-encoding` request header and
+// accept_encoding_order() lists the codings the client accepts, by q-value
+// and then by server preference (br, zstd, gzip). The server looks for
+// precompressed siblings (file.br, file.zst, file.gz) in that order.
+//
+// When TQUIC_COMPRESS_CACHE_DIR is set, text files without a usable
+// sibling are gzip-compressed the first time they are requested and the
+// result is kept in that directory. Cache file names include the source
+// size and mtime, so a changed file is simply compressed again.
+
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define COMPRESS_CACHE_ENV_DIR "TQUIC_COMPRESS_CACHE_DIR"
+#define COMPRESS_CACHE_ENV_MAX_FILE "TQUIC_COMPRESS_CACHE_MAX_FILE_MB"
+#define COMPRESS_CACHE_DEFAULT_MAX_FILE_MB 8
+#define COMPRESS_CACHE_LEVEL 6
+#define COMPRESS_CACHE_CHUNK 65536
+
+// Supported content codings, in server preference order.
+enum content_coding {
+    CODING_BR,
+    CODING_ZSTD,
+    CODING_GZIP,
+    CODING_COUNT,
+};
+
+static inline const char *content_coding_name(enum content_coding coding) {
+    switch (coding) {
+        case CODING_BR:
+            return "br";
+        case CODING_ZSTD:
+            return "zstd";
+        case CODING_GZIP:
+            return "gzip";
+        default:
+            return "identity";
+    }
+}
+
+// File name suffix of a precompressed sibling.
+static inline const char *content_coding_suffix(enum content_coding coding) {
+    switch (coding) {
+        case CODING_BR:
+            return ".br";
+        case CODING_ZSTD:
+            return ".zst";
+        case CODING_GZIP:
+            return ".gz";
+        default:
+            return "";
+    }
+}
+
+struct accept_encoding {
+    double q[CODING_COUNT];  // 0 means not acceptable
+};
+
+// Parse an accept-encoding field value, e.g. "gzip, br;q=0.9, *;q=0.1".
+// A NULL value accepts no coding.
+static inline void accept_encoding_parse(const char *value,
+                                         struct accept_encoding *ae) {
+    double wildcard = 0;
+    bool listed[CODING_COUNT] = {false};
+    memset(ae, 0, sizeof(*ae));
+    if (value == NULL) {
+        return;
+    }
+
+    const char *p = value;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        const char *token = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        size_t token_len = p - token;
+
+        double q = 1.0;
+        while (*p && *p != ',') {
+            if (*p == ';') {
+                p++;
+                while (*p == ' ' || *p == '\t') {
+                    p++;
+                }
+                if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+                    q = strtod(p + 2, NULL);
+                }
+            } else {
+                p++;
+            }
+        }
+        if (token_len == 0) {
+            continue;
+        }
+
+        if (token_len == 1 && token[0] == '*') {
+            wildcard = q;
+            continue;
+        }
+        for (int c = 0; c < CODING_COUNT; c++) {
+            const char *name = content_coding_name(c);
+            if (strlen(name) == token_len &&
+                strncasecmp(token, name, token_len) == 0) {
+                ae->q[c] = q;
+                listed[c] = true;
+            }
+        }
+        if (token_len == 6 && strncasecmp(token, "x-gzip", 6) == 0) {
+            ae->q[CODING_GZIP] = q;
+            listed[CODING_GZIP] = true;
+        }
+    }
+
+    for (int c = 0; c < CODING_COUNT; c++) {
+        if (!listed[c]) {
+            ae->q[c] = wildcard;
+        }
+    }
+}
+
+// Fill `out` with the acceptable codings, highest q first; ties keep the
+// server preference order. Returns the number of codings.
+static inline size_t accept_encoding_order(const struct accept_encoding *ae,
+                                           enum content_coding *out) {
+    size_t n = 0;
+    for (int c = 0; c < CODING_COUNT; c++) {
+        if (ae->q[c] <= 0) {
+            continue;
+        }
+        size_t i = n++;
+        while (i > 0 && ae->q[out[i - 1]] < ae->q[c]) {
+            out[i] = out[i - 1];
+            i--;
+        }
+        out[i] = c;
+    }
+    return n;
+}
+
+// Whether a response of this type is worth compressing.
+static inline bool content_type_compressible(const char *content_type) {
+    return strncmp(content_type, "text/", 5) == 0 ||
+           strcmp(content_type, "application/javascript") == 0 ||
+           strcmp(content_type, "application/json") == 0 ||
+           strcmp(content_type, "image/svg+xml") == 0;
+}
+
+struct compress_cache_stats {
+    uint64_t hits;
+    uint64_t compressed;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t failures;
+};
+
+struct compress_cache {
+    const char *dir;  // NULL when the cache is disabled
+    uint64_t max_file_size;
+    struct compress_cache_stats stats;
+};
+
+static inline void compress_cache_init(struct compress_cache *cc) {
+    memset(cc, 0, sizeof(*cc));
+    const char *dir = getenv(COMPRESS_CACHE_ENV_DIR);
+    if (dir == NULL || *dir == '\0') {
+        return;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "compress cache: failed to create %s: %s\n", dir,
+                strerror(errno));
+        return;
+    }
+    cc->dir = dir;
+
+    uint64_t max_mb = COMPRESS_CACHE_DEFAULT_MAX_FILE_MB;
+    const char *value = getenv(COMPRESS_CACHE_ENV_MAX_FILE);
+    if (value != NULL && *value != '\0') {
+        char *end = NULL;
+        unsigned long long mb = strtoull(value, &end, 10);
+        if (end != value && *end == '\0') {
+            max_mb = mb;
+        }
+    }
+    cc->max_file_size = max_mb << 20;
+}
+
+static inline int compress_cache_write_all(int fd, const uint8_t *buf,
+                                           size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// gzip everything from `in_fd` into `out_fd`. Fails unless deflate reaches
+// the end of the gzip stream; the caller discards the partial output.
+static inline int compress_cache_deflate(int in_fd, int out_fd,
+                                         uint64_t *out_bytes) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // windowBits 15 + 16 selects the gzip wrapper
+    if (deflateInit2(&zs, COMPRESS_CACHE_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+
+    static uint8_t in[COMPRESS_CACHE_CHUNK];
+    static uint8_t out[COMPRESS_CACHE_CHUNK];
+    int ret = 0;
+    int zret = Z_OK;
+    int flush;
+    do {
+        ssize_t n = read(in_fd, in, sizeof(in));
+        if (n < 0) {
+            if (errno == EINTR) {
+                flush = Z_NO_FLUSH;
+                continue;
+            }
+            ret = -1;
+            break;
+        }
+        flush = n == 0 ? Z_FINISH : Z_NO_FLUSH;
+        zs.next_in = in;
+        zs.avail_in = n;
+        do {
+            zs.next_out = out;
+            zs.avail_out = sizeof(out);
+            zret = deflate(&zs, flush);
+            if (zret == Z_STREAM_ERROR) {
+                ret = -1;
+                break;
+            }
+            size_t have = sizeof(out) - zs.avail_out;
+            if (compress_cache_write_all(out_fd, out, have) != 0) {
+                ret = -1;
+                break;
+            }
+            *out_bytes += have;
+        } while (zs.avail_out == 0);
+    } while (ret == 0 && flush != Z_FINISH);
+    // The last Z_FINISH pass must have written the gzip trailer
+    if (ret == 0 && zret != Z_STREAM_END) {
+        ret = -1;
+    }
+
+    deflateEnd(&zs);
+    return ret;
+}
+
+static inline uint64_t compress_cache_hash(const char *path) {
+    uint64_t h = 14695981039346656037ULL;  // FNV-1a
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Find or create the gzip copy of `path` (whose stat is `st`) and write its
+// location to `out`. Returns 0 on success, -1 if the cache is disabled, the
+// file is too large, or compression did not make it smaller.
+static inline int compress_cache_gzip(struct compress_cache *cc,
+                                      const char *path, const struct stat *st,
+                                      char *out, size_t out_len) {
+    if (cc->dir == NULL || (uint64_t)st->st_size > cc->max_file_size) {
+        return -1;
+    }
+
+    int n = snprintf(out, out_len, "%s/%016" PRIx64 "-%" PRIx64 "-%lld.%09ld.gz",
+                     cc->dir, compress_cache_hash(path), (uint64_t)st->st_size,
+                     (long long)st->st_mtim.tv_sec, (long)st->st_mtim.tv_nsec);
+    if (n < 0 || (size_t)n >= out_len) {
+        return -1;
+    }
+
+    struct stat cached;
+    if (stat(out, &cached) == 0) {
+        cc->stats.hits++;
+        return cached.st_size < st->st_size ? 0 : -1;
+    }
+
+    char tmp[4096];
+    n = snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", out, (long)getpid());
+    if (n < 0 || (size_t)n >= sizeof(tmp)) {
+        return -1;
+    }
+    int in_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0) {
+        return -1;
+    }
+    int out_fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out_fd < 0) {
+        close(in_fd);
+        cc->stats.failures++;
+        return -1;
+    }
+
+    uint64_t out_bytes = 0;
+    int ret = compress_cache_deflate(in_fd, out_fd, &out_bytes);
+    close(in_fd);
+    if (close(out_fd) != 0) {
+        ret = -1;
+    }
+    // Publish atomically so concurrent readers never see a partial file
+    if (ret != 0 || rename(tmp, out) != 0) {
+        unlink(tmp);
+        cc->stats.failures++;
+        return -1;
+    }
+
+    cc->stats.compressed++;
+    cc->stats.bytes_in += st->st_size;
+    cc->stats.bytes_out += out_bytes;
+    return out_bytes < (uint64_t)st->st_size ? 0 : -1;
+}
+
+static inline void compress_cache_print_stats(const struct compress_cache *cc) {
+    if (cc->dir == NULL) {
+        return;
+    }
+    const struct compress_cache_stats *s = &cc->stats;
+    fprintf(stderr,
+            "compress cache: hits=%" PRIu64 " compressed=%" PRIu64
+            " (%" PRIu64 " -> %" PRIu64 " bytes) failures=%" PRIu64 "\n",
+            s->hits, s->compressed, s->bytes_in, s->bytes_out, s->failures);
+}
+
+#endif  // COMPRESS_CACHE_H
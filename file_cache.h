@@ -0,0 +1,337 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Cache of memory-mapped files for the static file server.
+//
+// Entries are keyed by path and validated against (dev, inode, size, mtime)
+// from stat() on every lookup, so a file replaced on disk is remapped. The
+// cache is an LRU bounded by the total mapped bytes. Each lookup returns a
+// referenced entry; an evicted entry stays mapped until the last in-flight
+// response releases it, so bodies can be sent straight from the mapping.
+//
+// Files larger than the per-file limit are not mapped; lookup fails with
+// EFBIG and the caller streams them from the file descriptor instead.
+//
+// Files must be replaced (rename) rather than truncated in place while
+// mapped, as with any mmap-based server. Not thread-safe: use it from the
+// event loop thread only.
+
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define FILE_CACHE_ENV_SIZE "TQUIC_FILE_CACHE_MB"
+#define FILE_CACHE_ENV_MAX_FILE "TQUIC_FILE_CACHE_MAX_FILE_MB"
+#define FILE_CACHE_DEFAULT_SIZE_MB 256
+#define FILE_CACHE_DEFAULT_MAX_FILE_MB 32
+#define FILE_CACHE_BUCKETS 1024
+
+struct file_cache_entry {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    uint8_t *data;  // NULL for empty files
+
+    unsigned int refcount;  // The cache itself holds one while linked
+    bool cached;
+    struct file_cache_entry *hash_next;
+    struct file_cache_entry *lru_prev;  // Towards most recently used
+    struct file_cache_entry *lru_next;  // Towards least recently used
+};
+
+struct file_cache_stats {
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stale;        // Entry found but the file changed on disk
+    uint64_t too_large;    // Files left to the caller to stream
+    uint64_t evictions;
+    uint64_t evicted_bytes;
+};
+
+struct file_cache {
+    struct file_cache_entry *buckets[FILE_CACHE_BUCKETS];
+    struct file_cache_entry *lru_head;
+    struct file_cache_entry *lru_tail;
+    size_t entries;
+    uint64_t total_bytes;
+    uint64_t max_bytes;
+    uint64_t max_file_size;
+    struct file_cache_stats stats;
+};
+
+static inline uint64_t file_cache_hash(const char *path) {
+    uint64_t h = 14695981039346656037ULL;  // FNV-1a
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static inline uint64_t file_cache_env_mb(const char *name, uint64_t fallback) {
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') {
+        return fallback;
+    }
+    char *end = NULL;
+    unsigned long long mb = strtoull(value, &end, 10);
+    if (end == value || *end != '\0') {
+        fprintf(stderr, "%s: invalid value \"%s\", using %" PRIu64 "\n", name,
+                value, fallback);
+        return fallback;
+    }
+    return mb;
+}
+
+// Initialize from FILE_CACHE_ENV_SIZE and FILE_CACHE_ENV_MAX_FILE (in MiB).
+// A cache size of 0 disables mapping; every lookup then fails with EFBIG.
+static inline void file_cache_init(struct file_cache *cache) {
+    memset(cache, 0, sizeof(*cache));
+    cache->max_bytes =
+        file_cache_env_mb(FILE_CACHE_ENV_SIZE, FILE_CACHE_DEFAULT_SIZE_MB)
+        << 20;
+    cache->max_file_size =
+        file_cache_env_mb(FILE_CACHE_ENV_MAX_FILE,
+                          FILE_CACHE_DEFAULT_MAX_FILE_MB)
+        << 20;
+    if (cache->max_file_size > cache->max_bytes) {
+        cache->max_file_size = cache->max_bytes;
+    }
+}
+
+static inline bool file_cache_entry_matches(const struct file_cache_entry *e,
+                                            const struct stat *st) {
+    return e->dev == st->st_dev && e->ino == st->st_ino &&
+           e->size == st->st_size && e->mtime.tv_sec == st->st_mtim.tv_sec &&
+           e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static inline void file_cache_entry_destroy(struct file_cache_entry *e) {
+    if (e->data != NULL) {
+        munmap(e->data, e->size);
+    }
+    free(e->path);
+    free(e);
+}
+
+// Drop a reference taken by file_cache_open.
+static inline void file_cache_release(struct file_cache_entry *e) {
+    if (--e->refcount == 0) {
+        file_cache_entry_destroy(e);
+    }
+}
+
+static inline void file_cache_lru_unlink(struct file_cache *cache,
+                                         struct file_cache_entry *e) {
+    if (e->lru_prev != NULL) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        cache->lru_head = e->lru_next;
+    }
+    if (e->lru_next != NULL) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        cache->lru_tail = e->lru_prev;
+    }
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static inline void file_cache_lru_push(struct file_cache *cache,
+                                       struct file_cache_entry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head != NULL) {
+        cache->lru_head->lru_prev = e;
+    } else {
+        cache->lru_tail = e;
+    }
+    cache->lru_head = e;
+}
+
+// Unlink an entry from the cache and drop the cache's reference.
+static inline void file_cache_remove(struct file_cache *cache,
+                                     struct file_cache_entry *e) {
+    struct file_cache_entry **link =
+        &cache->buckets[file_cache_hash(e->path) % FILE_CACHE_BUCKETS];
+    while (*link != NULL && *link != e) {
+        link = &(*link)->hash_next;
+    }
+    if (*link != NULL) {
+        *link = e->hash_next;
+    }
+    file_cache_lru_unlink(cache, e);
+    e->cached = false;
+    cache->entries--;
+    cache->total_bytes -= e->size;
+    file_cache_release(e);
+}
+
+static inline void file_cache_evict_for(struct file_cache *cache,
+                                        uint64_t bytes) {
+    while (cache->lru_tail != NULL &&
+           cache->total_bytes + bytes > cache->max_bytes) {
+        struct file_cache_entry *victim = cache->lru_tail;
+        cache->stats.evictions++;
+        cache->stats.evicted_bytes += victim->size;
+        file_cache_remove(cache, victim);
+    }
+}
+
+// Map `path` into memory and insert it. Returns a referenced entry.
+static inline struct file_cache_entry *file_cache_load(
+    struct file_cache *cache, const char *path, uint64_t hash) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = EISDIR;
+        return NULL;
+    }
+    if ((uint64_t)st.st_size > cache->max_file_size) {
+        close(fd);
+        cache->stats.too_large++;
+        errno = EFBIG;
+        return NULL;
+    }
+
+    struct file_cache_entry *e = calloc(1, sizeof(*e));
+    if (e == NULL) {
+        close(fd);
+        return NULL;
+    }
+    e->path = strdup(path);
+    if (e->path == NULL) {
+        close(fd);
+        free(e);
+        return NULL;
+    }
+    if (st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            free(e->path);
+            free(e);
+            errno = err;
+            return NULL;
+        }
+        // Start paging the file in now rather than faulting on the loop
+        // thread while it is being sent
+        madvise(data, st.st_size, MADV_WILLNEED);
+        e->data = data;
+    }
+    close(fd);
+
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->size = st.st_size;
+    e->mtime = st.st_mtim;
+
+    file_cache_evict_for(cache, e->size);
+    size_t bucket = hash % FILE_CACHE_BUCKETS;
+    e->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = e;
+    file_cache_lru_push(cache, e);
+    e->cached = true;
+    e->refcount = 2;  // One for the cache, one for the caller
+    cache->entries++;
+    cache->total_bytes += e->size;
+    return e;
+}
+
+// Like file_cache_open, with `st` from a stat() of `path` the caller has
+// already made (e.g. from a stat cache).
+static inline struct file_cache_entry *file_cache_open_stat(
+    struct file_cache *cache, const char *path, const struct stat *st) {
+    cache->stats.lookups++;
+
+    uint64_t hash = file_cache_hash(path);
+    struct file_cache_entry *e = cache->buckets[hash % FILE_CACHE_BUCKETS];
+    while (e != NULL && strcmp(e->path, path) != 0) {
+        e = e->hash_next;
+    }
+
+    if (e != NULL) {
+        if (file_cache_entry_matches(e, st)) {
+            cache->stats.hits++;
+            file_cache_lru_unlink(cache, e);
+            file_cache_lru_push(cache, e);
+            e->refcount++;
+            return e;
+        }
+        cache->stats.stale++;
+        file_cache_remove(cache, e);
+    }
+
+    cache->stats.misses++;
+    return file_cache_load(cache, path, hash);
+}
+
+// Look up `path`, mapping it on a miss. Returns a referenced entry that must
+// be released with file_cache_release, or NULL with errno set. EFBIG means
+// the file exists but is too large to cache.
+static inline struct file_cache_entry *file_cache_open(struct file_cache *cache,
+                                                       const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        cache->stats.lookups++;
+        return NULL;
+    }
+    return file_cache_open_stat(cache, path, &st);
+}
+
+static inline void file_cache_print_stats(const struct file_cache *cache) {
+    const struct file_cache_stats *s = &cache->stats;
+    fprintf(stderr,
+            "file cache: %zu entries, %" PRIu64 "/%" PRIu64
+            " bytes, lookups=%" PRIu64 " hits=%" PRIu64 " (%.1f%%) misses=%" PRIu64
+            " stale=%" PRIu64 " too_large=%" PRIu64 " evictions=%" PRIu64
+            " (%" PRIu64 " bytes)\n",
+            cache->entries, cache->total_bytes, cache->max_bytes, s->lookups,
+            s->hits, s->lookups ? 100.0 * s->hits / s->lookups : 0.0,
+            s->misses, s->stale, s->too_large, s->evictions, s->evicted_bytes);
+}
+
+// Drop every cached entry. Entries still referenced by in-flight responses
+// are unmapped when those release them.
+static inline void file_cache_free(struct file_cache *cache) {
+    while (cache->lru_head != NULL) {
+        file_cache_remove(cache, cache->lru_head);
+    }
+}
+
+#endif  // FILE_CACHE_H
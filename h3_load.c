@@ -0,0 +1,1030 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Open-loop HTTP/3 load generator.
+//
+// Opens many connections to simple_h3_server (or any HTTP/3 server, such
+// as tquic_websocket_server) over a few shared UDP sockets and issues GET
+// requests at a fixed total rate, with constant or Poisson (exponential)
+// spacing. Requests are scheduled by the clock, never by responses: a
+// request that can't be sent on time waits in its connection's backlog,
+// and its latency is still measured from the time it was due. Slow
+// responses therefore show up in the percentiles instead of silently
+// lowering the offered load (no coordinated omission).
+//
+// Requests due during the warm-up are sent but not measured. Latencies
+// go into HDR histograms (see hdr_histogram.h), overall and per path of
+// the request mix, and are reported as text and optionally as JSON.
+
+#include <errno.h>
+#include <ev.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hdr_histogram.h"
+#include "openssl/ssl.h"
+#include "tquic.h"
+
+#define READ_BUF_SIZE 65536
+#define MAX_DATAGRAM_SIZE 1200
+#define MAX_SOCKETS 64
+#define MAX_PATHS 16
+// Seconds to wait for outstanding responses after the last arrival
+#define DRAIN_TIMEOUT 5.0
+
+enum arrival_model {
+    ARRIVAL_CONSTANT,
+    ARRIVAL_POISSON,
+};
+
+// One entry of the request mix
+struct load_path {
+    const char *path;
+    double weight;
+    uint64_t completed;  // Measured only
+    uint64_t errors;
+    struct hdr_histogram *latency;
+};
+
+struct load_request {
+    int64_t stream_id;
+    size_t path;
+    double due;     // When the request was scheduled; latency starts here
+    bool measured;  // Due after the warm-up
+    int status;
+    uint64_t bytes;
+    struct load_request *next;
+};
+
+struct load;
+
+struct load_conn {
+    struct load *load;
+    size_t index;
+    size_t sock;
+    struct quic_conn_t *conn;
+    struct http3_conn_t *h3_conn;
+    bool established;
+    bool closed;
+    struct load_request *active;        // Sent, waiting for the response
+    struct load_request *backlog_head;  // Due but not sent yet
+    struct load_request *backlog_tail;
+    size_t backlog_len;
+};
+
+struct load_socket {
+    struct load *load;
+    int fd;
+    struct sockaddr_storage local_addr;
+    socklen_t local_addr_len;
+    ev_io watcher;
+};
+
+struct load_counters {
+    uint64_t scheduled;
+    uint64_t completed;
+    uint64_t errors;  // Non-2xx, reset or lost with the connection
+    uint64_t dropped;  // Due while no connection was open (not scheduled)
+    uint64_t bytes;
+};
+
+struct load {
+    // Settings
+    size_t conn_count;
+    size_t sock_count;
+    double rate;
+    enum arrival_model arrival;
+    double warmup;
+    double duration;
+    const char *json_path;
+    const char *authority;
+    struct load_path paths[MAX_PATHS];
+    size_t path_count;
+    double weight_total;
+
+    struct quic_endpoint_t *quic_endpoint;
+    struct quic_tls_config_t *tls_config;
+    struct http3_config_t *h3_config;
+    struct ev_loop *loop;
+    ev_timer timer;
+    ev_timer arrival_timer;
+    ev_timer drain_timer;
+    struct load_socket socks[MAX_SOCKETS];
+    struct load_conn *conns;
+    struct load_conn *connecting;  // Set while quic_endpoint_connect runs
+    size_t next_conn;
+    size_t established_count;
+    size_t closed_count;
+
+    double start;          // First arrival
+    double measure_start;  // End of the warm-up
+    double end;            // No arrivals from here on
+    double next_arrival;
+    bool running;
+    bool stopping;
+    uint64_t rng;
+    size_t max_backlog;
+    struct load_counters all;
+    struct load_counters measured;
+    struct hdr_histogram *latency;  // Microseconds, measured requests
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64*, uniform in (0, 1]
+static double rng_uniform(struct load *load) {
+    load->rng ^= load->rng >> 12;
+    load->rng ^= load->rng << 25;
+    load->rng ^= load->rng >> 27;
+    uint64_t x = load->rng * 2685821657736338717ULL;
+    return ((x >> 11) + 1) / 9007199254740992.0;
+}
+
+static double next_interval(struct load *load) {
+    if (load->arrival == ARRIVAL_POISSON) {
+        return -log(rng_uniform(load)) / load->rate;
+    }
+    return 1.0 / load->rate;
+}
+
+static size_t pick_path(struct load *load) {
+    double x = rng_uniform(load) * load->weight_total;
+    for (size_t i = 0; i + 1 < load->path_count; i++) {
+        if (x <= load->paths[i].weight) {
+            return i;
+        }
+        x -= load->paths[i].weight;
+    }
+    return load->path_count - 1;
+}
+
+// Forward declarations for HTTP/3 event handlers
+static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
+                                    const struct http3_headers_t *headers,
+                                    bool fin);
+static void http3_on_stream_data(void *ctx, uint64_t stream_id);
+static void http3_on_stream_finished(void *ctx, uint64_t stream_id);
+static void http3_on_stream_reset(void *ctx, uint64_t stream_id,
+                                  uint64_t error_code);
+static void http3_on_stream_priority_update(void *ctx, uint64_t stream_id);
+static void http3_on_conn_goaway(void *ctx, uint64_t stream_id);
+
+static const struct http3_methods_t http3_methods = {
+    .on_stream_headers = http3_on_stream_headers,
+    .on_stream_data = http3_on_stream_data,
+    .on_stream_finished = http3_on_stream_finished,
+    .on_stream_reset = http3_on_stream_reset,
+    .on_stream_priority_update = http3_on_stream_priority_update,
+    .on_conn_goaway = http3_on_conn_goaway,
+};
+
+static void start_arrivals(struct load *load);
+static void check_drained(struct load *load);
+
+// Account for a finished or failed request and free it.
+static void complete_request(struct load *load, struct load_request *req, bool ok) {
+    ok = ok && req->status >= 200 && req->status < 300;
+    struct load_path *path = &load->paths[req->path];
+    struct load_counters *counters[2] = {&load->all, req->measured ? &load->measured : NULL};
+    for (int i = 0; i < 2; i++) {
+        if (counters[i] == NULL) {
+            continue;
+        }
+        counters[i]->bytes += req->bytes;
+        if (ok) {
+            counters[i]->completed++;
+        } else {
+            counters[i]->errors++;
+        }
+    }
+    if (req->measured) {
+        if (ok) {
+            uint64_t us = (uint64_t)((now_seconds() - req->due) * 1e6);
+            hdr_histogram_record(load->latency, us);
+            hdr_histogram_record(path->latency, us);
+            path->completed++;
+        } else {
+            path->errors++;
+        }
+    }
+    free(req);
+}
+
+// Send backlogged requests of `lc` while the peer allows new streams.
+// Returns the number of requests taken off the backlog.
+static size_t conn_flush(struct load_conn *lc) {
+    struct load *load = lc->load;
+    size_t sent = 0;
+    while (lc->backlog_head != NULL && lc->h3_conn != NULL && !lc->closed) {
+        int64_t stream_id = http3_stream_new(lc->h3_conn, lc->conn);
+        if (stream_id < 0) {
+            // Out of stream credit; retried when a stream ends and after
+            // every round of connection processing, which is where
+            // MAX_STREAMS arrives
+            break;
+        }
+
+        struct load_request *req = lc->backlog_head;
+        const char *path = load->paths[req->path].path;
+        struct http3_header_t headers[] = {
+            {.name = (uint8_t *)":method", .name_len = 7,
+             .value = (uint8_t *)"GET", .value_len = 3},
+            {.name = (uint8_t *)":scheme", .name_len = 7,
+             .value = (uint8_t *)"https", .value_len = 5},
+            {.name = (uint8_t *)":authority", .name_len = 10,
+             .value = (uint8_t *)load->authority, .value_len = strlen(load->authority)},
+            {.name = (uint8_t *)":path", .name_len = 5,
+             .value = (uint8_t *)path, .value_len = strlen(path)},
+            {.name = (uint8_t *)"user-agent", .name_len = 10,
+             .value = (uint8_t *)"tquic-h3-load", .value_len = 13},
+        };
+        lc->backlog_head = req->next;
+        if (lc->backlog_head == NULL) {
+            lc->backlog_tail = NULL;
+        }
+        lc->backlog_len--;
+        sent++;
+
+        int ret = http3_send_headers(lc->h3_conn, lc->conn, stream_id, headers,
+                                     sizeof(headers) / sizeof(headers[0]), true);
+        if (ret < 0) {
+            fprintf(stderr, "failed to send request on connection %zu: %d\n", lc->index, ret);
+            complete_request(load, req, false);
+            continue;
+        }
+        req->stream_id = stream_id;
+        req->next = lc->active;
+        lc->active = req;
+    }
+    return sent;
+}
+
+// Queue a request due at `due` on the next open connection.
+static void schedule_request(struct load *load, double due) {
+    struct load_conn *lc = NULL;
+    for (size_t i = 0; i < load->conn_count; i++) {
+        struct load_conn *c = &load->conns[load->next_conn];
+        load->next_conn = (load->next_conn + 1) % load->conn_count;
+        if (!c->closed) {
+            lc = c;
+            break;
+        }
+    }
+    struct load_request *req = lc != NULL ? calloc(1, sizeof(struct load_request)) : NULL;
+    if (req == NULL) {
+        load->all.dropped++;
+        if (due >= load->measure_start) {
+            load->measured.dropped++;
+        }
+        return;
+    }
+    req->stream_id = -1;
+    req->path = pick_path(load);
+    req->due = due;
+    req->measured = due >= load->measure_start;
+    load->all.scheduled++;
+    if (req->measured) {
+        load->measured.scheduled++;
+    }
+
+    if (lc->backlog_tail != NULL) {
+        lc->backlog_tail->next = req;
+    } else {
+        lc->backlog_head = req;
+    }
+    lc->backlog_tail = req;
+    if (++lc->backlog_len > load->max_backlog) {
+        load->max_backlog = lc->backlog_len;
+    }
+    conn_flush(lc);
+}
+
+static struct load_request *take_active(struct load_conn *lc, uint64_t stream_id,
+                                        bool remove) {
+    struct load_request **link = &lc->active;
+    while (*link != NULL && (*link)->stream_id != (int64_t)stream_id) {
+        link = &(*link)->next;
+    }
+    struct load_request *req = *link;
+    if (req != NULL && remove) {
+        *link = req->next;
+    }
+    return req;
+}
+
+static void close_all(struct load *load, const char *reason) {
+    for (size_t i = 0; i < load->conn_count; i++) {
+        struct load_conn *lc = &load->conns[i];
+        if (lc->conn != NULL && !lc->closed) {
+            quic_conn_close(lc->conn, true, 0, (const uint8_t *)reason, strlen(reason));
+        }
+    }
+}
+
+void client_on_conn_created(void *tctx, struct quic_conn_t *conn) {
+    struct load *load = tctx;
+    struct load_conn *lc = load->connecting;
+    if (lc != NULL) {
+        lc->conn = conn;
+        quic_conn_set_context(conn, lc);
+    }
+}
+
+void client_on_conn_established(void *tctx, struct quic_conn_t *conn) {
+    struct load *load = tctx;
+    struct load_conn *lc = quic_conn_context(conn);
+    if (lc == NULL) {
+        return;
+    }
+    lc->h3_conn = http3_conn_new(conn, load->h3_config);
+    if (lc->h3_conn == NULL) {
+        fprintf(stderr, "failed to create HTTP/3 connection %zu\n", lc->index);
+        const char *reason = "h3 failed";
+        quic_conn_close(conn, true, 0, (const uint8_t *)reason, strlen(reason));
+        return;
+    }
+    http3_conn_set_events_handler(lc->h3_conn, &http3_methods, lc);
+    lc->established = true;
+    load->established_count++;
+    if (!load->running && load->established_count + load->closed_count == load->conn_count) {
+        start_arrivals(load);
+    }
+}
+
+void client_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
+    struct load *load = tctx;
+    struct load_conn *lc = quic_conn_context(conn);
+    if (lc == NULL) {
+        return;
+    }
+    if (!load->stopping) {
+        fprintf(stderr, "connection %zu closed early\n", lc->index);
+    }
+    lc->closed = true;
+    load->closed_count++;
+    if (lc->h3_conn != NULL) {
+        http3_conn_free(lc->h3_conn);
+        lc->h3_conn = NULL;
+    }
+
+    // Whatever was outstanding on this connection failed
+    while (lc->active != NULL) {
+        struct load_request *req = lc->active;
+        lc->active = req->next;
+        complete_request(load, req, false);
+    }
+    while (lc->backlog_head != NULL) {
+        struct load_request *req = lc->backlog_head;
+        lc->backlog_head = req->next;
+        complete_request(load, req, false);
+    }
+    lc->backlog_tail = NULL;
+    lc->backlog_len = 0;
+    lc->conn = NULL;
+
+    if (load->closed_count == load->conn_count) {
+        ev_break(load->loop, EVBREAK_ALL);
+    } else if (!load->running &&
+               load->established_count + load->closed_count == load->conn_count) {
+        start_arrivals(load);
+    }
+}
+
+void client_on_stream_created(void *tctx, struct quic_conn_t *conn,
+                              uint64_t stream_id) {}
+
+void client_on_stream_readable(void *tctx, struct quic_conn_t *conn,
+                               uint64_t stream_id) {
+    struct load_conn *lc = quic_conn_context(conn);
+    if (lc != NULL && lc->h3_conn != NULL) {
+        http3_conn_process_streams(lc->h3_conn, conn);
+    }
+}
+
+void client_on_stream_writable(void *tctx, struct quic_conn_t *conn,
+                               uint64_t stream_id) {
+    quic_stream_wantwrite(conn, stream_id, false);
+}
+
+void client_on_stream_closed(void *tctx, struct quic_conn_t *conn,
+                             uint64_t stream_id) {}
+
+static bool same_address(const struct sockaddr *a, const struct sockaddr_storage *b) {
+    if (a->sa_family != b->ss_family) {
+        return false;
+    }
+    if (a->sa_family == AF_INET) {
+        return ((const struct sockaddr_in *)a)->sin_port ==
+               ((const struct sockaddr_in *)b)->sin_port;
+    }
+    return ((const struct sockaddr_in6 *)a)->sin6_port ==
+           ((const struct sockaddr_in6 *)b)->sin6_port;
+}
+
+int client_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts,
+                           unsigned int count) {
+    struct load *load = psctx;
+
+    unsigned int sent_count = 0;
+    int i, j = 0;
+    for (i = 0; i < count; i++) {
+        struct quic_packet_out_spec_t *pkt = pkts + i;
+        // Send from the socket the connection was opened on
+        int fd = load->socks[0].fd;
+        for (size_t s = 0; s < load->sock_count; s++) {
+            if (same_address(pkt->src_addr, &load->socks[s].local_addr)) {
+                fd = load->socks[s].fd;
+                break;
+            }
+        }
+        for (j = 0; j < (*pkt).iovlen; j++) {
+            const struct iovec *iov = pkt->iov + j;
+            ssize_t sent =
+                sendto(fd, iov->iov_base, iov->iov_len, 0,
+                       (struct sockaddr *)pkt->dst_addr, pkt->dst_addr_len);
+
+            if (sent != iov->iov_len) {
+                if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+                    return sent_count;
+                }
+                return -1;
+            }
+            sent_count++;
+        }
+    }
+
+    return sent_count;
+}
+
+const struct quic_transport_methods_t quic_transport_methods = {
+    .on_conn_created = client_on_conn_created,
+    .on_conn_established = client_on_conn_established,
+    .on_conn_closed = client_on_conn_closed,
+    .on_stream_created = client_on_stream_created,
+    .on_stream_readable = client_on_stream_readable,
+    .on_stream_writable = client_on_stream_writable,
+    .on_stream_closed = client_on_stream_closed,
+};
+
+const struct quic_packet_send_methods_t quic_packet_send_methods = {
+    .on_packets_send = client_on_packets_send,
+};
+
+static void process_connections(struct load *load) {
+    quic_endpoint_process_connections(load->quic_endpoint);
+    // Stream credit may have arrived without any stream ending
+    size_t sent = 0;
+    for (size_t i = 0; i < load->conn_count; i++) {
+        sent += conn_flush(&load->conns[i]);
+    }
+    if (sent > 0) {
+        quic_endpoint_process_connections(load->quic_endpoint);
+    }
+    double timeout = quic_endpoint_timeout(load->quic_endpoint) / 1e3f;
+    if (timeout < 0.0001) {
+        timeout = 0.0001;
+    }
+    load->timer.repeat = timeout;
+    ev_timer_again(load->loop, &load->timer);
+}
+
+static void read_callback(EV_P_ ev_io *w, int revents) {
+    struct load_socket *sock = w->data;
+    struct load *load = sock->load;
+    static uint8_t buf[READ_BUF_SIZE];
+
+    while (true) {
+        struct sockaddr_storage peer_addr;
+        socklen_t peer_addr_len = sizeof(peer_addr);
+        memset(&peer_addr, 0, peer_addr_len);
+
+        ssize_t read = recvfrom(sock->fd, buf, sizeof(buf), 0,
+                                (struct sockaddr *)&peer_addr, &peer_addr_len);
+        if (read < 0) {
+            if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+                break;
+            }
+            fprintf(stderr, "failed to read\n");
+            return;
+        }
+
+        quic_packet_info_t quic_packet_info = {
+            .src = (struct sockaddr *)&peer_addr,
+            .src_len = peer_addr_len,
+            .dst = (struct sockaddr *)&sock->local_addr,
+            .dst_len = sock->local_addr_len,
+        };
+        int r = quic_endpoint_recv(load->quic_endpoint, buf, read,
+                                   &quic_packet_info);
+        if (r != 0) {
+            fprintf(stderr, "recv failed %d\n", r);
+        }
+    }
+
+    process_connections(load);
+}
+
+static void timeout_callback(EV_P_ ev_timer *w, int revents) {
+    struct load *load = w->data;
+    quic_endpoint_on_timeout(load->quic_endpoint);
+    process_connections(load);
+}
+
+// Issue every request that is due, then sleep until the next one.
+static void arrival_callback(EV_P_ ev_timer *w, int revents) {
+    struct load *load = w->data;
+    double now = now_seconds();
+    while (load->next_arrival <= now && load->next_arrival < load->end) {
+        schedule_request(load, load->next_arrival);
+        load->next_arrival += next_interval(load);
+    }
+
+    if (load->next_arrival >= load->end) {
+        load->stopping = true;
+        ev_timer_start(load->loop, &load->drain_timer);
+        check_drained(load);
+    } else {
+        ev_timer_set(w, load->next_arrival - now, 0);
+        ev_timer_start(load->loop, w);
+    }
+    process_connections(load);
+}
+
+static void drain_callback(EV_P_ ev_timer *w, int revents) {
+    struct load *load = w->data;
+    fprintf(stderr, "drain timeout, closing with requests outstanding\n");
+    close_all(load, "done");
+    process_connections(load);
+}
+
+// Close the connections once the last arrival has been answered.
+static void check_drained(struct load *load) {
+    if (!load->stopping) {
+        return;
+    }
+    for (size_t i = 0; i < load->conn_count; i++) {
+        struct load_conn *lc = &load->conns[i];
+        if (!lc->closed && (lc->active != NULL || lc->backlog_head != NULL)) {
+            return;
+        }
+    }
+    ev_timer_stop(load->loop, &load->drain_timer);
+    close_all(load, "done");
+}
+
+static void start_arrivals(struct load *load) {
+    if (load->established_count == 0) {
+        fprintf(stderr, "no connection could be established\n");
+        return;
+    }
+    load->running = true;
+    load->start = now_seconds();
+    load->measure_start = load->start + load->warmup;
+    load->end = load->measure_start + load->duration;
+    load->next_arrival = load->start;
+    fprintf(stderr, "%zu/%zu connections up, starting %.1f req/s (%s)\n",
+            load->established_count, load->conn_count, load->rate,
+            load->arrival == ARRIVAL_POISSON ? "poisson" : "constant");
+    ev_timer_set(&load->arrival_timer, 0, 0);
+    ev_timer_start(load->loop, &load->arrival_timer);
+}
+
+static int status_callback(const uint8_t *name, size_t name_len,
+                           const uint8_t *value, size_t value_len, void *argp) {
+    struct load_request *req = argp;
+    if (name_len == 7 && memcmp(name, ":status", 7) == 0) {
+        char buf[8];
+        size_t len = value_len < sizeof(buf) - 1 ? value_len : sizeof(buf) - 1;
+        memcpy(buf, value, len);
+        buf[len] = '\0';
+        req->status = atoi(buf);
+    }
+    return 0;
+}
+
+static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
+                                    const struct http3_headers_t *headers,
+                                    bool fin) {
+    struct load_conn *lc = ctx;
+    struct load_request *req = take_active(lc, stream_id, false);
+    if (req != NULL) {
+        http3_for_each_header(headers, status_callback, req);
+    }
+}
+
+static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
+    struct load_conn *lc = ctx;
+    struct load_request *req = take_active(lc, stream_id, false);
+    static uint8_t buf[READ_BUF_SIZE];
+
+    while (lc->h3_conn != NULL) {
+        ssize_t read = http3_recv_body(lc->h3_conn, lc->conn, stream_id, buf,
+                                       sizeof(buf));
+        if (read <= 0) {
+            break;
+        }
+        if (req != NULL) {
+            req->bytes += read;
+        }
+    }
+}
+
+static void http3_on_stream_finished(void *ctx, uint64_t stream_id) {
+    struct load_conn *lc = ctx;
+    struct load_request *req = take_active(lc, stream_id, true);
+    if (req != NULL) {
+        complete_request(lc->load, req, true);
+        conn_flush(lc);
+        check_drained(lc->load);
+    }
+}
+
+static void http3_on_stream_reset(void *ctx, uint64_t stream_id,
+                                  uint64_t error_code) {
+    struct load_conn *lc = ctx;
+    struct load_request *req = take_active(lc, stream_id, true);
+    if (req != NULL) {
+        complete_request(lc->load, req, false);
+        conn_flush(lc);
+        check_drained(lc->load);
+    }
+}
+
+static void http3_on_stream_priority_update(void *ctx, uint64_t stream_id) {}
+
+static void http3_on_conn_goaway(void *ctx, uint64_t stream_id) {}
+
+// Open `load->sock_count` UDP sockets, each bound to its own port.
+static int create_sockets(const char *host, const char *port,
+                          struct addrinfo **peer, struct load *load) {
+    const struct addrinfo hints = {.ai_family = PF_UNSPEC,
+                                   .ai_socktype = SOCK_DGRAM,
+                                   .ai_protocol = IPPROTO_UDP};
+    if (getaddrinfo(host, port, &hints, peer) != 0) {
+        fprintf(stderr, "failed to resolve host\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < load->sock_count; i++) {
+        struct load_socket *sock = &load->socks[i];
+        sock->load = load;
+        sock->fd = socket((*peer)->ai_family, SOCK_DGRAM, 0);
+        if (sock->fd < 0) {
+            fprintf(stderr, "failed to create socket\n");
+            return -1;
+        }
+        if (fcntl(sock->fd, F_SETFL, O_NONBLOCK) != 0) {
+            fprintf(stderr, "failed to make socket non-blocking\n");
+            return -1;
+        }
+
+        // Bind to an ephemeral port so sockets can be told apart by address
+        struct sockaddr_storage any;
+        memset(&any, 0, sizeof(any));
+        any.ss_family = (*peer)->ai_family;
+        socklen_t any_len = any.ss_family == AF_INET ? sizeof(struct sockaddr_in)
+                                                     : sizeof(struct sockaddr_in6);
+        if (bind(sock->fd, (struct sockaddr *)&any, any_len) != 0) {
+            fprintf(stderr, "failed to bind socket: %s\n", strerror(errno));
+            return -1;
+        }
+        sock->local_addr_len = sizeof(sock->local_addr);
+        if (getsockname(sock->fd, (struct sockaddr *)&sock->local_addr,
+                        &sock->local_addr_len) != 0) {
+            fprintf(stderr, "failed to get local address of socket\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Parse a request mix such as "/index.html:8,/bytes/1m:1". The weight
+// defaults to 1. `mix` is modified in place and must outlive the load.
+static int parse_mix(struct load *load, char *mix) {
+    char *save = NULL;
+    for (char *item = strtok_r(mix, ",", &save); item != NULL;
+         item = strtok_r(NULL, ",", &save)) {
+        if (load->path_count == MAX_PATHS) {
+            fprintf(stderr, "at most %d paths in the mix\n", MAX_PATHS);
+            return -1;
+        }
+        struct load_path *path = &load->paths[load->path_count];
+        path->weight = 1;
+        char *colon = strrchr(item, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+            path->weight = atof(colon + 1);
+        }
+        if (*item != '/' || path->weight <= 0) {
+            fprintf(stderr, "invalid mix entry \"%s\"\n", item);
+            return -1;
+        }
+        path->path = item;
+        path->latency = hdr_histogram_new();
+        if (path->latency == NULL) {
+            return -1;
+        }
+        load->weight_total += path->weight;
+        load->path_count++;
+    }
+    return load->path_count > 0 ? 0 : -1;
+}
+
+static void print_report(struct load *load, FILE *out) {
+    const struct load_counters *m = &load->measured;
+    fprintf(out,
+            "h3_load: %zu connections on %zu sockets, %.1f req/s %s, warm-up %.1f s, "
+            "measured %.1f s\n",
+            load->conn_count, load->sock_count, load->rate,
+            load->arrival == ARRIVAL_POISSON ? "poisson" : "constant", load->warmup,
+            load->duration);
+    fprintf(out,
+            "requests:   scheduled=%" PRIu64 " completed=%" PRIu64 " errors=%" PRIu64
+            " dropped=%" PRIu64 " max_backlog=%zu\n",
+            m->scheduled, m->completed, m->errors, m->dropped, load->max_backlog);
+    fprintf(out, "throughput: %.1f req/s, %.2f Mbit/s\n", m->completed / load->duration,
+            m->bytes * 8 / load->duration / 1e6);
+    hdr_histogram_print(out, "latency", load->latency, 1e-3, "ms");
+    if (load->path_count > 1) {
+        for (size_t i = 0; i < load->path_count; i++) {
+            hdr_histogram_print(out, load->paths[i].path, load->paths[i].latency, 1e-3,
+                                "ms");
+        }
+    }
+}
+
+static void print_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static int write_json(struct load *load, const char *file) {
+    FILE *out = strcmp(file, "-") == 0 ? stdout : fopen(file, "w");
+    if (out == NULL) {
+        fprintf(stderr, "failed to open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    const struct load_counters *m = &load->measured;
+    fprintf(out,
+            "{\"connections\": %zu, \"sockets\": %zu, \"rate\": %.3f, \"arrival\": \"%s\", "
+            "\"warmup_s\": %.3f, \"duration_s\": %.3f,\n",
+            load->conn_count, load->sock_count, load->rate,
+            load->arrival == ARRIVAL_POISSON ? "poisson" : "constant", load->warmup,
+            load->duration);
+    fprintf(out,
+            " \"requests\": {\"scheduled\": %" PRIu64 ", \"completed\": %" PRIu64
+            ", \"errors\": %" PRIu64 ", \"dropped\": %" PRIu64 ", \"max_backlog\": %zu},\n",
+            m->scheduled, m->completed, m->errors, m->dropped, load->max_backlog);
+    fprintf(out, " \"throughput\": {\"rps\": %.3f, \"mbps\": %.3f},\n",
+            m->completed / load->duration, m->bytes * 8 / load->duration / 1e6);
+    fprintf(out, " \"latency_us\": ");
+    hdr_histogram_print_json(out, load->latency);
+    fprintf(out, ",\n \"paths\": [");
+    for (size_t i = 0; i < load->path_count; i++) {
+        struct load_path *path = &load->paths[i];
+        fprintf(out, "%s\n  {\"path\": ", i > 0 ? "," : "");
+        print_json_string(out, path->path);
+        fprintf(out, ", \"weight\": %.3f, \"errors\": %" PRIu64 ", \"latency_us\": ",
+                path->weight, path->errors);
+        hdr_histogram_print_json(out, path->latency);
+        fprintf(out, "}");
+    }
+    fprintf(out, "]}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] <dest_addr> <dest_port>\n", prog);
+    fprintf(stderr, "  -c <n>     connections (default: 10)\n");
+    fprintf(stderr, "  -u <n>     UDP sockets shared by the connections (default: 2, max %d)\n",
+            MAX_SOCKETS);
+    fprintf(stderr, "  -r <rps>   total request rate (default: 100)\n");
+    fprintf(stderr, "  -p         Poisson arrivals instead of constant spacing\n");
+    fprintf(stderr, "  -w <s>     warm-up, sent but not measured (default: 2)\n");
+    fprintf(stderr, "  -d <s>     measured duration (default: 10)\n");
+    fprintf(stderr, "  -m <mix>   request mix path[:weight],... (default: /)\n");
+    fprintf(stderr, "  -j <file>  also write the results as JSON (\"-\" for stdout)\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct load load;
+    memset(&load, 0, sizeof(load));
+    load.conn_count = 10;
+    load.sock_count = 2;
+    load.rate = 100;
+    load.arrival = ARRIVAL_CONSTANT;
+    load.warmup = 2;
+    load.duration = 10;
+    char default_mix[] = "/";
+    char *mix = default_mix;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:u:r:pw:d:m:j:h")) != -1) {
+        switch (opt) {
+            case 'c': load.conn_count = strtoul(optarg, NULL, 10); break;
+            case 'u': load.sock_count = strtoul(optarg, NULL, 10); break;
+            case 'r': load.rate = atof(optarg); break;
+            case 'p': load.arrival = ARRIVAL_POISSON; break;
+            case 'w': load.warmup = atof(optarg); break;
+            case 'd': load.duration = atof(optarg); break;
+            case 'm': mix = optarg; break;
+            case 'j': load.json_path = optarg; break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+    if (argc - optind < 2 || load.conn_count == 0 || load.sock_count == 0 ||
+        load.sock_count > MAX_SOCKETS || load.rate <= 0 || load.duration <= 0 ||
+        load.warmup < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    if (load.sock_count > load.conn_count) {
+        load.sock_count = load.conn_count;
+    }
+
+    const char *host = argv[optind];
+    const char *port = argv[optind + 1];
+    load.authority = host;
+    load.rng = (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ULL | 1;
+    for (size_t i = 0; i < MAX_SOCKETS; i++) {
+        load.socks[i].fd = -1;
+    }
+    quic_config_t *config = NULL;
+    struct addrinfo *peer = NULL;
+    int ret = 0;
+
+    load.latency = hdr_histogram_new();
+    load.conns = calloc(load.conn_count, sizeof(struct load_conn));
+    if (load.latency == NULL || load.conns == NULL || parse_mix(&load, mix) != 0) {
+        ret = -1;
+        goto EXIT;
+    }
+
+    if (create_sockets(host, port, &peer, &load) != 0) {
+        ret = -1;
+        goto EXIT;
+    }
+
+    config = quic_config_new();
+    if (config == NULL) {
+        ret = -1;
+        goto EXIT;
+    }
+    quic_config_set_max_idle_timeout(config, 30000);
+    quic_config_set_recv_udp_payload_size(config, MAX_DATAGRAM_SIZE);
+    quic_config_set_initial_max_data(config, 16 * 1024 * 1024);
+    quic_config_set_initial_max_stream_data_bidi_local(config, 8 * 1024 * 1024);
+    quic_config_set_initial_max_stream_data_bidi_remote(config, 8 * 1024 * 1024);
+
+    const char *const protos[1] = {"h3"};
+    load.tls_config = quic_tls_config_new_client_config(protos, 1, true);
+    if (load.tls_config == NULL) {
+        ret = -1;
+        goto EXIT;
+    }
+    quic_config_set_tls_config(config, load.tls_config);
+
+    load.h3_config = http3_config_new();
+    if (load.h3_config == NULL) {
+        ret = -1;
+        goto EXIT;
+    }
+
+    load.quic_endpoint =
+        quic_endpoint_new(config, false, &quic_transport_methods, &load,
+                          &quic_packet_send_methods, &load);
+    if (load.quic_endpoint == NULL) {
+        fprintf(stderr, "failed to create quic endpoint\n");
+        ret = -1;
+        goto EXIT;
+    }
+
+    load.loop = ev_default_loop(0);
+    ev_init(&load.timer, timeout_callback);
+    load.timer.data = &load;
+    ev_init(&load.arrival_timer, arrival_callback);
+    load.arrival_timer.data = &load;
+    ev_timer_init(&load.drain_timer, drain_callback, DRAIN_TIMEOUT, 0);
+    load.drain_timer.data = &load;
+
+    // Spread the connections over the sockets.
+    for (size_t i = 0; i < load.conn_count; i++) {
+        struct load_conn *lc = &load.conns[i];
+        lc->load = &load;
+        lc->index = i;
+        lc->sock = i % load.sock_count;
+        struct load_socket *sock = &load.socks[lc->sock];
+        load.connecting = lc;
+        int r = quic_endpoint_connect(
+            load.quic_endpoint, (struct sockaddr *)&sock->local_addr,
+            sock->local_addr_len, peer->ai_addr, peer->ai_addrlen,
+            NULL /* server_name */, NULL /* session */, 0 /* session_len */,
+            NULL /* token */, 0 /* token_len */, NULL /* config */,
+            NULL /* index */);
+        load.connecting = NULL;
+        if (r < 0) {
+            fprintf(stderr, "failed to connect connection %zu: %d\n", i, r);
+            lc->closed = true;
+            load.closed_count++;
+        }
+    }
+    if (load.closed_count == load.conn_count) {
+        ret = -1;
+        goto EXIT;
+    }
+    process_connections(&load);
+
+    for (size_t i = 0; i < load.sock_count; i++) {
+        struct load_socket *sock = &load.socks[i];
+        ev_io_init(&sock->watcher, read_callback, sock->fd, EV_READ);
+        sock->watcher.data = sock;
+        ev_io_start(load.loop, &sock->watcher);
+    }
+    ev_loop(load.loop, 0);
+
+    print_report(&load, stdout);
+    if (load.json_path != NULL && write_json(&load, load.json_path) != 0) {
+        ret = -1;
+    }
+
+EXIT:
+    if (peer != NULL) {
+        freeaddrinfo(peer);
+    }
+    if (load.quic_endpoint != NULL) {
+        quic_endpoint_free(load.quic_endpoint);
+    }
+    if (load.h3_config != NULL) {
+        http3_config_free(load.h3_config);
+    }
+    if (load.tls_config != NULL) {
+        quic_tls_config_free(load.tls_config);
+    }
+    for (size_t i = 0; i < load.sock_count; i++) {
+        if (load.socks[i].fd >= 0) {
+            close(load.socks[i].fd);
+        }
+    }
+    if (load.loop != NULL) {
+        ev_loop_destroy(load.loop);
+    }
+    if (config != NULL) {
+        quic_config_free(config);
+    }
+    for (size_t i = 0; load.conns != NULL && i < load.conn_count; i++) {
+        struct load_conn *lc = &load.conns[i];
+        while (lc->active != NULL) {
+            struct load_request *req = lc->active;
+            lc->active = req->next;
+            free(req);
+        }
+        while (lc->backlog_head != NULL) {
+            struct load_request *req = lc->backlog_head;
+            lc->backlog_head = req->next;
+            free(req);
+        }
+    }
+    free(load.conns);
+    for (size_t i = 0; i < load.path_count; i++) {
+        free(load.paths[i].latency);
+    }
+    free(load.latency);
+
+    return ret;
+}
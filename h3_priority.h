@@ -0,0 +1,150 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Extensible Priorities (RFC 9218) helpers shared by the HTTP/3 examples.
+//
+// A priority is carried either in the `priority` request header or in a
+// PRIORITY_UPDATE frame. Both use the Structured Fields dictionary syntax,
+// e.g. "u=5, i". Only the `u` (urgency, 0..7) and `i` (incremental)
+// parameters are defined; unknown members are ignored as the RFC requires.
+
+#ifndef H3_PRIORITY_H
+#define H3_PRIORITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "tquic.h"
+
+#define H3_PRIORITY_DEFAULT_URGENCY 3
+#define H3_PRIORITY_MAX_URGENCY 7
+
+static inline void h3_priority_init(struct http3_priority_t *priority) {
+    priority->urgency = H3_PRIORITY_DEFAULT_URGENCY;
+    priority->incremental = false;
+}
+
+static inline bool h3_priority_is_space(uint8_t c) {
+    return c == ' ' || c == '\t';
+}
+
+// Parse a priority field value into `priority`. Members that are malformed
+// or out of range leave the corresponding default untouched.
+static inline void h3_priority_parse(const uint8_t *value, size_t len,
+                                     struct http3_priority_t *priority) {
+    h3_priority_init(priority);
+
+    size_t pos = 0;
+    while (pos < len) {
+        while (pos < len && h3_priority_is_space(value[pos])) {
+            pos++;
+        }
+
+        size_t key_start = pos;
+        while (pos < len && value[pos] != '=' && value[pos] != ',' &&
+               value[pos] != ';' && !h3_priority_is_space(value[pos])) {
+            pos++;
+        }
+        size_t key_len = pos - key_start;
+        const uint8_t *key = value + key_start;
+
+        const uint8_t *item = NULL;
+        size_t item_len = 0;
+        if (pos < len && value[pos] == '=') {
+            pos++;
+            item = value + pos;
+            while (pos < len && value[pos] != ',' && value[pos] != ';' &&
+                   !h3_priority_is_space(value[pos])) {
+                pos++;
+            }
+            item_len = (size_t)(value + pos - item);
+        }
+
+        if (key_len == 1 && key[0] == 'u') {
+            if (item_len == 1 && item[0] >= '0' &&
+                item[0] <= '0' + H3_PRIORITY_MAX_URGENCY) {
+                priority->urgency = item[0] - '0';
+            }
+        } else if (key_len == 1 && key[0] == 'i') {
+            if (item == NULL || (item_len == 2 && memcmp(item, "?1", 2) == 0)) {
+                priority->incremental = true;
+            } else if (item_len == 2 && memcmp(item, "?0", 2) == 0) {
+                priority->incremental = false;
+            }
+        }
+
+        // Skip parameters and whitespace up to the next member.
+        while (pos < len && value[pos] != ',') {
+            pos++;
+        }
+        if (pos < len) {
+            pos++;
+        }
+    }
+}
+
+// Format a priority as a field value, e.g. "u=0" or "u=5, i".
+static inline size_t h3_priority_format(const struct http3_priority_t *priority,
+                                        char *buf, size_t buf_len) {
+    int n = snprintf(buf, buf_len, priority->incremental ? "u=%u, i" : "u=%u",
+                     (unsigned)priority->urgency);
+    return (n > 0 && (size_t)n < buf_len) ? (size_t)n : 0;
+}
+
+struct h3_priority_header_ctx {
+    struct http3_priority_t *priority;
+    bool found;
+};
+
+static inline int h3_priority_header_cb(const uint8_t *name, size_t name_len,
+                                        const uint8_t *value, size_t value_len,
+                                        void *argp) {
+    struct h3_priority_header_ctx *ctx = argp;
+    if (name_len == 8 && strncasecmp((const char *)name, "priority", 8) == 0) {
+        h3_priority_parse(value, value_len, ctx->priority);
+        ctx->found = true;
+    }
+    return 0;
+}
+
+// Extract the priority of a request from its headers. Returns true if a
+// `priority` header was present; `priority` holds the defaults otherwise.
+static inline bool h3_priority_from_headers(
+    const struct http3_headers_t *headers, struct http3_priority_t *priority) {
+    struct h3_priority_header_ctx ctx = {.priority = priority, .found = false};
+    h3_priority_init(priority);
+    http3_for_each_header(headers, h3_priority_header_cb, &ctx);
+    return ctx.found;
+}
+
+static inline int h3_priority_update_cb(uint8_t *data, size_t data_len,
+                                        void *argp) {
+    h3_priority_parse(data, data_len, argp);
+    return 0;
+}
+
+// Take the latest PRIORITY_UPDATE for `stream_id` from the HTTP/3
+// connection. Returns 0 and fills `priority` when an update was pending.
+static inline int h3_priority_take_update(struct http3_conn_t *h3_conn,
+                                          uint64_t stream_id,
+                                          struct http3_priority_t *priority) {
+    h3_priority_init(priority);
+    return http3_take_priority_update(h3_conn, stream_id,
+                                      h3_priority_update_cb, priority);
+}
+
+#endif  // H3_PRIORITY_H
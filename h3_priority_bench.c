@@ -0,0 +1,718 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// WebSocket latency under a concurrent bulk transfer.
+//
+// Opens one HTTP/3 connection to tquic_websocket_server, upgrades a
+// WebSocket stream and, on the same connection, downloads /bulk/<bytes>.
+// While the download runs, a timestamped binary message is sent every
+// interval and the echo round-trip time is recorded. Latency percentiles
+// are reported separately for "during bulk" and "idle" phases (by when the
+// message was sent), so the effect of Extensible Priorities (RFC 9218) can
+// be compared by changing the priority of the bulk request. A message is
+// only sent once the previous frame is fully written to the stream;
+// intervals skipped because it was not are reported.
+
+#include <errno.h>
+#include <ev.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "h3_priority.h"
+#include "openssl/ssl.h"
+#include "tquic.h"
+
+#define READ_BUF_SIZE 65536
+#define MAX_DATAGRAM_SIZE 1200
+#define PING_INTERVAL 0.01
+#define IDLE_SAMPLES 200
+#define WS_BUF_SIZE 65536
+#define PING_PAYLOAD_SIZE 9  // Send timestamp and phase
+
+enum bench_phase {
+    PHASE_BULK = 0,
+    PHASE_IDLE = 1,
+};
+
+struct latency_samples {
+    double *values;
+    size_t len;
+    size_t cap;
+};
+
+struct bench_client {
+    struct quic_endpoint_t *quic_endpoint;
+    ev_timer timer;
+    ev_timer ping_timer;
+    int sock;
+    struct sockaddr_storage local_addr;
+    socklen_t local_addr_len;
+    struct quic_tls_config_t *tls_config;
+    struct quic_conn_t *conn;
+    struct ev_loop *loop;
+    struct http3_conn_t *h3_conn;
+    struct http3_config_t *h3_config;
+
+    uint64_t bulk_bytes;
+    const char *bulk_priority;
+    int64_t ws_stream_id;
+    int64_t bulk_stream_id;
+    bool ws_open;
+    bool bulk_done;
+    uint64_t bulk_received;
+    double bulk_start;
+    double bulk_end;
+
+    // Reassembly buffer for WebSocket frames spanning reads
+    uint8_t ws_buf[WS_BUF_SIZE];
+    size_t ws_buf_len;
+
+    // Unwritten tail of the last ping frame
+    uint8_t ping_tx[16];
+    size_t ping_tx_len;
+    uint64_t pings_skipped;
+
+    struct latency_samples samples[2];
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void samples_add(struct latency_samples *s, double value) {
+    if (s->len == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 1024;
+        double *values = realloc(s->values, cap * sizeof(double));
+        if (values == NULL) {
+            return;
+        }
+        s->values = values;
+        s->cap = cap;
+    }
+    s->values[s->len++] = value;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const struct latency_samples *s, double p) {
+    if (s->len == 0) {
+        return 0;
+    }
+    size_t idx = (size_t)(p / 100.0 * (s->len - 1) + 0.5);
+    return s->values[idx];
+}
+
+static void print_samples(const char *label, struct latency_samples *s) {
+    if (s->len == 0) {
+        printf("%-12s no samples\n", label);
+        return;
+    }
+    qsort(s->values, s->len, sizeof(double), compare_double);
+    printf("%-12s n=%-6zu p50=%.2fms p90=%.2fms p99=%.2fms max=%.2fms\n",
+           label, s->len, percentile(s, 50) * 1e3, percentile(s, 90) * 1e3,
+           percentile(s, 99) * 1e3, s->values[s->len - 1] * 1e3);
+}
+
+// Build a masked client binary frame carrying a send timestamp and the
+// phase it was sent in.
+static size_t build_ping_frame(uint8_t *out, double sent_at, enum bench_phase phase) {
+    uint8_t payload[PING_PAYLOAD_SIZE];
+    memcpy(payload, &sent_at, sizeof(sent_at));
+    payload[8] = phase;
+
+    uint32_t mask = (uint32_t)rand();
+    uint8_t mask_bytes[4] = {mask >> 24, mask >> 16, mask >> 8, mask};
+    out[0] = 0x80 | 0x2;  // FIN + binary
+    out[1] = 0x80 | sizeof(payload);
+    memcpy(out + 2, mask_bytes, 4);
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        out[6 + i] = payload[i] ^ mask_bytes[i % 4];
+    }
+    return 6 + sizeof(payload);
+}
+
+// Consume complete server frames from the reassembly buffer.
+static void consume_ws_frames(struct bench_client *client) {
+    size_t offset = 0;
+    while (client->ws_buf_len - offset >= 2) {
+        const uint8_t *data = client->ws_buf + offset;
+        size_t avail = client->ws_buf_len - offset;
+        uint8_t opcode = data[0] & 0x0F;
+        uint64_t payload_len = data[1] & 0x7F;
+        size_t header_len = 2;
+        if (payload_len == 126) {
+            if (avail < 4) break;
+            payload_len = (data[2] << 8) | data[3];
+            header_len = 4;
+        } else if (payload_len == 127) {
+            if (avail < 10) break;
+            payload_len = 0;
+            for (int i = 0; i < 8; i++) {
+                payload_len = (payload_len << 8) | data[2 + i];
+            }
+            header_len = 10;
+        }
+        if (avail < header_len + payload_len) break;
+
+        if (opcode == 0x2 && payload_len == PING_PAYLOAD_SIZE) {
+            double sent_at;
+            memcpy(&sent_at, data + header_len, sizeof(sent_at));
+            enum bench_phase phase = data[header_len + 8] == PHASE_BULK ? PHASE_BULK : PHASE_IDLE;
+            samples_add(&client->samples[phase], now_seconds() - sent_at);
+        }
+        offset += header_len + payload_len;
+    }
+
+    memmove(client->ws_buf, client->ws_buf + offset,
+            client->ws_buf_len - offset);
+    client->ws_buf_len -= offset;
+}
+
+static void finish_bench(struct bench_client *client) {
+    ev_timer_stop(client->loop, &client->ping_timer);
+    if (client->conn != NULL) {
+        const char *reason = "done";
+        quic_conn_close(client->conn, true, 0, (const uint8_t *)reason,
+                        strlen(reason));
+    }
+}
+
+// Forward declarations for HTTP/3 event handlers
+static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
+                                    const struct http3_headers_t *headers,
+                                    bool fin);
+static void http3_on_stream_data(void *ctx, uint64_t stream_id);
+static void http3_on_stream_finished(void *ctx, uint64_t stream_id);
+static void http3_on_stream_reset(void *ctx, uint64_t stream_id,
+                                  uint64_t error_code);
+static void http3_on_stream_priority_update(void *ctx, uint64_t stream_id);
+static void http3_on_conn_goaway(void *ctx, uint64_t stream_id);
+
+static const struct http3_methods_t http3_methods = {
+    .on_stream_headers = http3_on_stream_headers,
+    .on_stream_data = http3_on_stream_data,
+    .on_stream_finished = http3_on_stream_finished,
+    .on_stream_reset = http3_on_stream_reset,
+    .on_stream_priority_update = http3_on_stream_priority_update,
+    .on_conn_goaway = http3_on_conn_goaway,
+};
+
+static void send_requests(struct bench_client *client) {
+    // WebSocket upgrade, asking for the highest urgency.
+    client->ws_stream_id = http3_stream_new(client->h3_conn, client->conn);
+    if (client->ws_stream_id < 0) {
+        fprintf(stderr, "failed to create WebSocket stream\n");
+        return;
+    }
+    struct http3_header_t ws_headers[] = {
+        {.name = (uint8_t *)":method", .name_len = 7,
+         .value = (uint8_t *)"GET", .value_len = 3},
+        {.name = (uint8_t *)":path", .name_len = 5,
+         .value = (uint8_t *)"/", .value_len = 1},
+        {.name = (uint8_t *)":scheme", .name_len = 7,
+         .value = (uint8_t *)"https", .value_len = 5},
+        {.name = (uint8_t *)":authority", .name_len = 10,
+         .value = (uint8_t *)"localhost", .value_len = 9},
+        {.name = (uint8_t *)"upgrade", .name_len = 7,
+         .value = (uint8_t *)"websocket", .value_len = 9},
+        {.name = (uint8_t *)"connection", .name_len = 10,
+         .value = (uint8_t *)"Upgrade", .value_len = 7},
+        {.name = (uint8_t *)"sec-websocket-key", .name_len = 17,
+         .value = (uint8_t *)"dGhlIHNhbXBsZSBub25jZQ==", .value_len = 24},
+        {.name = (uint8_t *)"sec-websocket-version", .name_len = 21,
+         .value = (uint8_t *)"13", .value_len = 2},
+        {.name = (uint8_t *)"priority", .name_len = 8,
+         .value = (uint8_t *)"u=0", .value_len = 3},
+    };
+    http3_send_headers(client->h3_conn, client->conn, client->ws_stream_id,
+                       ws_headers, sizeof(ws_headers) / sizeof(ws_headers[0]),
+                       false);
+
+    // Concurrent bulk download with the configured priority.
+    client->bulk_stream_id = http3_stream_new(client->h3_conn, client->conn);
+    if (client->bulk_stream_id < 0) {
+        fprintf(stderr, "failed to create bulk stream\n");
+        return;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/bulk/%" PRIu64, client->bulk_bytes);
+    struct http3_header_t bulk_headers[] = {
+        {.name = (uint8_t *)":method", .name_len = 7,
+         .value = (uint8_t *)"GET", .value_len = 3},
+        {.name = (uint8_t *)":path", .name_len = 5,
+         .value = (uint8_t *)path, .value_len = strlen(path)},
+        {.name = (uint8_t *)":scheme", .name_len = 7,
+         .value = (uint8_t *)"https", .value_len = 5},
+        {.name = (uint8_t *)":authority", .name_len = 10,
+         .value = (uint8_t *)"localhost", .value_len = 9},
+        {.name = (uint8_t *)"priority", .name_len = 8,
+         .value = (uint8_t *)client->bulk_priority,
+         .value_len = strlen(client->bulk_priority)},
+    };
+    http3_send_headers(client->h3_conn, client->conn, client->bulk_stream_id,
+                       bulk_headers,
+                       sizeof(bulk_headers) / sizeof(bulk_headers[0]), true);
+    client->bulk_start = now_seconds();
+
+    struct http3_priority_t prio;
+    char prio_str[16];
+    h3_priority_parse((const uint8_t *)client->bulk_priority,
+                      strlen(client->bulk_priority), &prio);
+    h3_priority_format(&prio, prio_str, sizeof(prio_str));
+    fprintf(stderr, "requested %s with priority \"%s\"\n", path, prio_str);
+}
+
+void client_on_conn_created(void *tctx, struct quic_conn_t *conn) {
+    struct bench_client *client = tctx;
+    client->conn = conn;
+}
+
+void client_on_conn_established(void *tctx, struct quic_conn_t *conn) {
+    struct bench_client *client = tctx;
+    client->h3_conn = http3_conn_new(conn, client->h3_config);
+    if (client->h3_conn == NULL) {
+        fprintf(stderr, "failed to create HTTP/3 connection\n");
+        const char *reason = "h3 failed";
+        quic_conn_close(conn, true, 0, (const uint8_t *)reason,
+                        strlen(reason));
+        return;
+    }
+    http3_conn_set_events_handler(client->h3_conn, &http3_methods, client);
+    send_requests(client);
+}
+
+void client_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
+    struct bench_client *client = tctx;
+    if (client->h3_conn != NULL) {
+        http3_conn_free(client->h3_conn);
+        client->h3_conn = NULL;
+    }
+    client->conn = NULL;
+    ev_break(client->loop, EVBREAK_ALL);
+}
+
+void client_on_stream_created(void *tctx, struct quic_conn_t *conn,
+                              uint64_t stream_id) {}
+
+void client_on_stream_readable(void *tctx, struct quic_conn_t *conn,
+                               uint64_t stream_id) {
+    struct bench_client *client = tctx;
+    if (client->h3_conn != NULL) {
+        http3_conn_process_streams(client->h3_conn, conn);
+    }
+}
+
+static int flush_ping(struct bench_client *client);
+
+void client_on_stream_writable(void *tctx, struct quic_conn_t *conn,
+                               uint64_t stream_id) {
+    struct bench_client *client = tctx;
+    if ((int64_t)stream_id == client->ws_stream_id && client->ping_tx_len > 0 &&
+        client->h3_conn != NULL) {
+        flush_ping(client);
+        return;
+    }
+    quic_stream_wantwrite(conn, stream_id, false);
+}
+
+void client_on_stream_closed(void *tctx, struct quic_conn_t *conn,
+                             uint64_t stream_id) {}
+
+int client_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts,
+                           unsigned int count) {
+    struct bench_client *client = psctx;
+
+    unsigned int sent_count = 0;
+    int i, j = 0;
+    for (i = 0; i < count; i++) {
+        struct quic_packet_out_spec_t *pkt = pkts + i;
+        for (j = 0; j < (*pkt).iovlen; j++) {
+            const struct iovec *iov = pkt->iov + j;
+            ssize_t sent =
+                sendto(client->sock, iov->iov_base, iov->iov_len, 0,
+                       (struct sockaddr *)pkt->dst_addr, pkt->dst_addr_len);
+
+            if (sent != iov->iov_len) {
+                if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+                    return sent_count;
+                }
+                return -1;
+            }
+            sent_count++;
+        }
+    }
+
+    return sent_count;
+}
+
+const struct quic_transport_methods_t quic_transport_methods = {
+    .on_conn_created = client_on_conn_created,
+    .on_conn_established = client_on_conn_established,
+    .on_conn_closed = client_on_conn_closed,
+    .on_stream_created = client_on_stream_created,
+    .on_stream_readable = client_on_stream_readable,
+    .on_stream_writable = client_on_stream_writable,
+    .on_stream_closed = client_on_stream_closed,
+};
+
+const struct quic_packet_send_methods_t quic_packet_send_methods = {
+    .on_packets_send = client_on_packets_send,
+};
+
+static void process_connections(struct bench_client *client) {
+    quic_endpoint_process_connections(client->quic_endpoint);
+    double timeout = quic_endpoint_timeout(client->quic_endpoint) / 1e3f;
+    if (timeout < 0.0001) {
+        timeout = 0.0001;
+    }
+    client->timer.repeat = timeout;
+    ev_timer_again(client->loop, &client->timer);
+}
+
+static void read_callback(EV_P_ ev_io *w, int revents) {
+    struct bench_client *client = w->data;
+    static uint8_t buf[READ_BUF_SIZE];
+
+    while (true) {
+        struct sockaddr_storage peer_addr;
+        socklen_t peer_addr_len = sizeof(peer_addr);
+        memset(&peer_addr, 0, peer_addr_len);
+
+        ssize_t read = recvfrom(client->sock, buf, sizeof(buf), 0,
+                                (struct sockaddr *)&peer_addr, &peer_addr_len);
+        if (read < 0) {
+            if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+                break;
+            }
+            fprintf(stderr, "failed to read\n");
+            return;
+        }
+
+        quic_packet_info_t quic_packet_info = {
+            .src = (struct sockaddr *)&peer_addr,
+            .src_len = peer_addr_len,
+            .dst = (struct sockaddr *)&client->local_addr,
+            .dst_len = client->local_addr_len,
+        };
+        int r = quic_endpoint_recv(client->quic_endpoint, buf, read,
+                                   &quic_packet_info);
+        if (r != 0) {
+            fprintf(stderr, "recv failed %d\n", r);
+        }
+    }
+
+    process_connections(client);
+}
+
+static void timeout_callback(EV_P_ ev_timer *w, int revents) {
+    struct bench_client *client = w->data;
+    quic_endpoint_on_timeout(client->quic_endpoint);
+    process_connections(client);
+}
+
+// Write as much of the pending ping frame as the stream takes; the rest
+// is retried when the stream becomes writable.
+static int flush_ping(struct bench_client *client) {
+    size_t offset = 0;
+    while (offset < client->ping_tx_len) {
+        ssize_t written = http3_send_body(client->h3_conn, client->conn, client->ws_stream_id,
+                                          client->ping_tx + offset,
+                                          client->ping_tx_len - offset, false);
+        if (written == HTTP3_ERR_DONE || written == 0) {
+            break;
+        }
+        if (written < 0) {
+            fprintf(stderr, "failed to send message: %zd\n", written);
+            return -1;
+        }
+        offset += written;
+    }
+    memmove(client->ping_tx, client->ping_tx + offset, client->ping_tx_len - offset);
+    client->ping_tx_len -= offset;
+    quic_stream_wantwrite(client->conn, client->ws_stream_id, client->ping_tx_len > 0);
+    return 0;
+}
+
+static void ping_callback(EV_P_ ev_timer *w, int revents) {
+    struct bench_client *client = w->data;
+    if (!client->ws_open || client->h3_conn == NULL || client->conn == NULL) {
+        return;
+    }
+
+    if (client->bulk_done &&
+        client->samples[PHASE_IDLE].len >= IDLE_SAMPLES) {
+        finish_bench(client);
+        process_connections(client);
+        return;
+    }
+
+    // A partly written frame must be finished first, or the echoes that
+    // follow would be misparsed
+    if (client->ping_tx_len > 0) {
+        flush_ping(client);
+        if (client->ping_tx_len > 0) {
+            client->pings_skipped++;
+            process_connections(client);
+            return;
+        }
+    }
+    enum bench_phase phase = client->bulk_done ? PHASE_IDLE : PHASE_BULK;
+    client->ping_tx_len = build_ping_frame(client->ping_tx, now_seconds(), phase);
+    flush_ping(client);
+    process_connections(client);
+}
+
+static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
+                                    const struct http3_headers_t *headers,
+                                    bool fin) {
+    struct bench_client *client = ctx;
+    if ((int64_t)stream_id == client->ws_stream_id && !client->ws_open) {
+        client->ws_open = true;
+        ev_timer_start(client->loop, &client->ping_timer);
+        fprintf(stderr, "WebSocket open, sending a message every %.0fms\n",
+                PING_INTERVAL * 1e3);
+    }
+}
+
+static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
+    struct bench_client *client = ctx;
+    static uint8_t buf[READ_BUF_SIZE];
+
+    while (client->h3_conn != NULL) {
+        if ((int64_t)stream_id == client->ws_stream_id) {
+            size_t room = sizeof(client->ws_buf) - client->ws_buf_len;
+            if (room == 0) {
+                fprintf(stderr, "WebSocket frame too large\n");
+                client->ws_buf_len = 0;
+                room = sizeof(client->ws_buf);
+            }
+            ssize_t read =
+                http3_recv_body(client->h3_conn, client->conn, stream_id,
+                                client->ws_buf + client->ws_buf_len, room);
+            if (read <= 0) {
+                break;
+            }
+            client->ws_buf_len += read;
+            consume_ws_frames(client);
+        } else {
+            ssize_t read = http3_recv_body(client->h3_conn, client->conn,
+                                           stream_id, buf, sizeof(buf));
+            if (read <= 0) {
+                break;
+            }
+            client->bulk_received += read;
+        }
+    }
+}
+
+static void http3_on_stream_finished(void *ctx, uint64_t stream_id) {
+    struct bench_client *client = ctx;
+    if ((int64_t)stream_id == client->bulk_stream_id && !client->bulk_done) {
+        client->bulk_done = true;
+        client->bulk_end = now_seconds();
+        double secs = client->bulk_end - client->bulk_start;
+        fprintf(stderr, "bulk finished: %" PRIu64 " bytes in %.3fs (%.2f Mbit/s)\n",
+                client->bulk_received, secs,
+                secs > 0 ? client->bulk_received * 8 / secs / 1e6 : 0);
+    }
+}
+
+static void http3_on_stream_reset(void *ctx, uint64_t stream_id,
+                                  uint64_t error_code) {
+    fprintf(stderr, "HTTP/3 stream %ld reset with error code %ld\n", stream_id,
+            error_code);
+}
+
+static void http3_on_stream_priority_update(void *ctx, uint64_t stream_id) {}
+
+static void http3_on_conn_goaway(void *ctx, uint64_t stream_id) {}
+
+static int create_socket(const char *host, const char *port,
+                         struct addrinfo **peer, struct bench_client *client) {
+    const struct addrinfo hints = {.ai_family = PF_UNSPEC,
+                                   .ai_socktype = SOCK_DGRAM,
+                                   .ai_protocol = IPPROTO_UDP};
+    if (getaddrinfo(host, port, &hints, peer) != 0) {
+        fprintf(stderr, "failed to resolve host\n");
+        return -1;
+    }
+
+    int sock = socket((*peer)->ai_family, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        fprintf(stderr, "failed to create socket\n");
+        return -1;
+    }
+    if (fcntl(sock, F_SETFL, O_NONBLOCK) != 0) {
+        fprintf(stderr, "failed to make socket non-blocking\n");
+        return -1;
+    }
+
+    client->local_addr_len = sizeof(client->local_addr);
+    if (getsockname(sock, (struct sockaddr *)&client->local_addr,
+                    &client->local_addr_len) != 0) {
+        fprintf(stderr, "failed to get local address of socket\n");
+        return -1;
+    };
+    client->sock = sock;
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr,
+                "Usage: %s <dest_addr> <dest_port> [bulk_bytes] "
+                "[bulk_priority]\n",
+                argv[0]);
+        fprintf(stderr, "  bulk_bytes: size of the concurrent download "
+                        "(default: 67108864)\n");
+        fprintf(stderr, "  bulk_priority: RFC 9218 priority of the download "
+                        "(default: \"u=7, i\")\n");
+        return -1;
+    }
+
+    struct bench_client client;
+    memset(&client, 0, sizeof(client));
+    client.bulk_bytes = (argc >= 4) ? strtoull(argv[3], NULL, 10) : 64 << 20;
+    client.bulk_priority = (argc >= 5) ? argv[4] : "u=7, i";
+    client.ws_stream_id = -1;
+    client.bulk_stream_id = -1;
+    quic_config_t *config = NULL;
+    int ret = 0;
+
+    srand(time(NULL));
+
+    const char *host = argv[1];
+    const char *port = argv[2];
+    struct addrinfo *peer = NULL;
+    if (create_socket(host, port, &peer, &client) != 0) {
+        ret = -1;
+        goto EXIT;
+    }
+
+    config = quic_config_new();
+    if (config == NULL) {
+        ret = -1;
+        goto EXIT;
+    }
+    quic_config_set_max_idle_timeout(config, 30000);
+    quic_config_set_recv_udp_payload_size(config, MAX_DATAGRAM_SIZE);
+    quic_config_set_initial_max_data(config, 16 * 1024 * 1024);
+    quic_config_set_initial_max_stream_data_bidi_local(config, 8 * 1024 * 1024);
+    quic_config_set_initial_max_stream_data_bidi_remote(config, 8 * 1024 * 1024);
+
+    const char *const protos[1] = {"h3"};
+    client.tls_config = quic_tls_config_new_client_config(protos, 1, true);
+    if (client.tls_config == NULL) {
+        ret = -1;
+        goto EXIT;
+    }
+    quic_config_set_tls_config(config, client.tls_config);
+
+    client.h3_config = http3_config_new();
+    if (client.h3_config == NULL) {
+        ret = -1;
+        goto EXIT;
+    }
+
+    client.quic_endpoint =
+        quic_endpoint_new(config, false, &quic_transport_methods, &client,
+                          &quic_packet_send_methods, &client);
+    if (client.quic_endpoint == NULL) {
+        fprintf(stderr, "failed to create quic endpoint\n");
+        ret = -1;
+        goto EXIT;
+    }
+
+    client.loop = ev_default_loop(0);
+    ev_init(&client.timer, timeout_callback);
+    client.timer.data = &client;
+    ev_timer_init(&client.ping_timer, ping_callback, PING_INTERVAL,
+                  PING_INTERVAL);
+    client.ping_timer.data = &client;
+
+    ret = quic_endpoint_connect(
+        client.quic_endpoint, (struct sockaddr *)&client.local_addr,
+        client.local_addr_len, peer->ai_addr, peer->ai_addrlen,
+        NULL /* server_name */, NULL /* session */, 0 /* session_len */,
+        NULL /* token */, 0 /* token_len */, NULL /* config */,
+        NULL /* index */);
+    if (ret < 0) {
+        fprintf(stderr, "failed to connect to client: %d\n", ret);
+        ret = -1;
+        goto EXIT;
+    }
+    process_connections(&client);
+
+    ev_io watcher;
+    ev_io_init(&watcher, read_callback, client.sock, EV_READ);
+    ev_io_start(client.loop, &watcher);
+    watcher.data = &client;
+    ev_loop(client.loop, 0);
+
+    printf("WebSocket echo RTT (bulk priority \"%s\", %" PRIu64 " bytes):\n",
+           client.bulk_priority, client.bulk_bytes);
+    print_samples("during bulk", &client.samples[PHASE_BULK]);
+    print_samples("idle", &client.samples[PHASE_IDLE]);
+    if (client.pings_skipped > 0) {
+        printf("%-12s %" PRIu64 " intervals (previous frame not fully written)\n", "skipped",
+               client.pings_skipped);
+    }
+
+EXIT:
+    if (peer != NULL) {
+        freeaddrinfo(peer);
+    }
+    if (client.h3_conn != NULL) {
+        http3_conn_free(client.h3_conn);
+    }
+    if (client.h3_config != NULL) {
+        http3_config_free(client.h3_config);
+    }
+    if (client.tls_config != NULL) {
+        quic_tls_config_free(client.tls_config);
+    }
+    if (client.sock > 0) {
+        close(client.sock);
+    }
+    if (client.quic_endpoint != NULL) {
+        quic_endpoint_free(client.quic_endpoint);
+    }
+    if (client.loop != NULL) {
+        ev_loop_destroy(client.loop);
+    }
+    if (config != NULL) {
+        quic_config_free(config);
+    }
+    free(client.samples[PHASE_BULK].values);
+    free(client.samples[PHASE_IDLE].values);
+
+    return ret;
+}
@@ -0,0 +1,177 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Fixed-size latency histogram in the style of HdrHistogram.
+//
+// Values (e.g. microseconds) are counted in log-linear buckets: every
+// power-of-two range is split into HDR_SUB_BUCKETS / 2 equal slots, so any
+// recorded value is reported within 0.1% (three significant digits).
+// Recording is O(1) and never allocates; percentiles walk the counts.
+// Values above HDR_MAX_VALUE are clamped to it and counted in `clamped`.
+//
+// Histograms from several threads or runs can be combined with
+// hdr_histogram_merge().
+
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Slots per power of two below 2 * HDR_SUB_BUCKETS (linear part)
+#define HDR_SUB_BUCKETS 2048
+#define HDR_SUB_BUCKET_BITS 11
+// Power-of-two ranges above the linear part; covers values up to 2^37
+// (about 38 hours in microseconds)
+#define HDR_BUCKETS 26
+#define HDR_COUNTS (HDR_SUB_BUCKETS + HDR_BUCKETS * (HDR_SUB_BUCKETS / 2))
+#define HDR_MAX_VALUE ((UINT64_C(1) << (HDR_BUCKETS + HDR_SUB_BUCKET_BITS)) - 1)
+
+struct hdr_histogram {
+    uint64_t counts[HDR_COUNTS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t clamped;
+    double sum;
+};
+
+static inline struct hdr_histogram *hdr_histogram_new(void) {
+    struct hdr_histogram *h = calloc(1, sizeof(*h));
+    if (h != NULL) {
+        h->min = UINT64_MAX;
+    }
+    return h;
+}
+
+static inline void hdr_histogram_reset(struct hdr_histogram *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline size_t hdr_histogram_index(uint64_t value) {
+    if (value < HDR_SUB_BUCKETS) {
+        return value;
+    }
+    // Highest set bit, at least HDR_SUB_BUCKET_BITS
+    unsigned shift = 63 - __builtin_clzll(value) - (HDR_SUB_BUCKET_BITS - 1);
+    uint64_t sub = value >> shift;  // In [HDR_SUB_BUCKETS / 2, HDR_SUB_BUCKETS)
+    return HDR_SUB_BUCKETS + (shift - 1) * (HDR_SUB_BUCKETS / 2) +
+           (sub - HDR_SUB_BUCKETS / 2);
+}
+
+// Highest value counted in slot `index`.
+static inline uint64_t hdr_histogram_value_at(size_t index) {
+    if (index < HDR_SUB_BUCKETS) {
+        return index;
+    }
+    size_t rel = index - HDR_SUB_BUCKETS;
+    unsigned shift = rel / (HDR_SUB_BUCKETS / 2) + 1;
+    uint64_t sub = rel % (HDR_SUB_BUCKETS / 2) + HDR_SUB_BUCKETS / 2;
+    return ((sub + 1) << shift) - 1;
+}
+
+static inline void hdr_histogram_record(struct hdr_histogram *h, uint64_t value) {
+    if (value > HDR_MAX_VALUE) {
+        value = HDR_MAX_VALUE;
+        h->clamped++;
+    }
+    h->counts[hdr_histogram_index(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+// Value at percentile `p` (0-100), or 0 if nothing was recorded.
+static inline uint64_t hdr_histogram_percentile(const struct hdr_histogram *h, double p) {
+    if (h->total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p / 100.0 * h->total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > h->total) {
+        rank = h->total;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HDR_COUNTS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t value = hdr_histogram_value_at(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
+static inline double hdr_histogram_mean(const struct hdr_histogram *h) {
+    return h->total ? h->sum / h->total : 0.0;
+}
+
+static inline void hdr_histogram_merge(struct hdr_histogram *dst,
+                                       const struct hdr_histogram *src) {
+    for (size_t i = 0; i < HDR_COUNTS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    dst->clamped += src->clamped;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+// One line of percentiles, with values scaled by `scale` (e.g. 1e-3 to
+// print microseconds as milliseconds).
+static inline void hdr_histogram_print(FILE *out, const char *label,
+                                       const struct hdr_histogram *h, double scale,
+                                       const char *unit) {
+    if (h->total == 0) {
+        fprintf(out, "%-12s no samples\n", label);
+        return;
+    }
+    fprintf(out,
+            "%-12s n=%-8" PRIu64 " min=%.3f%s mean=%.3f%s p50=%.3f%s p90=%.3f%s "
+            "p99=%.3f%s p99.9=%.3f%s max=%.3f%s\n",
+            label, h->total, h->min * scale, unit, hdr_histogram_mean(h) * scale, unit,
+            hdr_histogram_percentile(h, 50) * scale, unit,
+            hdr_histogram_percentile(h, 90) * scale, unit,
+            hdr_histogram_percentile(h, 99) * scale, unit,
+            hdr_histogram_percentile(h, 99.9) * scale, unit, h->max * scale, unit);
+}
+
+// The same as a JSON object, in the histogram's own unit.
+static inline void hdr_histogram_print_json(FILE *out, const struct hdr_histogram *h) {
+    fprintf(out,
+            "{\"count\": %" PRIu64 ", \"min\": %" PRIu64 ", \"mean\": %.1f, "
+            "\"p50\": %" PRIu64 ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64
+            ", \"p99.9\": %" PRIu64 ", \"max\": %" PRIu64 "}",
+            h->total, h->total ? h->min : 0, hdr_histogram_mean(h),
+            hdr_histogram_percentile(h, 50), hdr_histogram_percentile(h, 90),
+            hdr_histogram_percentile(h, 99), hdr_histogram_percentile(h, 99.9), h->max);
+}
+
+#endif  // HDR_HISTOGRAM_H
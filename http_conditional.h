@@ -0,0 +1,117 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Conditional request helpers (RFC 9110 section 13) for the static file
+// server: strong ETags derived from file metadata, `if-none-match` list
+// matching and HTTP-date parsing for `if-modified-since`.
+
+#ifndef HTTP_CONDITIONAL_H
+#define HTTP_CONDITIONAL_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Format a strong ETag from inode, size and mtime, e.g. "\"1a2b-400-...\"".
+// Any change to the file on disk, including replacement by rename,
+// changes the tag.
+static inline size_t http_etag_format(const struct stat *st, char *buf,
+                                      size_t buf_len) {
+    uint64_t mtime_ns =
+        (uint64_t)st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+    int n = snprintf(buf, buf_len, "\"%" PRIx64 "-%" PRIx64 "-%" PRIx64 "\"",
+                     (uint64_t)st->st_ino, (uint64_t)st->st_size, mtime_ns);
+    return (n > 0 && (size_t)n < buf_len) ? (size_t)n : 0;
+}
+
+// Strip the weak indicator so "W/\"x\"" and "\"x\"" compare equal.
+static inline const char *http_etag_opaque(const char *tag, size_t *len) {
+    if (*len >= 2 && tag[0] == 'W' && tag[1] == '/') {
+        tag += 2;
+        *len -= 2;
+    }
+    return tag;
+}
+
+// Weak comparison of `etag` against an `if-none-match` list such as
+// "\"a\", W/\"b\"" or "*".
+static inline bool http_etag_list_match(const char *list, const char *etag) {
+    size_t etag_len = strlen(etag);
+    etag = http_etag_opaque(etag, &etag_len);
+
+    const char *p = list;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        if (*p == '*') {
+            return true;
+        }
+        const char *start = p;
+        if (p[0] == 'W' && p[1] == '/') {
+            p += 2;
+        }
+        if (*p != '"') {
+            return false;  // Malformed
+        }
+        const char *close = strchr(p + 1, '"');
+        if (close == NULL) {
+            return false;
+        }
+        p = close + 1;
+
+        size_t len = p - start;
+        const char *tag = http_etag_opaque(start, &len);
+        if (len == etag_len && memcmp(tag, etag, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parse an IMF-fixdate such as "Sun, 06 Nov 1994 08:49:37 GMT". Returns
+// 0 and sets `*t`, or -1 if the value is not a valid date.
+static inline int http_date_parse(const char *value, time_t *t) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char mon[4];
+    int day, year, hour, min, sec;
+    int consumed = 0;
+    if (sscanf(value, "%*3[A-Za-z], %d %3[A-Za-z] %d %d:%d:%d GMT%n", &day, mon,
+               &year, &hour, &min, &sec, &consumed) != 6 ||
+        consumed == 0 || value[consumed] != '\0') {
+        return -1;
+    }
+    const char *m = strstr(months, mon);
+    if (strlen(mon) != 3 || m == NULL || (m - months) % 3 != 0 || day < 1 ||
+        day > 31 || hour > 23 || min > 59 || sec > 60) {
+        return -1;
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = year - 1900;
+    tm.tm_mon = (m - months) / 3;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = min;
+    tm.tm_sec = sec;
+    *t = timegm(&tm);
+    return 0;
+}
+
+#endif  // HTTP_CONDITIONAL_H
@@ -0,0 +1,196 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Byte range helpers (RFC 9110 section 14) shared by the HTTP/3 examples.
+//
+// The server parses `range` request headers with http_range_parse(); the
+// client parses `content-range` response headers with
+// http_content_range_parse(). HTTP-date formatting is here too because
+// `last-modified` is the validator that `if-range` is compared against.
+
+#ifndef HTTP_RANGE_H
+#define HTTP_RANGE_H
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// Max ranges accepted in one request; more are treated as no range at all
+#define HTTP_RANGE_MAX 16
+
+// An inclusive byte range [first, last]
+struct http_byte_range {
+    uint64_t first;
+    uint64_t last;
+};
+
+static inline const char *http_range_skip_space(const char *p) {
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    return p;
+}
+
+// Parse a decimal number. Returns the end of the digits, or NULL if there
+// are none or the value overflows.
+static inline const char *http_range_parse_u64(const char *p, uint64_t *out) {
+    if (!isdigit((unsigned char)*p)) {
+        return NULL;
+    }
+    uint64_t v = 0;
+    for (; isdigit((unsigned char)*p); p++) {
+        uint64_t digit = *p - '0';
+        if (v > (UINT64_MAX - digit) / 10) {
+            return NULL;
+        }
+        v = v * 10 + digit;
+    }
+    *out = v;
+    return p;
+}
+
+static inline int http_range_cmp(const void *a, const void *b) {
+    const struct http_byte_range *x = a;
+    const struct http_byte_range *y = b;
+    return x->first < y->first ? -1 : x->first > y->first;
+}
+
+// Parse a `range` field value, e.g. "bytes=0-499, 1000-, -500", against a
+// representation of `size` bytes. Satisfiable ranges are clipped to the
+// size, sorted, and overlapping or adjacent ones are coalesced.
+//
+// Returns the number of ranges written to `ranges`, 0 if the header must be
+// ignored (unknown unit, bad syntax, too many ranges, empty representation)
+// or -1 if no range is satisfiable.
+static inline int http_range_parse(const char *value, uint64_t size,
+                                   struct http_byte_range *ranges, int max) {
+    const char *p = http_range_skip_space(value);
+    if (strncasecmp(p, "bytes", 5) != 0) {
+        return 0;
+    }
+    p = http_range_skip_space(p + 5);
+    if (*p++ != '=' || size == 0) {
+        return 0;
+    }
+
+    int count = 0;
+    int specs = 0;
+    while (true) {
+        p = http_range_skip_space(p);
+        uint64_t first = 0;
+        uint64_t last = size - 1;
+        bool suffix = *p == '-';
+        if (suffix) {
+            uint64_t suffix_len;
+            p = http_range_parse_u64(p + 1, &suffix_len);
+            if (p == NULL) {
+                return 0;
+            }
+            if (suffix_len == 0) {
+                goto NEXT;  // Unsatisfiable
+            }
+            first = suffix_len < size ? size - suffix_len : 0;
+        } else {
+            p = http_range_parse_u64(p, &first);
+            if (p == NULL || *p++ != '-') {
+                return 0;
+            }
+            if (isdigit((unsigned char)*p)) {
+                uint64_t end;
+                p = http_range_parse_u64(p, &end);
+                if (p == NULL || end < first) {
+                    return 0;
+                }
+                if (end < last) {
+                    last = end;
+                }
+            }
+            if (first >= size) {
+                goto NEXT;  // Unsatisfiable
+            }
+        }
+
+        if (count == max) {
+            return 0;
+        }
+        ranges[count].first = first;
+        ranges[count].last = last;
+        count++;
+
+    NEXT:
+        specs++;
+        p = http_range_skip_space(p);
+        if (*p == '\0') {
+            break;
+        }
+        if (*p++ != ',' || specs >= max) {
+            return 0;
+        }
+    }
+
+    if (count == 0) {
+        return -1;
+    }
+
+    qsort(ranges, count, sizeof(*ranges), http_range_cmp);
+    int merged = 0;
+    for (int i = 1; i < count; i++) {
+        if (ranges[i].first <= ranges[merged].last + 1) {
+            if (ranges[i].last > ranges[merged].last) {
+                ranges[merged].last = ranges[i].last;
+            }
+        } else {
+            ranges[++merged] = ranges[i];
+        }
+    }
+    return merged + 1;
+}
+
+// Parse a `content-range` field value such as "bytes 0-499/1234". The total
+// is set to UINT64_MAX when it is "*". Returns 0 on success, -1 otherwise.
+static inline int http_content_range_parse(const char *value, uint64_t *first,
+                                           uint64_t *last, uint64_t *total) {
+    const char *p = http_range_skip_space(value);
+    if (strncasecmp(p, "bytes", 5) != 0 || (p[5] != ' ' && p[5] != '\t')) {
+        return -1;
+    }
+    p = http_range_skip_space(p + 5);
+    if ((p = http_range_parse_u64(p, first)) == NULL || *p++ != '-' ||
+        (p = http_range_parse_u64(p, last)) == NULL || *p++ != '/' ||
+        *last < *first) {
+        return -1;
+    }
+    if (*p == '*') {
+        *total = UINT64_MAX;
+        return 0;
+    }
+    return http_range_parse_u64(p, total) != NULL ? 0 : -1;
+}
+
+// Format `t` as an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+static inline size_t http_date_format(time_t t, char *buf, size_t buf_len) {
+    struct tm tm;
+    if (gmtime_r(&t, &tm) == NULL) {
+        return 0;
+    }
+    return strftime(buf, buf_len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+#endif  // HTTP_RANGE_H
@@ -0,0 +1,513 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// In-process packet impairment (a small subset of `tc netem`).
+//
+// Each example owns one impairment stage per direction. Outgoing packets are
+// diverted from on_packets_send, incoming datagrams from the recvfrom loop.
+// Packets are dropped, duplicated, delayed, jittered, reordered and paced to
+// a bandwidth cap, then handed to a deliver callback from an ev_timer. All
+// random decisions come from a seeded RNG, so a run is reproducible.
+//
+// The stage is disabled unless its environment variable is set, e.g.
+//
+//   TQUIC_IMPAIR_SEND="loss=1%,delay=40ms,jitter=5ms,rate=20mbit,seed=7"
+//   TQUIC_IMPAIR_RECV="reorder=5%,delay=20ms,dup=0.5%"
+//
+// Keys: loss, dup, reorder (percent or fraction), delay, jitter (ms),
+// rate (bit/s, with optional kbit/mbit/gbit suffix), limit (max queued
+// packets) and seed.
+
+#ifndef NET_IMPAIRMENT_H
+#define NET_IMPAIRMENT_H
+
+#include <errno.h>
+#include <ev.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "tquic.h"
+
+#define NET_IMPAIRMENT_ENV_SEND "TQUIC_IMPAIR_SEND"
+#define NET_IMPAIRMENT_ENV_RECV "TQUIC_IMPAIR_RECV"
+#define NET_IMPAIRMENT_DEFAULT_LIMIT 1000
+#define NET_IMPAIRMENT_DEFAULT_SEED 1
+
+struct net_impairment_config {
+    double loss;       // Drop probability in [0, 1]
+    double duplicate;  // Duplication probability in [0, 1]
+    double reorder;    // Probability a packet skips the delay line
+    double delay_ms;   // Fixed one-way delay
+    double jitter_ms;  // Uniform jitter added to the delay, +/- jitter_ms
+    uint64_t rate_bps; // Bandwidth cap, 0 means unlimited
+    size_t limit;      // Max packets held in the delay queue
+    uint64_t seed;     // RNG seed
+};
+
+// Called for every packet leaving the impairment stage.
+typedef void (*net_impairment_deliver_fn)(void *ctx, const uint8_t *data,
+                                          size_t len,
+                                          const struct sockaddr *addr,
+                                          socklen_t addr_len);
+
+// Called once after a batch of delayed packets has been delivered, so the
+// owner can process connections and rearm its QUIC timer.
+typedef void (*net_impairment_flush_fn)(void *ctx);
+
+struct net_impairment_packet {
+    double deliver_at;
+    uint64_t seq;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    size_t len;
+    uint8_t data[];
+};
+
+struct net_impairment {
+    bool enabled;
+    struct net_impairment_config config;
+    uint64_t rng;
+    struct ev_loop *loop;
+    ev_timer timer;
+    net_impairment_deliver_fn deliver;
+    net_impairment_flush_fn flush;
+    void *ctx;
+
+    // Delay queue: binary min-heap ordered by (deliver_at, seq).
+    struct net_impairment_packet **heap;
+    size_t heap_len;
+    size_t heap_cap;
+    uint64_t next_seq;
+
+    // Time at which the emulated link finishes serializing queued bytes.
+    double link_free_at;
+
+    // Statistics
+    uint64_t packets_in;
+    uint64_t packets_out;
+    uint64_t dropped_loss;
+    uint64_t dropped_limit;
+    uint64_t duplicated;
+    uint64_t reordered;
+};
+
+// splitmix64: tiny, fast and good enough for impairment decisions.
+static inline uint64_t net_impairment_rand(struct net_impairment *imp) {
+    uint64_t z = (imp->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform double in [0, 1).
+static inline double net_impairment_uniform(struct net_impairment *imp) {
+    return (net_impairment_rand(imp) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline int net_impairment_parse_prob(const char *value, double *out) {
+    char *end = NULL;
+    double v = strtod(value, &end);
+    if (end == value) {
+        return -1;
+    }
+    if (*end == '%') {
+        v /= 100.0;
+        end++;
+    }
+    if (*end != '\0' || v < 0.0 || v > 1.0) {
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+static inline int net_impairment_parse_ms(const char *value, double *out) {
+    char *end = NULL;
+    double v = strtod(value, &end);
+    if (end == value || v < 0.0) {
+        return -1;
+    }
+    if (strcmp(end, "s") == 0) {
+        v *= 1000.0;
+    } else if (strcmp(end, "us") == 0) {
+        v /= 1000.0;
+    } else if (*end != '\0' && strcmp(end, "ms") != 0) {
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+static inline int net_impairment_parse_rate(const char *value, uint64_t *out) {
+    char *end = NULL;
+    double v = strtod(value, &end);
+    if (end == value || v < 0.0) {
+        return -1;
+    }
+    if (strcmp(end, "kbit") == 0) {
+        v *= 1e3;
+    } else if (strcmp(end, "mbit") == 0) {
+        v *= 1e6;
+    } else if (strcmp(end, "gbit") == 0) {
+        v *= 1e9;
+    } else if (*end != '\0' && strcmp(end, "bit") != 0) {
+        return -1;
+    }
+    *out = (uint64_t)v;
+    return 0;
+}
+
+static inline int net_impairment_parse_u64(const char *value, uint64_t *out) {
+    // strtoull accepts a sign and wraps negative values
+    if (*value < '0' || *value > '9') {
+        return -1;
+    }
+    char *end = NULL;
+    errno = 0;
+    unsigned long long v = strtoull(value, &end, 10);
+    if (*end != '\0' || errno != 0) {
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+// Parse a "key=value,key=value" spec. Returns 0 on success, -1 on error.
+static inline int net_impairment_parse(struct net_impairment_config *config,
+                                       const char *spec) {
+    memset(config, 0, sizeof(*config));
+    config->limit = NET_IMPAIRMENT_DEFAULT_LIMIT;
+    config->seed = NET_IMPAIRMENT_DEFAULT_SEED;
+
+    char *copy = strdup(spec);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    int ret = 0;
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(copy, ",", &saveptr); tok != NULL;
+         tok = strtok_r(NULL, ",", &saveptr)) {
+        char *eq = strchr(tok, '=');
+        if (eq == NULL) {
+            ret = -1;
+            break;
+        }
+        *eq = '\0';
+        const char *key = tok;
+        const char *value = eq + 1;
+
+        if (strcmp(key, "loss") == 0) {
+            ret = net_impairment_parse_prob(value, &config->loss);
+        } else if (strcmp(key, "dup") == 0) {
+            ret = net_impairment_parse_prob(value, &config->duplicate);
+        } else if (strcmp(key, "reorder") == 0) {
+            ret = net_impairment_parse_prob(value, &config->reorder);
+        } else if (strcmp(key, "delay") == 0) {
+            ret = net_impairment_parse_ms(value, &config->delay_ms);
+        } else if (strcmp(key, "jitter") == 0) {
+            ret = net_impairment_parse_ms(value, &config->jitter_ms);
+        } else if (strcmp(key, "rate") == 0) {
+            ret = net_impairment_parse_rate(value, &config->rate_bps);
+        } else if (strcmp(key, "limit") == 0) {
+            uint64_t limit = 0;
+            ret = net_impairment_parse_u64(value, &limit);
+            if (ret == 0 && (limit == 0 || limit > SIZE_MAX)) {
+                ret = -1;
+            }
+            config->limit = limit;
+        } else if (strcmp(key, "seed") == 0) {
+            ret = net_impairment_parse_u64(value, &config->seed);
+        } else {
+            ret = -1;
+        }
+        if (ret != 0) {
+            fprintf(stderr, "impairment: invalid option '%s=%s'\n", key,
+                    value);
+            break;
+        }
+    }
+
+    free(copy);
+    return ret;
+}
+
+static inline bool net_impairment_before(const struct net_impairment_packet *a,
+                                         const struct net_impairment_packet *b) {
+    if (a->deliver_at != b->deliver_at) {
+        return a->deliver_at < b->deliver_at;
+    }
+    return a->seq < b->seq;
+}
+
+static inline int net_impairment_heap_push(struct net_impairment *imp,
+                                           struct net_impairment_packet *pkt) {
+    if (imp->heap_len == imp->heap_cap) {
+        size_t cap = imp->heap_cap ? imp->heap_cap * 2 : 64;
+        struct net_impairment_packet **heap =
+            realloc(imp->heap, cap * sizeof(*heap));
+        if (heap == NULL) {
+            return -1;
+        }
+        imp->heap = heap;
+        imp->heap_cap = cap;
+    }
+
+    size_t i = imp->heap_len++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!net_impairment_before(pkt, imp->heap[parent])) {
+            break;
+        }
+        imp->heap[i] = imp->heap[parent];
+        i = parent;
+    }
+    imp->heap[i] = pkt;
+    return 0;
+}
+
+static inline struct net_impairment_packet *net_impairment_heap_pop(
+    struct net_impairment *imp) {
+    struct net_impairment_packet *top = imp->heap[0];
+    struct net_impairment_packet *last = imp->heap[--imp->heap_len];
+
+    size_t i = 0;
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= imp->heap_len) {
+            break;
+        }
+        if (child + 1 < imp->heap_len &&
+            net_impairment_before(imp->heap[child + 1], imp->heap[child])) {
+            child++;
+        }
+        if (!net_impairment_before(imp->heap[child], last)) {
+            break;
+        }
+        imp->heap[i] = imp->heap[child];
+        i = child;
+    }
+    if (imp->heap_len > 0) {
+        imp->heap[i] = last;
+    }
+    return top;
+}
+
+static inline void net_impairment_arm(struct net_impairment *imp) {
+    if (imp->heap_len == 0) {
+        ev_timer_stop(imp->loop, &imp->timer);
+        return;
+    }
+    double after = imp->heap[0]->deliver_at - ev_now(imp->loop);
+    imp->timer.repeat = after > 0.00001 ? after : 0.00001;
+    ev_timer_again(imp->loop, &imp->timer);
+}
+
+static inline void net_impairment_timer_cb(EV_P_ ev_timer *w, int revents) {
+    struct net_impairment *imp = w->data;
+    double now = ev_now(EV_A);
+    bool delivered = false;
+
+    while (imp->heap_len > 0 && imp->heap[0]->deliver_at <= now) {
+        struct net_impairment_packet *pkt = net_impairment_heap_pop(imp);
+        imp->deliver(imp->ctx, pkt->data, pkt->len,
+                     (const struct sockaddr *)&pkt->addr, pkt->addr_len);
+        imp->packets_out++;
+        delivered = true;
+        free(pkt);
+    }
+
+    if (delivered && imp->flush != NULL) {
+        imp->flush(imp->ctx);
+    }
+    net_impairment_arm(imp);
+}
+
+// Set up an impairment stage from the environment variable `env_name`.
+// Returns 0 if the stage is disabled or configured, -1 on a bad spec.
+static inline int net_impairment_init(struct net_impairment *imp,
+                                      struct ev_loop *loop,
+                                      const char *env_name,
+                                      net_impairment_deliver_fn deliver,
+                                      net_impairment_flush_fn flush,
+                                      void *ctx) {
+    memset(imp, 0, sizeof(*imp));
+    imp->loop = loop;
+    imp->deliver = deliver;
+    imp->flush = flush;
+    imp->ctx = ctx;
+
+    const char *spec = getenv(env_name);
+    if (spec == NULL || *spec == '\0') {
+        return 0;
+    }
+    if (net_impairment_parse(&imp->config, spec) != 0) {
+        fprintf(stderr, "impairment: failed to parse %s=\"%s\"\n", env_name,
+                spec);
+        return -1;
+    }
+
+    imp->enabled = true;
+    imp->rng = imp->config.seed;
+    ev_init(&imp->timer, net_impairment_timer_cb);
+    imp->timer.data = imp;
+
+    fprintf(stderr,
+            "impairment %s: loss=%.2f%% dup=%.2f%% reorder=%.2f%% "
+            "delay=%.1fms jitter=%.1fms rate=%" PRIu64 "bit/s limit=%zu "
+            "seed=%" PRIu64 "\n",
+            env_name, imp->config.loss * 100, imp->config.duplicate * 100,
+            imp->config.reorder * 100, imp->config.delay_ms,
+            imp->config.jitter_ms, imp->config.rate_bps, imp->config.limit,
+            imp->config.seed);
+    return 0;
+}
+
+static inline int net_impairment_enqueue(struct net_impairment *imp,
+                                         const uint8_t *data, size_t len,
+                                         const struct sockaddr *addr,
+                                         socklen_t addr_len, double now) {
+    if (imp->heap_len >= imp->config.limit) {
+        imp->dropped_limit++;
+        return 0;
+    }
+
+    // Serialize onto the capped link first, then add propagation delay.
+    double depart = now;
+    if (imp->config.rate_bps > 0) {
+        if (imp->link_free_at > depart) {
+            depart = imp->link_free_at;
+        }
+        depart += (double)len * 8.0 / (double)imp->config.rate_bps;
+        imp->link_free_at = depart;
+    }
+
+    double delay_ms = imp->config.delay_ms;
+    if (imp->config.jitter_ms > 0) {
+        delay_ms += (net_impairment_uniform(imp) * 2.0 - 1.0) *
+                    imp->config.jitter_ms;
+        if (delay_ms < 0) {
+            delay_ms = 0;
+        }
+    }
+    if (imp->config.reorder > 0 &&
+        net_impairment_uniform(imp) < imp->config.reorder) {
+        // Like netem: a reordered packet jumps ahead of the delay line.
+        delay_ms = 0;
+        imp->reordered++;
+    }
+
+    struct net_impairment_packet *pkt = malloc(sizeof(*pkt) + len);
+    if (pkt == NULL) {
+        return -1;
+    }
+    pkt->deliver_at = depart + delay_ms / 1e3;
+    pkt->seq = imp->next_seq++;
+    pkt->len = len;
+    memcpy(pkt->data, data, len);
+    pkt->addr_len = addr_len <= sizeof(pkt->addr) ? addr_len : 0;
+    memcpy(&pkt->addr, addr, pkt->addr_len);
+
+    if (net_impairment_heap_push(imp, pkt) != 0) {
+        free(pkt);
+        return -1;
+    }
+    return 0;
+}
+
+// Pass a packet through the stage. When the stage is disabled the packet is
+// delivered synchronously, otherwise it is copied into the delay queue.
+static inline void net_impairment_submit(struct net_impairment *imp,
+                                         const uint8_t *data, size_t len,
+                                         const struct sockaddr *addr,
+                                         socklen_t addr_len) {
+    if (!imp->enabled) {
+        imp->deliver(imp->ctx, data, len, addr, addr_len);
+        return;
+    }
+
+    imp->packets_in++;
+    if (imp->config.loss > 0 && net_impairment_uniform(imp) < imp->config.loss) {
+        imp->dropped_loss++;
+        return;
+    }
+
+    double now = ev_now(imp->loop);
+    int copies = 1;
+    if (imp->config.duplicate > 0 &&
+        net_impairment_uniform(imp) < imp->config.duplicate) {
+        copies = 2;
+        imp->duplicated++;
+    }
+    for (int i = 0; i < copies; i++) {
+        if (net_impairment_enqueue(imp, data, len, addr, addr_len, now) != 0) {
+            fprintf(stderr, "impairment: failed to queue packet\n");
+        }
+    }
+    net_impairment_arm(imp);
+}
+
+// Feed a batch from on_packets_send into the stage. Every iovec counts as
+// one packet, matching the send loops of the examples.
+static inline int net_impairment_send_packets(
+    struct net_impairment *imp, struct quic_packet_out_spec_t *pkts,
+    unsigned int count) {
+    int sent_count = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        struct quic_packet_out_spec_t *pkt = pkts + i;
+        for (size_t j = 0; j < pkt->iovlen; j++) {
+            const struct iovec *iov = pkt->iov + j;
+            net_impairment_submit(imp, iov->iov_base, iov->iov_len,
+                                  (const struct sockaddr *)pkt->dst_addr,
+                                  pkt->dst_addr_len);
+            sent_count++;
+        }
+    }
+    return sent_count;
+}
+
+static inline void net_impairment_print_stats(const struct net_impairment *imp,
+                                              const char *label) {
+    if (!imp->enabled) {
+        return;
+    }
+    fprintf(stderr,
+            "impairment %s: in=%" PRIu64 " out=%" PRIu64 " lost=%" PRIu64
+            " overflow=%" PRIu64 " dup=%" PRIu64 " reordered=%" PRIu64
+            " queued=%zu\n",
+            label, imp->packets_in, imp->packets_out, imp->dropped_loss,
+            imp->dropped_limit, imp->duplicated, imp->reordered,
+            imp->heap_len);
+}
+
+static inline void net_impairment_free(struct net_impairment *imp) {
+    if (imp->enabled && imp->loop != NULL) {
+        ev_timer_stop(imp->loop, &imp->timer);
+    }
+    for (size_t i = 0; i < imp->heap_len; i++) {
+        free(imp->heap[i]);
+    }
+    free(imp->heap);
+    imp->heap = NULL;
+    imp->heap_len = 0;
+    imp->heap_cap = 0;
+}
+
+#endif  // NET_IMPAIRMENT_H
@@ -0,0 +1,791 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// QUIC handshake rate benchmark.
+//
+// Derived from simple_client: instead of one connection it keeps a fixed
+// number of handshakes in flight, closing every connection as soon as it
+// is established and opening the next one in its place. Connections are
+// spread over many UDP sockets so the server sees many source ports, as
+// it would during a reconnect storm.
+//
+// Optionally the client resumes the latest session ticket (-R), sends an
+// HTTP/0.9 request and waits for the response before closing (-q), or
+// sends that request as 0-RTT early data (-0). Reported are handshakes
+// per second, handshake (and response) latency percentiles and, if the
+// server runs on the same host (-P), the server CPU time per handshake.
+// Run the server with TQUIC_QUIET=1 so its logging isn't measured too.
+
+#include <errno.h>
+#include <ev.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hdr_histogram.h"
+#include "openssl/ssl.h"
+#include "tquic.h"
+
+#define READ_BUF_SIZE 65536
+#define MAX_DATAGRAM_SIZE 1200
+#define MAX_SOCKETS 1024
+#define MAX_CONCURRENCY 4096
+// Seconds to wait for a session ticket after the handshake (-R)
+#define TICKET_WAIT 1.0
+
+static const char *const REQUEST = "GET /\r\n";
+
+enum slot_state {
+    SLOT_IDLE,
+    SLOT_HANDSHAKE,  // Connecting
+    SLOT_TICKET,     // Established, waiting for a session ticket
+    SLOT_REQUEST,    // Established, waiting for the response
+};
+
+struct bench;
+
+// One in-flight connection. A slot is reused as soon as its connection is
+// closed by us; the connection itself lingers in the endpoint while it
+// drains, detached from the slot.
+struct bench_slot {
+    struct bench *bench;
+    enum slot_state state;
+    struct quic_conn_t *conn;
+    double started;
+    double ticket_deadline;
+    bool request_sent;
+};
+
+struct bench_socket {
+    struct bench *bench;
+    int fd;
+    struct sockaddr_storage local_addr;
+    socklen_t local_addr_len;
+    ev_io watcher;
+};
+
+struct bench {
+    // Settings
+    size_t concurrency;
+    size_t sock_count;
+    uint64_t count;   // Handshakes to run, unless `duration` is set
+    double duration;  // Seconds
+    bool resume;
+    bool zero_rtt;
+    bool request;
+    int server_pid;
+    const char *alpn;
+    const char *json_path;
+
+    struct quic_endpoint_t *quic_endpoint;
+    struct quic_tls_config_t *tls_config;
+    struct ev_loop *loop;
+    ev_timer timer;
+    ev_timer report_timer;
+    struct bench_socket *socks;
+    struct bench_slot *slots;
+    struct bench_slot *connecting;  // Set while quic_endpoint_connect runs
+    struct addrinfo *peer;
+    size_t next_sock;
+
+    // Latest session ticket, reused by the next connection (-R)
+    uint8_t *session;
+    size_t session_len;
+
+    double start;
+    double end;
+    uint64_t started;
+    uint64_t established;
+    uint64_t completed;
+    uint64_t failed;
+    uint64_t resumed;
+    uint64_t early;  // Requests sent as early data
+    uint64_t no_ticket;
+    uint64_t last_established;  // At the previous interval report
+    struct hdr_histogram *handshake;  // Microseconds
+    struct hdr_histogram *response;   // Microseconds, from connect (-q)
+
+    double server_cpu;  // Seconds, -1 if unknown
+    double client_cpu;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// User plus system CPU time of `pid`, or -1 if it can't be read.
+static double process_cpu_seconds(int pid) {
+    char path[64];
+    char stat[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    size_t len = fread(stat, 1, sizeof(stat) - 1, f);
+    fclose(f);
+    stat[len] = '\0';
+
+    // The command name may contain spaces; fields resume after its ')'.
+    char *p = strrchr(stat, ')');
+    unsigned long utime, stime;
+    if (p == NULL || sscanf(p + 2,
+                            "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                            "%lu %lu",
+                            &utime, &stime) != 2) {
+        return -1;
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static double self_cpu_seconds(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static bool more_to_start(struct bench *bench) {
+    if (bench->duration > 0) {
+        return now_seconds() < bench->end;
+    }
+    return bench->started < bench->count;
+}
+
+static void save_session(struct bench *bench, struct quic_conn_t *conn) {
+    const uint8_t *session = NULL;
+    size_t session_len = 0;
+    if (quic_conn_session(conn, &session, &session_len) != 0 ||
+        session_len == 0) {
+        return;
+    }
+    uint8_t *copy = realloc(bench->session, session_len);
+    if (copy == NULL) {
+        return;
+    }
+    memcpy(copy, session, session_len);
+    bench->session = copy;
+    bench->session_len = session_len;
+}
+
+// Detach the slot's connection, close it and free the slot for the next
+// handshake.
+static void finish_slot(struct bench_slot *slot) {
+    struct bench *bench = slot->bench;
+    if (bench->resume) {
+        save_session(bench, slot->conn);
+    }
+    quic_conn_set_context(slot->conn, NULL);
+    const char *reason = "done";
+    quic_conn_close(slot->conn, true, 0, (const uint8_t *)reason,
+                    strlen(reason));
+    slot->conn = NULL;
+    slot->state = SLOT_IDLE;
+    bench->completed++;
+}
+
+static void send_request(struct bench_slot *slot) {
+    ssize_t n = quic_stream_write(slot->conn, 0, (const uint8_t *)REQUEST,
+                                  strlen(REQUEST), true);
+    slot->request_sent = n == (ssize_t)strlen(REQUEST);
+}
+
+void client_on_conn_created(void *tctx, struct quic_conn_t *conn) {
+    struct bench *bench = tctx;
+    struct bench_slot *slot = bench->connecting;
+    if (slot == NULL) {
+        return;
+    }
+    slot->conn = conn;
+    quic_conn_set_context(conn, slot);
+
+    // With a resumed session the request can go out with the first flight.
+    if (bench->zero_rtt && quic_conn_is_in_early_data(conn)) {
+        send_request(slot);
+        if (slot->request_sent) {
+            bench->early++;
+        }
+    }
+}
+
+void client_on_conn_established(void *tctx, struct quic_conn_t *conn) {
+    struct bench *bench = tctx;
+    struct bench_slot *slot = quic_conn_context(conn);
+    if (slot == NULL) {
+        return;
+    }
+    double now = now_seconds();
+    hdr_histogram_record(bench->handshake,
+                         (uint64_t)((now - slot->started) * 1e6));
+    bench->established++;
+    if (quic_conn_is_resumed(conn)) {
+        bench->resumed++;
+    }
+
+    if (bench->request) {
+        if (!slot->request_sent) {
+            send_request(slot);
+        }
+        slot->state = SLOT_REQUEST;
+    } else if (bench->resume) {
+        // The ticket usually arrives right after the handshake completes.
+        slot->state = SLOT_TICKET;
+        slot->ticket_deadline = now + TICKET_WAIT;
+    } else {
+        finish_slot(slot);
+    }
+}
+
+void client_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
+    struct bench_slot *slot = quic_conn_context(conn);
+    if (slot == NULL) {
+        return;  // Closed by us
+    }
+    // Handshake timeout or closed by the server before we were done
+    slot->bench->failed++;
+    slot->conn = NULL;
+    slot->state = SLOT_IDLE;
+    quic_conn_set_context(conn, NULL);
+}
+
+void client_on_stream_created(void *tctx, struct quic_conn_t *conn,
+                              uint64_t stream_id) {}
+
+void client_on_stream_readable(void *tctx, struct quic_conn_t *conn,
+                               uint64_t stream_id) {
+    struct bench *bench = tctx;
+    struct bench_slot *slot = quic_conn_context(conn);
+    static uint8_t buf[READ_BUF_SIZE];
+    bool fin = false;
+    while (!fin) {
+        ssize_t r = quic_stream_read(conn, stream_id, buf, sizeof(buf), &fin);
+        if (r < 0 || (r == 0 && !fin)) {
+            break;
+        }
+    }
+    if (fin && slot != NULL && slot->state == SLOT_REQUEST) {
+        hdr_histogram_record(bench->response,
+                             (uint64_t)((now_seconds() - slot->started) * 1e6));
+        finish_slot(slot);
+    }
+}
+
+void client_on_stream_writable(void *tctx, struct quic_conn_t *conn,
+                               uint64_t stream_id) {
+    quic_stream_wantwrite(conn, stream_id, false);
+}
+
+void client_on_stream_closed(void *tctx, struct quic_conn_t *conn,
+                             uint64_t stream_id) {}
+
+static bool same_address(const struct sockaddr *a,
+                         const struct sockaddr_storage *b) {
+    if (a->sa_family != b->ss_family) {
+        return false;
+    }
+    if (a->sa_family == AF_INET) {
+        return ((const struct sockaddr_in *)a)->sin_port ==
+               ((const struct sockaddr_in *)b)->sin_port;
+    }
+    return ((const struct sockaddr_in6 *)a)->sin6_port ==
+           ((const struct sockaddr_in6 *)b)->sin6_port;
+}
+
+int client_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts,
+                           unsigned int count) {
+    struct bench *bench = psctx;
+
+    unsigned int sent_count = 0;
+    int i, j = 0;
+    for (i = 0; i < count; i++) {
+        struct quic_packet_out_spec_t *pkt = pkts + i;
+        // Send from the socket the connection was opened on
+        int fd = bench->socks[0].fd;
+        for (size_t s = 0; s < bench->sock_count; s++) {
+            if (same_address(pkt->src_addr, &bench->socks[s].local_addr)) {
+                fd = bench->socks[s].fd;
+                break;
+            }
+        }
+        for (j = 0; j < (*pkt).iovlen; j++) {
+            const struct iovec *iov = pkt->iov + j;
+            ssize_t sent =
+                sendto(fd, iov->iov_base, iov->iov_len, 0,
+                       (struct sockaddr *)pkt->dst_addr, pkt->dst_addr_len);
+
+            if (sent != iov->iov_len) {
+                if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+                    return sent_count;
+                }
+                return -1;
+            }
+            sent_count++;
+        }
+    }
+
+    return sent_count;
+}
+
+const struct quic_transport_methods_t quic_transport_methods = {
+    .on_conn_created = client_on_conn_created,
+    .on_conn_established = client_on_conn_established,
+    .on_conn_closed = client_on_conn_closed,
+    .on_stream_created = client_on_stream_created,
+    .on_stream_readable = client_on_stream_readable,
+    .on_stream_writable = client_on_stream_writable,
+    .on_stream_closed = client_on_stream_closed,
+};
+
+const struct quic_packet_send_methods_t quic_packet_send_methods = {
+    .on_packets_send = client_on_packets_send,
+};
+
+// Open a connection in an idle slot, from the next socket in turn.
+static void start_slot(struct bench *bench, struct bench_slot *slot) {
+    struct bench_socket *sock = &bench->socks[bench->next_sock];
+    bench->next_sock = (bench->next_sock + 1) % bench->sock_count;
+    bool resume = bench->resume && bench->session != NULL;
+
+    slot->state = SLOT_HANDSHAKE;
+    slot->request_sent = false;
+    slot->started = now_seconds();
+    bench->started++;
+    bench->connecting = slot;
+    int r = quic_endpoint_connect(
+        bench->quic_endpoint, (struct sockaddr *)&sock->local_addr,
+        sock->local_addr_len, bench->peer->ai_addr, bench->peer->ai_addrlen,
+        NULL /* server_name */, resume ? bench->session : NULL,
+        resume ? bench->session_len : 0, NULL /* token */, 0 /* token_len */,
+        NULL /* config */, NULL /* index */);
+    bench->connecting = NULL;
+    if (r < 0) {
+        fprintf(stderr, "failed to connect: %d\n", r);
+        bench->failed++;
+        slot->state = SLOT_IDLE;
+    }
+}
+
+static void process_connections(struct bench *bench) {
+    quic_endpoint_process_connections(bench->quic_endpoint);
+    double timeout = quic_endpoint_timeout(bench->quic_endpoint) / 1e3f;
+    if (timeout < 0.0001) {
+        timeout = 0.0001;
+    }
+    bench->timer.repeat = timeout;
+    ev_timer_again(bench->loop, &bench->timer);
+}
+
+// Run the endpoint, then close connections that got their ticket and
+// refill the free slots. New connections are only opened here, never
+// from inside tquic callbacks.
+static void step(struct bench *bench) {
+    process_connections(bench);
+
+    double now = now_seconds();
+    bool busy = false;
+    bool changed = false;
+    bool more = more_to_start(bench);
+    for (size_t i = 0; i < bench->concurrency; i++) {
+        struct bench_slot *slot = &bench->slots[i];
+        if (slot->state == SLOT_TICKET) {
+            const uint8_t *session = NULL;
+            size_t session_len = 0;
+            bool ticket =
+                quic_conn_session(slot->conn, &session, &session_len) == 0 &&
+                session_len > 0;
+            if (ticket || now >= slot->ticket_deadline) {
+                if (!ticket) {
+                    bench->no_ticket++;
+                }
+                finish_slot(slot);
+                changed = true;
+            }
+        }
+        if (slot->state == SLOT_IDLE && more) {
+            start_slot(bench, slot);
+            more = more_to_start(bench);
+            changed = true;
+        }
+        if (slot->state != SLOT_IDLE) {
+            busy = true;
+        }
+    }
+
+    if (!busy) {
+        ev_break(bench->loop, EVBREAK_ALL);
+    }
+    if (changed) {
+        process_connections(bench);
+    }
+}
+
+static void read_callback(EV_P_ ev_io *w, int revents) {
+    struct bench_socket *sock = w->data;
+    struct bench *bench = sock->bench;
+    static uint8_t buf[READ_BUF_SIZE];
+
+    while (true) {
+        struct sockaddr_storage peer_addr;
+        socklen_t peer_addr_len = sizeof(peer_addr);
+        memset(&peer_addr, 0, peer_addr_len);
+
+        ssize_t read = recvfrom(sock->fd, buf, sizeof(buf), 0,
+                                (struct sockaddr *)&peer_addr, &peer_addr_len);
+        if (read < 0) {
+            if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+                break;
+            }
+            fprintf(stderr, "failed to read\n");
+            return;
+        }
+
+        quic_packet_info_t quic_packet_info = {
+            .src = (struct sockaddr *)&peer_addr,
+            .src_len = peer_addr_len,
+            .dst = (struct sockaddr *)&sock->local_addr,
+            .dst_len = sock->local_addr_len,
+        };
+        int r = quic_endpoint_recv(bench->quic_endpoint, buf, read,
+                                   &quic_packet_info);
+        if (r != 0) {
+            fprintf(stderr, "recv failed %d\n", r);
+        }
+    }
+
+    step(bench);
+}
+
+static void timeout_callback(EV_P_ ev_timer *w, int revents) {
+    struct bench *bench = w->data;
+    quic_endpoint_on_timeout(bench->quic_endpoint);
+    step(bench);
+}
+
+// One progress line per second.
+static void report_callback(EV_P_ ev_timer *w, int revents) {
+    struct bench *bench = w->data;
+    size_t in_flight = 0;
+    for (size_t i = 0; i < bench->concurrency; i++) {
+        in_flight += bench->slots[i].state != SLOT_IDLE;
+    }
+    fprintf(stderr,
+            "[%6.1f s] %6" PRIu64 " handshakes/s, %" PRIu64 " total, %" PRIu64
+            " failed, %zu in flight\n",
+            now_seconds() - bench->start,
+            bench->established - bench->last_established, bench->established,
+            bench->failed, in_flight);
+    bench->last_established = bench->established;
+    step(bench);
+}
+
+// Open `bench->sock_count` UDP sockets, each bound to its own port.
+static int create_sockets(const char *host, const char *port,
+                          struct bench *bench) {
+    const struct addrinfo hints = {.ai_family = PF_UNSPEC,
+                                   .ai_socktype = SOCK_DGRAM,
+                                   .ai_protocol = IPPROTO_UDP};
+    if (getaddrinfo(host, port, &hints, &bench->peer) != 0) {
+        fprintf(stderr, "failed to resolve host\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < bench->sock_count; i++) {
+        struct bench_socket *sock = &bench->socks[i];
+        sock->bench = bench;
+        sock->fd = socket(bench->peer->ai_family, SOCK_DGRAM, 0);
+        if (sock->fd < 0) {
+            fprintf(stderr, "failed to create socket: %s\n", strerror(errno));
+            return -1;
+        }
+        if (fcntl(sock->fd, F_SETFL, O_NONBLOCK) != 0) {
+            fprintf(stderr, "failed to make socket non-blocking\n");
+            return -1;
+        }
+
+        // Bind to an ephemeral port so sockets can be told apart by address
+        struct sockaddr_storage any;
+        memset(&any, 0, sizeof(any));
+        any.ss_family = bench->peer->ai_family;
+        socklen_t any_len = any.ss_family == AF_INET
+                                ? sizeof(struct sockaddr_in)
+                                : sizeof(struct sockaddr_in6);
+        if (bind(sock->fd, (struct sockaddr *)&any, any_len) != 0) {
+            fprintf(stderr, "failed to bind socket: %s\n", strerror(errno));
+            return -1;
+        }
+        sock->local_addr_len = sizeof(sock->local_addr);
+        if (getsockname(sock->fd, (struct sockaddr *)&sock->local_addr,
+                        &sock->local_addr_len) != 0) {
+            fprintf(stderr, "failed to get local address of socket\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void print_report(struct bench *bench, FILE *out) {
+    double elapsed = bench->end - bench->start;
+    fprintf(out,
+            "quic_handshake_bench: %zu concurrent, %zu sockets, alpn %s%s%s%s\n",
+            bench->concurrency, bench->sock_count, bench->alpn,
+            bench->resume ? ", resumption" : "", bench->zero_rtt ? ", 0-RTT" : "",
+            bench->request ? ", request" : "");
+    fprintf(out,
+            "handshakes: started=%" PRIu64 " established=%" PRIu64
+            " failed=%" PRIu64 " resumed=%" PRIu64 " early_data=%" PRIu64
+            " no_ticket=%" PRIu64 "\n",
+            bench->started, bench->established, bench->failed, bench->resumed,
+            bench->early, bench->no_ticket);
+    fprintf(out, "rate:       %.1f handshakes/s over %.2f s\n",
+            bench->established / elapsed, elapsed);
+    hdr_histogram_print(out, "handshake", bench->handshake, 1e-3, "ms");
+    if (bench->request) {
+        hdr_histogram_print(out, "response", bench->response, 1e-3, "ms");
+    }
+    if (bench->established > 0) {
+        if (bench->server_cpu >= 0) {
+            fprintf(out, "server cpu: %.3f s, %.1f us/handshake\n",
+                    bench->server_cpu,
+                    bench->server_cpu * 1e6 / bench->established);
+        }
+        fprintf(out, "client cpu: %.3f s, %.1f us/handshake\n",
+                bench->client_cpu, bench->client_cpu * 1e6 / bench->established);
+    }
+}
+
+static int write_json(struct bench *bench, const char *file) {
+    FILE *out = strcmp(file, "-") == 0 ? stdout : fopen(file, "w");
+    if (out == NULL) {
+        fprintf(stderr, "failed to open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    double elapsed = bench->end - bench->start;
+    fprintf(out,
+            "{\"concurrency\": %zu, \"sockets\": %zu, \"resume\": %s, "
+            "\"zero_rtt\": %s, \"request\": %s, \"elapsed_s\": %.3f,\n",
+            bench->concurrency, bench->sock_count,
+            bench->resume ? "true" : "false", bench->zero_rtt ? "true" : "false",
+            bench->request ? "true" : "false", elapsed);
+    fprintf(out,
+            " \"handshakes\": {\"started\": %" PRIu64 ", \"established\": %" PRIu64
+            ", \"failed\": %" PRIu64 ", \"resumed\": %" PRIu64
+            ", \"early_data\": %" PRIu64 ", \"per_second\": %.3f},\n",
+            bench->started, bench->established, bench->failed, bench->resumed,
+            bench->early, bench->established / elapsed);
+    fprintf(out, " \"handshake_us\": ");
+    hdr_histogram_print_json(out, bench->handshake);
+    if (bench->request) {
+        fprintf(out, ",\n \"response_us\": ");
+        hdr_histogram_print_json(out, bench->response);
+    }
+    if (bench->established > 0 && bench->server_cpu >= 0) {
+        fprintf(out, ",\n \"server_cpu_us_per_handshake\": %.3f",
+                bench->server_cpu * 1e6 / bench->established);
+    }
+    if (bench->established > 0) {
+        fprintf(out, ",\n \"client_cpu_us_per_handshake\": %.3f",
+                bench->client_cpu * 1e6 / bench->established);
+    }
+    fprintf(out, "}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] <dest_addr> <dest_port>\n", prog);
+    fprintf(stderr, "  -c <n>     handshakes in flight (default: 16, max %d)\n",
+            MAX_CONCURRENCY);
+    fprintf(stderr, "  -u <n>     UDP sockets (source ports) (default: 64, max %d)\n",
+            MAX_SOCKETS);
+    fprintf(stderr, "  -n <n>     handshakes to run (default: 1000)\n");
+    fprintf(stderr, "  -d <s>     run for a duration instead of a count\n");
+    fprintf(stderr, "  -R         resume the latest session ticket\n");
+    fprintf(stderr, "  -q         send \"GET /\" and wait for the response\n");
+    fprintf(stderr, "  -0         send the request as 0-RTT data (implies -R -q)\n");
+    fprintf(stderr, "  -a <alpn>  application protocol (default: http/0.9)\n");
+    fprintf(stderr, "  -t <ms>    handshake timeout (default: 5000)\n");
+    fprintf(stderr, "  -P <pid>   server process on this host, for CPU per handshake\n");
+    fprintf(stderr, "  -j <file>  also write the results as JSON (\"-\" for stdout)\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct bench bench;
+    memset(&bench, 0, sizeof(bench));
+    bench.concurrency = 16;
+    bench.sock_count = 64;
+    bench.count = 1000;
+    bench.alpn = "http/0.9";
+    bench.server_cpu = -1;
+    uint64_t handshake_timeout = 5000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:u:n:d:Rq0a:t:P:j:h")) != -1) {
+        switch (opt) {
+            case 'c': bench.concurrency = strtoul(optarg, NULL, 10); break;
+            case 'u': bench.sock_count = strtoul(optarg, NULL, 10); break;
+            case 'n': bench.count = strtoull(optarg, NULL, 10); break;
+            case 'd': bench.duration = atof(optarg); break;
+            case 'R': bench.resume = true; break;
+            case 'q': bench.request = true; break;
+            case '0': bench.zero_rtt = bench.resume = bench.request = true; break;
+            case 'a': bench.alpn = optarg; break;
+            case 't': handshake_timeout = strtoull(optarg, NULL, 10); break;
+            case 'P': bench.server_pid = atoi(optarg); break;
+            case 'j': bench.json_path = optarg; break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+    if (argc - optind < 2 || bench.concurrency == 0 ||
+        bench.concurrency > MAX_CONCURRENCY || bench.sock_count == 0 ||
+        bench.sock_count > MAX_SOCKETS || bench.duration < 0 ||
+        (bench.duration == 0 && bench.count == 0) || handshake_timeout == 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    const char *host = argv[optind];
+    const char *port = argv[optind + 1];
+    quic_config_t *config = NULL;
+    int ret = 0;
+
+    bench.handshake = hdr_histogram_new();
+    bench.response = hdr_histogram_new();
+    bench.socks = calloc(bench.sock_count, sizeof(struct bench_socket));
+    bench.slots = calloc(bench.concurrency, sizeof(struct bench_slot));
+    if (bench.handshake == NULL || bench.response == NULL ||
+        bench.socks == NULL || bench.slots == NULL) {
+        ret = -1;
+        goto EXIT;
+    }
+    for (size_t i = 0; i < bench.sock_count; i++) {
+        bench.socks[i].fd = -1;
+    }
+    for (size_t i = 0; i < bench.concurrency; i++) {
+        bench.slots[i].bench = &bench;
+    }
+
+    if (create_sockets(host, port, &bench) != 0) {
+        ret = -1;
+        goto EXIT;
+    }
+
+    config = quic_config_new();
+    if (config == NULL) {
+        ret = -1;
+        goto EXIT;
+    }
+    quic_config_set_max_idle_timeout(config, 5000);
+    quic_config_set_max_handshake_timeout(config, handshake_timeout);
+    quic_config_set_recv_udp_payload_size(config, MAX_DATAGRAM_SIZE);
+
+    const char *const protos[1] = {bench.alpn};
+    bench.tls_config =
+        quic_tls_config_new_client_config(protos, 1, bench.zero_rtt);
+    if (bench.tls_config == NULL) {
+        ret = -1;
+        goto EXIT;
+    }
+    quic_config_set_tls_config(config, bench.tls_config);
+
+    bench.quic_endpoint =
+        quic_endpoint_new(config, false, &quic_transport_methods, &bench,
+                          &quic_packet_send_methods, &bench);
+    if (bench.quic_endpoint == NULL) {
+        fprintf(stderr, "failed to create quic endpoint\n");
+        ret = -1;
+        goto EXIT;
+    }
+
+    bench.loop = ev_default_loop(0);
+    ev_init(&bench.timer, timeout_callback);
+    bench.timer.data = &bench;
+    ev_timer_init(&bench.report_timer, report_callback, 1, 1);
+    bench.report_timer.data = &bench;
+    ev_timer_start(bench.loop, &bench.report_timer);
+    for (size_t i = 0; i < bench.sock_count; i++) {
+        struct bench_socket *sock = &bench.socks[i];
+        ev_io_init(&sock->watcher, read_callback, sock->fd, EV_READ);
+        sock->watcher.data = sock;
+        ev_io_start(bench.loop, &sock->watcher);
+    }
+
+    double server_cpu_start =
+        bench.server_pid > 0 ? process_cpu_seconds(bench.server_pid) : -1;
+    if (bench.server_pid > 0 && server_cpu_start < 0) {
+        fprintf(stderr, "can't read CPU time of process %d\n", bench.server_pid);
+    }
+    double client_cpu_start = self_cpu_seconds();
+    bench.start = now_seconds();
+    bench.end = bench.start + bench.duration;
+
+    step(&bench);
+    ev_loop(bench.loop, 0);
+
+    bench.end = now_seconds();
+    bench.client_cpu = self_cpu_seconds() - client_cpu_start;
+    if (server_cpu_start >= 0) {
+        double server_cpu = process_cpu_seconds(bench.server_pid);
+        if (server_cpu >= 0) {
+            bench.server_cpu = server_cpu - server_cpu_start;
+        }
+    }
+    print_report(&bench, stdout);
+    if (bench.json_path != NULL && write_json(&bench, bench.json_path) != 0) {
+        ret = -1;
+    }
+
+EXIT:
+    if (bench.peer != NULL) {
+        freeaddrinfo(bench.peer);
+    }
+    if (bench.quic_endpoint != NULL) {
+        quic_endpoint_free(bench.quic_endpoint);
+    }
+    if (bench.tls_config != NULL) {
+        quic_tls_config_free(bench.tls_config);
+    }
+    for (size_t i = 0; bench.socks != NULL && i < bench.sock_count; i++) {
+        if (bench.socks[i].fd >= 0) {
+            close(bench.socks[i].fd);
+        }
+    }
+    if (bench.loop != NULL) {
+        ev_loop_destroy(bench.loop);
+    }
+    if (config != NULL) {
+        quic_config_free(config);
+    }
+    free(bench.socks);
+    free(bench.slots);
+    free(bench.session);
+    free(bench.handshake);
+    free(bench.response);
+
+    return ret;
+}
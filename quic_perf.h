@@ -0,0 +1,261 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// iperf-like bulk transfer over raw QUIC streams, used by simple_client
+// and simple_server to measure the transport without HTTP/3 or WebSocket
+// framing on top.
+//
+// The client opens TQUIC_PERF_STREAMS bidirectional streams and starts
+// each with a one-line header:
+//
+//   PERF <up|down|bidir> <duration_ms> <chunk_bytes>\n
+//
+// Whoever sends ("up": the client, "down": the server, "bidir": both)
+// writes chunks of <chunk_bytes> as fast as flow and congestion control
+// allow, and finishes the stream after <duration_ms>. In "up" mode the
+// server answers with "OK <bytes received>\n" once the client's side is
+// finished. Both sides print interval and total goodput along with the
+// loss and path statistics tquic exposes.
+
+#ifndef QUIC_PERF_H
+#define QUIC_PERF_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "tquic.h"
+
+#define PERF_ENV_MODE "TQUIC_PERF_MODE"
+#define PERF_ENV_DURATION "TQUIC_PERF_DURATION"
+#define PERF_ENV_STREAMS "TQUIC_PERF_STREAMS"
+#define PERF_ENV_CHUNK "TQUIC_PERF_CHUNK"
+#define PERF_ENV_INTERVAL "TQUIC_PERF_INTERVAL"
+#define PERF_MAX_STREAMS 64
+#define PERF_DEFAULT_CHUNK (64 * 1024)
+#define PERF_MAX_CHUNK (1024 * 1024)
+#define PERF_HEADER_MAX 64
+
+enum perf_mode {
+    PERF_UP = 1,     // Client sends
+    PERF_DOWN = 2,   // Server sends
+    PERF_BIDIR = 3,  // Both send
+};
+
+struct perf_config {
+    enum perf_mode mode;
+    double duration;  // Seconds
+    int streams;
+    size_t chunk;
+    double interval;  // Seconds between reports
+};
+
+// One bulk transfer stream, on either side.
+struct perf_stream {
+    uint64_t stream_id;
+    bool sending;    // This side writes bulk data on the stream
+    bool send_done;  // Our fin has been written
+    bool recv_done;  // The peer's fin has been read
+    char header[PERF_HEADER_MAX];
+    size_t header_len;  // Server: header bytes buffered so far
+    bool header_done;
+    uint64_t sent;
+    uint64_t received;
+    double send_until;
+};
+
+// Counters of one interval report
+struct perf_report {
+    double start;
+    double last;
+    uint64_t last_sent;
+    uint64_t last_received;
+    uint64_t last_lost;
+};
+
+static inline double perf_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline const char *perf_mode_name(enum perf_mode mode) {
+    return mode == PERF_UP ? "up" : mode == PERF_DOWN ? "down" : "bidir";
+}
+
+static inline int perf_mode_parse(const char *name, enum perf_mode *mode) {
+    if (strcasecmp(name, "up") == 0 || strcasecmp(name, "upload") == 0) {
+        *mode = PERF_UP;
+    } else if (strcasecmp(name, "down") == 0 || strcasecmp(name, "download") == 0) {
+        *mode = PERF_DOWN;
+    } else if (strcasecmp(name, "bidir") == 0) {
+        *mode = PERF_BIDIR;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Read the client settings from the environment. Returns 1 if perf mode
+// is enabled (TQUIC_PERF_MODE is set), 0 if not and -1 if a value is
+// invalid.
+static inline int perf_config_from_env(struct perf_config *cfg) {
+    cfg->mode = PERF_DOWN;
+    cfg->duration = 10;
+    cfg->streams = 1;
+    cfg->chunk = PERF_DEFAULT_CHUNK;
+    cfg->interval = 1;
+
+    const char *value = getenv(PERF_ENV_MODE);
+    if (value == NULL || *value == '\0') {
+        return 0;
+    }
+    if (perf_mode_parse(value, &cfg->mode) != 0) {
+        fprintf(stderr, "%s: expected up, down or bidir\n", PERF_ENV_MODE);
+        return -1;
+    }
+    if ((value = getenv(PERF_ENV_DURATION)) != NULL) {
+        cfg->duration = atof(value);
+    }
+    if ((value = getenv(PERF_ENV_STREAMS)) != NULL) {
+        cfg->streams = atoi(value);
+    }
+    if ((value = getenv(PERF_ENV_CHUNK)) != NULL) {
+        cfg->chunk = strtoul(value, NULL, 10);
+    }
+    if ((value = getenv(PERF_ENV_INTERVAL)) != NULL) {
+        cfg->interval = atof(value);
+    }
+    if (cfg->duration <= 0 || cfg->streams < 1 || cfg->streams > PERF_MAX_STREAMS ||
+        cfg->chunk == 0 || cfg->chunk > PERF_MAX_CHUNK || cfg->interval <= 0) {
+        fprintf(stderr, "invalid perf settings (streams 1-%d, chunk 1-%d bytes)\n",
+                PERF_MAX_STREAMS, PERF_MAX_CHUNK);
+        return -1;
+    }
+    return 1;
+}
+
+static inline int perf_header_format(const struct perf_config *cfg, char *buf,
+                                     size_t buf_len) {
+    return snprintf(buf, buf_len, "PERF %s %.0f %zu\n", perf_mode_name(cfg->mode),
+                    cfg->duration * 1e3, cfg->chunk);
+}
+
+// Parse a header line without its newline. Returns 0 or -1.
+static inline int perf_header_parse(const char *line, struct perf_config *cfg) {
+    char mode[16];
+    unsigned long duration_ms;
+    unsigned long chunk;
+    if (sscanf(line, "PERF %15s %lu %lu", mode, &duration_ms, &chunk) != 3 ||
+        perf_mode_parse(mode, &cfg->mode) != 0 || chunk == 0 || chunk > PERF_MAX_CHUNK) {
+        return -1;
+    }
+    cfg->duration = duration_ms / 1e3;
+    cfg->chunk = chunk;
+    cfg->streams = 1;
+    cfg->interval = 1;
+    return 0;
+}
+
+// Whether `data` starts a perf stream.
+static inline bool perf_header_match(const uint8_t *data, size_t len) {
+    return len >= 5 && memcmp(data, "PERF ", 5) == 0;
+}
+
+// Write chunks of `chunk` until the stream stops taking data, or finish
+// the stream once its time is up. Asks for a writable event while there
+// is more to send.
+static inline void perf_stream_send(struct quic_conn_t *conn, struct perf_stream *ps,
+                                    const uint8_t *chunk, size_t chunk_len) {
+    if (!ps->sending || ps->send_done) {
+        return;
+    }
+    if (perf_now() >= ps->send_until) {
+        if (quic_stream_write(conn, ps->stream_id, chunk, 0, true) >= 0) {
+            ps->send_done = true;
+            quic_stream_wantwrite(conn, ps->stream_id, false);
+            return;
+        }
+    } else {
+        while (true) {
+            ssize_t n = quic_stream_write(conn, ps->stream_id, chunk, chunk_len, false);
+            if (n <= 0) {
+                break;
+            }
+            ps->sent += n;
+            if ((size_t)n < chunk_len) {
+                break;
+            }
+        }
+    }
+    quic_stream_wantwrite(conn, ps->stream_id, true);
+}
+
+static inline void perf_report_start(struct perf_report *r) {
+    memset(r, 0, sizeof(*r));
+    r->start = r->last = perf_now();
+}
+
+// Print one interval line: goodput each way, packets lost and, if known,
+// the smoothed RTT and congestion window of the path.
+static inline void perf_report_interval(struct perf_report *r, const char *label,
+                                        uint64_t sent, uint64_t received,
+                                        const struct quic_conn_stats_t *cs,
+                                        const struct quic_path_stats_t *ps) {
+    double now = perf_now();
+    double secs = now - r->last;
+    if (secs <= 0) {
+        return;
+    }
+    uint64_t lost = cs ? cs->lost_count : 0;
+    printf("%s[%7.2f-%7.2f s] send %9.2f Mbit/s  recv %9.2f Mbit/s  lost %6" PRIu64, label,
+           r->last - r->start, now - r->start, (sent - r->last_sent) * 8 / secs / 1e6,
+           (received - r->last_received) * 8 / secs / 1e6, lost - r->last_lost);
+    if (ps != NULL) {
+        printf("  srtt %7.2f ms  cwnd %7" PRIu64 " KB%s", ps->srtt / 1e3,
+               ps->final_cwnd / 1024, ps->in_slow_start ? " (slow start)" : "");
+    }
+    printf("\n");
+    fflush(stdout);
+    r->last = now;
+    r->last_sent = sent;
+    r->last_received = received;
+    r->last_lost = lost;
+}
+
+static inline void perf_report_total(const struct perf_report *r, const char *label,
+                                     uint64_t sent, uint64_t received,
+                                     const struct quic_conn_stats_t *cs) {
+    double secs = perf_now() - r->start;
+    if (secs <= 0) {
+        secs = 1e-9;
+    }
+    printf("%s[%7.2f s total] sent %" PRIu64 " bytes (%.2f Mbit/s), received %" PRIu64
+           " bytes (%.2f Mbit/s)",
+           label, secs, sent, sent * 8 / secs / 1e6, received, received * 8 / secs / 1e6);
+    if (cs != NULL) {
+        printf(", %" PRIu64 "/%" PRIu64 " packets lost (%.2f%%)", cs->lost_count,
+               cs->sent_count, cs->sent_count ? 100.0 * cs->lost_count / cs->sent_count : 0.0);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+#endif  // QUIC_PERF_H
@@ -0,0 +1,48 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Progress logging for the example servers.
+//
+// Per-connection, per-stream and per-packet messages go through
+// server_log() so that benchmark runs can turn them off with
+// TQUIC_QUIET=1: at tens of thousands of handshakes or packets per second
+// the logging itself would be what gets measured. Quiet mode also skips
+// the tquic TRACE logger. Errors are printed with fprintf as before.
+
+#ifndef SERVER_LOG_H
+#define SERVER_LOG_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SERVER_QUIET_ENV "TQUIC_QUIET"
+
+static bool g_server_quiet = false;
+
+#define server_log(...)                   \
+    do {                                  \
+        if (!g_server_quiet) {            \
+            fprintf(stderr, __VA_ARGS__); \
+        }                                 \
+    } while (0)
+
+// Read TQUIC_QUIET; any value other than empty or "0" enables quiet mode.
+static inline void server_log_init(void) {
+    const char *value = getenv(SERVER_QUIET_ENV);
+    g_server_quiet = value != NULL && *value != '\0' && strcmp(value, "0") != 0;
+}
+
+#endif  // SERVER_LOG_H
@@ -26,11 +26,19 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "net_impairment.h"
 #include "openssl/ssl.h"
+#include "quic_perf.h"
 #include "tquic.h"
 
 #define READ_BUF_SIZE 4096
 #define MAX_DATAGRAM_SIZE 1200
+#define PERF_READ_BUF_SIZE 65536
+// Give up this long after the transfer should have ended
+#define PERF_GRACE_SECS 10
+
+// Payload written by perf streams; the content does not matter.
+static uint8_t g_perf_chunk[PERF_MAX_CHUNK];
 
 // A simple client that supports HTTP/0.9 over QUIC
 struct simple_client {
@@ -42,20 +50,188 @@ struct simple_client {
     struct quic_tls_config_t *tls_config;
     struct quic_conn_t *conn;
     struct ev_loop *loop;
+    struct net_impairment send_impairment;
+    struct net_impairment recv_impairment;
+
+    // Bulk transfer mode, enabled by TQUIC_PERF_MODE (see quic_perf.h)
+    bool perf_enabled;
+    bool perf_finished;
+    struct perf_config perf;
+    struct perf_stream perf_streams[PERF_MAX_STREAMS];
+    struct perf_report perf_report;
+    ev_timer perf_timer;
+    double perf_deadline;
+    struct sockaddr_storage peer_addr;
+    socklen_t peer_addr_len;
 };
 
+static void process_connections(struct simple_client *client);
+
+static struct perf_stream *perf_find(struct simple_client *client,
+                                     uint64_t stream_id) {
+    uint64_t i = stream_id / 4;
+    if (!client->perf_enabled || stream_id % 4 != 0 ||
+        i >= (uint64_t)client->perf.streams) {
+        return NULL;
+    }
+    return &client->perf_streams[i];
+}
+
+static void perf_totals(struct simple_client *client, uint64_t *sent,
+                        uint64_t *received) {
+    *sent = *received = 0;
+    for (int i = 0; i < client->perf.streams; i++) {
+        *sent += client->perf_streams[i].sent;
+        *received += client->perf_streams[i].received;
+    }
+}
+
+static void perf_print_interval(struct simple_client *client) {
+    uint64_t sent, received;
+    perf_totals(client, &sent, &received);
+    const struct quic_path_stats_t *path = quic_conn_path_stats(
+        client->conn, (struct sockaddr *)&client->local_addr,
+        client->local_addr_len, (struct sockaddr *)&client->peer_addr,
+        client->peer_addr_len);
+    perf_report_interval(&client->perf_report, "", sent, received,
+                         quic_conn_stats(client->conn), path);
+}
+
+// Print the totals and close the connection once every stream is done
+// (or the grace period is over).
+static void perf_check_done(struct simple_client *client) {
+    if (client->perf_finished) {
+        return;
+    }
+    bool done = true;
+    for (int i = 0; i < client->perf.streams; i++) {
+        struct perf_stream *ps = &client->perf_streams[i];
+        if (!ps->send_done || !ps->recv_done) {
+            done = false;
+            break;
+        }
+    }
+    bool expired = perf_now() >= client->perf_deadline;
+    if (!done && !expired) {
+        return;
+    }
+    if (expired && !done) {
+        fprintf(stderr, "perf: streams not finished, giving up\n");
+    }
+
+    client->perf_finished = true;
+    ev_timer_stop(client->loop, &client->perf_timer);
+    perf_print_interval(client);
+    uint64_t sent, received;
+    perf_totals(client, &sent, &received);
+    perf_report_total(&client->perf_report, "", sent, received,
+                      quic_conn_stats(client->conn));
+
+    const char *reason = "ok";
+    quic_conn_close(client->conn, true, 0, (const uint8_t *)reason,
+                    strlen(reason));
+}
+
+static void perf_timer_callback(EV_P_ ev_timer *w, int revents) {
+    struct simple_client *client = w->data;
+    perf_print_interval(client);
+    // Streams blocked on flow control still have to notice the deadline.
+    for (int i = 0; i < client->perf.streams; i++) {
+        perf_stream_send(client->conn, &client->perf_streams[i], g_perf_chunk,
+                         client->perf.chunk);
+    }
+    perf_check_done(client);
+    process_connections(client);
+}
+
+// Open the perf streams: each starts with the header line, followed by
+// bulk data if the client uploads. A download-only stream is finished
+// right after the header.
+static void perf_start(struct simple_client *client, struct quic_conn_t *conn) {
+    char header[PERF_HEADER_MAX];
+    int header_len = perf_header_format(&client->perf, header, sizeof(header));
+    double now = perf_now();
+    bool upload = client->perf.mode & PERF_UP;
+
+    printf("perf: %s, %d stream(s), %.1f s, %zu byte chunks\n",
+           perf_mode_name(client->perf.mode), client->perf.streams,
+           client->perf.duration, client->perf.chunk);
+    perf_report_start(&client->perf_report);
+    client->perf_deadline = now + client->perf.duration + PERF_GRACE_SECS;
+
+    for (int i = 0; i < client->perf.streams; i++) {
+        struct perf_stream *ps = &client->perf_streams[i];
+        memset(ps, 0, sizeof(*ps));
+        ps->stream_id = 4 * i;
+        ps->sending = upload;
+        ps->send_done = !upload;
+        ps->send_until = now + client->perf.duration;
+        if (quic_stream_write(conn, ps->stream_id, (uint8_t *)header,
+                              header_len, !upload) != header_len) {
+            fprintf(stderr, "perf: failed to open stream %" PRIu64 "\n",
+                    ps->stream_id);
+            ps->send_done = ps->recv_done = true;
+            continue;
+        }
+        perf_stream_send(conn, ps, g_perf_chunk, client->perf.chunk);
+    }
+
+    ev_timer_init(&client->perf_timer, perf_timer_callback,
+                  client->perf.interval, client->perf.interval);
+    client->perf_timer.data = client;
+    ev_timer_start(client->loop, &client->perf_timer);
+}
+
+// Drain a perf stream. Uploads are answered with a one-line summary from
+// the server, which is printed rather than counted.
+static void perf_read(struct simple_client *client, struct quic_conn_t *conn,
+                      struct perf_stream *ps) {
+    static uint8_t buf[PERF_READ_BUF_SIZE];
+    bool fin = false;
+    while (!fin) {
+        ssize_t r = quic_stream_read(conn, ps->stream_id, buf, sizeof(buf),
+                                     &fin);
+        if (r < 0) {
+            break;
+        }
+        if (client->perf.mode == PERF_UP) {
+            printf("perf: stream %" PRIu64 " server: %.*s", ps->stream_id,
+                   (int)r, buf);
+        } else {
+            ps->received += r;
+        }
+        if (r == 0 && !fin) {
+            break;
+        }
+    }
+    if (fin) {
+        ps->recv_done = true;
+        perf_check_done(client);
+    }
+}
+
 void client_on_conn_created(void *tctx, struct quic_conn_t *conn) {
     struct simple_client *client = tctx;
     client->conn = conn;
 }
 
 void client_on_conn_established(void *tctx, struct quic_conn_t *conn) {
+    struct simple_client *client = tctx;
+    if (client->perf_enabled) {
+        perf_start(client, conn);
+        return;
+    }
+
     const char *data = "GET /\r\n";
     quic_stream_write(conn, 0, (uint8_t *)data, strlen(data), true);
 }
 
 void client_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
     struct simple_client *client = tctx;
+    if (client->perf_enabled && !client->perf_finished) {
+        fprintf(stderr, "perf: connection closed before the transfer ended\n");
+        ev_timer_stop(client->loop, &client->perf_timer);
+    }
     ev_break(client->loop, EVBREAK_ALL);
 }
 
@@ -64,6 +240,13 @@ void client_on_stream_created(void *tctx, struct quic_conn_t *conn,
 
 void client_on_stream_readable(void *tctx, struct quic_conn_t *conn,
                                uint64_t stream_id) {
+    struct simple_client *client = tctx;
+    struct perf_stream *ps = perf_find(client, stream_id);
+    if (ps != NULL) {
+        perf_read(client, conn, ps);
+        return;
+    }
+
     static uint8_t buf[READ_BUF_SIZE];
     bool fin = false;
     ssize_t r = quic_stream_read(conn, stream_id, buf, READ_BUF_SIZE, &fin);
@@ -82,6 +265,15 @@ void client_on_stream_readable(void *tctx, struct quic_conn_t *conn,
 
 void client_on_stream_writable(void *tctx, struct quic_conn_t *conn,
                                uint64_t stream_id) {
+    struct simple_client *client = tctx;
+    struct perf_stream *ps = perf_find(client, stream_id);
+    if (ps != NULL) {
+        perf_stream_send(conn, ps, g_perf_chunk, client->perf.chunk);
+        if (ps->send_done) {
+            perf_check_done(client);
+        }
+        return;
+    }
     quic_stream_wantwrite(conn, stream_id, false);
 }
 
@@ -91,6 +283,10 @@ void client_on_stream_closed(void *tctx, struct quic_conn_t *conn,
 int client_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts,
                            unsigned int count) {
     struct simple_client *client = psctx;
+    if (client->send_impairment.enabled) {
+        return net_impairment_send_packets(&client->send_impairment, pkts,
+                                           count);
+    }
 
     unsigned int sent_count = 0;
     int i, j = 0;
@@ -141,6 +337,36 @@ static void process_connections(struct simple_client *client) {
     ev_timer_again(client->loop, &client->timer);
 }
 
+// Send a packet released by the send impairment stage.
+static void impaired_send(void *ctx, const uint8_t *data, size_t len,
+                          const struct sockaddr *addr, socklen_t addr_len) {
+    struct simple_client *client = ctx;
+    ssize_t sent = sendto(client->sock, data, len, 0, addr, addr_len);
+    if (sent != len) {
+        fprintf(stderr, "impaired send failed: %s\n", strerror(errno));
+    }
+}
+
+// Feed a received packet (possibly delayed) into the quic endpoint.
+static void deliver_packet(void *ctx, const uint8_t *data, size_t len,
+                           const struct sockaddr *addr, socklen_t addr_len) {
+    struct simple_client *client = ctx;
+    quic_packet_info_t quic_packet_info = {
+        .src = addr,
+        .src_len = addr_len,
+        .dst = (struct sockaddr *)&client->local_addr,
+        .dst_len = client->local_addr_len,
+    };
+
+    int r = quic_endpoint_recv(client->quic_endpoint, (uint8_t *)data, len,
+                               &quic_packet_info);
+    if (r != 0) {
+        fprintf(stderr, "recv failed %d\n", r);
+    }
+}
+
+static void flush_delivered(void *ctx) { process_connections(ctx); }
+
 static void read_callback(EV_P_ ev_io *w, int revents) {
     struct simple_client *client = w->data;
     static uint8_t buf[READ_BUF_SIZE];
@@ -161,19 +387,8 @@ static void read_callback(EV_P_ ev_io *w, int revents) {
             return;
         }
 
-        quic_packet_info_t quic_packet_info = {
-            .src = (struct sockaddr *)&peer_addr,
-            .src_len = peer_addr_len,
-            .dst = (struct sockaddr *)&client->local_addr,
-            .dst_len = client->local_addr_len,
-        };
-
-        int r = quic_endpoint_recv(client->quic_endpoint, buf, read,
-                                   &quic_packet_info);
-        if (r != 0) {
-            fprintf(stderr, "recv failed %d\n", r);
-            continue;
-        }
+        net_impairment_submit(&client->recv_impairment, buf, read,
+                              (struct sockaddr *)&peer_addr, peer_addr_len);
     }
 
     process_connections(client);
@@ -226,18 +441,38 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    // Set logger.
-    quic_set_logger(debug_log, NULL, "TRACE");
-
     // Create client.
     struct simple_client client;
     client.quic_endpoint = NULL;
     client.tls_config = NULL;
     client.conn = NULL;
-    client.loop = NULL;
+    client.loop = ev_default_loop(0);
+    client.perf_finished = false;
     quic_config_t *config = NULL;
     int ret = 0;
 
+    // Bulk transfer mode (see quic_perf.h).
+    int perf = perf_config_from_env(&client.perf);
+    if (perf < 0) {
+        return -1;
+    }
+    client.perf_enabled = perf > 0;
+
+    // Set logger. Trace logs would dominate a throughput measurement.
+    if (!client.perf_enabled) {
+        quic_set_logger(debug_log, NULL, "TRACE");
+    }
+
+    // Set up optional packet impairment (see net_impairment.h).
+    if (net_impairment_init(&client.send_impairment, client.loop,
+                            NET_IMPAIRMENT_ENV_SEND, impaired_send, NULL,
+                            &client) != 0 ||
+        net_impairment_init(&client.recv_impairment, client.loop,
+                            NET_IMPAIRMENT_ENV_RECV, deliver_packet,
+                            flush_delivered, &client) != 0) {
+        return -1;
+    }
+
     // Create socket.
     const char *host = argv[1];
     const char *port = argv[2];
@@ -246,6 +481,8 @@ int main(int argc, char *argv[]) {
         ret = -1;
         goto EXIT;
     }
+    memcpy(&client.peer_addr, peer->ai_addr, peer->ai_addrlen);
+    client.peer_addr_len = peer->ai_addrlen;
 
     // Create quic config.
     config = quic_config_new();
@@ -277,7 +514,6 @@ int main(int argc, char *argv[]) {
     }
 
     // Init event loop.
-    client.loop = ev_default_loop(0);
     ev_init(&client.timer, timeout_callback);
     client.timer.data = &client;
 
@@ -315,6 +551,10 @@ EXIT:
     if (client.quic_endpoint != NULL) {
         quic_endpoint_free(client.quic_endpoint);
     }
+    net_impairment_print_stats(&client.send_impairment, "send");
+    net_impairment_print_stats(&client.recv_impairment, "recv");
+    net_impairment_free(&client.send_impairment);
+    net_impairment_free(&client.recv_impairment);
     if (client.loop != NULL) {
         ev_loop_destroy(client.loop);
     }
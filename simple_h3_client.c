@@ -16,6 +16,7 @@
 #include <ev.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <netdb.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -23,18 +24,102 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "http_range.h"
+#include "net_impairment.h"
 #include "openssl/ssl.h"
 #include "tquic.h"
 
 #define READ_BUF_SIZE 4096
+#define BODY_BUF_SIZE 65536
 #define MAX_DATAGRAM_SIZE 1200
+#define MAX_SEGMENTS 64
+
+// Download options, read from the environment
+#define ENV_SEGMENTS "TQUIC_H3_SEGMENTS"
+#define ENV_OUTPUT "TQUIC_H3_OUTPUT"
+// Batch options, also from the environment
+#define ENV_URL_FILE "TQUIC_H3_URL_FILE"
+#define ENV_REQUESTS "TQUIC_H3_REQUESTS"
+#define ENV_CONCURRENCY "TQUIC_H3_CONCURRENCY"
+#define ENV_OUTPUT_DIR "TQUIC_H3_OUTPUT_DIR"
+#define DEFAULT_CONCURRENCY 8
 
 // Global variable to store the HTTP path
 static const char *g_http_path = "/";
 
+// One request stream. A segmented download uses one per byte range.
+struct h3_request {
+    int64_t stream_id;
+    const char *path;
+    bool ranged;
+    uint64_t first;         // Requested range, inclusive
+    uint64_t last;          // UINT64_MAX for an open-ended range
+    uint64_t write_offset;  // Output offset of the next body byte
+    uint64_t received;
+    int status;
+    bool finished;
+};
+
+enum download_phase {
+    DOWNLOAD_IDLE,      // Nothing sent yet
+    DOWNLOAD_PROBE,     // Learning the size with a one-byte range request
+    DOWNLOAD_SEGMENTS,  // One range request per segment in flight
+    DOWNLOAD_SINGLE,    // One plain or resumed request in flight
+    DOWNLOAD_DONE,
+};
+
+// Segmented downloads first probe the size with "range: bytes=0-0", then
+// fetch TQUIC_H3_SEGMENTS ranges in parallel, each on its own stream, and
+// write them in place into TQUIC_H3_OUTPUT (or discard them). A single
+// download into an existing output file resumes from its current size.
+struct download {
+    enum download_phase phase;
+    int segments;  // Parallel streams; 1 disables segmenting
+    const char *output;
+    int fd;
+    uint64_t resume_from;  // Bytes already in the output file
+    uint64_t total_size;
+    struct h3_request requests[MAX_SEGMENTS];
+    size_t request_count;
+    size_t finished_count;
+    uint64_t bytes;
+    ev_tstamp start;
+};
+
+// One request of a batch
+struct batch_request {
+    struct h3_request req;  // First, so find_request() results can be cast
+    char *path;
+    int fd;                 // Body file, or -1 to discard the body
+    ev_tstamp sent_at;
+    ev_tstamp headers_at;   // Time to first byte is headers_at - sent_at
+    ev_tstamp done_at;
+    bool failed;
+};
+
+// Batch mode fetches many paths over one connection, like a browser
+// loading a page: the paths of TQUIC_H3_URL_FILE, or TQUIC_H3_REQUESTS
+// copies of the path argument with "%d" replaced by the request index.
+// At most TQUIC_H3_CONCURRENCY streams are open at a time; bodies go to
+// files in TQUIC_H3_OUTPUT_DIR or are discarded.
+struct batch {
+    struct batch_request *requests;  // NULL when not in batch mode
+    size_t count;
+    size_t next;         // First request not sent yet
+    size_t first_open;   // No request before this one is open
+    size_t active;
+    size_t finished;
+    int concurrency;
+    const char *output_dir;
+    uint64_t bytes;
+    ev_tstamp start;
+    bool done;
+};
+
 // A simple client that supports HTTP/3 over QUIC
 struct simple_client {
     struct quic_endpoint_t *quic_endpoint;
@@ -45,8 +130,12 @@ struct simple_client {
     struct quic_tls_config_t *tls_config;
     struct quic_conn_t *conn;
     struct ev_loop *loop;
+    struct net_impairment send_impairment;
+    struct net_impairment recv_impairment;
     struct http3_conn_t * h3_conn;
     struct http3_config_t *h3_config; // Store HTTP/3 config to avoid early cleanup
+    struct download download;
+    struct batch batch;
 };
 
 void client_on_conn_created(void *tctx, struct quic_conn_t *conn) {
@@ -155,6 +244,10 @@ void client_on_stream_closed(void *tctx, struct quic_conn_t *conn,
 int client_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts,
                            unsigned int count) {
     struct simple_client *client = psctx;
+    if (client->send_impairment.enabled) {
+        return net_impairment_send_packets(&client->send_impairment, pkts,
+                                           count);
+    }
 
     unsigned int sent_count = 0;
     int i, j = 0;
@@ -221,6 +314,36 @@ static void process_connections(struct simple_client *client) {
     ev_timer_again(client->loop, &client->timer);
 }
 
+// Send a packet released by the send impairment stage.
+static void impaired_send(void *ctx, const uint8_t *data, size_t len,
+                          const struct sockaddr *addr, socklen_t addr_len) {
+    struct simple_client *client = ctx;
+    ssize_t sent = sendto(client->sock, data, len, 0, addr, addr_len);
+    if (sent != len) {
+        fprintf(stderr, "impaired send failed: %s\n", strerror(errno));
+    }
+}
+
+// Feed a received packet (possibly delayed) into the quic endpoint.
+static void deliver_packet(void *ctx, const uint8_t *data, size_t len,
+                           const struct sockaddr *addr, socklen_t addr_len) {
+    struct simple_client *client = ctx;
+    quic_packet_info_t quic_packet_info = {
+        .src = addr,
+        .src_len = addr_len,
+        .dst = (struct sockaddr *)&client->local_addr,
+        .dst_len = client->local_addr_len,
+    };
+
+    int r = quic_endpoint_recv(client->quic_endpoint, (uint8_t *)data, len,
+                               &quic_packet_info);
+    if (r != 0) {
+        fprintf(stderr, "recv failed %d\n", r);
+    }
+}
+
+static void flush_delivered(void *ctx) { process_connections(ctx); }
+
 static void read_callback(EV_P_ ev_io *w, int revents) {
     struct simple_client *client = w->data;
     static uint8_t buf[READ_BUF_SIZE];
@@ -241,19 +364,8 @@ static void read_callback(EV_P_ ev_io *w, int revents) {
             return;
         }
 
-        quic_packet_info_t quic_packet_info = {
-            .src = (struct sockaddr *)&peer_addr,
-            .src_len = peer_addr_len,
-            .dst = (struct sockaddr *)&client->local_addr,
-            .dst_len = client->local_addr_len,
-        };
-
-        int r = quic_endpoint_recv(client->quic_endpoint, buf, read,
-                                   &quic_packet_info);
-        if (r != 0) {
-            fprintf(stderr, "recv failed %d\n", r);
-            continue;
-        }
+        net_impairment_submit(&client->recv_impairment, buf, read,
+                              (struct sockaddr *)&peer_addr, peer_addr_len);
     }
 
     process_connections(client);
@@ -265,39 +377,395 @@ static void timeout_callback(EV_P_ ev_timer *w, int revents) {
     process_connections(client);
 }
 
-static void process_h3_events(struct simple_client *client) {
-    static bool request_sent = false;
-    
-    // Try to send request if not sent yet and we have a valid HTTP/3 connection
-    if (!request_sent && client->h3_conn != NULL && client->conn != NULL) {
-        // First, create a new HTTP/3 stream
-        int64_t stream_id = http3_stream_new(client->h3_conn, client->conn);
-        if (stream_id < 0) {
-            printf("Failed to create HTTP/3 stream: %ld\n", stream_id);
+// Send a GET for `req->path` on a new stream, with a range if requested.
+static int send_request(struct simple_client *client, struct h3_request *req) {
+    int64_t stream_id = http3_stream_new(client->h3_conn, client->conn);
+    if (stream_id < 0) {
+        printf("Failed to create HTTP/3 stream: %ld\n", stream_id);
+        return -1;
+    }
+
+    // Create HTTP/3 headers using the global path variable
+    char range[64] = "";
+    struct http3_header_t headers[6] = {
+        {.name = (uint8_t *)":method", .name_len = 7, .value = (uint8_t *)"GET", .value_len = 3},
+        {.name = (uint8_t *)":scheme", .name_len = 7, .value = (uint8_t *)"https", .value_len = 5},
+        {.name = (uint8_t *)":authority", .name_len = 10, .value = (uint8_t *)"127.0.0.1", .value_len = 9},
+        {.name = (uint8_t *)":path", .name_len = 5, .value = (uint8_t *)req->path, .value_len = strlen(req->path)},
+        {.name = (uint8_t *)"user-agent", .name_len = 10, .value = (uint8_t *)"tquic", .value_len = 5}
+    };
+    size_t header_count = 5;
+    if (req->ranged) {
+        if (req->last == UINT64_MAX) {
+            snprintf(range, sizeof(range), "bytes=%" PRIu64 "-", req->first);
+        } else {
+            snprintf(range, sizeof(range), "bytes=%" PRIu64 "-%" PRIu64, req->first, req->last);
+        }
+        headers[header_count++] = (struct http3_header_t){
+            .name = (uint8_t *)"range", .name_len = 5, .value = (uint8_t *)range, .value_len = strlen(range)};
+    }
+
+    // Send headers on the created stream
+    int result = http3_send_headers(client->h3_conn, client->conn, (uint64_t)stream_id,
+                                    headers, header_count, true);
+    if (result < 0) {
+        printf("Failed to send HTTP/3 request: %d\n", result);
+        return -1;
+    }
+    req->stream_id = stream_id;
+    printf("HTTP/3 request sent successfully on stream %ld for path: %s %s\n", stream_id,
+           req->path, range);
+    return 0;
+}
+
+static struct h3_request *find_request(struct simple_client *client, uint64_t stream_id) {
+    struct batch *b = &client->batch;
+    if (b->requests != NULL) {
+        for (size_t i = b->first_open; i < b->next; i++) {
+            if (b->requests[i].req.stream_id == (int64_t)stream_id) {
+                return &b->requests[i].req;
+            }
+        }
+        return NULL;
+    }
+
+    struct download *dl = &client->download;
+    for (size_t i = 0; i < dl->request_count; i++) {
+        if (dl->requests[i].stream_id == (int64_t)stream_id) {
+            return &dl->requests[i];
+        }
+    }
+    return NULL;
+}
+
+// Report throughput and close the connection.
+static void finish_download(struct simple_client *client, const char *reason) {
+    struct download *dl = &client->download;
+    if (dl->phase == DOWNLOAD_DONE) {
+        return;
+    }
+    dl->phase = DOWNLOAD_DONE;
+
+    double elapsed = ev_time() - dl->start;
+    printf("Downloaded %" PRIu64 " bytes in %.3f s (%.2f Mbit/s) over %zu stream(s)\n",
+           dl->bytes, elapsed, elapsed > 0 ? dl->bytes * 8 / elapsed / 1e6 : 0.0,
+           dl->request_count);
+
+    if (client->conn != NULL) {
+        quic_conn_close(client->conn, true, 0, (const uint8_t *)reason, strlen(reason));
+    }
+}
+
+// Send the first request: the size probe of a segmented download, or one
+// request for the whole (rest of the) file.
+static void start_download(struct simple_client *client) {
+    struct download *dl = &client->download;
+    struct h3_request *req = &dl->requests[0];
+    memset(req, 0, sizeof(*req));
+    req->stream_id = -1;
+    req->path = g_http_path;
+    dl->request_count = 1;
+    dl->start = ev_time();
+
+    if (dl->segments > 1) {
+        req->ranged = true;
+        req->first = 0;
+        req->last = 0;
+        dl->phase = DOWNLOAD_PROBE;
+    } else {
+        if (dl->resume_from > 0) {
+            printf("Resuming %s at byte %" PRIu64 "\n", dl->output, dl->resume_from);
+            req->ranged = true;
+            req->first = dl->resume_from;
+            req->last = UINT64_MAX;
+            req->write_offset = dl->resume_from;
+        }
+        dl->phase = DOWNLOAD_SINGLE;
+    }
+    if (send_request(client, req) != 0) {
+        finish_download(client, "request failed");
+    }
+}
+
+// Split the file into ranges and request them all at once.
+static void start_segments(struct simple_client *client) {
+    struct download *dl = &client->download;
+    uint64_t size = dl->total_size;
+    uint64_t count = dl->segments;
+    if (count > size) {
+        count = size;
+    }
+    if (count == 0) {
+        finish_download(client, "empty");
+        return;
+    }
+    if (dl->fd >= 0 && ftruncate(dl->fd, size) != 0) {
+        fprintf(stderr, "failed to size %s: %s\n", dl->output, strerror(errno));
+    }
+
+    uint64_t segment = size / count;
+    dl->request_count = count;
+    dl->finished_count = 0;
+    dl->bytes = 0;
+    dl->start = ev_time();
+    dl->phase = DOWNLOAD_SEGMENTS;
+    printf("Downloading %" PRIu64 " bytes in %" PRIu64 " segments\n", size, count);
+    for (size_t i = 0; i < count; i++) {
+        struct h3_request *req = &dl->requests[i];
+        memset(req, 0, sizeof(*req));
+        req->stream_id = -1;
+        req->path = g_http_path;
+        req->ranged = true;
+        req->first = i * segment;
+        req->last = i + 1 == count ? size - 1 : req->first + segment - 1;
+        req->write_offset = req->first;
+        if (send_request(client, req) != 0) {
+            finish_download(client, "request failed");
             return;
         }
-        
-        // Create HTTP/3 headers using the global path variable
-        struct http3_header_t headers[] = {
-            {.name = (uint8_t *)":method", .name_len = 7, .value = (uint8_t *)"GET", .value_len = 3},
-            {.name = (uint8_t *)":scheme", .name_len = 7, .value = (uint8_t *)"https", .value_len = 5},
-            {.name = (uint8_t *)":authority", .name_len = 10, .value = (uint8_t *)"127.0.0.1", .value_len = 9},
-            {.name = (uint8_t *)":path", .name_len = 5, .value = (uint8_t *)g_http_path, .value_len = strlen(g_http_path)},
-            {.name = (uint8_t *)"user-agent", .name_len = 10, .value = (uint8_t *)"tquic", .value_len = 5}
-        };
-        
-        // Send headers on the created stream
-        int result = http3_send_headers(client->h3_conn, client->conn, (uint64_t)stream_id,
-                           headers, sizeof(headers) / sizeof(headers[0]),
-                           true);
-        
-        if (result >= 0) {
-            request_sent = true;
-            printf("HTTP/3 request sent successfully on stream %ld for path: %s\n", stream_id, g_http_path);
-        } else {
-            printf("Failed to send HTTP/3 request: %d\n", result);
+    }
+}
+
+// Print the summary of a batch and close the connection.
+static void finish_batch(struct simple_client *client, const char *reason) {
+    struct batch *b = &client->batch;
+    if (b->done) {
+        return;
+    }
+    b->done = true;
+
+    size_t ok = 0;
+    double ttfb_sum = 0, ttfb_min = 0, ttfb_max = 0;
+    for (size_t i = 0; i < b->count; i++) {
+        struct batch_request *r = &b->requests[i];
+        if (!r->req.finished || r->failed) {
+            continue;
+        }
+        double ttfb = r->headers_at - r->sent_at;
+        ttfb_min = ok == 0 || ttfb < ttfb_min ? ttfb : ttfb_min;
+        ttfb_max = ttfb > ttfb_max ? ttfb : ttfb_max;
+        ttfb_sum += ttfb;
+        ok++;
+    }
+    double elapsed = b->start > 0 ? ev_time() - b->start : 0;
+    printf("Batch: %zu/%zu requests ok, %" PRIu64 " bytes in %.3f s (%.2f Mbit/s), "
+           "concurrency %d\n",
+           ok, b->count, b->bytes, elapsed, elapsed > 0 ? b->bytes * 8 / elapsed / 1e6 : 0.0,
+           b->concurrency);
+    if (ok > 0) {
+        printf("Batch TTFB: min %.3f ms, avg %.3f ms, max %.3f ms\n", ttfb_min * 1e3,
+               ttfb_sum / ok * 1e3, ttfb_max * 1e3);
+    }
+
+    if (client->conn != NULL) {
+        quic_conn_close(client->conn, true, 0, (const uint8_t *)reason, strlen(reason));
+    }
+}
+
+// Map a request path to a file name in the output directory, e.g.
+// "/img/a.png" -> "img_a.png" and "/" -> "index".
+static int batch_output_name(const char *path, char *buf, size_t buf_len) {
+    while (*path == '/') {
+        path++;
+    }
+    if (*path == '\0') {
+        path = "index";
+    }
+    size_t len = strcspn(path, "?#");
+    if (len + 1 > buf_len) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = path[i] == '/' ? '_' : path[i];
+    }
+    buf[len] = '\0';
+    return 0;
+}
+
+// Open streams for pending requests until the concurrency limit is hit.
+// A request the peer has no stream credit for yet is retried on the next
+// call.
+static void batch_fill(struct simple_client *client) {
+    struct batch *b = &client->batch;
+    if (b->start == 0) {
+        b->start = ev_time();
+    }
+    while (!b->done && b->next < b->count && b->active < (size_t)b->concurrency) {
+        struct batch_request *r = &b->requests[b->next];
+        r->req.stream_id = -1;
+        r->req.path = r->path;
+        if (send_request(client, &r->req) != 0) {
+            break;
+        }
+        r->sent_at = ev_time();
+        b->next++;
+        b->active++;
+    }
+}
+
+// Report one finished request of a batch and start the next ones.
+static void batch_request_done(struct simple_client *client, struct batch_request *r,
+                               bool failed) {
+    struct batch *b = &client->batch;
+    r->req.finished = true;
+    r->failed = failed || r->req.status < 200 || r->req.status >= 300;
+    r->done_at = ev_time();
+    if (r->headers_at == 0) {
+        r->headers_at = r->done_at;
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+        r->fd = -1;
+    }
+    b->active--;
+    b->finished++;
+
+    double total = r->done_at - r->sent_at;
+    printf("[%zu] %s: status %d, %" PRIu64 " bytes, ttfb %.3f ms, total %.3f ms, "
+           "%.2f Mbit/s%s\n",
+           (size_t)(r - b->requests), r->path, r->req.status, r->req.received,
+           (r->headers_at - r->sent_at) * 1e3, total * 1e3,
+           total > 0 ? r->req.received * 8 / total / 1e6 : 0.0, failed ? " (reset)" : "");
+
+    while (b->first_open < b->next && b->requests[b->first_open].req.finished) {
+        b->first_open++;
+    }
+    if (b->finished == b->count) {
+        finish_batch(client, "ok");
+    } else {
+        batch_fill(client);
+    }
+}
+
+static void process_h3_events(struct simple_client *client) {
+    if (client->h3_conn == NULL || client->conn == NULL) {
+        return;
+    }
+
+    if (client->batch.requests != NULL) {
+        batch_fill(client);
+        return;
+    }
+
+    struct download *dl = &client->download;
+    if (dl->phase == DOWNLOAD_IDLE) {
+        start_download(client);
+    } else if (dl->phase == DOWNLOAD_PROBE && dl->requests[0].finished) {
+        start_segments(client);
+    }
+}
+
+static int batch_add(struct batch *b, size_t *cap, const char *path) {
+    if (b->count == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 16;
+        struct batch_request *requests = realloc(b->requests, new_cap * sizeof(*requests));
+        if (requests == NULL) {
+            return -1;
+        }
+        b->requests = requests;
+        *cap = new_cap;
+    }
+    struct batch_request *r = &b->requests[b->count];
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->path = strdup(path);
+    if (r->path == NULL) {
+        return -1;
+    }
+    b->count++;
+    return 0;
+}
+
+// Read one path per line from `file`. Full URLs are reduced to their path;
+// empty lines and lines starting with '#' are skipped.
+static int batch_read_url_file(struct batch *b, size_t *cap, const char *file) {
+    FILE *f = fopen(file, "r");
+    if (f == NULL) {
+        fprintf(stderr, "failed to open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    char line[4096];
+    int ret = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *path = line + strspn(line, " \t");
+        if (*path == '\0' || *path == '#') {
+            continue;
+        }
+        char *scheme = strstr(path, "://");
+        if (scheme != NULL) {
+            path = strchr(scheme + 3, '/');
+            if (path == NULL) {
+                path = "/";
+            }
+        }
+        if (batch_add(b, cap, path) != 0) {
+            ret = -1;
+            break;
+        }
+    }
+    fclose(f);
+    return ret;
+}
+
+// Set up batch mode from the environment. Returns 0 if batch mode is off.
+static int batch_init(struct batch *b, const char *path) {
+    memset(b, 0, sizeof(*b));
+    const char *url_file = getenv(ENV_URL_FILE);
+    const char *requests = getenv(ENV_REQUESTS);
+    if ((url_file == NULL || *url_file == '\0') && (requests == NULL || *requests == '\0')) {
+        return 0;
+    }
+
+    size_t cap = 0;
+    if (url_file != NULL && *url_file != '\0') {
+        if (batch_read_url_file(b, &cap, url_file) != 0) {
+            return -1;
+        }
+    } else {
+        long count = atol(requests);
+        const char *index = strstr(path, "%d");
+        for (long i = 0; i < count; i++) {
+            char buf[4096];
+            if (index != NULL) {
+                snprintf(buf, sizeof(buf), "%.*s%ld%s", (int)(index - path), path, i, index + 2);
+            } else {
+                snprintf(buf, sizeof(buf), "%s", path);
+            }
+            if (batch_add(b, &cap, buf) != 0) {
+                return -1;
+            }
         }
     }
+    if (b->count == 0) {
+        fprintf(stderr, "batch mode: no requests\n");
+        return -1;
+    }
+
+    const char *concurrency = getenv(ENV_CONCURRENCY);
+    b->concurrency = concurrency ? atoi(concurrency) : DEFAULT_CONCURRENCY;
+    if (b->concurrency < 1) {
+        b->concurrency = 1;
+    }
+    b->output_dir = getenv(ENV_OUTPUT_DIR);
+    if (b->output_dir != NULL && *b->output_dir == '\0') {
+        b->output_dir = NULL;
+    }
+    printf("Batch mode: %zu requests, up to %d at a time, bodies %s%s\n", b->count,
+           b->concurrency, b->output_dir ? "written to " : "discarded",
+           b->output_dir ? b->output_dir : "");
+    return 0;
+}
+
+static void batch_free(struct batch *b) {
+    for (size_t i = 0; i < b->count; i++) {
+        if (b->requests[i].fd >= 0) {
+            close(b->requests[i].fd);
+        }
+        free(b->requests[i].path);
+    }
+    free(b->requests);
+    b->requests = NULL;
 }
 
 static int create_socket(const char *host, const char *port,
@@ -335,6 +803,17 @@ int main(int argc, char *argv[]) {
     if (argc < 3) {
         fprintf(stderr, "Usage: %s <dest_addr> <dest_port> [path]\n", argv[0]);
         fprintf(stderr, "  path: optional HTTP path (default: /)\n");
+        fprintf(stderr, "Environment:\n");
+        fprintf(stderr, "  %s=<file>  write the body to <file>, resuming if it exists\n", ENV_OUTPUT);
+        fprintf(stderr, "  %s=<n>   download in <n> parallel range requests (max %d)\n",
+                ENV_SEGMENTS, MAX_SEGMENTS);
+        fprintf(stderr, "  %s=<file>  fetch the paths or URLs listed in <file>\n", ENV_URL_FILE);
+        fprintf(stderr, "  %s=<n>   fetch path <n> times, \"%%d\" in it replaced by the index\n",
+                ENV_REQUESTS);
+        fprintf(stderr, "  %s=<n>  streams open at a time in batch mode (default %d)\n",
+                ENV_CONCURRENCY, DEFAULT_CONCURRENCY);
+        fprintf(stderr, "  %s=<dir>  write batch bodies into <dir> (default: discard)\n",
+                ENV_OUTPUT_DIR);
         return -1;
     }
 
@@ -348,15 +827,54 @@ int main(int argc, char *argv[]) {
     client.conn = NULL;
     client.h3_conn = NULL;
     client.h3_config = NULL;
-    client.loop = NULL;
+    client.loop = ev_default_loop(0);
+    memset(&client.download, 0, sizeof(client.download));
+    client.download.fd = -1;
+    memset(&client.batch, 0, sizeof(client.batch));
     quic_config_t *config = NULL;
     int ret = 0;
 
+    // Set up optional packet impairment (see net_impairment.h).
+    if (net_impairment_init(&client.send_impairment, client.loop,
+                            NET_IMPAIRMENT_ENV_SEND, impaired_send, NULL,
+                            &client) != 0 ||
+        net_impairment_init(&client.recv_impairment, client.loop,
+                            NET_IMPAIRMENT_ENV_RECV, deliver_packet,
+                            flush_delivered, &client) != 0) {
+        return -1;
+    }
+
     // Create socket.
     const char *host = argv[1];
     const char *port = argv[2];
     g_http_path = (argc >= 4) ? argv[3] : "/";  // Set global path variable
     printf("Using HTTP path: %s\n", g_http_path);
+
+    // Set up batch mode, or else the download mode.
+    if (batch_init(&client.batch, g_http_path) != 0) {
+        batch_free(&client.batch);
+        return -1;
+    }
+    struct download *dl = &client.download;
+    const char *segments = getenv(ENV_SEGMENTS);
+    dl->segments = segments ? atoi(segments) : 1;
+    if (dl->segments < 1) {
+        dl->segments = 1;
+    } else if (dl->segments > MAX_SEGMENTS) {
+        dl->segments = MAX_SEGMENTS;
+    }
+    dl->output = getenv(ENV_OUTPUT);
+    if (dl->output != NULL && *dl->output != '\0') {
+        dl->fd = open(dl->output, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        struct stat st;
+        if (dl->fd < 0 || fstat(dl->fd, &st) != 0) {
+            fprintf(stderr, "failed to open %s: %s\n", dl->output, strerror(errno));
+            return -1;
+        }
+        if (dl->segments == 1) {
+            dl->resume_from = st.st_size;
+        }
+    }
     struct addrinfo *peer = NULL;
     if (create_socket(host, port, &peer, &client) != 0) {
         ret = -1;
@@ -393,7 +911,6 @@ int main(int argc, char *argv[]) {
     }
 
     // Init event loop.
-    client.loop = ev_default_loop(0);
     ev_init(&client.timer, timeout_callback);
     client.timer.data = &client;
 
@@ -417,6 +934,9 @@ int main(int argc, char *argv[]) {
     ev_io_start(client.loop, &watcher);
     watcher.data = &client;
     ev_loop(client.loop, 0);
+    if (client.batch.requests != NULL) {
+        finish_batch(&client, "done");
+    }
 
 EXIT:
     if (peer != NULL) {
@@ -440,9 +960,17 @@ EXIT:
     if (client.quic_endpoint != NULL) {
         quic_endpoint_free(client.quic_endpoint);
     }
+    net_impairment_print_stats(&client.send_impairment, "send");
+    net_impairment_print_stats(&client.recv_impairment, "recv");
+    net_impairment_free(&client.send_impairment);
+    net_impairment_free(&client.recv_impairment);
     if (client.loop != NULL) {
         ev_loop_destroy(client.loop);
     }
+    if (client.download.fd >= 0) {
+        close(client.download.fd);
+    }
+    batch_free(&client.batch);
     if (config != NULL) {
         quic_config_free(config);
     }
@@ -458,11 +986,114 @@ static int print_header_callback(const uint8_t *name, size_t name_len,
     return 0;
 }
 
+// Response headers the download logic acts on
+struct response_info {
+    int status;
+    bool has_range;
+    uint64_t range_first;
+    uint64_t range_last;
+    uint64_t range_total;
+};
+
+static int response_header_callback(const uint8_t *name, size_t name_len,
+                                    const uint8_t *value, size_t value_len, void *argp) {
+    struct response_info *resp = argp;
+    char buf[128];
+    if (value_len >= sizeof(buf)) {
+        return 0;
+    }
+    memcpy(buf, value, value_len);
+    buf[value_len] = '\0';
+
+    if (name_len == 7 && memcmp(name, ":status", 7) == 0) {
+        resp->status = atoi(buf);
+    } else if (name_len == 13 && strncasecmp((const char *)name, "content-range", 13) == 0) {
+        resp->has_range = http_content_range_parse(buf, &resp->range_first, &resp->range_last,
+                                                   &resp->range_total) == 0;
+    }
+    return 0;
+}
+
 static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
                                     const struct http3_headers_t *headers, bool fin) {
-    (void)ctx; // Suppress unused parameter warning
-    printf("Received HTTP/3 headers on stream %ld:\n", stream_id);
-    http3_for_each_header(headers, print_header_callback, NULL);
+    struct simple_client *client = ctx;
+    struct batch *b = &client->batch;
+    if (b->requests == NULL) {
+        printf("Received HTTP/3 headers on stream %ld:\n", stream_id);
+        http3_for_each_header(headers, print_header_callback, NULL);
+    }
+
+    struct download *dl = &client->download;
+    struct h3_request *req = find_request(client, stream_id);
+    if (req == NULL) {
+        return;
+    }
+    struct response_info resp = {0};
+    http3_for_each_header(headers, response_header_callback, &resp);
+    req->status = resp.status;
+
+    if (b->requests != NULL) {
+        struct batch_request *r = (struct batch_request *)req;
+        r->headers_at = ev_time();
+        char name[256], file[PATH_MAX];
+        if (b->output_dir != NULL && batch_output_name(r->path, name, sizeof(name)) == 0) {
+            snprintf(file, sizeof(file), "%s/%s", b->output_dir, name);
+            r->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (r->fd < 0) {
+                fprintf(stderr, "failed to open %s: %s\n", file, strerror(errno));
+            }
+        }
+        return;
+    }
+
+    switch (dl->phase) {
+        case DOWNLOAD_PROBE:
+            if (resp.status == 206 && resp.has_range && resp.range_total != UINT64_MAX) {
+                dl->total_size = resp.range_total;
+            } else {
+                // No range support: take the full body from this stream
+                printf("Server ignored the range request, downloading on one stream\n");
+                dl->phase = DOWNLOAD_SINGLE;
+                req->write_offset = 0;
+            }
+            break;
+        case DOWNLOAD_SEGMENTS:
+            if (resp.status != 206 || !resp.has_range || resp.range_first != req->first) {
+                printf("Unexpected response for segment %" PRIu64 "-%" PRIu64 ": %d\n",
+                       req->first, req->last, resp.status);
+                finish_download(client, "bad segment");
+            }
+            break;
+        case DOWNLOAD_SINGLE:
+            if (req->ranged && resp.status == 416) {
+                printf("%s is already complete\n", dl->output);
+            } else if (req->ranged && resp.status != 206) {
+                // Full body instead of the rest: start over
+                req->write_offset = 0;
+                if (dl->fd >= 0 && ftruncate(dl->fd, 0) != 0) {
+                    fprintf(stderr, "failed to truncate %s: %s\n", dl->output, strerror(errno));
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static int write_all_at(int fd, const uint8_t *buf, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
 }
 
 static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
@@ -473,15 +1104,49 @@ static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
         return;
     }
     
-    static uint8_t buf[READ_BUF_SIZE];
+    static uint8_t buf[BODY_BUF_SIZE];
+    struct download *dl = &client->download;
+    struct h3_request *req = find_request(client, stream_id);
+    if (req != NULL && client->batch.requests != NULL) {
+        struct batch_request *r = (struct batch_request *)req;
+        ssize_t read;
+        while ((read = http3_recv_body(client->h3_conn, client->conn, stream_id, buf,
+                                       sizeof(buf))) > 0) {
+            if (r->fd >= 0 && write_all_at(r->fd, buf, read, req->write_offset) != 0) {
+                fprintf(stderr, "failed to write %s: %s\n", r->path, strerror(errno));
+                close(r->fd);
+                r->fd = -1;
+            }
+            req->write_offset += read;
+            req->received += read;
+            client->batch.bytes += read;
+        }
+        return;
+    }
+    // The probe's single byte is not part of the download
+    bool discard = req == NULL || (dl->phase == DOWNLOAD_PROBE && req == &dl->requests[0]);
     
     // Loop to read all available data on this stream
     while (true) {
         ssize_t read = http3_recv_body(client->h3_conn, client->conn, stream_id, buf, sizeof(buf));
         
         if (read > 0) {
-            // Successfully read data, print it
-            printf("%.*s", (int)read, buf);
+            if (discard) {
+                continue;
+            }
+            if (dl->fd >= 0) {
+                if (write_all_at(dl->fd, buf, read, req->write_offset) != 0) {
+                    fprintf(stderr, "failed to write %s: %s\n", dl->output, strerror(errno));
+                    finish_download(client, "write failed");
+                    return;
+                }
+            } else if (dl->phase != DOWNLOAD_SEGMENTS) {
+                // Successfully read data, print it
+                printf("%.*s", (int)read, buf);
+            }
+            req->write_offset += read;
+            req->received += read;
+            dl->bytes += read;
         } else if (read == 0) {
             // No more data available right now, break the loop
             break;
@@ -496,16 +1161,36 @@ static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
 static void http3_on_stream_finished(void *ctx, uint64_t stream_id) {
     struct simple_client *client = ctx;
     printf("HTTP/3 stream %ld finished\n", stream_id);
-    
-    // Check if connection is still valid before closing
-    if (client->conn != NULL) {
-        const char *reason = "ok";
-        quic_conn_close(client->conn, true, 0, (const uint8_t *)reason, strlen(reason));
+
+    struct download *dl = &client->download;
+    struct h3_request *req = find_request(client, stream_id);
+    if (req == NULL || req->finished) {
+        return;
+    }
+    if (client->batch.requests != NULL) {
+        batch_request_done(client, (struct batch_request *)req, false);
+        return;
+    }
+    req->finished = true;
+    dl->finished_count++;
+
+    // The probe is followed by the segment requests from process_h3_events
+    if (dl->phase == DOWNLOAD_PROBE) {
+        return;
+    }
+    if (dl->finished_count == dl->request_count) {
+        finish_download(client, "ok");
     }
 }
 
 static void http3_on_stream_reset(void *ctx, uint64_t stream_id, uint64_t error_code) {
+    struct simple_client *client = ctx;
     printf("HTTP/3 stream %ld reset with error code %ld\n", stream_id, error_code);
+
+    struct h3_request *req = find_request(client, stream_id);
+    if (req != NULL && !req->finished && client->batch.requests != NULL) {
+        batch_request_done(client, (struct batch_request *)req, true);
+    }
 }
 
 static void http3_on_stream_priority_update(void *ctx, uint64_t stream_id) {
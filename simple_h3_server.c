@@ -16,6 +16,7 @@
 #include <ev.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <netdb.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -23,20 +24,146 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "async_read.h"
+#include "compress_cache.h"
+#include "file_cache.h"
+#include "h3_priority.h"
+#include "http_conditional.h"
+#include "http_range.h"
+#include "net_impairment.h"
 #include "openssl/pem.h"
 #include "openssl/ssl.h"
 #include "openssl/x509.h"
+#include "server_log.h"
+#include "stat_cache.h"
 #include "tquic.h"
 
 #define READ_BUF_SIZE 4096
 #define MAX_DATAGRAM_SIZE 1200
 
+// File bodies are streamed in chunks of at most this size.
+#define FILE_CHUNK_SIZE (64 * 1024)
+// Chunks each file response reads ahead of the send cursor, by default and
+// at most (TQUIC_FILE_READAHEAD).
+#define FILE_READAHEAD_ENV "TQUIC_FILE_READAHEAD"
+#define FILE_READAHEAD_DEFAULT 4
+#define FILE_READAHEAD_MAX 16
+// Max idle chunk buffers kept for reuse.
+#define CHUNK_POOL_MAX 16
+// Interval for printing file cache statistics, in seconds.
+#define CACHE_STATS_INTERVAL 10.0
+// Bytes each active response may send per scheduling round.
+#define SEND_QUANTUM (32 * 1024)
+// Buckets of the per-connection send-state table.
+#define SEND_TABLE_BUCKETS 64
+// Synthetic endpoints for throughput tests: GET /bytes/<n> streams n bytes
+// (k/m/g suffixes allowed) from a pattern buffer of SYNTHETIC_BUF_SIZE,
+// POST /sink discards the request body and reports its size and duration.
+#define BYTES_PATH_PREFIX "/bytes/"
+#define SINK_PATH "/sink"
+#define SYNTHETIC_BUF_SIZE (1024 * 1024)
+
 // Global variable to store the document root directory
 static const char *g_document_root = ".";
 
+// Body of /bytes/<n> responses, repeated as often as needed
+static uint8_t g_synthetic_buf[SYNTHETIC_BUF_SIZE];
+
+// Reusable chunk buffers for streaming file bodies
+struct chunk_pool {
+    uint8_t *free_list[CHUNK_POOL_MAX];
+    size_t free_count;
+};
+
+static struct chunk_pool g_chunk_pool;
+
+// Memory-mapped hot files, shared by all connections
+static struct file_cache g_file_cache;
+
+// gzip copies of text files made on first request (optional)
+static struct compress_cache g_compress_cache;
+
+// Recent stat() results, so revalidations don't touch the file system
+static struct stat_cache g_stat_cache;
+
+// Background reads of files that aren't in the file cache
+static struct async_read g_async_read;
+static size_t g_file_readahead = FILE_READAHEAD_DEFAULT;
+
+// Max extra response headers beyond :status, content-type and content-length
+#define MAX_EXTRA_HEADERS 8
+
+// Where the rest of a response body comes from
+enum send_source {
+    SEND_SOURCE_BUFFER,  // Heap copy of an in-memory body
+    SEND_SOURCE_MAPPED,  // File mapping from the file cache
+    SEND_SOURCE_FILE,    // File descriptor read with pread
+    SEND_SOURCE_SYNTHETIC,  // g_synthetic_buf, repeated (/bytes/<n>)
+};
+
+// One run of a multipart body: `length` bytes at `offset` of `data`, or of
+// the stream's body source when `data` is NULL
+struct send_piece {
+    const uint8_t *data;
+    uint64_t offset;
+    uint64_t length;
+};
+
+// A chunk of a SEND_SOURCE_FILE body, read in the background
+struct file_chunk {
+    struct async_read_req req;  // First, so the completion finds the chunk
+    bool ready;
+    size_t sent;                // Bytes of req.buf already sent
+};
+
+// Send state of one response stream. The cursor only moves forward;
+// unsent data is never shifted in memory.
+struct stream_send {
+    uint64_t stream_id;
+    struct connection_context *ctx;
+    enum send_source source;
+    uint8_t *data;                   // SEND_SOURCE_BUFFER
+    struct file_cache_entry *entry;  // SEND_SOURCE_MAPPED
+    int fd;                          // SEND_SOURCE_FILE
+    // SEND_SOURCE_FILE: ring of g_file_readahead chunks, read ahead of the
+    // cursor regardless of flow control and sent in order
+    struct file_chunk *chunks;
+    size_t chunk_head;               // Oldest chunk, sent next
+    size_t chunk_count;
+    uint64_t read_offset;            // Next file offset to read in this run
+    uint64_t read_remaining;         // Bytes of this run not yet requested
+    unsigned reads_in_flight;
+    bool read_error;
+    bool closing;                    // Removed; freed when reads finish
+    uint64_t started_ns;             // SEND_SOURCE_SYNTHETIC: for the report
+    uint64_t offset;                 // Next offset to send in the current run
+    uint64_t remaining;              // Bytes left in the current run
+    // Multipart bodies (multiple ranges) are sent as a list of runs; single
+    // bodies have none and the cursor covers the whole body
+    const uint8_t *piece_data;       // Current run comes from here if not NULL
+    struct send_piece *pieces;
+    size_t piece_count;
+    size_t piece_next;               // Index of the run after the current one
+    char *piece_text;                // Part headers referenced by `pieces`
+    struct stream_send *hash_next;   // Chain in the table bucket
+    struct stream_send *prev;        // Round-robin order
+    struct stream_send *next;
+};
+
+// Per-connection table of responses that still have body to send, plus the
+// round-robin queue used to share the connection fairly between them.
+struct send_table {
+    struct stream_send *buckets[SEND_TABLE_BUCKETS];
+    struct stream_send *head;  // Served next
+    struct stream_send *tail;
+    size_t count;
+};
+
 // A simple server that supports HTTP/3 over QUIC
 struct simple_server {
     struct quic_endpoint_t *quic_endpoint;
@@ -47,16 +174,28 @@ struct simple_server {
     struct quic_tls_config_t *tls_config;
     struct ev_loop *loop;
     struct http3_config_t *h3_config;
+    struct net_impairment send_impairment;
+    struct net_impairment recv_impairment;
+    ev_timer stats_timer;
+    uint64_t stats_last_lookups;
+};
+
+// A /sink request whose body is still arriving
+struct sink_stream {
+    uint64_t stream_id;
+    uint64_t bytes;
+    uint64_t started_ns;
+    struct sink_stream *next;
 };
 
 // Connection context to track H3 state per connection
 struct connection_context {
     struct http3_conn_t *h3_conn;
     struct quic_conn_t *quic_conn;  // Store quic connection for HTTP3 callbacks
-    // For handling large file transfers
-    char *pending_data;          // Remaining data to send
-    size_t pending_data_len;     // Length of remaining data
-    uint64_t pending_stream_id;  // Stream ID for pending data
+    // Response bodies that didn't fit into the stream yet
+    struct send_table sends;
+    // Request bodies being discarded by /sink
+    struct sink_stream *sinks;
 };
 
 // Forward declarations for HTTP/3 event handlers
@@ -68,6 +207,13 @@ static void http3_on_stream_reset(void *ctx, uint64_t stream_id, uint64_t error_
 static void http3_on_stream_priority_update(void *ctx, uint64_t stream_id);
 static void http3_on_conn_goaway(void *ctx, uint64_t stream_id);
 
+// Response send-state helpers
+static struct stream_send *send_table_find(struct send_table *table,
+                                           uint64_t stream_id);
+static void send_table_remove(struct send_table *table, struct stream_send *ss);
+static void schedule_sends(struct connection_context *ctx);
+static struct sink_stream *sink_take(struct connection_context *ctx, uint64_t stream_id);
+
 // HTTP/3 event handlers structure
 static const struct http3_methods_t http3_methods = {
     .on_stream_headers = http3_on_stream_headers,
@@ -79,16 +225,15 @@ static const struct http3_methods_t http3_methods = {
 };
 
 void server_on_conn_created(void *tctx, struct quic_conn_t *conn) {
-    fprintf(stderr, "new connection created\n");
+    server_log("new connection created\n");
     
     // Create connection context
     struct connection_context *ctx = malloc(sizeof(struct connection_context));
     if (ctx) {
         ctx->h3_conn = NULL;
         ctx->quic_conn = conn;
-        ctx->pending_data = NULL;
-        ctx->pending_data_len = 0;
-        ctx->pending_stream_id = 0;
+        memset(&ctx->sends, 0, sizeof(ctx->sends));
+        ctx->sinks = NULL;
         quic_conn_set_context(conn, ctx);
     }
 }
@@ -98,7 +243,7 @@ void server_on_conn_established(void *tctx, struct quic_conn_t *conn) {
     struct connection_context *ctx = quic_conn_context(conn);
     if (!ctx) return;
     
-    fprintf(stderr, "connection established\n");
+    server_log("connection established\n");
     
     // Get the negotiated protocol
     const uint8_t *proto;
@@ -106,10 +251,10 @@ void server_on_conn_established(void *tctx, struct quic_conn_t *conn) {
     quic_conn_application_proto(conn, &proto, &proto_len);
     
     if (proto_len > 0) {
-        fprintf(stderr, "Negotiated protocol: %.*s (length: %zu)\n", (int)proto_len, proto, proto_len);
+        server_log("Negotiated protocol: %.*s (length: %zu)\n", (int)proto_len, proto, proto_len);
         
         if (proto_len == 2 && memcmp(proto, "h3", 2) == 0) {
-            fprintf(stderr, "Using HTTP/3 protocol\n");
+            server_log("Using HTTP/3 protocol\n");
             
             // Create HTTP/3 connection
             ctx->h3_conn = http3_conn_new(conn, server->h3_config);
@@ -134,7 +279,7 @@ void server_on_conn_established(void *tctx, struct quic_conn_t *conn) {
 }
 
 void server_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
-    fprintf(stderr, "connection closed\n");
+    server_log("connection closed\n");
     
     // Cleanup connection context
     struct connection_context *ctx = quic_conn_context(conn);
@@ -142,8 +287,13 @@ void server_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
         if (ctx->h3_conn) {
             http3_conn_free(ctx->h3_conn);
         }
-        if (ctx->pending_data) {
-            free(ctx->pending_data);
+        while (ctx->sends.head) {
+            send_table_remove(&ctx->sends, ctx->sends.head);
+        }
+        while (ctx->sinks) {
+            struct sink_stream *sink = ctx->sinks;
+            ctx->sinks = sink->next;
+            free(sink);
         }
         free(ctx);
         quic_conn_set_context(conn, NULL);
@@ -152,7 +302,7 @@ void server_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
 
 void server_on_stream_created(void *tctx, struct quic_conn_t *conn,
                               uint64_t stream_id) {
-    fprintf(stderr, "new stream created %ld\n", stream_id);
+    server_log("new stream created %ld\n", stream_id);
 }
 
 void server_on_stream_readable(void *tctx, struct quic_conn_t *conn,
@@ -176,41 +326,9 @@ void server_on_stream_writable(void *tctx, struct quic_conn_t *conn,
         return;
     }
     
-    // Check if we have pending data to send
-    if (ctx->pending_data && ctx->pending_data_len > 0 && ctx->pending_stream_id == stream_id) {
-        int written = http3_send_body(ctx->h3_conn, conn, stream_id, 
-                                    (uint8_t *)ctx->pending_data, ctx->pending_data_len, true);
-        if (written > 0) {
-            if ((size_t)written < ctx->pending_data_len) {
-                // Still have data to send, update pending data
-                memmove(ctx->pending_data, ctx->pending_data + written, ctx->pending_data_len - written);
-                ctx->pending_data_len -= written;
-                fprintf(stderr, "Continued sending HTTP/3 body: %d bytes, %zu bytes remaining\n", 
-                        written, ctx->pending_data_len);
-                // Keep wanting write events
-                quic_stream_wantwrite(conn, stream_id, true);
-            } else {
-                // All data sent successfully
-                fprintf(stderr, "Finished sending HTTP/3 body: %d bytes\n", written);
-                free(ctx->pending_data);
-                ctx->pending_data = NULL;
-                ctx->pending_data_len = 0;
-                ctx->pending_stream_id = 0;
-                quic_stream_wantwrite(conn, stream_id, false);
-            }
-        } else if (written < 0) {
-            fprintf(stderr, "Failed to continue sending HTTP/3 body: %d\n", written);
-            // Clean up pending data on error
-            free(ctx->pending_data);
-            ctx->pending_data = NULL;
-            ctx->pending_data_len = 0;
-            ctx->pending_stream_id = 0;
-            quic_stream_wantwrite(conn, stream_id, false);
-        } else {
-            // written == 0, try again later
-            fprintf(stderr, "HTTP/3 body send would block, will retry\n");
-            quic_stream_wantwrite(conn, stream_id, true);
-        }
+    // Continue pending response bodies, sharing the credit between streams
+    if (send_table_find(&ctx->sends, stream_id)) {
+        schedule_sends(ctx);
     } else {
         quic_stream_wantwrite(conn, stream_id, false);
     }
@@ -218,12 +336,26 @@ void server_on_stream_writable(void *tctx, struct quic_conn_t *conn,
 
 void server_on_stream_closed(void *tctx, struct quic_conn_t *conn,
                              uint64_t stream_id) {
-    fprintf(stderr, "stream closed %ld\n", stream_id);
+    server_log("stream closed %ld\n", stream_id);
+
+    // Drop a response body the peer will never read
+    struct connection_context *ctx = quic_conn_context(conn);
+    if (ctx) {
+        struct stream_send *ss = send_table_find(&ctx->sends, stream_id);
+        if (ss) {
+            send_table_remove(&ctx->sends, ss);
+        }
+        free(sink_take(ctx, stream_id));
+    }
 }
 
 int server_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts,
                            unsigned int count) {
     struct simple_server *server = psctx;
+    if (server->send_impairment.enabled) {
+        return net_impairment_send_packets(&server->send_impairment, pkts,
+                                           count);
+    }
 
     unsigned int sent_count = 0;
     int i, j = 0;
@@ -243,7 +375,7 @@ int server_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts,
                 }
                 return -1;
             }
-            fprintf(stderr, "send packet, length %ld\n", sent);
+            server_log("send packet, length %ld\n", sent);
             sent_count++;
         }
     }
@@ -282,6 +414,46 @@ const struct quic_tls_config_select_methods_t tls_config_select_method = {
     .select = server_select_tls_config,
 };
 
+static void process_connections(struct simple_server *server) {
+    quic_endpoint_process_connections(server->quic_endpoint);
+    double timeout = quic_endpoint_timeout(server->quic_endpoint) / 1e3f;
+    if (timeout < 0.0001) {
+        timeout = 0.0001;
+    }
+    server->timer.repeat = timeout;
+    ev_timer_again(server->loop, &server->timer);
+}
+
+// Send a packet released by the send impairment stage.
+static void impaired_send(void *ctx, const uint8_t *data, size_t len,
+                          const struct sockaddr *addr, socklen_t addr_len) {
+    struct simple_server *server = ctx;
+    ssize_t sent = sendto(server->sock, data, len, 0, addr, addr_len);
+    if (sent != len) {
+        fprintf(stderr, "impaired send failed: %s\n", strerror(errno));
+    }
+}
+
+// Feed a received packet (possibly delayed) into the quic endpoint.
+static void deliver_packet(void *ctx, const uint8_t *data, size_t len,
+                           const struct sockaddr *addr, socklen_t addr_len) {
+    struct simple_server *server = ctx;
+    quic_packet_info_t quic_packet_info = {
+        .src = addr,
+        .src_len = addr_len,
+        .dst = (struct sockaddr *)&server->local_addr,
+        .dst_len = server->local_addr_len,
+    };
+
+    int r = quic_endpoint_recv(server->quic_endpoint, (uint8_t *)data, len,
+                               &quic_packet_info);
+    if (r != 0) {
+        fprintf(stderr, "recv failed %d\n", r);
+    }
+}
+
+static void flush_delivered(void *ctx) { process_connections(ctx); }
+
 static void read_callback(EV_P_ ev_io *w, int revents) {
     struct simple_server *server = w->data;
     static uint8_t buf[READ_BUF_SIZE];
@@ -295,7 +467,7 @@ static void read_callback(EV_P_ ev_io *w, int revents) {
                                 (struct sockaddr *)&peer_addr, &peer_addr_len);
         if (read < 0) {
             if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
-                fprintf(stderr, "recv would block\n");
+                server_log("recv would block\n");
                 break;
             }
 
@@ -303,109 +475,487 @@ static void read_callback(EV_P_ ev_io *w, int revents) {
             return;
         }
 
-        quic_packet_info_t quic_packet_info = {
-            .src = (struct sockaddr *)&peer_addr,
-            .src_len = peer_addr_len,
-            .dst = (struct sockaddr *)&server->local_addr,
-            .dst_len = server->local_addr_len,
-        };
-
-        int r = quic_endpoint_recv(server->quic_endpoint, buf, read,
-                                   &quic_packet_info);
-        if (r != 0) {
-            fprintf(stderr, "recv failed %d\n", r);
-            // Don't continue on this error, but don't return either
-            continue;
-        }
+        net_impairment_submit(&server->recv_impairment, buf, read,
+                              (struct sockaddr *)&peer_addr, peer_addr_len);
     }
 
-    quic_endpoint_process_connections(server->quic_endpoint);
-    double timeout = quic_endpoint_timeout(server->quic_endpoint) / 1e3f;
-    if (timeout < 0.0001) {
-        timeout = 0.0001;
-    }
-    server->timer.repeat = timeout;
-    ev_timer_again(loop, &server->timer);
+    process_connections(server);
 }
 
 static void timeout_callback(EV_P_ ev_timer *w, int revents) {
     struct simple_server *server = w->data;
     quic_endpoint_on_timeout(server->quic_endpoint);
-    quic_endpoint_process_connections(server->quic_endpoint);
+    process_connections(server);
+}
 
-    double timeout = quic_endpoint_timeout(server->quic_endpoint) / 1e3f;
-    if (timeout < 0.0001) {
-        timeout = 0.0001;
+// Periodically report stat and file cache hit rates and evictions.
+static void stats_callback(EV_P_ ev_timer *w, int revents) {
+    struct simple_server *server = w->data;
+    if (g_stat_cache.stats.lookups != server->stats_last_lookups) {
+        server->stats_last_lookups = g_stat_cache.stats.lookups;
+        stat_cache_print_stats(&g_stat_cache);
+        file_cache_print_stats(&g_file_cache);
+        compress_cache_print_stats(&g_compress_cache);
+        async_read_print_stats(&g_async_read);
     }
-    server->timer.repeat = timeout;
-    ev_timer_again(loop, &server->timer);
+}
+
+static void flush_file_reads(void *ctx) { process_connections(ctx); }
+
+// Read TQUIC_FILE_READAHEAD, the chunks read ahead per file response.
+static void file_readahead_init(void) {
+    const char *value = getenv(FILE_READAHEAD_ENV);
+    if (value == NULL || *value == '\0') {
+        return;
+    }
+    char *end = NULL;
+    unsigned long n = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || n == 0 || n > FILE_READAHEAD_MAX) {
+        fprintf(stderr, "%s: invalid value \"%s\", using %d\n", FILE_READAHEAD_ENV,
+                value, FILE_READAHEAD_DEFAULT);
+        return;
+    }
+    g_file_readahead = n;
 }
 
 static void debug_log(const uint8_t *data, size_t data_len, void *argp) {
     fwrite(data, sizeof(uint8_t), data_len, stderr);
 }
 
-// Function to read file content and determine content type
-static int read_file_content(const char *path, char **content, size_t *content_length, char **content_type) {
-    FILE *file = fopen(path, "rb");
-    if (!file) {
-        return -1;  // File not found
-    }
-    
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    if (file_size < 0) {
-        fclose(file);
-        return -1;
-    }
-    
-    // Allocate buffer and read file
-    *content = malloc(file_size + 1);
-    if (!*content) {
-        fclose(file);
-        return -1;
-    }
-    
-    size_t read_size = fread(*content, 1, file_size, file);
-    fclose(file);
-    
-    if (read_size != (size_t)file_size) {
-        free(*content);
-        *content = NULL;
-        return -1;
-    }
-    
-    (*content)[file_size] = '\0';
-    *content_length = file_size;
-    
-    // Determine content type based on file extension
+// Determine content type based on file extension
+static const char *content_type_for_path(const char *path) {
     const char *ext = strrchr(path, '.');
     if (ext) {
         if (strcmp(ext, ".html") == 0 || strcmp(ext, ".htm") == 0) {
-            *content_type = "text/html";
+            return "text/html";
         } else if (strcmp(ext, ".css") == 0) {
-            *content_type = "text/css";
+            return "text/css";
         } else if (strcmp(ext, ".js") == 0) {
-            *content_type = "application/javascript";
+            return "application/javascript";
         } else if (strcmp(ext, ".json") == 0) {
-            *content_type = "application/json";
+            return "application/json";
         } else if (strcmp(ext, ".png") == 0) {
-            *content_type = "image/png";
+            return "image/png";
         } else if (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0) {
-            *content_type = "image/jpeg";
+            return "image/jpeg";
         } else if (strcmp(ext, ".gif") == 0) {
-            *content_type = "image/gif";
-        } else {
-            *content_type = "text/plain";
+            return "image/gif";
+        } else if (strcmp(ext, ".svg") == 0) {
+            return "image/svg+xml";
         }
+    }
+    return "text/plain";
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Log the size, duration and rate of a synthetic transfer, and also format
+// the line into `buf` if one is given.
+static void print_transfer_report(const char *what, uint64_t stream_id, uint64_t bytes,
+                                  uint64_t elapsed_ns, char *buf, size_t buf_len) {
+    double secs = elapsed_ns / 1e9;
+    char line[160];
+    snprintf(line, sizeof(line), "%s: %" PRIu64 " bytes in %.3f ms (%.2f Mbit/s)\n", what,
+             bytes, elapsed_ns / 1e6, secs > 0 ? bytes * 8 / secs / 1e6 : 0.0);
+    server_log("Stream %" PRIu64 " %s", stream_id, line);
+    if (buf) {
+        snprintf(buf, buf_len, "%s", line);
+    }
+}
+
+static uint8_t *chunk_pool_get(void) {
+    if (g_chunk_pool.free_count > 0) {
+        return g_chunk_pool.free_list[--g_chunk_pool.free_count];
+    }
+    return malloc(FILE_CHUNK_SIZE);
+}
+
+static void chunk_pool_put(uint8_t *chunk) {
+    if (g_chunk_pool.free_count < CHUNK_POOL_MAX) {
+        g_chunk_pool.free_list[g_chunk_pool.free_count++] = chunk;
+    } else {
+        free(chunk);
+    }
+}
+
+static void chunk_pool_free(void) {
+    while (g_chunk_pool.free_count > 0) {
+        free(g_chunk_pool.free_list[--g_chunk_pool.free_count]);
+    }
+}
+
+static struct stream_send *send_table_find(struct send_table *table,
+                                           uint64_t stream_id) {
+    struct stream_send *ss = table->buckets[(stream_id >> 2) % SEND_TABLE_BUCKETS];
+    while (ss && ss->stream_id != stream_id) {
+        ss = ss->hash_next;
+    }
+    return ss;
+}
+
+static void send_table_add(struct send_table *table, struct stream_send *ss) {
+    struct stream_send **bucket = &table->buckets[(ss->stream_id >> 2) % SEND_TABLE_BUCKETS];
+    ss->hash_next = *bucket;
+    *bucket = ss;
+
+    ss->next = NULL;
+    ss->prev = table->tail;
+    if (table->tail) {
+        table->tail->next = ss;
+    } else {
+        table->head = ss;
+    }
+    table->tail = ss;
+    table->count++;
+}
+
+static void send_queue_unlink(struct send_table *table, struct stream_send *ss) {
+    if (ss->prev) {
+        ss->prev->next = ss->next;
     } else {
-        *content_type = "text/plain";
+        table->head = ss->next;
+    }
+    if (ss->next) {
+        ss->next->prev = ss->prev;
+    } else {
+        table->tail = ss->prev;
+    }
+    ss->prev = ss->next = NULL;
+}
+
+// Release the body source and everything else a stream's send state owns.
+static void stream_send_free(struct stream_send *ss) {
+    switch (ss->source) {
+        case SEND_SOURCE_BUFFER:
+            free(ss->data);
+            break;
+        case SEND_SOURCE_MAPPED:
+            file_cache_release(ss->entry);
+            break;
+        case SEND_SOURCE_FILE:
+            close(ss->fd);
+            break;
+        case SEND_SOURCE_SYNTHETIC:
+            break;
+    }
+    for (size_t i = 0; i < ss->chunk_count; i++) {
+        chunk_pool_put(ss->chunks[(ss->chunk_head + i) % g_file_readahead].req.buf);
+    }
+    free(ss->chunks);
+    free(ss->pieces);
+    free(ss->piece_text);
+    free(ss);
+}
+
+// Remove a stream from the table and release its send state. Reads still
+// in flight own their buffers, so then the state is freed by the last
+// completion instead.
+static void send_table_remove(struct send_table *table, struct stream_send *ss) {
+    struct stream_send **link = &table->buckets[(ss->stream_id >> 2) % SEND_TABLE_BUCKETS];
+    while (*link && *link != ss) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = ss->hash_next;
+    }
+    send_queue_unlink(table, ss);
+    table->count--;
+
+    if (ss->reads_in_flight > 0) {
+        ss->closing = true;
+        return;
+    }
+    stream_send_free(ss);
+}
+
+// Whether the current run is the last of the body
+static bool send_in_last_piece(const struct stream_send *ss) {
+    return ss->piece_next == ss->piece_count;
+}
+
+// Whether the whole body has been sent
+static bool send_done(const struct stream_send *ss) {
+    return ss->remaining == 0 && send_in_last_piece(ss);
+}
+
+// Move the cursor to the next run of a multipart body.
+static void send_next_piece(struct stream_send *ss) {
+    const struct send_piece *piece = &ss->pieces[ss->piece_next++];
+    ss->piece_data = piece->data;
+    ss->offset = piece->offset;
+    ss->remaining = piece->length;
+    if (!piece->data) {
+        ss->read_offset = piece->offset;
+        ss->read_remaining = piece->length;
+    }
+}
+
+static void file_read_done(struct async_read_req *req);
+
+// Issue background reads for the current file run until g_file_readahead
+// chunks are buffered or in flight. This runs ahead of the stream's flow
+// control credit, so data is in memory by the time the peer grants more.
+static void file_readahead_fill(struct stream_send *ss) {
+    while (ss->chunk_count < g_file_readahead && ss->read_remaining > 0 && !ss->read_error) {
+        struct file_chunk *chunk =
+            &ss->chunks[(ss->chunk_head + ss->chunk_count) % g_file_readahead];
+        uint8_t *buf = chunk_pool_get();
+        if (!buf) {
+            fprintf(stderr, "Failed to allocate chunk buffer\n");
+            ss->read_error = true;
+            break;
+        }
+
+        size_t len = FILE_CHUNK_SIZE;
+        if (ss->read_remaining < len) {
+            len = ss->read_remaining;
+        }
+        memset(chunk, 0, sizeof(*chunk));
+        chunk->req.fd = ss->fd;
+        chunk->req.buf = buf;
+        chunk->req.len = len;
+        chunk->req.offset = ss->read_offset;
+        chunk->req.done = file_read_done;
+        chunk->req.ctx = ss;
+        ss->read_offset += len;
+        ss->read_remaining -= len;
+        ss->chunk_count++;
+        ss->reads_in_flight++;
+        async_read_submit(&g_async_read, &chunk->req);
+    }
+}
+
+// Runs on the loop thread when a background read finishes.
+static void file_read_done(struct async_read_req *req) {
+    struct file_chunk *chunk = (struct file_chunk *)req;
+    struct stream_send *ss = req->ctx;
+    ss->reads_in_flight--;
+    chunk->ready = true;
+    if (req->result != (ssize_t)req->len && !ss->read_error) {
+        fprintf(stderr, "Failed to read file for stream %ld: %s\n", ss->stream_id,
+                req->result < 0 ? strerror(-req->result) : "unexpected EOF");
+        ss->read_error = true;
+    }
+
+    if (ss->closing) {
+        if (ss->reads_in_flight == 0) {
+            stream_send_free(ss);
+        }
+        return;
+    }
+    schedule_sends(ss->ctx);
+}
+
+// Whether a stream can't send anything until a file read completes.
+static bool send_waiting_for_read(const struct stream_send *ss) {
+    return !ss->piece_data && ss->source == SEND_SOURCE_FILE && ss->remaining > 0 &&
+           !ss->read_error &&
+           (ss->chunk_count == 0 || !ss->chunks[ss->chunk_head].ready);
+}
+
+// Send read-ahead chunks of a file body in order, up to `budget` bytes,
+// then top the read-ahead up again. A partly sent chunk keeps its data for
+// the next call. Returns bytes sent or -1 on error.
+static ssize_t send_file_chunks(struct connection_context *ctx, struct stream_send *ss,
+                                size_t budget) {
+    if (ss->read_error) {
+        return -1;
+    }
+
+    ssize_t total = 0;
+    while (ss->remaining > 0 && (size_t)total < budget && ss->chunk_count > 0) {
+        struct file_chunk *chunk = &ss->chunks[ss->chunk_head];
+        if (!chunk->ready) {
+            break;  // Resumed from file_read_done
+        }
+
+        size_t len = chunk->req.len - chunk->sent;
+        if (budget - total < len) {
+            len = budget - total;
+        }
+        bool fin = len == ss->remaining && send_in_last_piece(ss);
+        ssize_t written = http3_send_body(ctx->h3_conn, ctx->quic_conn, ss->stream_id,
+                                          chunk->req.buf + chunk->sent, len, fin);
+        if (written < 0) {
+            if (written != HTTP3_ERR_DONE) {
+                fprintf(stderr, "Failed to send HTTP/3 body: %zd\n", written);
+                return -1;
+            }
+            break;
+        }
+
+        chunk->sent += written;
+        ss->offset += written;
+        ss->remaining -= written;
+        total += written;
+        if (chunk->sent == chunk->req.len) {
+            chunk_pool_put(chunk->req.buf);
+            ss->chunk_head = (ss->chunk_head + 1) % g_file_readahead;
+            ss->chunk_count--;
+        }
+        if ((size_t)written < len) {
+            break;  // Blocked by flow control
+        }
+    }
+    file_readahead_fill(ss);
+    return total;
+}
+
+// Send up to `budget` bytes of the current run. In-memory and mapped bodies
+// are passed to http3_send_body in place at the cursor. Returns bytes sent
+// or -1 on error.
+static ssize_t send_current_piece(struct connection_context *ctx, struct stream_send *ss,
+                                  size_t budget) {
+    if (!ss->piece_data && ss->source == SEND_SOURCE_FILE) {
+        return send_file_chunks(ctx, ss, budget);
+    }
+
+    size_t len = ss->remaining < budget ? ss->remaining : budget;
+    const uint8_t *data;
+    if (ss->piece_data) {
+        data = ss->piece_data + ss->offset;
+    } else if (ss->source == SEND_SOURCE_SYNTHETIC) {
+        // Wrap around the pattern buffer
+        size_t at = ss->offset % SYNTHETIC_BUF_SIZE;
+        if (len > SYNTHETIC_BUF_SIZE - at) {
+            len = SYNTHETIC_BUF_SIZE - at;
+        }
+        data = g_synthetic_buf + at;
+    } else if (ss->source == SEND_SOURCE_MAPPED) {
+        data = ss->entry->data + ss->offset;
+    } else {
+        data = ss->data + ss->offset;
+    }
+    bool fin = len == ss->remaining && send_in_last_piece(ss);
+    ssize_t written = http3_send_body(ctx->h3_conn, ctx->quic_conn, ss->stream_id,
+                                      data, len, fin);
+    if (written < 0) {
+        if (written == HTTP3_ERR_DONE) {
+            return 0;
+        }
+        fprintf(stderr, "Failed to send HTTP/3 body: %zd\n", written);
+        return -1;
+    }
+    ss->offset += written;
+    ss->remaining -= written;
+    return written;
+}
+
+// Send up to `budget` bytes of a response body, moving on through the runs
+// of a multipart body. Returns bytes sent or -1 on error.
+static ssize_t send_stream_body(struct connection_context *ctx, struct stream_send *ss,
+                                size_t budget) {
+    ssize_t total = 0;
+    while ((size_t)total < budget && !send_done(ss)) {
+        if (ss->remaining == 0) {
+            send_next_piece(ss);
+        }
+        ssize_t written = send_current_piece(ctx, ss, budget - total);
+        if (written < 0) {
+            return -1;
+        }
+        total += written;
+        if (ss->remaining > 0) {
+            break;  // Blocked or out of budget
+        }
+    }
+    return total;
+}
+
+// Serve pending responses round-robin, one quantum per stream per round,
+// until each is finished or blocked by flow control. This keeps a single
+// large response from using up the connection's credit while other
+// responses on the same connection wait.
+static void schedule_sends(struct connection_context *ctx) {
+    if (!ctx->h3_conn || !ctx->quic_conn) {
+        return;
+    }
+
+    bool progress = true;
+    while (progress && ctx->sends.head) {
+        progress = false;
+        size_t round = ctx->sends.count;
+        for (size_t i = 0; i < round && ctx->sends.head; i++) {
+            struct stream_send *ss = ctx->sends.head;
+
+            // Move to the back of the queue before serving
+            send_queue_unlink(&ctx->sends, ss);
+            ss->prev = ctx->sends.tail;
+            if (ctx->sends.tail) {
+                ctx->sends.tail->next = ss;
+            } else {
+                ctx->sends.head = ss;
+            }
+            ctx->sends.tail = ss;
+
+            ssize_t written = send_stream_body(ctx, ss, SEND_QUANTUM);
+            if (written < 0) {
+                http3_stream_close(ctx->h3_conn, ctx->quic_conn, ss->stream_id);
+                send_table_remove(&ctx->sends, ss);
+                continue;
+            }
+            if (send_done(ss)) {
+                server_log("Finished sending HTTP/3 body on stream %ld\n",
+                           ss->stream_id);
+                if (ss->source == SEND_SOURCE_SYNTHETIC) {
+                    print_transfer_report("bytes", ss->stream_id, ss->offset,
+                                          monotonic_ns() - ss->started_ns, NULL, 0);
+                }
+                quic_stream_wantwrite(ctx->quic_conn, ss->stream_id, false);
+                send_table_remove(&ctx->sends, ss);
+                continue;
+            }
+            if (written > 0) {
+                progress = true;
+            }
+        }
+    }
+
+    // Whatever is left is blocked; resume from on_stream_writable, or from
+    // file_read_done for streams waiting on the disk
+    for (struct stream_send *ss = ctx->sends.head; ss; ss = ss->next) {
+        quic_stream_wantwrite(ctx->quic_conn, ss->stream_id, !send_waiting_for_read(ss));
     }
+}
+
+// Queue the rest of a response body on `stream_id` and start sending it.
+static void queue_stream_send(struct connection_context *ctx, struct stream_send *ss) {
+    ss->ctx = ctx;
+    send_table_add(&ctx->sends, ss);
+    schedule_sends(ctx);
+}
+
+// Build an http3_header_t from two C strings
+#define HTTP3_HEADER(n, v) \
+    {.name = (uint8_t *)(n), .name_len = strlen(n), .value = (uint8_t *)(v), .value_len = strlen(v)}
+
+// Function to send HTTP/3 response headers, followed by up to
+// MAX_EXTRA_HEADERS `extra` headers (may be NULL)
+static int send_http3_headers(struct connection_context *conn_ctx, uint64_t stream_id,
+                              const char *status, const char *content_type,
+                              uint64_t content_length,
+                              const struct http3_header_t *extra, size_t extra_len) {
+    char content_length_str[32];
+    snprintf(content_length_str, sizeof(content_length_str), "%" PRIu64, content_length);
     
-    return 0;  // Success
+    struct http3_header_t response_headers[3 + MAX_EXTRA_HEADERS] = {
+        HTTP3_HEADER(":status", status),
+        HTTP3_HEADER("content-type", content_type),
+        HTTP3_HEADER("content-length", content_length_str),
+    };
+    if (extra_len > MAX_EXTRA_HEADERS) {
+        extra_len = MAX_EXTRA_HEADERS;
+    }
+    if (extra_len > 0) {
+        memcpy(response_headers + 3, extra, extra_len * sizeof(*extra));
+    }
+    
+    return http3_send_headers(conn_ctx->h3_conn, conn_ctx->quic_conn, stream_id,
+                              response_headers, 3 + extra_len, false);
 }
 
 // Function to send HTTP/3 response
@@ -416,38 +966,36 @@ static void send_http3_response(struct connection_context *conn_ctx, uint64_t st
         return;
     }
     
-    char content_length_str[32];
-    snprintf(content_length_str, sizeof(content_length_str), "%zu", body_len);
-    
-    struct http3_header_t response_headers[] = {
-        {.name = (uint8_t *)":status", .name_len = 7, .value = (uint8_t *)status, .value_len = strlen(status)},
-        {.name = (uint8_t *)"content-type", .name_len = 12, .value = (uint8_t *)content_type, .value_len = strlen(content_type)},
-        {.name = (uint8_t *)"content-length", .name_len = 14, .value = (uint8_t *)content_length_str, .value_len = strlen(content_length_str)}
-    };
-    
-    int ret = http3_send_headers(conn_ctx->h3_conn, conn_ctx->quic_conn, stream_id,
-                               response_headers, sizeof(response_headers)/sizeof(response_headers[0]), false);
+    int ret = send_http3_headers(conn_ctx, stream_id, status, content_type, body_len, NULL, 0);
     if (ret >= 0 && body && body_len > 0) {
         // If the body is large, it needs to be sent continuously using http3_send_body in on_stream_writable.
         int written = http3_send_body(conn_ctx->h3_conn, conn_ctx->quic_conn, stream_id, 
                       (uint8_t *)body, body_len, true);
+        if (written == HTTP3_ERR_DONE) {
+            written = 0;
+        }
         if (written >= 0) {
             if ((size_t)written < body_len) {
-                // Partial write - store remaining data and continue sending in on_stream_writable
+                // Partial write - keep a copy of the rest for on_stream_writable
                 size_t remaining = body_len - written;
-                conn_ctx->pending_data = malloc(remaining);
-                if (conn_ctx->pending_data) {
-                    memcpy(conn_ctx->pending_data, body + written, remaining);
-                    conn_ctx->pending_data_len = remaining;
-                    conn_ctx->pending_stream_id = stream_id;
-                    quic_stream_wantwrite(conn_ctx->quic_conn, stream_id, true);
-                    fprintf(stderr, "HTTP/3 response partially sent: %s (%d/%zu bytes) - will continue in on_stream_writable\n", 
-                            status, written, body_len);
+                struct stream_send *ss = calloc(1, sizeof(struct stream_send));
+                uint8_t *data = malloc(remaining);
+                if (ss && data) {
+                    memcpy(data, body + written, remaining);
+                    ss->stream_id = stream_id;
+                    ss->source = SEND_SOURCE_BUFFER;
+                    ss->data = data;
+                    ss->remaining = remaining;
+                    server_log("HTTP/3 response partially sent: %s (%d/%zu bytes) - will continue in on_stream_writable\n", 
+                               status, written, body_len);
+                    queue_stream_send(conn_ctx, ss);
                 } else {
+                    free(ss);
+                    free(data);
                     fprintf(stderr, "Failed to allocate memory for pending data\n");
                 }
             } else {
-                fprintf(stderr, "HTTP/3 response sent: %s (%zu bytes)\n", status, body_len);
+                server_log("HTTP/3 response sent: %s (%zu bytes)\n", status, body_len);
             }
         } else {
             fprintf(stderr, "Failed to send HTTP/3 body: %d\n", written);
@@ -456,12 +1004,456 @@ static void send_http3_response(struct connection_context *conn_ctx, uint64_t st
         // Send empty body with fin=true
         http3_send_body(conn_ctx->h3_conn, conn_ctx->quic_conn, stream_id, 
                       (uint8_t *)"", 0, true);
-        fprintf(stderr, "HTTP/3 response sent: %s (0 bytes)\n", status);
+        server_log("HTTP/3 response sent: %s (0 bytes)\n", status);
     } else {
         fprintf(stderr, "Failed to send HTTP/3 headers: %d\n", ret);
     }
 }
 
+// Request headers the server acts on
+struct request_info {
+    char *path;
+    char *accept_encoding;
+    char *range;
+    char *if_range;
+    char *if_none_match;
+    char *if_modified_since;
+};
+
+static void request_info_free(struct request_info *req) {
+    free(req->path);
+    free(req->accept_encoding);
+    free(req->range);
+    free(req->if_range);
+    free(req->if_none_match);
+    free(req->if_modified_since);
+}
+
+// Send a response without a body.
+static void send_http3_empty_response(struct connection_context *conn_ctx, uint64_t stream_id,
+                                      const char *status, const char *content_type,
+                                      const struct http3_header_t *extra, size_t extra_len) {
+    int ret = send_http3_headers(conn_ctx, stream_id, status, content_type, 0, extra, extra_len);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to send HTTP/3 headers: %d\n", ret);
+        return;
+    }
+    http3_send_body(conn_ctx->h3_conn, conn_ctx->quic_conn, stream_id, (uint8_t *)"", 0, true);
+    server_log("HTTP/3 response sent: %s (0 bytes)\n", status);
+}
+
+// Pick the representation of `path` to send: a precompressed sibling
+// (path.br, path.zst or path.gz) no older than the file, in the client's
+// order of preference, else a gzip copy from the compression cache for
+// text types, else the file itself. Sets `*encoding` to the content-coding
+// or NULL and `*body_st` to the metadata of the chosen file, and returns the
+// path to read the body from.
+static const char *select_encoded_variant(const char *path, const struct stat *st,
+                                          const char *content_type,
+                                          const char *accept_encoding,
+                                          char *buf, size_t buf_len,
+                                          const char **encoding, struct stat *body_st) {
+    struct accept_encoding ae;
+    enum content_coding order[CODING_COUNT];
+    accept_encoding_parse(accept_encoding, &ae);
+    size_t count = accept_encoding_order(&ae, order);
+
+    *encoding = NULL;
+    for (size_t i = 0; i < count; i++) {
+        int n = snprintf(buf, buf_len, "%s%s", path, content_coding_suffix(order[i]));
+        if (n < 0 || (size_t)n >= buf_len) {
+            continue;
+        }
+        struct stat vst;
+        if (stat_cache_stat(&g_stat_cache, buf, &vst) == 0 && S_ISREG(vst.st_mode) &&
+            (vst.st_mtim.tv_sec > st->st_mtim.tv_sec ||
+             (vst.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+              vst.st_mtim.tv_nsec >= st->st_mtim.tv_nsec))) {
+            *encoding = content_coding_name(order[i]);
+            *body_st = vst;
+            return buf;
+        }
+    }
+
+    if (ae.q[CODING_GZIP] > 0 && content_type_compressible(content_type) &&
+        compress_cache_gzip(&g_compress_cache, path, st, buf, buf_len) == 0 &&
+        stat_cache_stat(&g_stat_cache, buf, body_st) == 0) {
+        *encoding = content_coding_name(CODING_GZIP);
+        return buf;
+    }
+    *body_st = *st;
+    return path;
+}
+
+// Make a multipart boundary that is unlikely to appear in any body.
+static void make_multipart_boundary(char *buf, size_t buf_len, uint64_t stream_id) {
+    static uint64_t counter;
+    uint64_t x = (uint64_t)time(NULL) ^ (stream_id << 32) ^ (++counter * 0x9E3779B97F4A7C15ULL);
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    snprintf(buf, buf_len, "tquic-%016" PRIx64, x);
+}
+
+// Lay out a multipart/byteranges body for `ranges` of a representation of
+// `size` bytes as runs of `ss`: part headers from one text buffer, part
+// data straight from the body source. Returns the body length or 0 if
+// out of memory.
+static uint64_t build_multipart_pieces(struct stream_send *ss,
+                                       const struct http_byte_range *ranges, int count,
+                                       uint64_t size, const char *content_type,
+                                       const char *boundary) {
+    size_t text_len = (count + 1) * (128 + strlen(content_type) + strlen(boundary));
+    ss->piece_text = malloc(text_len);
+    ss->pieces = calloc(2 * count + 1, sizeof(struct send_piece));
+    if (!ss->piece_text || !ss->pieces) {
+        return 0;
+    }
+
+    size_t used = 0;
+    uint64_t total = 0;
+    size_t n = 0;
+    for (int i = 0; i <= count; i++) {
+        int len;
+        if (i < count) {
+            len = snprintf(ss->piece_text + used, text_len - used,
+                           "%s--%s\r\ncontent-type: %s\r\n"
+                           "content-range: bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64 "\r\n\r\n",
+                           i > 0 ? "\r\n" : "", boundary, content_type,
+                           ranges[i].first, ranges[i].last, size);
+        } else {
+            len = snprintf(ss->piece_text + used, text_len - used, "\r\n--%s--\r\n", boundary);
+        }
+        if (len < 0 || (size_t)len >= text_len - used) {
+            return 0;
+        }
+        ss->pieces[n++] = (struct send_piece){
+            .data = (const uint8_t *)ss->piece_text, .offset = used, .length = len};
+        used += len;
+        total += len;
+
+        if (i < count) {
+            uint64_t part_len = ranges[i].last - ranges[i].first + 1;
+            ss->pieces[n++] = (struct send_piece){
+                .data = NULL, .offset = ranges[i].first, .length = part_len};
+            total += part_len;
+        }
+    }
+    ss->piece_count = n;
+    ss->piece_next = 0;
+    send_next_piece(ss);
+    return total;
+}
+
+// Open a file and stream it on `stream_id`. Hot files come from the mmap
+// cache and are sent in place; files too large to cache are read in the
+// background, a few chunks ahead of the send cursor (see async_read.h).
+// Either way headers go out immediately and memory stays bounded per
+// stream. A `range` header selects one byte range (206 with content-range)
+// or several (206 multipart/byteranges); if-range is matched against the
+// ETag or last-modified. Returns -1 if the file can't be served.
+static int start_file_response(struct connection_context *conn_ctx, uint64_t stream_id,
+                               const char *path, const struct request_info *req) {
+    struct stat st;
+    if (stat_cache_stat(&g_stat_cache, path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return -1;  // File not found
+    }
+
+    // Content negotiation: the type is that of the original file whichever
+    // encoded variant is sent
+    const char *content_type = content_type_for_path(path);
+    const char *encoding;
+    char variant[PATH_MAX];
+    struct stat body_st;
+    const char *body_path = select_encoded_variant(path, &st, content_type,
+                                                   req->accept_encoding, variant,
+                                                   sizeof(variant), &encoding, &body_st);
+
+    // Validators: the ETag identifies the exact file sent (each encoded
+    // variant has its own), last-modified is that of the original file
+    char etag[64];
+    char last_modified[64];
+    http_etag_format(&body_st, etag, sizeof(etag));
+    http_date_format(st.st_mtime, last_modified, sizeof(last_modified));
+    char content_range[96];
+    struct http3_header_t extra[MAX_EXTRA_HEADERS] = {
+        HTTP3_HEADER("vary", "accept-encoding"),
+        HTTP3_HEADER("accept-ranges", "bytes"),
+        HTTP3_HEADER("last-modified", last_modified),
+        HTTP3_HEADER("etag", etag),
+    };
+    size_t extra_len = 4;
+    if (encoding) {
+        extra[extra_len++] = (struct http3_header_t)HTTP3_HEADER("content-encoding", encoding);
+    }
+
+    // if-none-match takes precedence; if-modified-since is only used
+    // without it (RFC 9110 section 13.2.2)
+    bool not_modified = false;
+    time_t since;
+    if (req->if_none_match) {
+        not_modified = http_etag_list_match(req->if_none_match, etag);
+    } else if (req->if_modified_since &&
+               http_date_parse(req->if_modified_since, &since) == 0) {
+        not_modified = st.st_mtime <= since;
+    }
+    if (not_modified) {
+        // content-length is that of the selected representation
+        int ret = send_http3_headers(conn_ctx, stream_id, "304", content_type,
+                                     body_st.st_size, extra, extra_len);
+        if (ret >= 0) {
+            http3_send_body(conn_ctx->h3_conn, conn_ctx->quic_conn, stream_id,
+                            (uint8_t *)"", 0, true);
+            server_log("HTTP/3 response sent: 304 for %s\n", body_path);
+        } else {
+            fprintf(stderr, "Failed to send HTTP/3 headers: %d\n", ret);
+        }
+        return 0;
+    }
+
+    int fd = -1;
+    uint64_t size;
+    struct file_cache_entry *entry = file_cache_open_stat(&g_file_cache, body_path, &body_st);
+    if (entry) {
+        size = entry->size;
+        body_st.st_dev = entry->dev;
+        body_st.st_ino = entry->ino;
+        body_st.st_size = entry->size;
+        body_st.st_mtim = entry->mtime;
+    } else {
+        if (errno != EFBIG) {
+            return -1;  // File not found
+        }
+        fd = open(body_path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return -1;
+        }
+        if (fstat(fd, &body_st) != 0 || !S_ISREG(body_st.st_mode)) {
+            close(fd);
+            return -1;
+        }
+        size = body_st.st_size;
+    }
+    // The stat cache may be up to its TTL old and a miss maps or opens the
+    // file afresh, so re-derive the ETag from the version actually sent
+    http_etag_format(&body_st, etag, sizeof(etag));
+
+    // Ranges apply to the selected representation, and only while it is
+    // still the one the client's if-range validator refers to. An ETag in
+    // if-range must match strongly, so weak tags never do.
+    struct http_byte_range ranges[HTTP_RANGE_MAX];
+    int range_count = 0;
+    if (req->range && (!req->if_range || strcmp(req->if_range, etag) == 0 ||
+                       strcmp(req->if_range, last_modified) == 0)) {
+        range_count = http_range_parse(req->range, size, ranges, HTTP_RANGE_MAX);
+    }
+
+    struct stream_send *ss = NULL;
+    if (range_count < 0) {
+        snprintf(content_range, sizeof(content_range), "bytes */%" PRIu64, size);
+        extra[extra_len++] = (struct http3_header_t)HTTP3_HEADER("content-range", content_range);
+        send_http3_empty_response(conn_ctx, stream_id, "416", content_type, extra, extra_len);
+        goto DONE;
+    }
+    if (size == 0) {
+        send_http3_empty_response(conn_ctx, stream_id, "200", content_type, extra, extra_len);
+        goto DONE;
+    }
+
+    ss = calloc(1, sizeof(struct stream_send));
+    if (!ss) {
+        goto NOMEM;
+    }
+    if (!entry) {
+        ss->chunks = calloc(g_file_readahead, sizeof(struct file_chunk));
+        if (!ss->chunks) {
+            goto NOMEM;
+        }
+    }
+
+    const char *status = "200";
+    const char *response_type = content_type;
+    char multipart_type[96];
+    uint64_t body_len = size;
+    ss->offset = 0;
+    ss->remaining = size;
+    if (range_count == 1) {
+        status = "206";
+        body_len = ranges[0].last - ranges[0].first + 1;
+        snprintf(content_range, sizeof(content_range),
+                 "bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64, ranges[0].first,
+                 ranges[0].last, size);
+        extra[extra_len++] = (struct http3_header_t)HTTP3_HEADER("content-range", content_range);
+        ss->offset = ranges[0].first;
+        ss->remaining = body_len;
+    } else if (range_count > 1) {
+        char boundary[32];
+        make_multipart_boundary(boundary, sizeof(boundary), stream_id);
+        snprintf(multipart_type, sizeof(multipart_type),
+                 "multipart/byteranges; boundary=%s", boundary);
+        status = "206";
+        response_type = multipart_type;
+        body_len = build_multipart_pieces(ss, ranges, range_count, size, content_type, boundary);
+        if (body_len == 0) {
+            goto NOMEM;
+        }
+    }
+
+    int ret = send_http3_headers(conn_ctx, stream_id, status, response_type, body_len,
+                                 extra, extra_len);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to send HTTP/3 headers: %d\n", ret);
+        goto FREE;
+    }
+
+    ss->stream_id = stream_id;
+    ss->source = entry ? SEND_SOURCE_MAPPED : SEND_SOURCE_FILE;
+    ss->entry = entry;
+    ss->fd = fd;
+    if (!entry && !ss->pieces) {
+        ss->read_offset = ss->offset;
+        ss->read_remaining = ss->remaining;
+    }
+    server_log("Streaming %s (%s, %" PRIu64 " bytes, %d ranges, %s) on stream %ld\n",
+               body_path, status, body_len, range_count, encoding ? encoding : "identity",
+               stream_id);
+    queue_stream_send(conn_ctx, ss);
+    return 0;
+
+NOMEM:
+    {
+        const char *error_body = "Internal Server Error: Memory allocation failed";
+        send_http3_response(conn_ctx, stream_id, "500", "text/plain", error_body, strlen(error_body));
+    }
+FREE:
+    if (ss) {
+        free(ss->chunks);
+        free(ss->pieces);
+        free(ss->piece_text);
+        free(ss);
+    }
+DONE:
+    if (entry) {
+        file_cache_release(entry);
+    } else {
+        close(fd);
+    }
+    return 0;
+}
+
+// Parse the size of /bytes/<n>: decimal digits with an optional k, m or g
+// (binary) suffix. Returns -1 if malformed or too large.
+static int parse_byte_count(const char *value, uint64_t *out) {
+    uint64_t n;
+    const char *end = http_range_parse_u64(value, &n);
+    if (end == NULL) {
+        return -1;
+    }
+    unsigned shift = 0;
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end != '\0' || n > (UINT64_MAX >> shift)) {
+        return -1;
+    }
+    *out = n << shift;
+    return 0;
+}
+
+// Stream `/bytes/<n>` from g_synthetic_buf, so disk and page cache stay out
+// of throughput measurements. The time to the last byte is logged when
+// the body has been handed to the stream.
+static void start_bytes_response(struct connection_context *conn_ctx, uint64_t stream_id,
+                                 const char *count) {
+    uint64_t size;
+    if (parse_byte_count(count, &size) != 0) {
+        const char *error_body = "Bad Request: expected /bytes/<n>[k|m|g]";
+        send_http3_response(conn_ctx, stream_id, "400", "text/plain", error_body, strlen(error_body));
+        return;
+    }
+
+    struct http3_header_t extra[] = {HTTP3_HEADER("cache-control", "no-store")};
+    if (size == 0) {
+        send_http3_empty_response(conn_ctx, stream_id, "200", "application/octet-stream",
+                                  extra, 1);
+        return;
+    }
+    struct stream_send *ss = calloc(1, sizeof(struct stream_send));
+    if (!ss) {
+        const char *error_body = "Internal Server Error: Memory allocation failed";
+        send_http3_response(conn_ctx, stream_id, "500", "text/plain", error_body, strlen(error_body));
+        return;
+    }
+    ss->started_ns = monotonic_ns();
+    int ret = send_http3_headers(conn_ctx, stream_id, "200", "application/octet-stream", size,
+                                 extra, 1);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to send HTTP/3 headers: %d\n", ret);
+        free(ss);
+        return;
+    }
+
+    ss->stream_id = stream_id;
+    ss->source = SEND_SOURCE_SYNTHETIC;
+    ss->remaining = size;
+    server_log("Streaming %" PRIu64 " synthetic bytes on stream %ld\n", size, stream_id);
+    queue_stream_send(conn_ctx, ss);
+}
+
+// Answer a /sink request once its body has been discarded.
+static void finish_sink(struct connection_context *conn_ctx, uint64_t stream_id,
+                        uint64_t bytes, uint64_t started_ns) {
+    char report[160];
+    print_transfer_report("sink", stream_id, bytes, monotonic_ns() - started_ns, report,
+                          sizeof(report));
+    send_http3_response(conn_ctx, stream_id, "200", "text/plain", report, strlen(report));
+}
+
+// Start counting the body of a /sink request. A request without a body is
+// answered right away.
+static void start_sink(struct connection_context *conn_ctx, uint64_t stream_id, bool fin) {
+    if (fin) {
+        finish_sink(conn_ctx, stream_id, 0, monotonic_ns());
+        return;
+    }
+    struct sink_stream *sink = calloc(1, sizeof(struct sink_stream));
+    if (!sink) {
+        const char *error_body = "Internal Server Error: Memory allocation failed";
+        send_http3_response(conn_ctx, stream_id, "500", "text/plain", error_body, strlen(error_body));
+        return;
+    }
+    sink->stream_id = stream_id;
+    sink->started_ns = monotonic_ns();
+    sink->next = conn_ctx->sinks;
+    conn_ctx->sinks = sink;
+}
+
+static struct sink_stream *sink_find(struct connection_context *ctx, uint64_t stream_id) {
+    struct sink_stream *sink = ctx->sinks;
+    while (sink && sink->stream_id != stream_id) {
+        sink = sink->next;
+    }
+    return sink;
+}
+
+// Unlink and return the sink of `stream_id`, if any.
+static struct sink_stream *sink_take(struct connection_context *ctx, uint64_t stream_id) {
+    struct sink_stream **link = &ctx->sinks;
+    while (*link && (*link)->stream_id != stream_id) {
+        link = &(*link)->next;
+    }
+    struct sink_stream *sink = *link;
+    if (sink) {
+        *link = sink->next;
+    }
+    return sink;
+}
+
 static int create_socket(const char *host, const char *port,
                          struct addrinfo **local,
                          struct simple_server *server) {
@@ -499,16 +1491,26 @@ static int create_socket(const char *host, const char *port,
 }
 
 // HTTP/3 event handler implementations
-static int extract_path_callback(const uint8_t *name, size_t name_len,
-                                 const uint8_t *value, size_t value_len, void *argp) {
-    char **path = (char **)argp;
+static int request_header_callback(const uint8_t *name, size_t name_len,
+                                   const uint8_t *value, size_t value_len, void *argp) {
+    struct request_info *req = argp;
+    char **field = NULL;
     
     if (name_len == 5 && memcmp(name, ":path", 5) == 0) {
-        *path = malloc(value_len + 1);
-        if (*path) {
-            memcpy(*path, value, value_len);
-            (*path)[value_len] = '\0';
-        }
+        field = &req->path;
+    } else if (name_len == 15 && strncasecmp((const char *)name, "accept-encoding", 15) == 0) {
+        field = &req->accept_encoding;
+    } else if (name_len == 5 && strncasecmp((const char *)name, "range", 5) == 0) {
+        field = &req->range;
+    } else if (name_len == 8 && strncasecmp((const char *)name, "if-range", 8) == 0) {
+        field = &req->if_range;
+    } else if (name_len == 13 && strncasecmp((const char *)name, "if-none-match", 13) == 0) {
+        field = &req->if_none_match;
+    } else if (name_len == 17 && strncasecmp((const char *)name, "if-modified-since", 17) == 0) {
+        field = &req->if_modified_since;
+    }
+    if (field && *field == NULL) {
+        *field = strndup((const char *)value, value_len);
     }
     return 0;
 }
@@ -516,32 +1518,60 @@ static int extract_path_callback(const uint8_t *name, size_t name_len,
 static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
                                     const struct http3_headers_t *headers, bool fin) {
     struct connection_context *conn_ctx = ctx;
-    fprintf(stderr, "Received HTTP/3 headers on stream %ld\n", stream_id);
+    server_log("Received HTTP/3 headers on stream %ld\n", stream_id);
     
-    if (fin && conn_ctx && conn_ctx->h3_conn && conn_ctx->quic_conn) {
-        // Extract the requested path
-        char *requested_path = NULL;
-        http3_for_each_header(headers, extract_path_callback, &requested_path);
+    if (conn_ctx && conn_ctx->h3_conn && conn_ctx->quic_conn) {
+        // Apply the client's Extensible Priorities (RFC 9218) to the
+        // response stream before any body is queued.
+        struct http3_priority_t priority;
+        if (h3_priority_from_headers(headers, &priority)) {
+            http3_stream_set_priority(conn_ctx->h3_conn, conn_ctx->quic_conn,
+                                      stream_id, &priority);
+            server_log("Stream %ld priority: u=%u i=%d\n", stream_id,
+                       priority.urgency, priority.incremental);
+        }
+
+        // Extract the requested path and the headers used for negotiation
+        struct request_info req = {0};
+        http3_for_each_header(headers, request_header_callback, &req);
         
-        if (!requested_path) {
+        if (!req.path) {
             // No path found, send 400 Bad Request
+            request_info_free(&req);
             const char *error_body = "Bad Request: No path specified";
             send_http3_response(conn_ctx, stream_id, "400", "text/plain", error_body, strlen(error_body));
             return;
         }
         
-        fprintf(stderr, "Requested path: %s\n", requested_path);
+        server_log("Requested path: %s\n", req.path);
+
+        // Synthetic endpoints; only /sink takes a request body
+        if (strcmp(req.path, SINK_PATH) == 0) {
+            start_sink(conn_ctx, stream_id, fin);
+            request_info_free(&req);
+            return;
+        }
+        if (!fin) {
+            request_info_free(&req);
+            return;
+        }
+        if (strncmp(req.path, BYTES_PATH_PREFIX, strlen(BYTES_PATH_PREFIX)) == 0) {
+            start_bytes_response(conn_ctx, stream_id, req.path + strlen(BYTES_PATH_PREFIX));
+            request_info_free(&req);
+            return;
+        }
         
         // If path is "/", serve index.html
-        if (strcmp(requested_path, "/") == 0) {
-            free(requested_path);
-            requested_path = strdup("/index.html");
+        if (strcmp(req.path, "/") == 0) {
+            free(req.path);
+            req.path = strdup("/index.html");
         }
+        char *requested_path = req.path;
         
         // Construct full file path (remove leading slash and combine with document root)
-        char *file_path = malloc(strlen(g_document_root) + strlen(requested_path) + 2);
+        char *file_path = requested_path ? malloc(strlen(g_document_root) + strlen(requested_path) + 2) : NULL;
         if (!file_path) {
-            free(requested_path);
+            request_info_free(&req);
             const char *error_body = "Internal Server Error: Memory allocation failed";
             send_http3_response(conn_ctx, stream_id, "500", "text/plain", error_body, strlen(error_body));
             return;
@@ -552,53 +1582,84 @@ static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
         snprintf(file_path, strlen(g_document_root) + strlen(requested_path) + 2, 
                 "%s/%s", g_document_root, path_without_slash);
         
-        // Try to read the file
-        char *content = NULL;
-        size_t content_length = 0;
-        char *content_type = NULL;
-        
-        if (read_file_content(file_path, &content, &content_length, &content_type) == 0) {
-            // File found, send it
-            send_http3_response(conn_ctx, stream_id, "200", content_type, content, content_length);
-            free(content);
-        } else {
+        // Try to stream the file
+        if (start_file_response(conn_ctx, stream_id, file_path, &req) != 0) {
             // File not found, send 404
             const char *error_body = "<!DOCTYPE html><html><head><title>404 Not Found</title></head><body><h1>404 Not Found</h1><p>The requested file was not found.</p></body></html>";
             send_http3_response(conn_ctx, stream_id, "404", "text/html", error_body, strlen(error_body));
         }
         
-        free(requested_path);
+        request_info_free(&req);
         free(file_path);
     }
 }
 
 static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
     struct connection_context *conn_ctx = ctx;
-    fprintf(stderr, "Received HTTP/3 data on stream %ld\n", stream_id);
-    
-    // Drain any available data from the stream
-    if (conn_ctx && conn_ctx->h3_conn && conn_ctx->quic_conn) {
-        static uint8_t buf[READ_BUF_SIZE];
-        ssize_t read = http3_recv_body(conn_ctx->h3_conn, conn_ctx->quic_conn, stream_id, buf, sizeof(buf));
-        if (read > 0) {
-            fprintf(stderr, "Received %zd bytes of HTTP/3 body data\n", read);
-        } else if (read < 0) {
+    if (!conn_ctx || !conn_ctx->h3_conn || !conn_ctx->quic_conn) {
+        return;
+    }
+
+    // Count and drop everything readable for /sink, without per-read logging
+    struct sink_stream *sink = sink_find(conn_ctx, stream_id);
+    if (sink) {
+        static uint8_t sink_buf[FILE_CHUNK_SIZE];
+        ssize_t read;
+        while ((read = http3_recv_body(conn_ctx->h3_conn, conn_ctx->quic_conn, stream_id,
+                                       sink_buf, sizeof(sink_buf))) > 0) {
+            sink->bytes += read;
+        }
+        if (read < 0 && read != HTTP3_ERR_DONE) {
             fprintf(stderr, "Error reading HTTP/3 body data: %zd\n", read);
         }
+        return;
+    }
+
+    // Drain any available data from the stream
+    server_log("Received HTTP/3 data on stream %ld\n", stream_id);
+    static uint8_t buf[READ_BUF_SIZE];
+    ssize_t read = http3_recv_body(conn_ctx->h3_conn, conn_ctx->quic_conn, stream_id, buf, sizeof(buf));
+    if (read > 0) {
+        server_log("Received %zd bytes of HTTP/3 body data\n", read);
+    } else if (read < 0) {
+        fprintf(stderr, "Error reading HTTP/3 body data: %zd\n", read);
     }
 }
 
 static void http3_on_stream_finished(void *ctx, uint64_t stream_id) {
-    (void)ctx;
-    fprintf(stderr, "HTTP/3 stream %ld finished\n", stream_id);
+    struct connection_context *conn_ctx = ctx;
+    server_log("HTTP/3 stream %ld finished\n", stream_id);
+
+    struct sink_stream *sink = conn_ctx ? sink_take(conn_ctx, stream_id) : NULL;
+    if (sink) {
+        finish_sink(conn_ctx, stream_id, sink->bytes, sink->started_ns);
+        free(sink);
+    }
 }
 
 static void http3_on_stream_reset(void *ctx, uint64_t stream_id, uint64_t error_code) {
+    struct connection_context *conn_ctx = ctx;
     fprintf(stderr, "HTTP/3 stream %ld reset with error code %ld\n", stream_id, error_code);
+    if (conn_ctx) {
+        free(sink_take(conn_ctx, stream_id));
+    }
 }
 
 static void http3_on_stream_priority_update(void *ctx, uint64_t stream_id) {
-    fprintf(stderr, "HTTP/3 stream %ld priority updated\n", stream_id);
+    struct connection_context *conn_ctx = ctx;
+    if (!conn_ctx || !conn_ctx->h3_conn || !conn_ctx->quic_conn) {
+        return;
+    }
+
+    // Reprioritize the stream from the PRIORITY_UPDATE frame.
+    struct http3_priority_t priority;
+    if (h3_priority_take_update(conn_ctx->h3_conn, stream_id, &priority) != 0) {
+        return;
+    }
+    http3_stream_set_priority(conn_ctx->h3_conn, conn_ctx->quic_conn,
+                              stream_id, &priority);
+    server_log("HTTP/3 stream %ld priority updated: u=%u i=%d\n",
+               stream_id, priority.urgency, priority.incremental);
 }
 
 static void http3_on_conn_goaway(void *ctx, uint64_t stream_id) {
@@ -612,23 +1673,46 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    // Set logger.
-    quic_set_logger(debug_log, NULL, "TRACE");
+    // Set logger, unless quiet mode is on (see server_log.h).
+    server_log_init();
+    if (!g_server_quiet) {
+        quic_set_logger(debug_log, NULL, "TRACE");
+    }
 
     // Create simple server.
     struct simple_server server;
     server.quic_endpoint = NULL;
     server.tls_config = NULL;
     server.h3_config = NULL;
-    server.loop = NULL;
+    server.loop = ev_default_loop(0);
     quic_config_t *config = NULL;
     int ret = 0;
 
+    // Set up optional packet impairment (see net_impairment.h).
+    if (net_impairment_init(&server.send_impairment, server.loop,
+                            NET_IMPAIRMENT_ENV_SEND, impaired_send, NULL,
+                            &server) != 0 ||
+        net_impairment_init(&server.recv_impairment, server.loop,
+                            NET_IMPAIRMENT_ENV_RECV, deliver_packet,
+                            flush_delivered, &server) != 0) {
+        return -1;
+    }
+
     // Create socket.
     const char *host = argv[1];
     const char *port = argv[2];
     g_document_root = (argc >= 4) ? argv[3] : ".";  // Set global document root
     printf("Using document root: %s\n", g_document_root);
+    file_cache_init(&g_file_cache);
+    compress_cache_init(&g_compress_cache);
+    stat_cache_init(&g_stat_cache);
+    file_readahead_init();
+    for (size_t i = 0; i < SYNTHETIC_BUF_SIZE; i++) {
+        g_synthetic_buf[i] = 'a' + i % 26;
+    }
+    if (async_read_init(&g_async_read, server.loop, flush_file_reads, &server) != 0) {
+        return -1;
+    }
     struct addrinfo *local = NULL;
     if (create_socket(host, port, &local, &server) != 0) {
         ret = -1;
@@ -673,9 +1757,13 @@ int main(int argc, char *argv[]) {
     }
 
     // Start event loop.
-    server.loop = ev_default_loop(0);
     ev_init(&server.timer, timeout_callback);
     server.timer.data = &server;
+    ev_timer_init(&server.stats_timer, stats_callback, CACHE_STATS_INTERVAL,
+                  CACHE_STATS_INTERVAL);
+    server.stats_timer.data = &server;
+    server.stats_last_lookups = 0;
+    ev_timer_start(server.loop, &server.stats_timer);
 
     ev_io watcher;
     ev_io_init(&watcher, read_callback, server.sock, EV_READ);
@@ -699,12 +1787,24 @@ EXIT:
     if (server.quic_endpoint != NULL) {
         quic_endpoint_free(server.quic_endpoint);
     }
+    net_impairment_print_stats(&server.send_impairment, "send");
+    net_impairment_print_stats(&server.recv_impairment, "recv");
+    net_impairment_free(&server.send_impairment);
+    net_impairment_free(&server.recv_impairment);
+    async_read_print_stats(&g_async_read);
+    async_read_free(&g_async_read);
     if (server.loop != NULL) {
         ev_loop_destroy(server.loop);
     }
     if (config != NULL) {
         quic_config_free(config);
     }
+    stat_cache_print_stats(&g_stat_cache);
+    file_cache_print_stats(&g_file_cache);
+    compress_cache_print_stats(&g_compress_cache);
+    stat_cache_free(&g_stat_cache);
+    file_cache_free(&g_file_cache);
+    chunk_pool_free();
 
     return ret;
 }
@@ -26,13 +26,20 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "net_impairment.h"
 #include "openssl/pem.h"
 #include "openssl/ssl.h"
 #include "openssl/x509.h"
+#include "quic_perf.h"
+#include "server_log.h"
 #include "tquic.h"
 
 #define READ_BUF_SIZE 4096
 #define MAX_DATAGRAM_SIZE 1200
+#define PERF_READ_BUF_SIZE 65536
+
+// Payload written by perf streams; the content does not matter.
+static uint8_t g_perf_chunk[PERF_MAX_CHUNK];
 
 // A simple server that supports HTTP/0.9 over QUIC
 struct simple_server {
@@ -43,27 +50,207 @@ struct simple_server {
     socklen_t local_addr_len;
     struct quic_tls_config_t *tls_config;
     struct ev_loop *loop;
+    struct net_impairment send_impairment;
+    struct net_impairment recv_impairment;
+};
+
+// Bulk transfer state of a connection that opened perf streams (see
+// quic_perf.h), stored as the connection context.
+struct perf_conn {
+    struct simple_server *server;
+    struct quic_conn_t *conn;
+    uint64_t index;
+    size_t chunk;
+    struct perf_stream streams[PERF_MAX_STREAMS];
+    int stream_count;
+    struct perf_report report;
+    ev_timer timer;
 };
 
+static void process_connections(struct simple_server *server);
+
+static struct perf_stream *perf_find(struct perf_conn *pc, uint64_t stream_id) {
+    for (int i = 0; pc != NULL && i < pc->stream_count; i++) {
+        if (pc->streams[i].stream_id == stream_id) {
+            return &pc->streams[i];
+        }
+    }
+    return NULL;
+}
+
+static void perf_totals(struct perf_conn *pc, uint64_t *sent,
+                        uint64_t *received) {
+    *sent = *received = 0;
+    for (int i = 0; i < pc->stream_count; i++) {
+        *sent += pc->streams[i].sent;
+        *received += pc->streams[i].received;
+    }
+}
+
+static void perf_timer_callback(EV_P_ ev_timer *w, int revents) {
+    struct perf_conn *pc = w->data;
+    char label[32];
+    uint64_t sent, received;
+    snprintf(label, sizeof(label), "conn %" PRIu64 " ", pc->index);
+    perf_totals(pc, &sent, &received);
+    perf_report_interval(&pc->report, label, sent, received,
+                         quic_conn_stats(pc->conn), NULL);
+
+    // Streams blocked on flow control still have to notice the deadline.
+    for (int i = 0; i < pc->stream_count; i++) {
+        perf_stream_send(pc->conn, &pc->streams[i], g_perf_chunk, pc->chunk);
+    }
+    process_connections(pc->server);
+}
+
+// Track a new perf stream, creating the connection state on first use.
+static struct perf_stream *perf_accept(struct simple_server *server,
+                                       struct quic_conn_t *conn,
+                                       uint64_t stream_id) {
+    struct perf_conn *pc = quic_conn_context(conn);
+    if (pc == NULL) {
+        pc = calloc(1, sizeof(*pc));
+        if (pc == NULL) {
+            return NULL;
+        }
+        pc->server = server;
+        pc->conn = conn;
+        pc->index = quic_conn_index(conn);
+        pc->chunk = PERF_DEFAULT_CHUNK;
+        quic_conn_set_context(conn, pc);
+        perf_report_start(&pc->report);
+        ev_timer_init(&pc->timer, perf_timer_callback, 1, 1);
+        pc->timer.data = pc;
+        ev_timer_start(server->loop, &pc->timer);
+    }
+    if (pc->stream_count == PERF_MAX_STREAMS) {
+        fprintf(stderr, "perf: too many streams on connection %" PRIu64 "\n",
+                pc->index);
+        return NULL;
+    }
+
+    struct perf_stream *ps = &pc->streams[pc->stream_count++];
+    memset(ps, 0, sizeof(*ps));
+    ps->stream_id = stream_id;
+    return ps;
+}
+
+// Consume data of a perf stream: the header line first, then bulk data.
+// Returns -1 if the header is malformed.
+static int perf_consume(struct perf_conn *pc, struct perf_stream *ps,
+                        const uint8_t *data, size_t len) {
+    while (!ps->header_done && len > 0) {
+        char c = *data++;
+        len--;
+        if (c != '\n') {
+            if (ps->header_len == PERF_HEADER_MAX - 1) {
+                return -1;
+            }
+            ps->header[ps->header_len++] = c;
+            continue;
+        }
+
+        struct perf_config cfg;
+        ps->header[ps->header_len] = '\0';
+        if (perf_header_parse(ps->header, &cfg) != 0) {
+            return -1;
+        }
+        server_log("perf: conn %" PRIu64 " stream %" PRIu64 ": %s\n",
+                   pc->index, ps->stream_id, ps->header);
+        ps->header_done = true;
+        ps->sending = cfg.mode & PERF_DOWN;
+        ps->send_until = perf_now() + cfg.duration;
+        pc->chunk = cfg.chunk;
+    }
+    ps->received += len;
+    return 0;
+}
+
+// Read everything available on a perf stream. A stream the client only
+// uploads on is answered with the byte count once the client finishes.
+static void perf_read(struct perf_conn *pc, struct perf_stream *ps,
+                      const uint8_t *data, size_t len, bool fin) {
+    static uint8_t buf[PERF_READ_BUF_SIZE];
+    struct quic_conn_t *conn = pc->conn;
+    if (perf_consume(pc, ps, data, len) != 0) {
+        goto BAD_HEADER;
+    }
+    while (!fin) {
+        ssize_t r = quic_stream_read(conn, ps->stream_id, buf, sizeof(buf),
+                                     &fin);
+        if (r < 0 || (r == 0 && !fin)) {
+            break;
+        }
+        if (perf_consume(pc, ps, buf, r) != 0) {
+            goto BAD_HEADER;
+        }
+    }
+
+    if (fin && !ps->recv_done) {
+        ps->recv_done = true;
+        if (!ps->sending) {
+            char reply[64];
+            int n = snprintf(reply, sizeof(reply), "OK %" PRIu64 "\n",
+                             ps->received);
+            quic_stream_write(conn, ps->stream_id, (uint8_t *)reply, n, true);
+            ps->send_done = true;
+        }
+    }
+    perf_stream_send(conn, ps, g_perf_chunk, pc->chunk);
+    return;
+
+BAD_HEADER:
+    fprintf(stderr, "perf: stream %" PRIu64 " bad header\n", ps->stream_id);
+    ps->sending = false;
+    ps->send_done = ps->recv_done = ps->header_done = true;
+    quic_stream_shutdown(conn, ps->stream_id, 0 /* read */, 0);
+    quic_stream_shutdown(conn, ps->stream_id, 1 /* write */, 0);
+}
+
+static void perf_conn_free(struct perf_conn *pc) {
+    char label[32];
+    uint64_t sent, received;
+    snprintf(label, sizeof(label), "conn %" PRIu64 " ", pc->index);
+    perf_totals(pc, &sent, &received);
+    perf_report_total(&pc->report, label, sent, received,
+                      quic_conn_stats(pc->conn));
+    ev_timer_stop(pc->server->loop, &pc->timer);
+    free(pc);
+}
+
 void server_on_conn_created(void *tctx, struct quic_conn_t *conn) {
-    fprintf(stderr, "new connection created\n");
+    server_log("new connection created\n");
+    quic_conn_set_context(conn, NULL);
 }
 
 void server_on_conn_established(void *tctx, struct quic_conn_t *conn) {
-    fprintf(stderr, "connection established\n");
+    server_log("connection established\n");
 }
 
 void server_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
-    fprintf(stderr, "connection closed\n");
+    server_log("connection closed\n");
+    struct perf_conn *pc = quic_conn_context(conn);
+    if (pc != NULL) {
+        perf_conn_free(pc);
+        quic_conn_set_context(conn, NULL);
+    }
 }
 
 void server_on_stream_created(void *tctx, struct quic_conn_t *conn,
                               uint64_t stream_id) {
-    fprintf(stderr, "new stream created %ld\n", stream_id);
+    server_log("new stream created %ld\n", stream_id);
 }
 
 void server_on_stream_readable(void *tctx, struct quic_conn_t *conn,
                                uint64_t stream_id) {
+    struct simple_server *server = tctx;
+    struct perf_conn *pc = quic_conn_context(conn);
+    struct perf_stream *ps = perf_find(pc, stream_id);
+    if (ps != NULL) {
+        perf_read(pc, ps, NULL, 0, false);
+        return;
+    }
+
     static uint8_t buf[READ_BUF_SIZE];
     bool fin = false;
     ssize_t r = quic_stream_read(conn, stream_id, buf, READ_BUF_SIZE, &fin);
@@ -72,8 +259,19 @@ void server_on_stream_readable(void *tctx, struct quic_conn_t *conn,
         return;
     }
 
-    printf("Got request:\n");
-    printf("%.*s\n", (int)r, buf);
+    // Streams starting with a perf header carry a bulk transfer.
+    if (perf_header_match(buf, r)) {
+        ps = perf_accept(server, conn, stream_id);
+        if (ps != NULL) {
+            perf_read(quic_conn_context(conn), ps, buf, r, fin);
+            return;
+        }
+    }
+
+    if (!g_server_quiet) {
+        printf("Got request:\n");
+        printf("%.*s\n", (int)r, buf);
+    }
 
     if (fin) {
         const char *resp = "HTTP/0.9 200 OK\n";
@@ -83,17 +281,27 @@ void server_on_stream_readable(void *tctx, struct quic_conn_t *conn,
 
 void server_on_stream_writable(void *tctx, struct quic_conn_t *conn,
                                uint64_t stream_id) {
+    struct perf_conn *pc = quic_conn_context(conn);
+    struct perf_stream *ps = perf_find(pc, stream_id);
+    if (ps != NULL) {
+        perf_stream_send(conn, ps, g_perf_chunk, pc->chunk);
+        return;
+    }
     quic_stream_wantwrite(conn, stream_id, false);
 }
 
 void server_on_stream_closed(void *tctx, struct quic_conn_t *conn,
                              uint64_t stream_id) {
-    fprintf(stderr, "stream closed %ld\n", stream_id);
+    server_log("stream closed %ld\n", stream_id);
 }
 
 int server_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts,
                            unsigned int count) {
     struct simple_server *server = psctx;
+    if (server->send_impairment.enabled) {
+        return net_impairment_send_packets(&server->send_impairment, pkts,
+                                           count);
+    }
 
     unsigned int sent_count = 0;
     int i, j = 0;
@@ -113,7 +321,7 @@ int server_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts,
                 }
                 return -1;
             }
-            fprintf(stderr, "send packet, length %ld\n", sent);
+            server_log("send packet, length %ld\n", sent);
             sent_count++;
         }
     }
@@ -152,6 +360,46 @@ const struct quic_tls_config_select_methods_t tls_config_select_method = {
     .select = server_select_tls_config,
 };
 
+static void process_connections(struct simple_server *server) {
+    quic_endpoint_process_connections(server->quic_endpoint);
+    double timeout = quic_endpoint_timeout(server->quic_endpoint) / 1e3f;
+    if (timeout < 0.0001) {
+        timeout = 0.0001;
+    }
+    server->timer.repeat = timeout;
+    ev_timer_again(server->loop, &server->timer);
+}
+
+// Send a packet released by the send impairment stage.
+static void impaired_send(void *ctx, const uint8_t *data, size_t len,
+                          const struct sockaddr *addr, socklen_t addr_len) {
+    struct simple_server *server = ctx;
+    ssize_t sent = sendto(server->sock, data, len, 0, addr, addr_len);
+    if (sent != len) {
+        fprintf(stderr, "impaired send failed: %s\n", strerror(errno));
+    }
+}
+
+// Feed a received packet (possibly delayed) into the quic endpoint.
+static void deliver_packet(void *ctx, const uint8_t *data, size_t len,
+                           const struct sockaddr *addr, socklen_t addr_len) {
+    struct simple_server *server = ctx;
+    quic_packet_info_t quic_packet_info = {
+        .src = addr,
+        .src_len = addr_len,
+        .dst = (struct sockaddr *)&server->local_addr,
+        .dst_len = server->local_addr_len,
+    };
+
+    int r = quic_endpoint_recv(server->quic_endpoint, (uint8_t *)data, len,
+                               &quic_packet_info);
+    if (r != 0) {
+        fprintf(stderr, "recv failed %d\n", r);
+    }
+}
+
+static void flush_delivered(void *ctx) { process_connections(ctx); }
+
 static void read_callback(EV_P_ ev_io *w, int revents) {
     struct simple_server *server = w->data;
     static uint8_t buf[READ_BUF_SIZE];
@@ -165,7 +413,7 @@ static void read_callback(EV_P_ ev_io *w, int revents) {
                                 (struct sockaddr *)&peer_addr, &peer_addr_len);
         if (read < 0) {
             if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
-                fprintf(stderr, "recv would block\n");
+                server_log("recv would block\n");
                 break;
             }
 
@@ -173,41 +421,17 @@ static void read_callback(EV_P_ ev_io *w, int revents) {
             return;
         }
 
-        quic_packet_info_t quic_packet_info = {
-            .src = (struct sockaddr *)&peer_addr,
-            .src_len = peer_addr_len,
-            .dst = (struct sockaddr *)&server->local_addr,
-            .dst_len = server->local_addr_len,
-        };
-
-        int r = quic_endpoint_recv(server->quic_endpoint, buf, read,
-                                   &quic_packet_info);
-        if (r != 0) {
-            fprintf(stderr, "recv failed %d\n", r);
-            continue;
-        }
+        net_impairment_submit(&server->recv_impairment, buf, read,
+                              (struct sockaddr *)&peer_addr, peer_addr_len);
     }
 
-    quic_endpoint_process_connections(server->quic_endpoint);
-    double timeout = quic_endpoint_timeout(server->quic_endpoint) / 1e3f;
-    if (timeout < 0.0001) {
-        timeout = 0.0001;
-    }
-    server->timer.repeat = timeout;
-    ev_timer_again(loop, &server->timer);
+    process_connections(server);
 }
 
 static void timeout_callback(EV_P_ ev_timer *w, int revents) {
     struct simple_server *server = w->data;
     quic_endpoint_on_timeout(server->quic_endpoint);
-    quic_endpoint_process_connections(server->quic_endpoint);
-
-    double timeout = quic_endpoint_timeout(server->quic_endpoint) / 1e3f;
-    if (timeout < 0.0001) {
-        timeout = 0.0001;
-    }
-    server->timer.repeat = timeout;
-    ev_timer_again(loop, &server->timer);
+    process_connections(server);
 }
 
 static void debug_log(const uint8_t *data, size_t data_len, void *argp) {
@@ -256,17 +480,30 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    // Set logger.
-    quic_set_logger(debug_log, NULL, "TRACE");
+    // Set logger, unless quiet mode is on (see server_log.h).
+    server_log_init();
+    if (!g_server_quiet) {
+        quic_set_logger(debug_log, NULL, "TRACE");
+    }
 
     // Create simple server.
     struct simple_server server;
     server.quic_endpoint = NULL;
     server.tls_config = NULL;
-    server.loop = NULL;
+    server.loop = ev_default_loop(0);
     quic_config_t *config = NULL;
     int ret = 0;
 
+    // Set up optional packet impairment (see net_impairment.h).
+    if (net_impairment_init(&server.send_impairment, server.loop,
+                            NET_IMPAIRMENT_ENV_SEND, impaired_send, NULL,
+                            &server) != 0 ||
+        net_impairment_init(&server.recv_impairment, server.loop,
+                            NET_IMPAIRMENT_ENV_RECV, deliver_packet,
+                            flush_delivered, &server) != 0) {
+        return -1;
+    }
+
     // Create socket.
     const char *host = argv[1];
     const char *port = argv[2];
@@ -306,7 +543,6 @@ int main(int argc, char *argv[]) {
     }
 
     // Start event loop.
-    server.loop = ev_default_loop(0);
     ev_init(&server.timer, timeout_callback);
     server.timer.data = &server;
 
@@ -329,6 +565,10 @@ EXIT:
     if (server.quic_endpoint != NULL) {
         quic_endpoint_free(server.quic_endpoint);
     }
+    net_impairment_print_stats(&server.send_impairment, "send");
+    net_impairment_print_stats(&server.recv_impairment, "recv");
+    net_impairment_free(&server.send_impairment);
+    net_impairment_free(&server.recv_impairment);
     if (server.loop != NULL) {
         ev_loop_destroy(server.loop);
     }
@@ -0,0 +1,155 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Short-lived cache of stat() results for the static file server.
+//
+// Clients that poll the same assets revalidate them constantly; with this
+// cache a revalidation answered with 304 costs no system call at all. The
+// table is direct-mapped (a colliding path replaces the slot), so lookups
+// and memory are O(1). Failed lookups (ENOENT etc.) are cached too.
+//
+// A result is reused for TQUIC_STAT_CACHE_TTL_MS milliseconds (default
+// 1000, 0 disables the cache), so a changed file may be seen up to that
+// long after the change. Not thread-safe: use it from the event loop
+// thread only.
+
+#ifndef STAT_CACHE_H
+#define STAT_CACHE_H
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define STAT_CACHE_ENV_TTL "TQUIC_STAT_CACHE_TTL_MS"
+#define STAT_CACHE_DEFAULT_TTL_MS 1000
+#define STAT_CACHE_SLOTS 1024
+
+struct stat_cache_slot {
+    char *path;  // NULL if unused
+    uint64_t hash;
+    int err;  // 0, or errno of the failed stat()
+    struct stat st;
+    uint64_t checked_ms;  // When stat() was called, monotonic
+};
+
+struct stat_cache_stats {
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct stat_cache {
+    struct stat_cache_slot slots[STAT_CACHE_SLOTS];
+    uint64_t ttl_ms;
+    struct stat_cache_stats stats;
+};
+
+static inline uint64_t stat_cache_hash(const char *path) {
+    uint64_t h = 14695981039346656037ULL;  // FNV-1a
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static inline uint64_t stat_cache_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline void stat_cache_init(struct stat_cache *cache) {
+    memset(cache, 0, sizeof(*cache));
+    cache->ttl_ms = STAT_CACHE_DEFAULT_TTL_MS;
+    const char *value = getenv(STAT_CACHE_ENV_TTL);
+    if (value != NULL && *value != '\0') {
+        char *end = NULL;
+        unsigned long long ttl = strtoull(value, &end, 10);
+        if (end == value || *end != '\0') {
+            fprintf(stderr, "%s: invalid value \"%s\", using %d\n",
+                    STAT_CACHE_ENV_TTL, value, STAT_CACHE_DEFAULT_TTL_MS);
+        } else {
+            cache->ttl_ms = ttl;
+        }
+    }
+}
+
+// Same contract as stat(2): returns 0 and fills `st`, or -1 with errno set.
+static inline int stat_cache_stat(struct stat_cache *cache, const char *path,
+                                  struct stat *st) {
+    cache->stats.lookups++;
+    if (cache->ttl_ms == 0) {
+        cache->stats.misses++;
+        return stat(path, st);
+    }
+
+    uint64_t hash = stat_cache_hash(path);
+    struct stat_cache_slot *slot = &cache->slots[hash % STAT_CACHE_SLOTS];
+    uint64_t now = stat_cache_now_ms();
+    if (slot->path != NULL && slot->hash == hash &&
+        now - slot->checked_ms < cache->ttl_ms && strcmp(slot->path, path) == 0) {
+        cache->stats.hits++;
+        if (slot->err != 0) {
+            errno = slot->err;
+            return -1;
+        }
+        *st = slot->st;
+        return 0;
+    }
+
+    cache->stats.misses++;
+    int ret = stat(path, st);
+    int err = ret == 0 ? 0 : errno;
+    if (slot->path == NULL || strcmp(slot->path, path) != 0) {
+        char *copy = strdup(path);
+        if (copy == NULL) {
+            errno = err;
+            return ret;
+        }
+        free(slot->path);
+        slot->path = copy;
+        slot->hash = hash;
+    }
+    slot->err = err;
+    if (ret == 0) {
+        slot->st = *st;
+    }
+    slot->checked_ms = now;
+    errno = err;
+    return ret;
+}
+
+static inline void stat_cache_print_stats(const struct stat_cache *cache) {
+    const struct stat_cache_stats *s = &cache->stats;
+    fprintf(stderr,
+            "stat cache: lookups=%" PRIu64 " hits=%" PRIu64 " (%.1f%%) misses=%" PRIu64
+            "\n",
+            s->lookups, s->hits, s->lookups ? 100.0 * s->hits / s->lookups : 0.0,
+            s->misses);
+}
+
+static inline void stat_cache_free(struct stat_cache *cache) {
+    for (size_t i = 0; i < STAT_CACHE_SLOTS; i++) {
+        free(cache->slots[i].path);
+        cache->slots[i].path = NULL;
+    }
+}
+
+#endif  // STAT_CACHE_H
@@ -22,11 +22,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <time.h>
 
+#include "hdr_histogram.h"
+#include "net_impairment.h"
+#include "ws_mask.h"
 #include "openssl/pem.h"
 #include "openssl/ssl.h"
 #include "openssl/x509.h"
@@ -35,6 +39,20 @@
 #define READ_BUF_SIZE 4096
 #define MAX_DATAGRAM_SIZE 1200
 
+// 基准测试模式的环境变量（设置 TQUIC_WS_BENCH 即启用）
+#define WS_BENCH_ENV "TQUIC_WS_BENCH"
+#define WS_BENCH_SIZE_ENV "TQUIC_WS_BENCH_SIZE"
+#define WS_BENCH_COUNT_ENV "TQUIC_WS_BENCH_COUNT"
+#define WS_BENCH_DURATION_ENV "TQUIC_WS_BENCH_DURATION"
+#define WS_BENCH_DEPTH_ENV "TQUIC_WS_BENCH_DEPTH"
+#define WS_BENCH_JSON_ENV "TQUIC_WS_BENCH_JSON"
+// 每条消息开头是十六进制的序号和发送时间戳，文本和二进制消息通用
+#define WS_BENCH_HEADER_LEN 32
+#define WS_BENCH_MAX_SIZE (16 * 1024 * 1024)
+#define WS_BENCH_MAX_DEPTH 4096
+// 超过该时间没有收到任何回显则放弃
+#define WS_BENCH_STALL_TIMEOUT 10.0
+
 // WebSocket 帧类型
 typedef enum {
     WS_FRAME_CONTINUATION = 0x0,
@@ -68,10 +86,45 @@ struct websocket_client {
     struct quic_tls_config_t *tls_config;
     struct ev_loop *loop;
     struct http3_config_t *h3_config;
+    struct net_impairment send_impairment;
+    struct net_impairment recv_impairment;
     uint64_t stream_id;
     websocket_state_t state;
     bool is_websocket;
     int message_count;
+    // 接收缓冲区：帧可能跨越多次读取，凑齐完整帧后再解析
+    uint8_t *rx_buf;
+    size_t rx_len;
+    size_t rx_cap;
+    // 发送积压：流量控制阻塞时未写出的字节，在 on_stream_writable 中继续发送
+    uint8_t *tx_buf;
+    size_t tx_len;
+    size_t tx_cap;
+    struct ws_bench *bench;
+};
+
+// 回显基准测试状态
+struct ws_bench {
+    uint8_t opcode;
+    size_t size;
+    uint64_t count;    // 消息总数，duration > 0 时不使用
+    double duration;   // 秒
+    uint64_t depth;    // 同时在途的消息数
+    const char *json_path;
+    uint8_t *payload;
+    uint8_t *frame;
+    uint64_t sent;
+    uint64_t received;
+    uint64_t errors;   // 序号不符或长度不符的回显
+    uint64_t last_received;
+    double start;
+    double end;
+    double cpu_start;  // 进程 CPU 时间（用户态 + 内核态），秒
+    double cpu_end;
+    double last_echo;
+    bool finished;
+    struct hdr_histogram *rtt;  // 微秒
+    ev_timer report_timer;
 };
 
 // WebSocket 帧结构
@@ -93,6 +146,7 @@ static void http3_on_stream_finished(void *ctx, uint64_t stream_id);
 static void http3_on_stream_reset(void *ctx, uint64_t stream_id, uint64_t error_code);
 static void http3_on_stream_priority_update(void *ctx, uint64_t stream_id);
 static void http3_on_conn_goaway(void *ctx, uint64_t stream_id);
+static void process_connections(struct websocket_client *client);
 
 // HTTP/3 事件处理器
 static const struct http3_methods_t http3_methods = {
@@ -104,11 +158,6 @@ static const struct http3_methods_t http3_methods = {
     .on_conn_goaway = http3_on_conn_goaway,
 };
 
-// 生成随机掩码
-static uint32_t generate_mask(void) {
-    return rand();
-}
-
 // 解析 WebSocket 帧
 static int parse_websocket_frame(const uint8_t *data, size_t len, struct websocket_frame *frame) {
     if (len < 2) return -1;
@@ -195,41 +244,78 @@ static int create_websocket_frame(uint8_t opcode, const uint8_t *payload, size_t
         header_len = 10;
     }
     
-    uint32_t masking_key = 0;
+    const uint8_t *key = NULL;
     if (mask) {
         if (output_len < header_len + 4) return -1;
-        masking_key = generate_mask();
-        output[header_len] = (masking_key >> 24) & 0xFF;
-        output[header_len + 1] = (masking_key >> 16) & 0xFF;
-        output[header_len + 2] = (masking_key >> 8) & 0xFF;
-        output[header_len + 3] = masking_key & 0xFF;
+        // 掩码键来自按批补充的 CSPRNG 池，见 ws_mask.h
+        ws_mask_key(output + header_len);
+        key = output + header_len;
         header_len += 4;
     }
     
     if (output_len < header_len + payload_len) return -1;
     
     if (payload && payload_len > 0) {
-        memcpy(output + header_len, payload, payload_len);
-        
-        // 应用掩码 - 修复字节序问题
+        // 复制和掩码合并为一次遍历
         if (mask) {
-            // 将masking_key转换为正确的字节序
-            uint8_t mask_bytes[4] = {
-                (masking_key >> 24) & 0xFF,
-                (masking_key >> 16) & 0xFF,
-                (masking_key >> 8) & 0xFF,
-                masking_key & 0xFF
-            };
-
-            for (size_t i = 0; i < payload_len; i++) {
-                output[header_len + i] ^= mask_bytes[i % 4];
-            }
+            ws_mask_copy(output + header_len, payload, payload_len, key, 0);
+        } else {
+            memcpy(output + header_len, payload, payload_len);
         }
     }
     
     return header_len + payload_len;
 }
 
+// 追加到缓冲区，按需扩容
+static int buffer_append(uint8_t **buf, size_t *len, size_t *cap,
+                         const uint8_t *data, size_t data_len) {
+    if (*len + data_len > *cap) {
+        size_t new_cap = *cap ? *cap : 4096;
+        while (new_cap < *len + data_len) {
+            new_cap *= 2;
+        }
+        uint8_t *new_buf = realloc(*buf, new_cap);
+        if (!new_buf) return -1;
+        *buf = new_buf;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, data, data_len);
+    *len += data_len;
+    return 0;
+}
+
+// 尽量写出发送积压，返回 -1 表示发送出错
+static int flush_tx(struct websocket_client *client) {
+    size_t offset = 0;
+    while (offset < client->tx_len) {
+        ssize_t written = http3_send_body(client->h3_conn, client->quic_conn, client->stream_id,
+                                          client->tx_buf + offset, client->tx_len - offset,
+                                          false);
+        if (written == HTTP3_ERR_DONE || written == 0) {
+            break;
+        }
+        if (written < 0) {
+            fprintf(stderr, "Failed to send WebSocket data: %ld\n", written);
+            return -1;
+        }
+        offset += written;
+    }
+    memmove(client->tx_buf, client->tx_buf + offset, client->tx_len - offset);
+    client->tx_len -= offset;
+    quic_stream_wantwrite(client->quic_conn, client->stream_id, client->tx_len > 0);
+    return 0;
+}
+
+// 按顺序发送一个完整的帧：已有积压时排在积压之后，写不完的部分进入积压
+static int write_frame(struct websocket_client *client, const uint8_t *frame, size_t len) {
+    if (buffer_append(&client->tx_buf, &client->tx_len, &client->tx_cap, frame, len) != 0) {
+        fprintf(stderr, "Failed to buffer WebSocket frame\n");
+        return -1;
+    }
+    return flush_tx(client);
+}
+
 // 发送 WebSocket 消息
 static void send_websocket_message(struct websocket_client *client, uint8_t opcode,
                                   const char *message, size_t message_len) {
@@ -239,20 +325,247 @@ static void send_websocket_message(struct websocket_client *client, uint8_t opco
     int frame_len = create_websocket_frame(opcode, (const uint8_t *)message, message_len,
                                           true, true, frame, sizeof(frame));
     
-    if (frame_len > 0) {
-        ssize_t written = http3_send_body(client->h3_conn, client->quic_conn, 
-                                        client->stream_id, frame, frame_len, false);
-        if (written > 0) {
-            fprintf(stderr, "WebSocket message sent: %.*s\n", (int)message_len, message);
-        } else {
-            fprintf(stderr, "Failed to send WebSocket message: %ld\n", written);
+    if (frame_len > 0 && write_frame(client, frame, frame_len) == 0) {
+        fprintf(stderr, "WebSocket message sent: %.*s\n", (int)message_len, message);
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 从环境变量读取基准测试配置，未启用时返回 NULL
+static struct ws_bench *bench_from_env(void) {
+    const char *mode = getenv(WS_BENCH_ENV);
+    if (!mode || !*mode) return NULL;
+
+    struct ws_bench *bench = calloc(1, sizeof(*bench));
+    if (!bench) return NULL;
+    bench->opcode = strcmp(mode, "binary") == 0 ? WS_FRAME_BINARY : WS_FRAME_TEXT;
+    bench->size = 64;
+    bench->count = 10000;
+    bench->depth = 1;
+
+    const char *value;
+    if ((value = getenv(WS_BENCH_SIZE_ENV))) bench->size = strtoull(value, NULL, 10);
+    if ((value = getenv(WS_BENCH_COUNT_ENV))) bench->count = strtoull(value, NULL, 10);
+    if ((value = getenv(WS_BENCH_DURATION_ENV))) bench->duration = atof(value);
+    if ((value = getenv(WS_BENCH_DEPTH_ENV))) bench->depth = strtoull(value, NULL, 10);
+    bench->json_path = getenv(WS_BENCH_JSON_ENV);
+
+    if (strcmp(mode, "text") != 0 && strcmp(mode, "binary") != 0) {
+        fprintf(stderr, "%s: expected text or binary\n", WS_BENCH_ENV);
+    } else if (bench->size < WS_BENCH_HEADER_LEN || bench->size > WS_BENCH_MAX_SIZE) {
+        fprintf(stderr, "%s: message size must be %d-%d bytes\n", WS_BENCH_SIZE_ENV,
+                WS_BENCH_HEADER_LEN, WS_BENCH_MAX_SIZE);
+    } else if (bench->depth < 1 || bench->depth > WS_BENCH_MAX_DEPTH) {
+        fprintf(stderr, "%s: depth must be 1-%d\n", WS_BENCH_DEPTH_ENV, WS_BENCH_MAX_DEPTH);
+    } else if (bench->duration < 0 || (bench->duration == 0 && bench->count == 0)) {
+        fprintf(stderr, "invalid benchmark count or duration\n");
+    } else {
+        bench->payload = malloc(bench->size);
+        bench->frame = malloc(bench->size + 14);
+        bench->rtt = hdr_histogram_new();
+        if (bench->payload && bench->frame && bench->rtt) {
+            // 填充部分使用可打印字符，文本消息也是合法的 UTF-8
+            for (size_t i = 0; i < bench->size; i++) {
+                bench->payload[i] = 'a' + i % 26;
+            }
+            return bench;
         }
     }
+    free(bench->payload);
+    free(bench->frame);
+    free(bench->rtt);
+    free(bench);
+    return NULL;
+}
+
+static void bench_free(struct ws_bench *bench) {
+    if (!bench) return;
+    free(bench->payload);
+    free(bench->frame);
+    free(bench->rtt);
+    free(bench);
+}
+
+static double cpu_seconds(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static bool bench_more_to_send(struct ws_bench *bench) {
+    if (bench->duration > 0) {
+        return now_seconds() < bench->start + bench->duration;
+    }
+    return bench->sent < bench->count;
+}
+
+// 保持 depth 条消息在途；消息头记录序号和发送时间，回显后据此计算 RTT
+static void bench_fill(struct websocket_client *client) {
+    struct ws_bench *bench = client->bench;
+    while (client->state == WS_STATE_OPEN && bench->sent - bench->received < bench->depth &&
+           bench_more_to_send(bench)) {
+        char header[WS_BENCH_HEADER_LEN + 1];
+        snprintf(header, sizeof(header), "%016" PRIx64 "%016" PRIx64, bench->sent, now_ns());
+        memcpy(bench->payload, header, WS_BENCH_HEADER_LEN);
+
+        int frame_len = create_websocket_frame(bench->opcode, bench->payload, bench->size,
+                                               true, true, bench->frame, bench->size + 14);
+        if (frame_len < 0 || write_frame(client, bench->frame, frame_len) != 0) {
+            bench->errors++;
+            return;
+        }
+        bench->sent++;
+    }
+}
+
+static void bench_print_report(struct ws_bench *bench, FILE *out) {
+    double elapsed = bench->end - bench->start;
+    fprintf(out, "ws bench: %s, %zu byte messages, depth %" PRIu64 "\n",
+            bench->opcode == WS_FRAME_TEXT ? "text" : "binary", bench->size, bench->depth);
+    fprintf(out, "messages:   sent=%" PRIu64 " echoed=%" PRIu64 " errors=%" PRIu64 "\n",
+            bench->sent, bench->received, bench->errors);
+    fprintf(out, "throughput: %.1f msgs/s, %.2f Mbit/s each way over %.2f s\n",
+            bench->received / elapsed, bench->received * bench->size * 8 / elapsed / 1e6,
+            elapsed);
+    double cpu = bench->cpu_end - bench->cpu_start;
+    fprintf(out, "cpu:        %.3f s (%.0f%%), %.2f us per message\n", cpu,
+            elapsed > 0 ? cpu / elapsed * 100 : 0, bench->sent ? cpu / bench->sent * 1e6 : 0);
+    hdr_histogram_print(out, "echo rtt", bench->rtt, 1e-3, "ms");
+}
+
+static int bench_write_json(struct ws_bench *bench, const char *file) {
+    FILE *out = strcmp(file, "-") == 0 ? stdout : fopen(file, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    double elapsed = bench->end - bench->start;
+    fprintf(out,
+            "{\"type\": \"%s\", \"size\": %zu, \"depth\": %" PRIu64 ", "
+            "\"sent\": %" PRIu64 ", \"echoed\": %" PRIu64 ", \"errors\": %" PRIu64 ",\n"
+            " \"elapsed_s\": %.3f, \"msgs_per_s\": %.3f, \"mbps\": %.3f,\n"
+            " \"cpu_s\": %.3f, \"cpu_us_per_msg\": %.3f,\n"
+            " \"rtt_us\": ",
+            bench->opcode == WS_FRAME_TEXT ? "text" : "binary", bench->size, bench->depth,
+            bench->sent, bench->received, bench->errors, elapsed, bench->received / elapsed,
+            bench->received * bench->size * 8 / elapsed / 1e6, bench->cpu_end - bench->cpu_start,
+            bench->sent ? (bench->cpu_end - bench->cpu_start) / bench->sent * 1e6 : 0);
+    hdr_histogram_print_json(out, bench->rtt);
+    fprintf(out, "}\n");
+    if (out != stdout) fclose(out);
+    return 0;
+}
+
+// 结束测试：输出结果，发送关闭帧并关闭连接
+static void bench_finish(struct websocket_client *client, const char *reason) {
+    struct ws_bench *bench = client->bench;
+    if (bench->finished) return;
+    bench->finished = true;
+    bench->end = now_seconds();
+    bench->cpu_end = cpu_seconds();
+    ev_timer_stop(client->loop, &bench->report_timer);
+
+    if (reason) {
+        fprintf(stderr, "Benchmark aborted: %s\n", reason);
+    }
+    bench_print_report(bench, stdout);
+    if (bench->json_path) {
+        bench_write_json(bench, bench->json_path);
+    }
+
+    send_websocket_message(client, WS_FRAME_CLOSE, "", 0);
+    client->state = WS_STATE_CLOSING;
+    const char *close_reason = "benchmark done";
+    quic_conn_close(client->quic_conn, true, 0, (const uint8_t *)close_reason,
+                    strlen(close_reason));
+}
+
+// 处理一条回显：校验序号（回显保持发送顺序）并记录 RTT
+static void bench_on_echo(struct websocket_client *client, struct websocket_frame *frame) {
+    struct ws_bench *bench = client->bench;
+    if (bench->finished || frame->opcode != bench->opcode) return;
+
+    char field[17];
+    uint64_t seq = UINT64_MAX, sent_ns = 0;
+    if (frame->payload_len == bench->size) {
+        memcpy(field, frame->payload, 16);
+        field[16] = '\0';
+        seq = strtoull(field, NULL, 16);
+        memcpy(field, frame->payload + 16, 16);
+        sent_ns = strtoull(field, NULL, 16);
+    }
+    if (seq != bench->received) {
+        bench->errors++;
+    } else {
+        hdr_histogram_record(bench->rtt, (now_ns() - sent_ns) / 1000);
+    }
+    bench->received++;
+    bench->last_echo = now_seconds();
+
+    if (!bench_more_to_send(bench) && bench->received >= bench->sent) {
+        bench_finish(client, NULL);
+    } else {
+        bench_fill(client);
+    }
+}
+
+// 每秒输出一次进度，并检测回显是否停滞
+static void bench_report_callback(EV_P_ ev_timer *w, int revents) {
+    struct websocket_client *client = w->data;
+    struct ws_bench *bench = client->bench;
+    double now = now_seconds();
+    fprintf(stderr, "[%6.1f s] %8" PRIu64 " msgs/s, %" PRIu64 " echoed, %" PRIu64 " in flight\n",
+            now - bench->start, bench->received - bench->last_received, bench->received,
+            bench->sent - bench->received);
+    bench->last_received = bench->received;
+
+    if (now - bench->last_echo > WS_BENCH_STALL_TIMEOUT) {
+        bench_finish(client, "no echo received for too long");
+    } else if (!bench_more_to_send(bench) && bench->received >= bench->sent) {
+        bench_finish(client, NULL);
+    }
+    process_connections(client);
+}
+
+static void bench_start(struct websocket_client *client) {
+    struct ws_bench *bench = client->bench;
+    if (bench->duration > 0) {
+        fprintf(stderr, "Benchmark: %s messages of %zu bytes for %.1f s, depth %" PRIu64 "\n",
+                bench->opcode == WS_FRAME_TEXT ? "text" : "binary", bench->size,
+                bench->duration, bench->depth);
+    } else {
+        fprintf(stderr, "Benchmark: %" PRIu64 " %s messages of %zu bytes, depth %" PRIu64 "\n",
+                bench->count, bench->opcode == WS_FRAME_TEXT ? "text" : "binary", bench->size,
+                bench->depth);
+    }
+    bench->start = bench->last_echo = now_seconds();
+    bench->cpu_start = cpu_seconds();
+    ev_timer_init(&bench->report_timer, bench_report_callback, 1.0, 1.0);
+    bench->report_timer.data = client;
+    ev_timer_start(client->loop, &bench->report_timer);
+    bench_fill(client);
 }
 
 // 处理 WebSocket 消息
 static void handle_websocket_message(struct websocket_client *client,
                                    struct websocket_frame *frame) {
+    if (client->bench && (frame->opcode == WS_FRAME_TEXT || frame->opcode == WS_FRAME_BINARY)) {
+        bench_on_echo(client, frame);
+        return;
+    }
+
     switch (frame->opcode) {
         case WS_FRAME_TEXT:
             fprintf(stderr, "Received WebSocket text: %.*s\n", 
@@ -300,6 +613,11 @@ static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
         client->state = WS_STATE_OPEN;
         fprintf(stderr, "WebSocket connection established!\n");
         
+        if (client->bench) {
+            bench_start(client);
+            return;
+        }
+
         // 发送第一条消息
         send_websocket_message(client, WS_FRAME_TEXT, "Hello from TQUIC WebSocket client!", 34);
     }
@@ -328,11 +646,17 @@ static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
             break;
         }
 
-        // 解析 WebSocket 帧
+        if (buffer_append(&client->rx_buf, &client->rx_len, &client->rx_cap, buf, read) != 0) {
+            fprintf(stderr, "Failed to buffer WebSocket data\n");
+            return;
+        }
+
+        // 解析 WebSocket 帧，不完整的帧留在缓冲区等待后续数据
         size_t offset = 0;
-        while (offset < (size_t)read) {
+        while (offset < client->rx_len) {
             struct websocket_frame frame;
-            int frame_len = parse_websocket_frame(buf + offset, read - offset, &frame);
+            int frame_len = parse_websocket_frame(client->rx_buf + offset,
+                                                  client->rx_len - offset, &frame);
             
             if (frame_len < 0) {
                 break; // 需要更多数据
@@ -341,6 +665,8 @@ static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
             handle_websocket_message(client, &frame);
             offset += frame_len;
         }
+        memmove(client->rx_buf, client->rx_buf + offset, client->rx_len - offset);
+        client->rx_len -= offset;
         
         if (fin) {
             break;
@@ -437,12 +763,17 @@ void client_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
     
     fprintf(stderr, "WebSocket client connection closed\n");
     
+    if (client->bench && !client->bench->finished) {
+        bench_finish(client, "connection closed");
+    }
+
     if (client->h3_conn) {
         http3_conn_free(client->h3_conn);
         client->h3_conn = NULL;
     }
     
     client->state = WS_STATE_CLOSED;
+    ev_break(client->loop, EVBREAK_ALL);
 }
 
 void client_on_stream_created(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
@@ -458,6 +789,16 @@ void client_on_stream_readable(void *tctx, struct quic_conn_t *conn, uint64_t st
 }
 
 void client_on_stream_writable(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
+    struct websocket_client *client = tctx;
+
+    // 继续发送积压的帧，积压清空后补充新的基准测试消息
+    if (client->h3_conn && stream_id == client->stream_id && client->tx_len > 0) {
+        if (flush_tx(client) == 0 && client->tx_len == 0 && client->bench &&
+            !client->bench->finished) {
+            bench_fill(client);
+        }
+        return;
+    }
     quic_stream_wantwrite(conn, stream_id, false);
 }
 
@@ -468,6 +809,9 @@ void client_on_stream_closed(void *tctx, struct quic_conn_t *conn, uint64_t stre
 // 数据包发送处理器
 int client_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts, unsigned int count) {
     struct websocket_client *client = psctx;
+    if (client->send_impairment.enabled) {
+        return net_impairment_send_packets(&client->send_impairment, pkts, count);
+    }
     
     unsigned int sent_count = 0;
     for (unsigned int i = 0; i < count; i++) {
@@ -505,6 +849,48 @@ const struct quic_packet_send_methods_t quic_packet_send_methods = {
     .on_packets_send = client_on_packets_send,
 };
 
+// 发送经过损伤模拟层延迟后的数据包
+static void impaired_send(void *ctx, const uint8_t *data, size_t len,
+                          const struct sockaddr *addr, socklen_t addr_len) {
+    struct websocket_client *client = ctx;
+    ssize_t sent = sendto(client->sock, data, len, 0, addr, addr_len);
+    if (sent != (ssize_t)len) {
+        fprintf(stderr, "impaired send failed: %s\n", strerror(errno));
+    }
+}
+
+// 将收到的（可能被延迟的）数据包交给 QUIC 端点
+static void deliver_packet(void *ctx, const uint8_t *data, size_t len,
+                           const struct sockaddr *addr, socklen_t addr_len) {
+    struct websocket_client *client = ctx;
+    struct quic_packet_info_t pkt_info = {
+        .src = addr,
+        .src_len = addr_len,
+        .dst = (struct sockaddr *)&client->local_addr,
+        .dst_len = client->local_addr_len,
+    };
+    int processed = quic_endpoint_recv(client->quic_endpoint, (uint8_t *)data, len, &pkt_info);
+    if (processed < 0) {
+        fprintf(stderr, "quic_endpoint_recv failed: %d\n", processed);
+    }
+}
+
+// 处理连接并根据 QUIC 端点的下一个超时时间更新 timer
+static void process_connections(struct websocket_client *client) {
+    quic_endpoint_process_connections(client->quic_endpoint);
+    double timeout = quic_endpoint_timeout(client->quic_endpoint) / 1e3f;
+    if (timeout < 0.0001) {
+        timeout = 0.0001;
+    }
+    client->timer.repeat = timeout;
+    ev_timer_again(client->loop, &client->timer);
+}
+
+// 延迟数据包投递完成后处理连接并更新 timer
+static void flush_delivered(void *ctx) {
+    process_connections(ctx);
+}
+
 // 网络事件处理
 static void read_callback(EV_P_ ev_io *w, int revents) {
     struct websocket_client *client = w->data;
@@ -525,30 +911,18 @@ static void read_callback(EV_P_ ev_io *w, int revents) {
             return;
         }
         
-        struct quic_packet_info_t pkt_info = {
-            .src = (struct sockaddr *)&peer_addr,
-            .src_len = peer_addr_len,
-            .dst = (struct sockaddr *)&client->local_addr,  // 修复：设置本地地址
-            .dst_len = client->local_addr_len,
-        };
-        int processed = quic_endpoint_recv(client->quic_endpoint, buf, read, &pkt_info);
-        if (processed < 0) {
-            fprintf(stderr, "quic_endpoint_recv failed: %d\n", processed);
-        }
+        net_impairment_submit(&client->recv_impairment, buf, read,
+                              (struct sockaddr *)&peer_addr, peer_addr_len);
     }
+
+    process_connections(client);
 }
 
+// 超时处理：先让 QUIC 端点处理到期的定时器（重传、空闲超时等），再处理连接
 static void timeout_callback(EV_P_ ev_timer *w, int revents) {
     struct websocket_client *client = w->data;
-    quic_endpoint_process_connections(client->quic_endpoint);
-    
-    uint64_t timeout = quic_endpoint_timeout(client->quic_endpoint);
-    if (timeout == UINT64_MAX) {
-        ev_timer_stop(EV_A_ w);
-    } else {
-        w->repeat = (double)timeout / 1000000.0;
-        ev_timer_again(EV_A_ w);
-    }
+    quic_endpoint_on_timeout(client->quic_endpoint);
+    process_connections(client);
 }
 
 // 定期发送消息
@@ -619,10 +993,25 @@ int main(int argc, char *argv[]) {
     memset(&client, 0, sizeof(client));
     
     // 初始化随机数生成器
-    srand(time(NULL));
+
+    // 可选的回显基准测试模式
+    if (getenv(WS_BENCH_ENV)) {
+        client.bench = bench_from_env();
+        if (!client.bench) {
+            return 1;
+        }
+    }
     
     // 创建事件循环
     client.loop = EV_DEFAULT;
+
+    // 可选的网络损伤模拟（参见 net_impairment.h）
+    if (net_impairment_init(&client.send_impairment, client.loop, NET_IMPAIRMENT_ENV_SEND,
+                            impaired_send, NULL, &client) != 0 ||
+        net_impairment_init(&client.recv_impairment, client.loop, NET_IMPAIRMENT_ENV_RECV,
+                            deliver_packet, flush_delivered, &client) != 0) {
+        return 1;
+    }
     
     // 创建套接字
     struct addrinfo *remote = NULL;
@@ -693,17 +1082,14 @@ int main(int argc, char *argv[]) {
     client.timer.data = &client;
 
     // 立即处理连接并启动 timer（关键修复）
-    quic_endpoint_process_connections(client.quic_endpoint);
-    double timeout = quic_endpoint_timeout(client.quic_endpoint) / 1e3f;
-    if (timeout < 0.0001) {
-        timeout = 0.0001;
-    }
-    client.timer.repeat = timeout;
-    ev_timer_again(client.loop, &client.timer);
+    process_connections(&client);
     
-    ev_timer_init(&client.message_timer, message_callback, 2.0, 0.0);
-    client.message_timer.data = &client;
-    ev_timer_start(client.loop, &client.message_timer);
+    // 基准测试模式不发送固定的测试消息
+    if (!client.bench) {
+        ev_timer_init(&client.message_timer, message_callback, 2.0, 0.0);
+        client.message_timer.data = &client;
+        ev_timer_start(client.loop, &client.message_timer);
+    }
     
     printf("TQUIC WebSocket Client connecting to %s:%s\n", host, port);
     
@@ -712,11 +1098,18 @@ int main(int argc, char *argv[]) {
     
     // 清理
     if (remote) freeaddrinfo(remote);
+    net_impairment_print_stats(&client.send_impairment, "send");
+    net_impairment_print_stats(&client.recv_impairment, "recv");
+    net_impairment_free(&client.send_impairment);
+    net_impairment_free(&client.recv_impairment);
     quic_endpoint_free(client.quic_endpoint);
     quic_config_free(config);
     quic_tls_config_free(client.tls_config);
     http3_config_free(client.h3_config);
     close(client.sock);
+    free(client.rx_buf);
+    free(client.tx_buf);
+    bench_free(client.bench);
     
     return 0;
 }
@@ -1,5 +1,14 @@
 // 交互式 TQUIC WebSocket 客户端
 // 支持用户输入消息进行双向通信
+//
+// 回放模式：设置 TQUIC_WS_REPLAY=<日志文件> 后不读取标准输入，而是按日志中的时间戳
+// 重放录制的消息，并记录每条回复及其延迟，用于在测试环境复现线上流量突发。
+// 日志每行一条消息，空行和 # 开头的行被忽略：
+//
+//   <时间戳（秒）> text <文本内容>
+//   <时间戳（秒）> binary <base64 编码的二进制内容>
+//
+// 时间戳只取相对值（减去第一条的时间戳），因此可以直接使用 Unix 时间。
 
 #include <errno.h>
 #include <ev.h>
@@ -16,11 +25,24 @@
 #include <unistd.h>
 #include <time.h>
 
+#include "hdr_histogram.h"
+#include "net_impairment.h"
 #include "tquic.h"
+#include "ws_mask.h"
 
 #define READ_BUF_SIZE 4096
 #define MAX_DATAGRAM_SIZE 1200
 
+// 回放模式的环境变量（设置 TQUIC_WS_REPLAY 即启用）
+#define WS_REPLAY_ENV "TQUIC_WS_REPLAY"
+// 回放速度倍数：1 为原始节奏，2 为两倍速，0 为不等待、尽快发送
+#define WS_REPLAY_SPEED_ENV "TQUIC_WS_REPLAY_SPEED"
+// 回复记录文件，未设置时输出到标准输出
+#define WS_REPLAY_OUTPUT_ENV "TQUIC_WS_REPLAY_OUTPUT"
+// 最后一条消息发出后等待回复的秒数
+#define WS_REPLAY_WAIT_ENV "TQUIC_WS_REPLAY_WAIT"
+#define WS_REPLAY_DEFAULT_WAIT 5.0
+
 // WebSocket 帧类型
 #define WS_FRAME_CONTINUATION 0x0
 #define WS_FRAME_TEXT         0x1
@@ -51,10 +73,50 @@ struct websocket_client {
     struct quic_tls_config_t *tls_config;
     struct ev_loop *loop;
     struct http3_config_t *h3_config;
+    struct net_impairment send_impairment;
+    struct net_impairment recv_impairment;
     uint64_t stream_id;
     websocket_state_t state;
     bool is_websocket;
     bool connected;
+    // 接收缓冲区：帧可能跨越多次读取
+    uint8_t *rx_buf;
+    size_t rx_len;
+    size_t rx_cap;
+    // 发送积压：流量控制阻塞时未写出的数据，在 on_stream_writable 中按序继续发送
+    uint8_t *tx_buf;
+    size_t tx_len;
+    size_t tx_cap;
+    // 回放模式状态，交互模式下为 NULL
+    struct ws_replay *replay;
+};
+
+// 回放日志中的一条消息
+struct replay_entry {
+    double at;        // 相对第一条消息的时间（秒）
+    uint8_t opcode;   // WS_FRAME_TEXT 或 WS_FRAME_BINARY
+    uint8_t *data;
+    size_t len;
+    double sent_at;   // 实际发送时间，用于计算回复延迟
+};
+
+// 回放状态
+struct ws_replay {
+    struct replay_entry *entries;
+    size_t count;
+    size_t next;      // 下一条待发送的消息
+    size_t answered;  // 按顺序匹配回复：下一条回复对应的消息
+    double speed;
+    double wait;
+    FILE *out;
+    double start;
+    bool finished;
+    uint64_t received;
+    uint64_t unmatched;  // 没有对应请求的回复（例如服务器主动推送）
+    uint64_t errors;
+    struct hdr_histogram *latency;  // 微秒
+    ev_timer send_timer;
+    ev_timer wait_timer;
 };
 
 // WebSocket 帧结构
@@ -96,11 +158,6 @@ static const struct http3_methods_t http3_methods = {
     .on_conn_goaway = http3_on_conn_goaway,
 };
 
-// 生成随机掩码
-static uint32_t generate_mask(void) {
-    return rand();
-}
-
 // 解析 WebSocket 帧
 static int parse_websocket_frame(const uint8_t *data, size_t len, struct websocket_frame *frame) {
     if (len < 2) return -1;
@@ -188,18 +245,10 @@ static int create_websocket_frame(uint8_t opcode, const uint8_t *payload, size_t
     
     size_t payload_offset = header_len;
     if (mask) {
-        uint32_t masking_key = generate_mask();
-        payload_offset -= 4;
-        frame[payload_offset] = (masking_key >> 24) & 0xFF;
-        frame[payload_offset + 1] = (masking_key >> 16) & 0xFF;
-        frame[payload_offset + 2] = (masking_key >> 8) & 0xFF;
-        frame[payload_offset + 3] = masking_key & 0xFF;
-        payload_offset += 4;
-        
-        // 复制并掩码载荷
-        for (size_t i = 0; i < payload_len; i++) {
-            frame[payload_offset + i] = payload[i] ^ ((uint8_t *)&masking_key)[i % 4];
-        }
+        // 掩码键来自按批补充的 CSPRNG 池，复制和掩码合并为一次遍历，见 ws_mask.h
+        uint8_t *key = frame + payload_offset - 4;
+        ws_mask_key(key);
+        ws_mask_copy(frame + payload_offset, payload, payload_len, key, 0);
     } else {
         memcpy(frame + payload_offset, payload, payload_len);
     }
@@ -207,6 +256,64 @@ static int create_websocket_frame(uint8_t opcode, const uint8_t *payload, size_t
     return header_len + payload_len;
 }
 
+// 追加到缓冲区，按需扩容
+static int buffer_append(uint8_t **buf, size_t *len, size_t *cap,
+                         const uint8_t *data, size_t data_len) {
+    if (*len + data_len > *cap) {
+        size_t new_cap = *cap ? *cap : 4096;
+        while (new_cap < *len + data_len) {
+            new_cap *= 2;
+        }
+        uint8_t *new_buf = realloc(*buf, new_cap);
+        if (!new_buf) return -1;
+        *buf = new_buf;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, data, data_len);
+    *len += data_len;
+    return 0;
+}
+
+// 尽量写出发送积压，返回 -1 表示发送出错
+static int flush_tx(struct websocket_client *client) {
+    if (!client->h3_conn || !client->quic_conn) return -1;
+    size_t offset = 0;
+    while (offset < client->tx_len) {
+        ssize_t written = http3_send_body(client->h3_conn, client->quic_conn, client->stream_id,
+                                          client->tx_buf + offset, client->tx_len - offset,
+                                          false);
+        if (written == HTTP3_ERR_DONE || written == 0) {
+            break;
+        }
+        if (written < 0) {
+            printf("Failed to send message: %ld\n", written);
+            return -1;
+        }
+        offset += written;
+    }
+    memmove(client->tx_buf, client->tx_buf + offset, client->tx_len - offset);
+    client->tx_len -= offset;
+    quic_stream_wantwrite(client->quic_conn, client->stream_id, client->tx_len > 0);
+    return 0;
+}
+
+// 构造并按序发送一个帧：写不完的部分进入发送积压
+static int send_frame(struct websocket_client *client, uint8_t opcode,
+                      const uint8_t *payload, size_t payload_len) {
+    size_t frame_size = payload_len + 14;
+    uint8_t *frame = malloc(frame_size);
+    if (!frame) return -1;
+    int frame_len = create_websocket_frame(opcode, payload, payload_len, true, true,
+                                           frame, frame_size);
+    int ret = -1;
+    if (frame_len > 0 &&
+        buffer_append(&client->tx_buf, &client->tx_len, &client->tx_cap, frame, frame_len) == 0) {
+        ret = flush_tx(client);
+    }
+    free(frame);
+    return ret;
+}
+
 // 发送 WebSocket 消息
 static void send_websocket_message(struct websocket_client *client, uint8_t opcode,
                                   const char *message, size_t message_len) {
@@ -215,24 +322,320 @@ static void send_websocket_message(struct websocket_client *client, uint8_t opco
         return;
     }
     
-    uint8_t frame[READ_BUF_SIZE];
-    int frame_len = create_websocket_frame(opcode, (const uint8_t *)message, message_len,
-                                          true, true, frame, sizeof(frame));
-    
-    if (frame_len > 0) {
-        ssize_t written = http3_send_body(client->h3_conn, client->quic_conn, 
-                                        client->stream_id, frame, frame_len, false);
-        if (written > 0) {
-            printf("Sent: %.*s\n", (int)message_len, message);
-        } else {
-            printf("Failed to send message: %ld\n", written);
+    if (send_frame(client, opcode, (const uint8_t *)message, message_len) == 0 &&
+        !client->replay) {
+        printf("Sent: %.*s\n", (int)message_len, message);
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void process_connections(struct websocket_client *client);
+
+static const char BASE64_CHARS[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Base64 解码，忽略结尾的 '='；返回解码后的长度，输入非法时返回 -1
+static ssize_t base64_decode(const char *in, size_t len, uint8_t *out) {
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == '=') break;
+        const char *p = memchr(BASE64_CHARS, in[i], 64);
+        if (!p || in[i] == '\0') return -1;
+        acc = (acc << 6) | (uint32_t)(p - BASE64_CHARS);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out[n++] = (acc >> bits) & 0xFF;
         }
     }
+    return n;
+}
+
+static void base64_write(FILE *out, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < len) v |= data[i + 1] << 8;
+        if (i + 2 < len) v |= data[i + 2];
+        fputc(BASE64_CHARS[(v >> 18) & 0x3F], out);
+        fputc(BASE64_CHARS[(v >> 12) & 0x3F], out);
+        fputc(i + 1 < len ? BASE64_CHARS[(v >> 6) & 0x3F] : '=', out);
+        fputc(i + 2 < len ? BASE64_CHARS[v & 0x3F] : '=', out);
+    }
+}
+
+static void replay_free(struct ws_replay *replay) {
+    if (!replay) return;
+    for (size_t i = 0; i < replay->count; i++) {
+        free(replay->entries[i].data);
+    }
+    free(replay->entries);
+    if (replay->out && replay->out != stdout) fclose(replay->out);
+    free(replay->latency);
+    free(replay);
+}
+
+// 解析一行日志，返回 1 表示得到一条消息，0 表示空行或注释，-1 表示格式错误
+static int replay_parse_line(char *line, size_t len, struct replay_entry *entry) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        line[--len] = '\0';
+    }
+    if (len == 0 || line[0] == '#') return 0;
+
+    char *end;
+    entry->at = strtod(line, &end);
+    if (end == line || *end != ' ') return -1;
+    char *kind = end + 1;
+    char *payload = strchr(kind, ' ');
+    size_t payload_len = 0;
+    if (payload) {
+        *payload++ = '\0';
+        payload_len = line + len - payload;
+    } else {
+        payload = line + len;
+    }
+
+    entry->data = malloc(payload_len + 1);
+    if (!entry->data) return -1;
+    if (strcmp(kind, "text") == 0) {
+        entry->opcode = WS_FRAME_TEXT;
+        memcpy(entry->data, payload, payload_len);
+        entry->len = payload_len;
+    } else if (strcmp(kind, "binary") == 0) {
+        entry->opcode = WS_FRAME_BINARY;
+        ssize_t n = base64_decode(payload, payload_len, entry->data);
+        if (n < 0) {
+            free(entry->data);
+            return -1;
+        }
+        entry->len = n;
+    } else {
+        free(entry->data);
+        return -1;
+    }
+    return 1;
+}
+
+// 读取回放日志，行长度不受限制
+static int replay_load(struct ws_replay *replay, const char *path) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    size_t cap = 0;
+    unsigned long line_no = 0;
+    int ret = 0;
+    while ((line_len = getline(&line, &line_cap, in)) >= 0) {
+        line_no++;
+        struct replay_entry entry;
+        memset(&entry, 0, sizeof(entry));
+        int r = replay_parse_line(line, line_len, &entry);
+        if (r == 0) continue;
+        if (r < 0) {
+            fprintf(stderr, "%s:%lu: expected \"<seconds> text|binary <payload>\"\n", path,
+                    line_no);
+            ret = -1;
+            break;
+        }
+        if (replay->count == cap) {
+            cap = cap ? cap * 2 : 256;
+            struct replay_entry *entries = realloc(replay->entries, cap * sizeof(*entries));
+            if (!entries) {
+                free(entry.data);
+                ret = -1;
+                break;
+            }
+            replay->entries = entries;
+        }
+        replay->entries[replay->count++] = entry;
+    }
+    free(line);
+    fclose(in);
+    if (ret == 0 && replay->count == 0) {
+        fprintf(stderr, "%s: no messages to replay\n", path);
+        ret = -1;
+    }
+
+    // 时间戳改为相对第一条消息
+    for (size_t i = 1; ret == 0 && i < replay->count; i++) {
+        replay->entries[i].at -= replay->entries[0].at;
+    }
+    if (ret == 0) replay->entries[0].at = 0;
+    return ret;
+}
+
+// 从环境变量读取回放配置；未启用时 *out 为 NULL，配置或日志有误时返回 -1
+static int replay_from_env(struct ws_replay **out) {
+    *out = NULL;
+    const char *path = getenv(WS_REPLAY_ENV);
+    if (!path || !*path) return 0;
+
+    struct ws_replay *replay = calloc(1, sizeof(*replay));
+    if (!replay) return -1;
+    replay->speed = 1.0;
+    replay->wait = WS_REPLAY_DEFAULT_WAIT;
+    replay->out = stdout;
+    replay->latency = hdr_histogram_new();
+
+    const char *value;
+    if ((value = getenv(WS_REPLAY_SPEED_ENV))) replay->speed = atof(value);
+    if ((value = getenv(WS_REPLAY_WAIT_ENV))) replay->wait = atof(value);
+    if (!replay->latency) {
+        replay_free(replay);
+        return -1;
+    }
+    if (replay->speed < 0 || replay->wait < 0) {
+        fprintf(stderr, "%s and %s must be >= 0\n", WS_REPLAY_SPEED_ENV, WS_REPLAY_WAIT_ENV);
+        replay_free(replay);
+        return -1;
+    }
+    if ((value = getenv(WS_REPLAY_OUTPUT_ENV)) && *value) {
+        replay->out = fopen(value, "w");
+        if (!replay->out) {
+            fprintf(stderr, "Failed to open %s: %s\n", value, strerror(errno));
+            replay_free(replay);
+            return -1;
+        }
+    }
+    if (replay_load(replay, path) != 0) {
+        replay_free(replay);
+        return -1;
+    }
+    *out = replay;
+    return 0;
+}
+
+// 输出回放结果，关闭 WebSocket 和 QUIC 连接
+static void replay_finish(struct websocket_client *client) {
+    struct ws_replay *replay = client->replay;
+    if (replay->finished) return;
+    replay->finished = true;
+    ev_timer_stop(client->loop, &replay->send_timer);
+    ev_timer_stop(client->loop, &replay->wait_timer);
+    fflush(replay->out);
+
+    // 握手完成前连接就断开时回放没有开始，没有可报告的结果
+    if (replay->start == 0) {
+        fprintf(stderr, "Replay: not started (connection closed before the WebSocket opened)\n");
+    } else {
+        double elapsed = now_seconds() - replay->start;
+        fprintf(stderr, "Replay: sent %zu/%zu messages in %.3f s (speed %s%.2f), "
+                        "%" PRIu64 " replies (%zu unanswered, %" PRIu64 " unsolicited), "
+                        "%" PRIu64 " errors\n",
+                replay->next, replay->count, elapsed, replay->speed == 0 ? "max, " : "",
+                replay->speed, replay->received, replay->next - replay->answered,
+                replay->unmatched, replay->errors);
+        hdr_histogram_print(stderr, "reply rtt", replay->latency, 1e-3, "ms");
+    }
+
+    // 连接已关闭时（client_on_conn_closed）不再发送关闭帧，也不再处理连接
+    if (!client->quic_conn) return;
+    if (client->state == WS_STATE_OPEN && client->h3_conn) {
+        send_frame(client, WS_FRAME_CLOSE, NULL, 0);
+        client->state = WS_STATE_CLOSING;
+    }
+    const char *reason = "replay done";
+    quic_conn_close(client->quic_conn, true, 0, (const uint8_t *)reason, strlen(reason));
+    process_connections(client);
+}
+
+static void replay_wait_callback(EV_P_ ev_timer *w, int revents) {
+    replay_finish(w->data);
+}
+
+// 发送所有到期的消息，然后等待下一条
+static void replay_send_callback(EV_P_ ev_timer *w, int revents) {
+    struct websocket_client *client = w->data;
+    struct ws_replay *replay = client->replay;
+    double now = now_seconds();
+
+    while (replay->next < replay->count) {
+        struct replay_entry *entry = &replay->entries[replay->next];
+        double due = replay->speed > 0 ? replay->start + entry->at / replay->speed : now;
+        if (due > now) {
+            ev_timer_set(w, due - now, 0);
+            ev_timer_start(EV_A_ w);
+            break;
+        }
+        entry->sent_at = now;
+        if (send_frame(client, entry->opcode, entry->data, entry->len) != 0) {
+            replay->errors++;
+        }
+        replay->next++;
+    }
+
+    if (replay->next == replay->count) {
+        if (replay->answered == replay->count) {
+            replay_finish(client);
+            return;
+        }
+        ev_timer_set(&replay->wait_timer, replay->wait, 0);
+        ev_timer_start(EV_A_ &replay->wait_timer);
+    }
+    process_connections(client);
+}
+
+static void replay_start(struct websocket_client *client) {
+    struct ws_replay *replay = client->replay;
+    fprintf(stderr, "Replaying %zu messages over %.3f s of recorded time\n",
+            replay->count, replay->entries[replay->count - 1].at);
+    replay->start = now_seconds();
+    ev_init(&replay->send_timer, replay_send_callback);
+    replay->send_timer.data = client;
+    ev_init(&replay->wait_timer, replay_wait_callback);
+    replay->wait_timer.data = client;
+    ev_feed_event(client->loop, &replay->send_timer, EV_TIMER);
+}
+
+// 记录一条回复：按发送顺序匹配请求，输出 "<相对时间> <延迟毫秒|-> text|binary <内容>"
+static void replay_on_reply(struct websocket_client *client, struct websocket_frame *frame) {
+    struct ws_replay *replay = client->replay;
+    if (replay->finished) return;
+    double now = now_seconds();
+    replay->received++;
+
+    fprintf(replay->out, "%.6f ", now - replay->start);
+    if (replay->answered < replay->next) {
+        double rtt = now - replay->entries[replay->answered++].sent_at;
+        hdr_histogram_record(replay->latency, (uint64_t)(rtt * 1e6));
+        fprintf(replay->out, "%.3f ", rtt * 1e3);
+    } else {
+        replay->unmatched++;
+        fprintf(replay->out, "- ");
+    }
+    if (frame->opcode == WS_FRAME_TEXT) {
+        fprintf(replay->out, "text ");
+        fwrite(frame->payload, 1, frame->payload_len, replay->out);
+    } else {
+        fprintf(replay->out, "binary ");
+        base64_write(replay->out, frame->payload, frame->payload_len);
+    }
+    fputc('\n', replay->out);
+
+    if (replay->next == replay->count && replay->answered == replay->count) {
+        replay_finish(client);
+    }
 }
 
 // 处理 WebSocket 消息
 static void handle_websocket_message(struct websocket_client *client,
                                    struct websocket_frame *frame) {
+    if (client->replay && (frame->opcode == WS_FRAME_TEXT || frame->opcode == WS_FRAME_BINARY)) {
+        replay_on_reply(client, frame);
+        return;
+    }
+
     switch (frame->opcode) {
         case WS_FRAME_TEXT:
             printf("Received: %.*s\n", (int)frame->payload_len, frame->payload);
@@ -275,6 +678,10 @@ static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
 
     if (client->is_websocket) {
         client->state = WS_STATE_OPEN;
+        if (client->replay) {
+            replay_start(client);
+            return;
+        }
         printf("WebSocket connection established! Type messages to send (or 'quit' to exit):\n");
     }
 }
@@ -301,11 +708,17 @@ static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
             break;
         }
 
-        // 解析 WebSocket 帧
+        if (buffer_append(&client->rx_buf, &client->rx_len, &client->rx_cap, buf, read) != 0) {
+            printf("Failed to buffer WebSocket data\n");
+            return;
+        }
+
+        // 解析 WebSocket 帧，不完整的帧留在缓冲区等待后续数据
         size_t offset = 0;
-        while (offset < (size_t)read) {
+        while (offset < client->rx_len) {
             struct websocket_frame frame;
-            int frame_len = parse_websocket_frame(buf + offset, read - offset, &frame);
+            int frame_len = parse_websocket_frame(client->rx_buf + offset,
+                                                  client->rx_len - offset, &frame);
 
             if (frame_len < 0) {
                 break;
@@ -314,6 +727,8 @@ static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
             handle_websocket_message(client, &frame);
             offset += frame_len;
         }
+        memmove(client->rx_buf, client->rx_buf + offset, client->rx_len - offset);
+        client->rx_len -= offset;
     }
 }
 
@@ -401,6 +816,13 @@ void client_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
         http3_conn_free(client->h3_conn);
         client->h3_conn = NULL;
     }
+    client->state = WS_STATE_CLOSED;
+    client->quic_conn = NULL;
+
+    if (client->replay) {
+        replay_finish(client);
+        ev_break(client->loop, EVBREAK_ALL);
+    }
 }
 
 void client_on_stream_created(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
@@ -416,7 +838,14 @@ void client_on_stream_readable(void *tctx, struct quic_conn_t *conn, uint64_t st
 }
 
 void client_on_stream_writable(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
-    // Stream writable
+    struct websocket_client *client = tctx;
+
+    // 继续发送积压的帧
+    if (client->h3_conn && stream_id == client->stream_id && client->tx_len > 0) {
+        flush_tx(client);
+        return;
+    }
+    quic_stream_wantwrite(conn, stream_id, false);
 }
 
 void client_on_stream_closed(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
@@ -426,6 +855,9 @@ void client_on_stream_closed(void *tctx, struct quic_conn_t *conn, uint64_t stre
 // 数据包发送处理器
 int client_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts, unsigned int count) {
     struct websocket_client *client = psctx;
+    if (client->send_impairment.enabled) {
+        return net_impairment_send_packets(&client->send_impairment, pkts, count);
+    }
 
     unsigned int sent_count = 0;
     for (unsigned int i = 0; i < count; i++) {
@@ -463,6 +895,48 @@ const struct quic_packet_send_methods_t quic_packet_send_methods = {
     .on_packets_send = client_on_packets_send,
 };
 
+// 发送经过损伤模拟层延迟后的数据包
+static void impaired_send(void *ctx, const uint8_t *data, size_t len,
+                          const struct sockaddr *addr, socklen_t addr_len) {
+    struct websocket_client *client = ctx;
+    ssize_t sent = sendto(client->sock, data, len, 0, addr, addr_len);
+    if (sent != (ssize_t)len) {
+        printf("impaired send failed: %s\n", strerror(errno));
+    }
+}
+
+// 将收到的（可能被延迟的）数据包交给 QUIC 端点
+static void deliver_packet(void *ctx, const uint8_t *data, size_t len,
+                           const struct sockaddr *addr, socklen_t addr_len) {
+    struct websocket_client *client = ctx;
+    struct quic_packet_info_t pkt_info = {
+        .src = addr,
+        .src_len = addr_len,
+        .dst = (struct sockaddr *)&client->local_addr,
+        .dst_len = client->local_addr_len,
+    };
+    int processed = quic_endpoint_recv(client->quic_endpoint, (uint8_t *)data, len, &pkt_info);
+    if (processed < 0) {
+        printf("quic_endpoint_recv failed: %d\n", processed);
+    }
+}
+
+// 处理连接并更新 timer
+static void process_connections(struct websocket_client *client) {
+    quic_endpoint_process_connections(client->quic_endpoint);
+    double timeout = quic_endpoint_timeout(client->quic_endpoint) / 1e3f;
+    if (timeout < 0.0001) {
+        timeout = 0.0001;
+    }
+    client->timer.repeat = timeout;
+    ev_timer_again(client->loop, &client->timer);
+}
+
+// 延迟数据包投递完成后处理连接并更新 timer
+static void flush_delivered(void *ctx) {
+    process_connections(ctx);
+}
+
 // 网络事件处理
 static void read_callback(EV_P_ ev_io *w, int revents) {
     struct websocket_client *client = w->data;
@@ -483,40 +957,34 @@ static void read_callback(EV_P_ ev_io *w, int revents) {
             return;
         }
 
-        struct quic_packet_info_t pkt_info = {
-            .src = (struct sockaddr *)&peer_addr,
-            .src_len = peer_addr_len,
-            .dst = (struct sockaddr *)&client->local_addr,
-            .dst_len = client->local_addr_len,
-        };
-        int processed = quic_endpoint_recv(client->quic_endpoint, buf, read, &pkt_info);
-        if (processed < 0) {
-            printf("quic_endpoint_recv failed: %d\n", processed);
-        }
+        net_impairment_submit(&client->recv_impairment, buf, read,
+                              (struct sockaddr *)&peer_addr, peer_addr_len);
     }
 }
 
+// 超时处理：先让 QUIC 端点处理到期的定时器（重传、空闲超时等），再处理连接
 static void timeout_callback(EV_P_ ev_timer *w, int revents) {
     struct websocket_client *client = w->data;
-    quic_endpoint_process_connections(client->quic_endpoint);
-
-    uint64_t timeout = quic_endpoint_timeout(client->quic_endpoint);
-    if (timeout == UINT64_MAX) {
-        ev_timer_stop(EV_A_ w);
-    } else {
-        w->repeat = (double)timeout / 1000000.0;
-        ev_timer_again(EV_A_ w);
-    }
+    quic_endpoint_on_timeout(client->quic_endpoint);
+    process_connections(client);
 }
 
 // 标准输入处理
 static void stdin_callback(EV_P_ ev_io *w, int revents) {
     struct websocket_client *client = w->data;
-    char line[1024];
-
-    if (fgets(line, sizeof(line), stdin)) {
+    // getline 不限制行长度，长消息不会被截断成多条
+    static char *line = NULL;
+    static size_t line_cap = 0;
+
+    ssize_t line_len = getline(&line, &line_cap, stdin);
+    if (line_len < 0) {
+        // 标准输入结束（例如管道输入已读完），不再监听
+        ev_io_stop(EV_A_ w);
+        return;
+    }
+    {
         // 移除换行符
-        size_t len = strlen(line);
+        size_t len = line_len;
         if (len > 0 && line[len-1] == '\n') {
             line[len-1] = '\0';
             len--;
@@ -579,6 +1047,8 @@ static int create_socket(const char *host, const char *port, struct addrinfo **r
 int main(int argc, char *argv[]) {
     if (argc != 3) {
         printf("Usage: %s <host> <port>\n", argv[0]);
+        printf("Replay mode: %s=<log> [%s=<factor>] [%s=<file>] [%s=<seconds>]\n",
+               WS_REPLAY_ENV, WS_REPLAY_SPEED_ENV, WS_REPLAY_OUTPUT_ENV, WS_REPLAY_WAIT_ENV);
         return 1;
     }
 
@@ -589,7 +1059,21 @@ int main(int argc, char *argv[]) {
     memset(&client, 0, sizeof(client));
     client.connected = true;
 
-    srand(time(NULL));
+
+    if (replay_from_env(&client.replay) != 0) {
+        return 1;
+    }
+
+    // 创建事件循环
+    client.loop = ev_default_loop(0);
+
+    // 可选的网络损伤模拟（参见 net_impairment.h）
+    if (net_impairment_init(&client.send_impairment, client.loop, NET_IMPAIRMENT_ENV_SEND,
+                            impaired_send, NULL, &client) != 0 ||
+        net_impairment_init(&client.recv_impairment, client.loop, NET_IMPAIRMENT_ENV_RECV,
+                            deliver_packet, flush_delivered, &client) != 0) {
+        return 1;
+    }
 
     struct addrinfo *remote = NULL;
     client.sock = create_socket(host, port, &remote, &client);
@@ -640,8 +1124,6 @@ int main(int argc, char *argv[]) {
     }
 
     // 设置事件处理
-    client.loop = ev_default_loop(0);
-
     ev_io socket_watcher;
     ev_io_init(&socket_watcher, read_callback, client.sock, EV_READ);
     socket_watcher.data = &client;
@@ -659,11 +1141,13 @@ int main(int argc, char *argv[]) {
     client.timer.repeat = timeout;
     ev_timer_again(client.loop, &client.timer);
 
-    // 设置标准输入监听
+    // 设置标准输入监听（回放模式不读取标准输入）
     ev_io stdin_watcher;
     ev_io_init(&stdin_watcher, stdin_callback, STDIN_FILENO, EV_READ);
     stdin_watcher.data = &client;
-    ev_io_start(client.loop, &stdin_watcher);
+    if (!client.replay) {
+        ev_io_start(client.loop, &stdin_watcher);
+    }
 
     printf("Connecting to %s:%s...\n", host, port);
 
@@ -674,9 +1158,16 @@ int main(int argc, char *argv[]) {
     if (remote) freeaddrinfo(remote);
     if (client.tls_config) quic_tls_config_free(client.tls_config);
     if (client.h3_config) http3_config_free(client.h3_config);
+    net_impairment_print_stats(&client.send_impairment, "send");
+    net_impairment_print_stats(&client.recv_impairment, "recv");
+    net_impairment_free(&client.send_impairment);
+    net_impairment_free(&client.recv_impairment);
     if (client.quic_endpoint) quic_endpoint_free(client.quic_endpoint);
     if (client.sock > 0) close(client.sock);
     if (config) quic_config_free(config);
+    replay_free(client.replay);
+    free(client.rx_buf);
+    free(client.tx_buf);
 
     printf("Goodbye!\n");
     return 0;
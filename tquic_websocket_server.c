@@ -27,16 +27,30 @@
 #include <unistd.h>
 #include <time.h>
 
+#include "h3_priority.h"
+#include "net_impairment.h"
 #include "openssl/pem.h"
 #include "openssl/ssl.h"
 #include "openssl/x509.h"
 #include "openssl/sha.h"
+#include "server_log.h"
 #include "tquic.h"
+#include "ws_topics.h"
+#include "ws_worker_pool.h"
 
 #define READ_BUF_SIZE 4096
 #define MAX_DATAGRAM_SIZE 1200
 #define WEBSOCKET_MAGIC_STRING "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 
+// 优先级策略：WebSocket 流固定为最高紧急度，避免被并发的大文件传输饿死
+#define WS_STREAM_URGENCY 0
+
+// 批量传输测试端点 /bulk/<bytes> 的发送块大小
+#define BULK_CHUNK_SIZE 16384
+
+// 工作线程池统计信息的输出间隔（秒）
+#define WORKER_STATS_INTERVAL 10.0
+
 // WebSocket 帧类型
 typedef enum {
     WS_FRAME_CONTINUATION = 0x0,
@@ -65,18 +79,48 @@ struct websocket_server {
     struct quic_tls_config_t *tls_config;
     struct ev_loop *loop;
     struct http3_config_t *h3_config;
+    struct net_impairment send_impairment;
+    struct net_impairment recv_impairment;
+    // 消息处理工作线程池，避免耗时的处理逻辑阻塞 QUIC 事件循环
+    struct ws_worker_pool worker_pool;
+    ev_timer stats_timer;
+    uint64_t stats_last_completed;
+    uint64_t next_session_id;
+    // 主题订阅表（SUB/UNSUB/PUB 命令，参见 ws_topics.h）
+    struct ws_topics topics;
+    // 发布消息写入了其他连接的流，需要在本轮事件循环结束前再处理一次连接
+    bool fanout_pending;
+    ev_prepare fanout_watcher;
 };
 
 // WebSocket 连接上下文
 struct websocket_connection {
+    struct websocket_server *server;
+    uint64_t session_id;
+    // 已投递到工作线程池但尚未完成的消息数
+    unsigned int jobs_in_flight;
+    // QUIC 连接已关闭，等待在途消息完成后释放
+    bool closed;
     struct http3_conn_t *h3_conn;
     struct quic_conn_t *quic_conn;
     uint64_t stream_id;
     websocket_state_t state;
     bool is_websocket;
     char *sec_websocket_key;
-    char *pending_data;
+    // 发送积压：流量控制阻塞时未写出的回复，在 on_stream_writable 中按序继续发送
+    uint8_t *pending_data;
     size_t pending_data_len;
+    size_t pending_data_cap;
+    // 接收缓冲区：帧可能跨越多次读取，凑齐完整帧后再解析
+    uint8_t *rx_buf;
+    size_t rx_len;
+    size_t rx_cap;
+    // 本会话订阅的主题
+    struct ws_subscription *subscriptions;
+    // /bulk/<bytes> 批量传输状态（用于优先级基准测试）
+    bool bulk_active;
+    uint64_t bulk_stream_id;
+    uint64_t bulk_remaining;
 };
 
 // WebSocket 帧头结构
@@ -139,6 +183,7 @@ static void generate_websocket_accept(const char *key, char *accept) {
     // 将哈希值进行 Base64 编码
     base64_encode(hash, 20, accept);
 
+    if (g_server_quiet) return;
     fprintf(stderr, "WebSocket Accept key generated:\n");
     fprintf(stderr, "  Input: %s\n", concatenated);
     fprintf(stderr, "  SHA-1 hash: ");
@@ -242,6 +287,58 @@ static int create_websocket_frame(uint8_t opcode, const uint8_t *payload, size_t
     return header_len + payload_len;
 }
 
+// 追加到缓冲区，按需扩容
+static int buffer_append(uint8_t **buf, size_t *len, size_t *cap,
+                         const uint8_t *data, size_t data_len) {
+    if (*len + data_len > *cap) {
+        size_t new_cap = *cap ? *cap : 4096;
+        while (new_cap < *len + data_len) {
+            new_cap *= 2;
+        }
+        uint8_t *new_buf = realloc(*buf, new_cap);
+        if (!new_buf) return -1;
+        *buf = new_buf;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, data, data_len);
+    *len += data_len;
+    return 0;
+}
+
+// 尽量写出发送积压，返回 -1 表示发送出错
+static int flush_pending_data(struct websocket_connection *ws_conn) {
+    size_t offset = 0;
+    while (offset < ws_conn->pending_data_len) {
+        ssize_t written = http3_send_body(ws_conn->h3_conn, ws_conn->quic_conn,
+                                          ws_conn->stream_id, ws_conn->pending_data + offset,
+                                          ws_conn->pending_data_len - offset, false);
+        if (written == HTTP3_ERR_DONE || written == 0) {
+            break;
+        }
+        if (written < 0) {
+            fprintf(stderr, "Failed to send WebSocket data: %ld\n", written);
+            return -1;
+        }
+        offset += written;
+    }
+    memmove(ws_conn->pending_data, ws_conn->pending_data + offset,
+            ws_conn->pending_data_len - offset);
+    ws_conn->pending_data_len -= offset;
+    quic_stream_wantwrite(ws_conn->quic_conn, ws_conn->stream_id,
+                          ws_conn->pending_data_len > 0);
+    return 0;
+}
+
+// 按顺序发送一个完整的帧：已有积压时排在积压之后，写不完的部分进入积压
+static int write_frame(struct websocket_connection *ws_conn, const uint8_t *frame, size_t len) {
+    if (buffer_append(&ws_conn->pending_data, &ws_conn->pending_data_len,
+                      &ws_conn->pending_data_cap, frame, len) != 0) {
+        fprintf(stderr, "Failed to buffer WebSocket frame\n");
+        return -1;
+    }
+    return flush_pending_data(ws_conn);
+}
+
 // 发送 WebSocket 消息
 static void send_websocket_message(struct websocket_connection *ws_conn, uint8_t opcode,
                                   const char *message, size_t message_len) {
@@ -251,56 +348,201 @@ static void send_websocket_message(struct websocket_connection *ws_conn, uint8_t
     int frame_len = create_websocket_frame(opcode, (const uint8_t *)message, message_len,
                                           true, frame, sizeof(frame));
     
-    if (frame_len > 0) {
-        ssize_t written = http3_send_body(ws_conn->h3_conn, ws_conn->quic_conn,
-                                        ws_conn->stream_id, frame, frame_len, false);
-        if (written > 0) {
-            fprintf(stderr, "WebSocket message sent: %.*s\n", (int)message_len, message);
-        } else {
-            fprintf(stderr, "Failed to send WebSocket message\n");
-        }
+    if (frame_len > 0 && write_frame(ws_conn, frame, frame_len) == 0) {
+        server_log("WebSocket message sent: %.*s\n", (int)message_len, message);
     }
 }
 
-// 处理 WebSocket 消息
-static void handle_websocket_message(struct websocket_connection *ws_conn,
-                                   struct websocket_frame *frame) {
-    switch (frame->opcode) {
+// 释放 WebSocket 连接上下文
+static void websocket_connection_free(struct websocket_connection *ws_conn) {
+    if (ws_conn->h3_conn) {
+        http3_conn_free(ws_conn->h3_conn);
+    }
+    if (ws_conn->sec_websocket_key) {
+        free(ws_conn->sec_websocket_key);
+    }
+    if (ws_conn->pending_data) {
+        free(ws_conn->pending_data);
+    }
+    free(ws_conn->rx_buf);
+    free(ws_conn);
+}
+
+// 在工作线程中处理消息并生成完整的回复帧
+// 耗时的业务逻辑（JSON 解析、压缩、鉴权查询等）应放在这里，不能访问 QUIC/HTTP3 状态
+static void websocket_job_handler(struct ws_job *job, void *ctx) {
+    uint8_t reply_opcode;
+    size_t reply_len = job->payload_len;
+
+    switch (job->opcode) {
         case WS_FRAME_TEXT:
-            fprintf(stderr, "Received WebSocket text: %.*s\n", 
-                   (int)frame->payload_len, frame->payload);
+            server_log("Received WebSocket text: %.*s\n",
+                      (int)job->payload_len, job->payload);
             // 回显消息
-            send_websocket_message(ws_conn, WS_FRAME_TEXT, 
-                                 (const char *)frame->payload, frame->payload_len);
+            reply_opcode = WS_FRAME_TEXT;
             break;
-            
+
         case WS_FRAME_BINARY:
-            fprintf(stderr, "Received WebSocket binary data (%llu bytes)\n", 
-                   (unsigned long long)frame->payload_len);
-            send_websocket_message(ws_conn, WS_FRAME_BINARY, 
-                                 (const char *)frame->payload, frame->payload_len);
+            server_log("Received WebSocket binary data (%llu bytes)\n",
+                      (unsigned long long)job->payload_len);
+            reply_opcode = WS_FRAME_BINARY;
             break;
-            
+
+        case WS_FRAME_CLOSE:
+            server_log("Received WebSocket close\n");
+            reply_opcode = WS_FRAME_CLOSE;
+            reply_len = 0;
+            break;
+
+        default:
+            fprintf(stderr, "Unknown WebSocket frame type: %d\n", job->opcode);
+            return;
+    }
+
+    size_t frame_cap = reply_len + 10;
+    job->result = malloc(frame_cap);
+    if (!job->result) return;
+
+    int frame_len = create_websocket_frame(reply_opcode, job->payload, reply_len,
+                                          true, job->result, frame_cap);
+    job->result_len = frame_len > 0 ? frame_len : 0;
+}
+
+// 在事件循环线程中发送工作线程生成的回复，同一会话内按投递顺序调用
+static void websocket_job_complete(struct ws_job *job, void *ctx) {
+    struct websocket_connection *ws_conn = job->session;
+
+    ws_conn->jobs_in_flight--;
+    if (ws_conn->closed) {
+        // 连接已关闭，丢弃回复；最后一条在途消息负责释放连接上下文
+        if (ws_conn->jobs_in_flight == 0) {
+            websocket_connection_free(ws_conn);
+        }
+        return;
+    }
+
+    if (ws_conn->state != WS_STATE_OPEN || job->result_len == 0) return;
+
+    if (write_frame(ws_conn, job->result, job->result_len) == 0) {
+        server_log("WebSocket message sent: %.*s\n", (int)job->payload_len, job->payload);
+    }
+
+    if (job->opcode == WS_FRAME_CLOSE) {
+        ws_conn->state = WS_STATE_CLOSING;
+    }
+}
+
+// 把一条发布消息原样转发给主题的所有订阅者（包括已订阅的发布者自己）
+static void publish_to_topic(struct websocket_connection *ws_conn,
+                             const struct ws_topic_command *cmd,
+                             const struct websocket_frame *frame) {
+    struct websocket_server *server = ws_conn->server;
+    struct ws_topic *topic = ws_topics_find(&server->topics, cmd->topic, cmd->topic_len, false);
+    if (!topic || !topic->subscribers) return;
+
+    // 帧只构造一次，再写入每个订阅者的流
+    size_t frame_cap = frame->payload_len + 10;
+    uint8_t *out = malloc(frame_cap);
+    if (!out) return;
+    int out_len = create_websocket_frame(WS_FRAME_TEXT, frame->payload, frame->payload_len,
+                                         true, out, frame_cap);
+    size_t delivered = 0;
+    for (struct ws_subscription *sub = topic->subscribers; out_len > 0 && sub; sub = sub->next) {
+        struct websocket_connection *subscriber = sub->session;
+        if (subscriber->state == WS_STATE_OPEN && write_frame(subscriber, out, out_len) == 0) {
+            delivered++;
+        }
+    }
+    free(out);
+
+    topic->published++;
+    server->fanout_pending = true;
+    server_log("Published %llu bytes to %zu subscribers of %.*s\n",
+               (unsigned long long)frame->payload_len, delivered, (int)cmd->topic_len,
+               (const char *)cmd->topic);
+}
+
+// 处理主题命令：订阅回复 "SUBSCRIBED <topic>"，取消订阅和发布不回复
+static void handle_topic_command(struct websocket_connection *ws_conn,
+                                 const struct ws_topic_command *cmd,
+                                 const struct websocket_frame *frame) {
+    struct ws_topics *topics = &ws_conn->server->topics;
+    switch (cmd->kind) {
+        case WS_TOPIC_SUB: {
+            if (ws_topics_subscribe(topics, ws_conn, &ws_conn->subscriptions, cmd->topic,
+                                    cmd->topic_len) < 0) {
+                fprintf(stderr, "Failed to subscribe session %llu\n",
+                        (unsigned long long)ws_conn->session_id);
+                return;
+            }
+            char ack[sizeof(WS_TOPIC_ACK) + WS_TOPIC_MAX_NAME];
+            int ack_len = snprintf(ack, sizeof(ack), WS_TOPIC_ACK "%.*s", (int)cmd->topic_len,
+                                   (const char *)cmd->topic);
+            send_websocket_message(ws_conn, WS_FRAME_TEXT, ack, ack_len);
+            break;
+        }
+
+        case WS_TOPIC_UNSUB:
+            ws_topics_unsubscribe(topics, &ws_conn->subscriptions, cmd->topic, cmd->topic_len);
+            break;
+
+        case WS_TOPIC_PUB:
+            publish_to_topic(ws_conn, cmd, frame);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// 处理 WebSocket 消息
+static void handle_websocket_message(struct websocket_connection *ws_conn,
+                                   struct websocket_frame *frame) {
+    // ping/pong 直接在事件循环线程处理，RFC 6455 允许控制帧插入到数据消息之间
+    switch (frame->opcode) {
         case WS_FRAME_PING:
-            fprintf(stderr, "Received WebSocket ping\n");
+            server_log("Received WebSocket ping\n");
             send_websocket_message(ws_conn, WS_FRAME_PONG, 
                                  (const char *)frame->payload, frame->payload_len);
-            break;
+            return;
             
         case WS_FRAME_PONG:
-            fprintf(stderr, "Received WebSocket pong\n");
-            break;
-            
-        case WS_FRAME_CLOSE:
-            fprintf(stderr, "Received WebSocket close\n");
-            ws_conn->state = WS_STATE_CLOSING;
-            send_websocket_message(ws_conn, WS_FRAME_CLOSE, "", 0);
-            break;
-            
+            server_log("Received WebSocket pong\n");
+            return;
+
         default:
-            fprintf(stderr, "Unknown WebSocket frame type: %d\n", frame->opcode);
             break;
     }
+
+    // 主题命令在事件循环线程处理，因为发布要写入其他连接的流
+    struct ws_topic_command cmd;
+    if (frame->opcode == WS_FRAME_TEXT &&
+        ws_topic_command_parse(frame->payload, frame->payload_len, &cmd) != WS_TOPIC_NONE) {
+        handle_topic_command(ws_conn, &cmd, frame);
+        return;
+    }
+
+    // 数据帧和关闭帧投递到工作线程池，同一会话固定由同一个工作线程按序处理
+    struct ws_job *job = ws_job_new(ws_conn, ws_conn->session_id, frame->opcode,
+                                    frame->payload, frame->payload_len);
+    if (!job) {
+        fprintf(stderr, "Failed to allocate WebSocket job\n");
+        return;
+    }
+
+    ws_conn->jobs_in_flight++;
+    if (ws_worker_pool_post(&ws_conn->server->worker_pool, job) != 0) {
+        ws_conn->jobs_in_flight--;
+        ws_job_free(job);
+
+        // 队列已满：以 1013 (Try Again Later) 关闭会话，而不是丢弃消息打乱顺序
+        fprintf(stderr, "Worker queue full, closing WebSocket session %llu\n",
+               (unsigned long long)ws_conn->session_id);
+        const uint8_t close_payload[2] = {1013 >> 8, 1013 & 0xFF};
+        send_websocket_message(ws_conn, WS_FRAME_CLOSE, (const char *)close_payload,
+                               sizeof(close_payload));
+        ws_conn->state = WS_STATE_CLOSING;
+    }
 }
 
 // WebSocket 升级检查的上下文结构
@@ -398,9 +640,9 @@ static bool is_websocket_upgrade(const struct http3_headers_t *headers, char **w
 
     if (is_valid_upgrade) {
         *websocket_key = ctx.websocket_key; // 转移所有权
-        fprintf(stderr, "Valid WebSocket upgrade request detected\n");
-        fprintf(stderr, "  WebSocket-Key: %s\n", ctx.websocket_key);
-        fprintf(stderr, "  WebSocket-Version: %s\n", ctx.websocket_version ? ctx.websocket_version : "unknown");
+        server_log("Valid WebSocket upgrade request detected\n");
+        server_log("  WebSocket-Key: %s\n", ctx.websocket_key);
+        server_log("  WebSocket-Version: %s\n", ctx.websocket_version ? ctx.websocket_version : "unknown");
     } else {
         fprintf(stderr, "Invalid WebSocket upgrade request:\n");
         fprintf(stderr, "  GET method: %s\n", ctx.is_get_method ? "✓" : "✗");
@@ -416,14 +658,101 @@ static bool is_websocket_upgrade(const struct http3_headers_t *headers, char **w
     return is_valid_upgrade;
 }
 
+// 提取请求路径的头部回调
+static int path_header_callback(const uint8_t *name, size_t name_len,
+                                const uint8_t *value, size_t value_len,
+                                void *argp) {
+    char **path = (char **)argp;
+    if (name_len == 5 && memcmp(name, ":path", 5) == 0 && *path == NULL) {
+        *path = strndup((const char *)value, value_len);
+    }
+    return 0;
+}
+
+// 继续发送批量数据，直到流量控制阻塞或全部发送完毕
+static void continue_bulk_transfer(struct websocket_connection *ws_conn) {
+    static uint8_t chunk[BULK_CHUNK_SIZE];
+    static bool chunk_ready = false;
+    if (!chunk_ready) {
+        memset(chunk, 'x', sizeof(chunk));
+        chunk_ready = true;
+    }
+
+    while (ws_conn->bulk_remaining > 0) {
+        size_t len = ws_conn->bulk_remaining < sizeof(chunk)
+                         ? (size_t)ws_conn->bulk_remaining
+                         : sizeof(chunk);
+        bool fin = len == ws_conn->bulk_remaining;
+        ssize_t written = http3_send_body(ws_conn->h3_conn, ws_conn->quic_conn,
+                                          ws_conn->bulk_stream_id, chunk, len, fin);
+        if (written < 0 && written != HTTP3_ERR_DONE) {
+            fprintf(stderr, "Bulk transfer on stream %llu failed: %ld\n",
+                    (unsigned long long)ws_conn->bulk_stream_id, written);
+            ws_conn->bulk_active = false;
+            quic_stream_wantwrite(ws_conn->quic_conn, ws_conn->bulk_stream_id, false);
+            return;
+        }
+        if (written > 0) {
+            ws_conn->bulk_remaining -= written;
+        }
+        if (written < (ssize_t)len) {
+            // 被流量控制阻塞，等待 on_stream_writable
+            quic_stream_wantwrite(ws_conn->quic_conn, ws_conn->bulk_stream_id, true);
+            return;
+        }
+    }
+
+    fprintf(stderr, "Bulk transfer on stream %llu finished\n",
+            (unsigned long long)ws_conn->bulk_stream_id);
+    ws_conn->bulk_active = false;
+    quic_stream_wantwrite(ws_conn->quic_conn, ws_conn->bulk_stream_id, false);
+}
+
+// 处理 /bulk/<bytes> 请求：返回指定字节数的填充数据
+static void start_bulk_transfer(struct websocket_connection *ws_conn, uint64_t stream_id,
+                                const char *path) {
+    const char *status = "200";
+    uint64_t bytes = strtoull(path + strlen("/bulk/"), NULL, 10);
+    if (ws_conn->bulk_active) {
+        status = "503";
+        bytes = 0;
+    }
+
+    char length_str[32];
+    snprintf(length_str, sizeof(length_str), "%llu", (unsigned long long)bytes);
+    struct http3_header_t response_headers[] = {
+        {.name = (uint8_t *)":status", .name_len = 7,
+         .value = (uint8_t *)status, .value_len = 3},
+        {.name = (uint8_t *)"content-type", .name_len = 12,
+         .value = (uint8_t *)"application/octet-stream", .value_len = 24},
+        {.name = (uint8_t *)"content-length", .name_len = 14,
+         .value = (uint8_t *)length_str, .value_len = strlen(length_str)}
+    };
+
+    int ret = http3_send_headers(ws_conn->h3_conn, ws_conn->quic_conn, stream_id,
+                                 response_headers,
+                                 sizeof(response_headers)/sizeof(response_headers[0]),
+                                 bytes == 0);
+    if (ret < 0 || bytes == 0) {
+        return;
+    }
+
+    ws_conn->bulk_active = true;
+    ws_conn->bulk_stream_id = stream_id;
+    ws_conn->bulk_remaining = bytes;
+    fprintf(stderr, "Bulk transfer of %llu bytes started on stream %llu\n",
+            (unsigned long long)bytes, (unsigned long long)stream_id);
+    continue_bulk_transfer(ws_conn);
+}
+
 // HTTP/3 事件处理器实现
 static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
                                    const struct http3_headers_t *headers, bool fin) {
     struct websocket_connection *ws_conn = ctx;
     if (!ws_conn) return;
     
-    fprintf(stderr, "HTTP/3 headers received on stream %llu\n", 
-           (unsigned long long)stream_id);
+    server_log("HTTP/3 headers received on stream %llu\n", 
+              (unsigned long long)stream_id);
     
     char *websocket_key = NULL;
     if (is_websocket_upgrade(headers, &websocket_key)) {
@@ -432,6 +761,14 @@ static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
         ws_conn->stream_id = stream_id;
         ws_conn->sec_websocket_key = websocket_key;
         ws_conn->state = WS_STATE_CONNECTING;
+
+        // WebSocket 流固定为最高紧急度，忽略客户端的 priority 头部
+        struct http3_priority_t ws_priority = {
+            .urgency = WS_STREAM_URGENCY,
+            .incremental = false,
+        };
+        http3_stream_set_priority(ws_conn->h3_conn, ws_conn->quic_conn, stream_id,
+                                  &ws_priority);
         
         // 生成 WebSocket Accept 响应
         char accept_key[256];
@@ -456,8 +793,8 @@ static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
         
         if (ret >= 0) {
             ws_conn->state = WS_STATE_OPEN;
-            fprintf(stderr, "WebSocket connection established on stream %llu\n", 
-                   (unsigned long long)stream_id);
+            server_log("WebSocket connection established on stream %llu\n", 
+                      (unsigned long long)stream_id);
             
             // 发送欢迎消息
             send_websocket_message(ws_conn, WS_FRAME_TEXT, 
@@ -466,7 +803,22 @@ static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
             fprintf(stderr, "Failed to send WebSocket upgrade response: %d\n", ret);
         }
     } else {
-        // 普通 HTTP 请求
+        // 普通 HTTP 请求：按客户端的 priority 头部设置优先级 (RFC 9218)
+        struct http3_priority_t priority;
+        if (h3_priority_from_headers(headers, &priority)) {
+            http3_stream_set_priority(ws_conn->h3_conn, ws_conn->quic_conn, stream_id,
+                                      &priority);
+        }
+
+        char *path = NULL;
+        http3_for_each_header(headers, path_header_callback, &path);
+        if (path && strncmp(path, "/bulk/", 6) == 0) {
+            start_bulk_transfer(ws_conn, stream_id, path);
+            free(path);
+            return;
+        }
+        free(path);
+
         struct http3_header_t response_headers[] = {
             {.name = (uint8_t *)":status", .name_len = 7, 
              .value = (uint8_t *)"200", .value_len = 3},
@@ -513,11 +865,17 @@ static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
             break;
         }
         
-        // 解析 WebSocket 帧
+        if (buffer_append(&ws_conn->rx_buf, &ws_conn->rx_len, &ws_conn->rx_cap, buf, read) != 0) {
+            fprintf(stderr, "Failed to buffer WebSocket data\n");
+            return;
+        }
+
+        // 解析 WebSocket 帧，不完整的帧留在缓冲区等待后续数据
         size_t offset = 0;
-        while (offset < (size_t)read) {
+        while (offset < ws_conn->rx_len) {
             struct websocket_frame frame;
-            int frame_len = parse_websocket_frame(buf + offset, read - offset, &frame);
+            int frame_len = parse_websocket_frame(ws_conn->rx_buf + offset,
+                                                  ws_conn->rx_len - offset, &frame);
             
             if (frame_len < 0) {
                 break; // 需要更多数据
@@ -526,6 +884,8 @@ static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
             handle_websocket_message(ws_conn, &frame);
             offset += frame_len;
         }
+        memmove(ws_conn->rx_buf, ws_conn->rx_buf + offset, ws_conn->rx_len - offset);
+        ws_conn->rx_len -= offset;
         
         if (fin) {
             break;
@@ -535,7 +895,7 @@ static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
 
 static void http3_on_stream_finished(void *ctx, uint64_t stream_id) {
     struct websocket_connection *ws_conn = ctx;
-    fprintf(stderr, "Stream %llu finished\n", (unsigned long long)stream_id);
+    server_log("Stream %llu finished\n", (unsigned long long)stream_id);
     
     if (ws_conn && ws_conn->is_websocket) {
         ws_conn->state = WS_STATE_CLOSED;
@@ -548,7 +908,24 @@ static void http3_on_stream_reset(void *ctx, uint64_t stream_id, uint64_t error_
 }
 
 static void http3_on_stream_priority_update(void *ctx, uint64_t stream_id) {
-    fprintf(stderr, "Stream %llu priority updated\n", (unsigned long long)stream_id);
+    struct websocket_connection *ws_conn = ctx;
+    if (!ws_conn || !ws_conn->h3_conn) return;
+
+    struct http3_priority_t priority;
+    if (h3_priority_take_update(ws_conn->h3_conn, stream_id, &priority) != 0) {
+        return;
+    }
+
+    // WebSocket 流的优先级由服务器策略固定，不接受降级
+    if (ws_conn->is_websocket && ws_conn->stream_id == stream_id) {
+        fprintf(stderr, "Stream %llu priority update ignored (WebSocket pinned to u=%d)\n",
+               (unsigned long long)stream_id, WS_STREAM_URGENCY);
+        return;
+    }
+
+    http3_stream_set_priority(ws_conn->h3_conn, ws_conn->quic_conn, stream_id, &priority);
+    server_log("Stream %llu priority updated: u=%u i=%d\n",
+              (unsigned long long)stream_id, priority.urgency, priority.incremental);
 }
 
 static void http3_on_conn_goaway(void *ctx, uint64_t stream_id) {
@@ -557,11 +934,14 @@ static void http3_on_conn_goaway(void *ctx, uint64_t stream_id) {
 
 // QUIC 连接事件处理器
 void server_on_conn_created(void *tctx, struct quic_conn_t *conn) {
-    fprintf(stderr, "New WebSocket connection created\n");
+    server_log("New WebSocket connection created\n");
     
+    struct websocket_server *server = tctx;
     struct websocket_connection *ws_conn = malloc(sizeof(struct websocket_connection));
     if (ws_conn) {
         memset(ws_conn, 0, sizeof(struct websocket_connection));
+        ws_conn->server = server;
+        ws_conn->session_id = ++server->next_session_id;
         ws_conn->quic_conn = conn;
         ws_conn->state = WS_STATE_CONNECTING;
         ws_conn->is_websocket = false;
@@ -573,7 +953,7 @@ void server_on_conn_established(void *tctx, struct quic_conn_t *conn) {
     struct websocket_server *server = tctx;
     struct websocket_connection *ws_conn = quic_conn_context(conn);
     
-    fprintf(stderr, "WebSocket connection established\n");
+    server_log("WebSocket connection established\n");
     
     if (ws_conn) {
         ws_conn->h3_conn = http3_conn_new(conn, server->h3_config);
@@ -586,24 +966,26 @@ void server_on_conn_established(void *tctx, struct quic_conn_t *conn) {
 void server_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
     struct websocket_connection *ws_conn = quic_conn_context(conn);
     
-    fprintf(stderr, "WebSocket connection closed\n");
+    server_log("WebSocket connection closed\n");
     
     if (ws_conn) {
-        if (ws_conn->h3_conn) {
-            http3_conn_free(ws_conn->h3_conn);
-        }
-        if (ws_conn->sec_websocket_key) {
-            free(ws_conn->sec_websocket_key);
-        }
-        if (ws_conn->pending_data) {
-            free(ws_conn->pending_data);
+        ws_topics_unsubscribe_all(&ws_conn->server->topics, &ws_conn->subscriptions);
+        if (ws_conn->jobs_in_flight > 0) {
+            // 仍有消息在工作线程中处理，等它们完成后再释放连接上下文
+            if (ws_conn->h3_conn) {
+                http3_conn_free(ws_conn->h3_conn);
+                ws_conn->h3_conn = NULL;
+            }
+            ws_conn->quic_conn = NULL;
+            ws_conn->closed = true;
+            return;
         }
-        free(ws_conn);
+        websocket_connection_free(ws_conn);
     }
 }
 
 void server_on_stream_created(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
-    fprintf(stderr, "New stream created %llu\n", (unsigned long long)stream_id);
+    server_log("New stream created %llu\n", (unsigned long long)stream_id);
 }
 
 void server_on_stream_readable(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
@@ -615,17 +997,32 @@ void server_on_stream_readable(void *tctx, struct quic_conn_t *conn, uint64_t st
 }
 
 void server_on_stream_writable(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
-    // 处理可写事件
+    struct websocket_connection *ws_conn = quic_conn_context(conn);
+
+    // 处理可写事件：继续未完成的批量传输
+    if (ws_conn && ws_conn->bulk_active && ws_conn->bulk_stream_id == stream_id) {
+        continue_bulk_transfer(ws_conn);
+        return;
+    }
+    // 继续发送 WebSocket 流上积压的回复
+    if (ws_conn && ws_conn->h3_conn && ws_conn->is_websocket && ws_conn->stream_id == stream_id &&
+        ws_conn->pending_data_len > 0) {
+        flush_pending_data(ws_conn);
+        return;
+    }
     quic_stream_wantwrite(conn, stream_id, false);
 }
 
 void server_on_stream_closed(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
-    fprintf(stderr, "Stream closed %llu\n", (unsigned long long)stream_id);
+    server_log("Stream closed %llu\n", (unsigned long long)stream_id);
 }
 
 // 数据包发送处理器
 int server_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts, unsigned int count) {
     struct websocket_server *server = psctx;
+    if (server->send_impairment.enabled) {
+        return net_impairment_send_packets(&server->send_impairment, pkts, count);
+    }
     
     unsigned int sent_count = 0;
     for (unsigned int i = 0; i < count; i++) {
@@ -680,6 +1077,71 @@ const struct quic_tls_config_select_methods_t tls_config_select_method = {
     .select = server_select_tls_config,
 };
 
+// 处理连接并更新 timer
+static void process_connections(struct websocket_server *server) {
+    quic_endpoint_process_connections(server->quic_endpoint);
+    double timeout = quic_endpoint_timeout(server->quic_endpoint) / 1e3f;
+    if (timeout < 0.0001) {
+        timeout = 0.0001;
+    }
+    server->timer.repeat = timeout;
+    ev_timer_again(server->loop, &server->timer);
+}
+
+// 发送经过损伤模拟层延迟后的数据包
+static void impaired_send(void *ctx, const uint8_t *data, size_t len,
+                          const struct sockaddr *addr, socklen_t addr_len) {
+    struct websocket_server *server = ctx;
+    ssize_t sent = sendto(server->sock, data, len, 0, addr, addr_len);
+    if (sent != (ssize_t)len) {
+        fprintf(stderr, "impaired send failed: %s\n", strerror(errno));
+    }
+}
+
+// 将收到的（可能被延迟的）数据包交给 QUIC 端点
+static void deliver_packet(void *ctx, const uint8_t *data, size_t len,
+                           const struct sockaddr *addr, socklen_t addr_len) {
+    struct websocket_server *server = ctx;
+    struct quic_packet_info_t pkt_info = {
+        .src = addr,
+        .src_len = addr_len,
+        .dst = (struct sockaddr *)&server->local_addr,
+        .dst_len = server->local_addr_len,
+    };
+    int processed = quic_endpoint_recv(server->quic_endpoint, (uint8_t *)data, len, &pkt_info);
+    if (processed < 0) {
+        fprintf(stderr, "quic_endpoint_recv failed: %d\n", processed);
+    }
+}
+
+// 延迟数据包投递完成后处理连接并更新 timer
+static void flush_delivered(void *ctx) {
+    process_connections(ctx);
+}
+
+// 工作线程的回复已写入流，处理连接把数据发送出去
+static void flush_worker_results(void *ctx) {
+    process_connections(ctx);
+}
+
+// 事件循环阻塞前，把本轮发布写入其他连接的数据发送出去
+static void fanout_callback(EV_P_ ev_prepare *w, int revents) {
+    struct websocket_server *server = w->data;
+    if (server->fanout_pending) {
+        server->fanout_pending = false;
+        process_connections(server);
+    }
+}
+
+// 定期输出工作线程池的排队延迟统计
+static void stats_callback(EV_P_ ev_timer *w, int revents) {
+    struct websocket_server *server = w->data;
+    if (server->worker_pool.stats.completed != server->stats_last_completed) {
+        server->stats_last_completed = server->worker_pool.stats.completed;
+        ws_worker_pool_print_stats(&server->worker_pool, "websocket");
+    }
+}
+
 // 网络事件处理
 static void read_callback(EV_P_ ev_io *w, int revents) {
     struct websocket_server *server = w->data;
@@ -700,39 +1162,19 @@ static void read_callback(EV_P_ ev_io *w, int revents) {
             return;
         }
         
-        struct quic_packet_info_t pkt_info = {
-            .src = (struct sockaddr *)&peer_addr,
-            .src_len = peer_addr_len,
-            .dst = (struct sockaddr *)&server->local_addr,
-            .dst_len = server->local_addr_len,
-        };
-        int processed = quic_endpoint_recv(server->quic_endpoint, buf, read, &pkt_info);
-        if (processed < 0) {
-            fprintf(stderr, "quic_endpoint_recv failed: %d\n", processed);
-        }
+        net_impairment_submit(&server->recv_impairment, buf, read,
+                              (struct sockaddr *)&peer_addr, peer_addr_len);
     }
 
     // 关键修复：处理连接和更新 timer（参考 simple_h3_server）
-    quic_endpoint_process_connections(server->quic_endpoint);
-    double timeout = quic_endpoint_timeout(server->quic_endpoint) / 1e3f;
-    if (timeout < 0.0001) {
-        timeout = 0.0001;
-    }
-    server->timer.repeat = timeout;
-    ev_timer_again(EV_A_ &server->timer);
+    process_connections(server);
 }
 
+// 超时处理：先让 QUIC 端点处理到期的定时器（重传、空闲超时等），再处理连接
 static void timeout_callback(EV_P_ ev_timer *w, int revents) {
     struct websocket_server *server = w->data;
-    quic_endpoint_process_connections(server->quic_endpoint);
-    
-    uint64_t timeout = quic_endpoint_timeout(server->quic_endpoint);
-    if (timeout == UINT64_MAX) {
-        ev_timer_stop(EV_A_ w);
-    } else {
-        w->repeat = (double)timeout / 1000000.0;
-        ev_timer_again(EV_A_ w);
-    }
+    quic_endpoint_on_timeout(server->quic_endpoint);
+    process_connections(server);
 }
 
 // 创建套接字
@@ -788,9 +1230,39 @@ int main(int argc, char *argv[]) {
     
     struct websocket_server server;
     memset(&server, 0, sizeof(server));
+
+    // TQUIC_QUIET=1 时关闭逐连接、逐消息日志（参见 server_log.h）
+    server_log_init();
     
     // 创建事件循环
     server.loop = EV_DEFAULT;
+
+    // 可选的网络损伤模拟（参见 net_impairment.h）
+    if (net_impairment_init(&server.send_impairment, server.loop, NET_IMPAIRMENT_ENV_SEND,
+                            impaired_send, NULL, &server) != 0 ||
+        net_impairment_init(&server.recv_impairment, server.loop, NET_IMPAIRMENT_ENV_RECV,
+                            deliver_packet, flush_delivered, &server) != 0) {
+        return 1;
+    }
+
+    // 消息处理工作线程池（TQUIC_WS_WORKERS=0 时在事件循环线程内联处理）
+    size_t workers = ws_worker_pool_env(WS_WORKER_POOL_ENV_WORKERS,
+                                        WS_WORKER_POOL_DEFAULT_WORKERS);
+    size_t queue_limit = ws_worker_pool_env(WS_WORKER_POOL_ENV_QUEUE_LIMIT,
+                                            WS_WORKER_POOL_DEFAULT_QUEUE_LIMIT);
+    if (ws_worker_pool_init(&server.worker_pool, server.loop, workers, queue_limit,
+                            websocket_job_handler, websocket_job_complete,
+                            flush_worker_results, &server) != 0) {
+        return 1;
+    }
+    ev_timer_init(&server.stats_timer, stats_callback, WORKER_STATS_INTERVAL,
+                  WORKER_STATS_INTERVAL);
+    server.stats_timer.data = &server;
+    ev_timer_start(server.loop, &server.stats_timer);
+    ws_topics_init(&server.topics);
+    ev_prepare_init(&server.fanout_watcher, fanout_callback);
+    server.fanout_watcher.data = &server;
+    ev_prepare_start(server.loop, &server.fanout_watcher);
     
     // 创建套接字
     struct addrinfo *local = NULL;
@@ -848,7 +1320,14 @@ int main(int argc, char *argv[]) {
     
     // 清理
     if (local) freeaddrinfo(local);
+    net_impairment_print_stats(&server.send_impairment, "send");
+    net_impairment_print_stats(&server.recv_impairment, "recv");
+    net_impairment_free(&server.send_impairment);
+    net_impairment_free(&server.recv_impairment);
+    ws_worker_pool_print_stats(&server.worker_pool, "websocket");
+    ws_worker_pool_free(&server.worker_pool);
     quic_endpoint_free(server.quic_endpoint);
+    ws_topics_free(&server.topics);
     quic_config_free(config);
     quic_tls_config_free(server.tls_config);
     http3_config_free(server.h3_config);
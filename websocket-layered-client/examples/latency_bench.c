@@ -0,0 +1,184 @@
+/**
+ * 往返延迟基准测试 - 比较单线程模式和多线程模式
+ *
+ * 连接回显服务器（如 tquic_websocket_server），每次只发一条通知消息，
+ * 收到回显后记录往返时间并立即发送下一条，测量客户端各层带来的延迟：
+ * - worker_threads = 0：各层在事件循环线程中同步执行，回调里发送的消息立即发出
+ * - worker_threads > 0：发送经消息处理层的队列和发送线程，事件系统使用工作线程
+ *
+ * 前 WARMUP_MESSAGES 条不计入结果。按 Ctrl-C 提前结束当前一轮。
+ *
+ * 用法: latency_bench [host] [port] [消息数] [worker_threads...]（默认依次测试 0 和 2）
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+#include "layered_websocket_client.h"
+
+#define WARMUP_MESSAGES 100
+#define BENCH_MESSAGE_TYPE "latency_bench"
+
+typedef struct {
+    layered_websocket_client_t *client;
+    uint32_t worker_threads;
+    uint32_t total;          // 需要发送的消息数（含预热）
+    uint32_t sent;
+    uint64_t sent_at_us;
+    uint64_t *rtt_us;        // 预热之后的往返时间
+    uint32_t rtt_count;
+} bench_state_t;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// 结束本轮测试。多线程模式下回调运行在事件系统的工作线程中，而 libev 不是线程安全的，
+// 通过 SIGTERM 让客户端的信号监视器在事件循环线程中调用 layered_client_stop
+static void finish(bench_state_t *state) {
+    if (state->worker_threads == 0) {
+        layered_client_stop(state->client);
+    } else {
+        raise(SIGTERM);
+    }
+}
+
+static void send_next(bench_state_t *state) {
+    char data[64];
+    snprintf(data, sizeof(data), "{\"seq\":%u}", state->sent);
+    state->sent_at_us = now_us();
+    state->sent++;
+    if (layered_client_send_notification(state->client, BENCH_MESSAGE_TYPE, data) != 0) {
+        fprintf(stderr, "Failed to send message %u\n", state->sent);
+        finish(state);
+    }
+}
+
+static void on_client_event(const client_event_t *event, void *user_data) {
+    bench_state_t *state = (bench_state_t *)user_data;
+
+    switch (event->type) {
+        case CLIENT_EVENT_STATE_CHANGED:
+            if (event->new_state == CLIENT_STATE_CONNECTED && state->sent == 0) {
+                send_next(state);
+            }
+            break;
+
+        case CLIENT_EVENT_MESSAGE_RECEIVED:
+            if (!event->message_type || strcmp(event->message_type, BENCH_MESSAGE_TYPE) != 0) {
+                break;
+            }
+            if (state->sent > WARMUP_MESSAGES) {
+                state->rtt_us[state->rtt_count++] = now_us() - state->sent_at_us;
+            }
+            if (state->sent < state->total) {
+                send_next(state);
+            } else {
+                finish(state);
+            }
+            break;
+
+        case CLIENT_EVENT_ERROR:
+            fprintf(stderr, "Client error: %s (%d)\n",
+                    event->error_description ? event->error_description : "unknown",
+                    event->error_code);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// 运行一轮测试并输出结果，失败时返回 -1
+static int run_round(const char *host, const char *port, uint32_t messages,
+                     uint32_t worker_threads) {
+    bench_state_t state = {
+        .worker_threads = worker_threads,
+        .total = messages + WARMUP_MESSAGES,
+        .rtt_us = calloc(messages, sizeof(uint64_t)),
+    };
+    if (!state.rtt_us) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    client_config_t config = layered_client_config_default();
+    config.host = host;
+    config.port = port;
+    config.worker_threads = worker_threads;
+    config.auto_reconnect = false;
+    config.heartbeat_interval_ms = 0;
+    config.enable_logging = false;
+
+    int ret = -1;
+    state.client = layered_client_create(&config, on_client_event, &state);
+    if (!state.client) {
+        fprintf(stderr, "Failed to create client\n");
+        goto EXIT;
+    }
+    if (layered_client_connect(state.client) != 0) {
+        fprintf(stderr, "Failed to connect to %s:%s\n", host, port);
+        goto EXIT;
+    }
+    layered_client_run(state.client);
+
+    if (state.rtt_count == 0) {
+        fprintf(stderr, "No replies received\n");
+        goto EXIT;
+    }
+
+    qsort(state.rtt_us, state.rtt_count, sizeof(uint64_t), compare_u64);
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < state.rtt_count; i++) {
+        sum += state.rtt_us[i];
+    }
+    printf("%-8s %-10u %-10.1f %-10" PRIu64 " %-10" PRIu64 " %-10" PRIu64 " %-10" PRIu64 "\n",
+           worker_threads == 0 ? "inline" : "threaded", state.rtt_count,
+           (double)sum / state.rtt_count,
+           state.rtt_us[state.rtt_count / 2],
+           state.rtt_us[(uint64_t)state.rtt_count * 90 / 100],
+           state.rtt_us[(uint64_t)state.rtt_count * 99 / 100],
+           state.rtt_us[state.rtt_count - 1]);
+    ret = 0;
+
+EXIT:
+    layered_client_destroy(state.client);
+    free(state.rtt_us);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    const char *host = argc >= 2 ? argv[1] : "127.0.0.1";
+    const char *port = argc >= 3 ? argv[2] : "4433";
+    uint32_t messages = argc >= 4 ? (uint32_t)atoi(argv[3]) : 10000;
+    if (messages == 0) {
+        fprintf(stderr, "Usage: %s [host] [port] [messages] [worker_threads...]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t default_modes[] = {0, 2};
+    uint32_t mode_count = argc >= 5 ? (uint32_t)(argc - 4) : 2;
+
+    int failed = 0;
+    printf("round-trip latency (us), %u messages per mode\n", messages);
+    printf("%-8s %-10s %-10s %-10s %-10s %-10s %-10s\n", "mode", "messages", "avg", "p50",
+           "p90", "p99", "max");
+    for (uint32_t i = 0; i < mode_count; i++) {
+        uint32_t threads = argc >= 5 ? (uint32_t)atoi(argv[4 + i]) : default_modes[i];
+        if (run_round(host, port, messages, threads) != 0) {
+            failed++;
+        }
+    }
+    return failed > 0 ? 1 : 0;
+}
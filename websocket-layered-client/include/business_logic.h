@@ -54,6 +54,7 @@ typedef struct {
     uint32_t max_reconnect_attempts; // 最大重连次数
     uint32_t reconnect_delay_ms;     // 重连延迟
     bool enable_logging;             // 启用日志
+    bool thread_safe;                // false 时只能在事件循环线程调用，不加锁
 } business_config_t;
 
 // 订阅信息
@@ -20,6 +20,8 @@ typedef enum {
     EVENT_TYPE_CUSTOM
 } event_type_t;
 
+#define EVENT_TYPE_COUNT (EVENT_TYPE_CUSTOM + 1)
+
 // 事件优先级
 typedef enum {
     EVENT_PRIORITY_LOW = 0,
@@ -28,23 +30,24 @@ typedef enum {
     EVENT_PRIORITY_URGENT = 3
 } event_priority_t;
 
+#define EVENT_PRIORITY_COUNT (EVENT_PRIORITY_URGENT + 1)
+
+// 不超过该大小的载荷直接复制到事件内部，不单独分配内存
+#define EVENT_INLINE_DATA_SIZE 64
+
 // 通用事件结构
 typedef struct {
     event_type_t type;
     event_priority_t priority;
     uint64_t timestamp;
-    char *event_id;
+    uint64_t event_id;
+    uint64_t enqueue_time_us;   // 入队时刻（单调时钟），由事件系统设置，用于统计排队时间
     void *data;
     size_t data_size;
-    void (*data_destructor)(void *data);
+    void (*data_destructor)(void *data);  // 销毁事件时调用，内联载荷也会调用
+    uint8_t inline_data[EVENT_INLINE_DATA_SIZE];
 } generic_event_t;
 
-// 事件队列项
-typedef struct event_queue_item {
-    generic_event_t *event;
-    struct event_queue_item *next;
-} event_queue_item_t;
-
 // 事件处理器函数类型
 typedef void (*event_handler_t)(const generic_event_t *event, void *user_data);
 
@@ -78,20 +81,42 @@ typedef struct {
     uint32_t max_queue_size;        // 最大队列大小
     uint32_t worker_thread_count;   // 工作线程数
     bool enable_priority_queue;     // 启用优先级队列
-    bool thread_safe;               // 线程安全模式
+    uint32_t starvation_interval;   // 每取出多少个事件优先服务一次低优先级（0 为严格优先级）
+    uint32_t dispatch_batch_size;   // 工作线程每次取出并分发的最大事件数（1~256）
+    bool thread_safe;               // 线程安全模式；false 为单线程模式：不创建工作线程，
+                                    // 发布时在调用线程直接分发，只能在事件循环线程使用
     uint32_t event_timeout_ms;      // 事件处理超时
 } event_system_config_t;
 
+// 延迟直方图（微秒）：小于 16 的值逐个计数，更大的值每个 2 的幂区间分 8 个桶，误差不超过 12.5%
+#define EVENT_LATENCY_BUCKETS 272
+#define EVENT_LATENCY_MAX_US ((UINT64_C(1) << 36) - 1)
+
+typedef struct {
+    uint64_t buckets[EVENT_LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+} event_latency_histogram_t;
+
 // 事件系统统计信息
 typedef struct {
-    uint64_t events_processed;
+    uint64_t events_processed;          // 已分发的事件数
+    uint64_t dispatch_batches;          // 工作线程取出的批次数
     uint64_t events_dropped;
     uint64_t events_timeout;
     uint64_t queue_size;
-    uint64_t max_queue_size_reached;
+    uint64_t max_queue_size_reached;    // 队列长度的最高水位
+    uint64_t priority_queue_size[EVENT_PRIORITY_COUNT];  // 各优先级当前排队的事件数
+    uint64_t starvation_dequeues;       // 为防止饥饿而先于更高优先级取出的事件数
+    uint64_t events_published;          // 成功入队的事件数
+    uint64_t event_allocations;         // 进程内事件相关的堆分配次数（对象池未命中 + 非内联载荷）
+    double allocations_per_event;       // event_allocations / events_published
     uint32_t active_listeners;
     uint32_t active_timers;
-    double avg_processing_time_ms;
+    double avg_processing_time_ms;      // 每个事件所有处理器的平均总耗时
+    event_latency_histogram_t queue_wait_us;    // 入队到开始分发的时间
+    event_latency_histogram_t handler_time_us;  // 每个事件所有处理器的总耗时
 } event_system_stats_t;
 
 // 事件系统 API
@@ -122,10 +147,18 @@ void event_system_stop(event_system_t *system);
 void event_system_set_event_loop(event_system_t *system, struct ev_loop *loop);
 
 /**
- * 发布事件
+ * 发布事件（复制事件，调用者保留原事件）
  */
 int event_system_publish(event_system_t *system, const generic_event_t *event);
 
+/**
+ * 发布事件并转移所有权，不复制事件
+ *
+ * event 必须由 generic_event_create 创建；无论成功与否，调用后事件都归事件系统所有，
+ * 失败时由事件系统销毁
+ */
+int event_system_publish_move(event_system_t *system, generic_event_t *event);
+
 /**
  * 发布高优先级事件
  */
@@ -171,7 +204,7 @@ void event_system_pause_timer(event_system_t *system, uint32_t timer_id);
 void event_system_resume_timer(event_system_t *system, uint32_t timer_id);
 
 /**
- * 处理事件队列（单次）
+ * 处理事件队列（单次），应在事件循环线程调用
  */
 int event_system_process_once(event_system_t *system);
 
@@ -182,9 +215,16 @@ int event_system_process_all(event_system_t *system);
 
 /**
  * 获取事件系统统计信息
+ *
+ * 各线程的计数和直方图在读取时合并，不影响分发；返回的快照在下次调用前有效
  */
 const event_system_stats_t *event_system_get_stats(const event_system_t *system);
 
+/**
+ * 直方图的百分位数（percentile 取 0~100），返回所在桶的上界，没有样本时返回 0
+ */
+uint64_t event_latency_percentile(const event_latency_histogram_t *histogram, double percentile);
+
 /**
  * 获取默认配置
  */
@@ -194,6 +234,12 @@ event_system_config_t event_system_config_default(void);
 
 /**
  * 创建通用事件
+ *
+ * data_size > 0 时复制载荷：不超过 EVENT_INLINE_DATA_SIZE 的存放在事件内部，
+ * 否则单独分配；data_size == 0 时直接保存 data 指针。事件对象来自全局对象池。
+ *
+ * 销毁事件时对载荷调用 data_destructor（如有）。内联载荷的缓冲区属于事件对象，
+ * 析构函数只能释放载荷内部引用的资源，不能 free 载荷本身；更大的载荷与之前一样由析构函数负责释放。
  */
 generic_event_t *generic_event_create(event_type_t type,
                                      event_priority_t priority,
@@ -202,7 +248,7 @@ generic_event_t *generic_event_create(event_type_t type,
                                      void (*data_destructor)(void *data));
 
 /**
- * 销毁通用事件
+ * 销毁通用事件，事件对象归还对象池
  */
 void generic_event_destroy(generic_event_t *event);
 
@@ -212,9 +258,9 @@ void generic_event_destroy(generic_event_t *event);
 generic_event_t *generic_event_clone(const generic_event_t *event);
 
 /**
- * 生成事件 ID
+ * 生成事件 ID（进程内唯一的整数，从 1 开始，同一线程内递增）
  */
-char *generate_event_id(void);
+uint64_t generate_event_id(void);
 
 /**
  * 获取当前时间戳（微秒）
@@ -224,12 +270,13 @@ uint64_t get_timestamp_us(void);
 // 线程安全的事件队列操作
 
 /**
- * 线程安全地入队事件
+ * 线程安全地入队事件（无锁），成功时队列接管事件的所有权；
+ * 队列已满时返回 -1 并计入 events_dropped
  */
 int event_queue_enqueue_safe(event_system_t *system, generic_event_t *event);
 
 /**
- * 线程安全地出队事件
+ * 线程安全地出队事件（无锁），队列为空时返回 NULL，调用者负责销毁返回的事件
  */
 generic_event_t *event_queue_dequeue_safe(event_system_t *system);
 
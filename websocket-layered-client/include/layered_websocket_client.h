@@ -88,7 +88,8 @@ typedef struct {
     const char *log_file;
     
     // 性能配置
-    uint32_t worker_threads;
+    uint32_t worker_threads;        // 事件系统工作线程数；0 为单线程模式，各层在事件循环线程中同步执行，
+                                    // 不使用队列和锁，API 只能在事件循环线程调用
     bool enable_priority_queue;
     uint32_t buffer_size;
 } client_config_t;
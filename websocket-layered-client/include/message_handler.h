@@ -83,6 +83,7 @@ typedef struct {
     uint32_t heartbeat_interval_ms; // 心跳间隔
     bool enable_compression;        // 启用压缩
     bool enable_encryption;         // 启用加密
+    bool thread_safe;               // false 时不启动发送线程，在调用线程直接发送，不加锁
 } message_handler_config_t;
 
 // 消息统计信息
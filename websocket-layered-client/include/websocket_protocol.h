@@ -89,6 +89,7 @@ typedef struct {
     bool auto_reconnect;
     uint32_t max_reconnect_attempts;
     uint32_t reconnect_delay_ms;
+    bool thread_safe;           // false 时只能在事件循环线程调用，不加锁，发送后立即发出数据包
 } ws_config_t;
 
 // WebSocket 连接统计信息
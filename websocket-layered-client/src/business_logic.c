@@ -6,6 +6,8 @@
  * - 订阅/发布模式
  * - 用户认证和授权
  * - 业务状态管理
+ *
+ * config.thread_safe 为 false 时所有调用都在事件循环线程，不加锁。
  */
 
 #include "business_logic.h"
@@ -40,6 +42,19 @@ struct business_logic {
     time_t last_heartbeat;
 };
 
+// 单线程模式下不加锁
+static inline void logic_lock(business_logic_t *logic) {
+    if (logic->config.thread_safe) {
+        pthread_mutex_lock(&logic->mutex);
+    }
+}
+
+static inline void logic_unlock(business_logic_t *logic) {
+    if (logic->config.thread_safe) {
+        pthread_mutex_unlock(&logic->mutex);
+    }
+}
+
 // 默认配置
 business_config_t business_config_default(void) {
     business_config_t config = {
@@ -50,7 +65,8 @@ business_config_t business_config_default(void) {
         .auto_reconnect = true,
         .max_reconnect_attempts = 5,
         .reconnect_delay_ms = 1000,
-        .enable_logging = true
+        .enable_logging = true,
+        .thread_safe = true
     };
     return config;
 }
@@ -229,7 +245,7 @@ static void on_message_event(const message_event_t *event, void *user_data) {
     business_logic_t *logic = (business_logic_t *)user_data;
     if (!logic || !event) return;
     
-    pthread_mutex_lock(&logic->mutex);
+    logic_lock(logic);
     
     switch (event->type) {
         case MSG_EVENT_RECEIVED:
@@ -237,10 +253,12 @@ static void on_message_event(const message_event_t *event, void *user_data) {
                 logic->stats.notifications_received++;
 
                 // 打印接收到的消息用于调试
-                printf("[业务层] 收到消息: 类型=%s, ID=%s, 数据=%s\n",
-                       event->message->type ? event->message->type : "NULL",
-                       event->message->id ? event->message->id : "NULL",
-                       event->message->data ? event->message->data : "NULL");
+                if (logic->config.enable_logging) {
+                    printf("[业务层] 收到消息: 类型=%s, ID=%s, 数据=%s\n",
+                           event->message->type ? event->message->type : "NULL",
+                           event->message->id ? event->message->id : "NULL",
+                           event->message->data ? event->message->data : "NULL");
+                }
 
                 // 根据消息类型处理
                 if (strcmp(event->message->type, "notification") == 0) {
@@ -309,7 +327,7 @@ static void on_message_event(const message_event_t *event, void *user_data) {
             break;
     }
     
-    pthread_mutex_unlock(&logic->mutex);
+    logic_unlock(logic);
 }
 
 // 创建业务逻辑处理器
@@ -362,9 +380,9 @@ void business_logic_set_message_handler(business_logic_t *logic,
                                        message_handler_t *handler) {
     if (!logic) return;
     
-    pthread_mutex_lock(&logic->mutex);
+    logic_lock(logic);
     logic->msg_handler = handler;
-    pthread_mutex_unlock(&logic->mutex);
+    logic_unlock(logic);
 }
 
 // 发送业务请求
@@ -384,9 +402,9 @@ int business_logic_send_request(business_logic_t *logic,
                                             request_id);
     
     if (result == 0) {
-        pthread_mutex_lock(&logic->mutex);
+        logic_lock(logic);
         logic->stats.requests_sent++;
-        pthread_mutex_unlock(&logic->mutex);
+        logic_unlock(logic);
     }
     
     free(data);
@@ -398,12 +416,12 @@ int business_logic_subscribe_topic(business_logic_t *logic, const char *topic) {
     if (!logic || !topic || !logic->msg_handler) return -1;
     
     // 检查是否已经订阅
-    pthread_mutex_lock(&logic->mutex);
+    logic_lock(logic);
     subscription_t *sub = logic->subscriptions;
     while (sub) {
         if (strcmp(sub->topic, topic) == 0) {
             if (sub->active) {
-                pthread_mutex_unlock(&logic->mutex);
+                logic_unlock(logic);
                 return 0; // 已经订阅
             }
             break;
@@ -415,7 +433,7 @@ int business_logic_subscribe_topic(business_logic_t *logic, const char *topic) {
     if (!sub) {
         sub = calloc(1, sizeof(subscription_t));
         if (!sub) {
-            pthread_mutex_unlock(&logic->mutex);
+            logic_unlock(logic);
             return -1;
         }
         
@@ -428,7 +446,7 @@ int business_logic_subscribe_topic(business_logic_t *logic, const char *topic) {
     sub->subscribed_at = get_timestamp_ms();
     logic->stats.subscriptions_active++;
     
-    pthread_mutex_unlock(&logic->mutex);
+    logic_unlock(logic);
     
     // 发送订阅请求
     char *data = build_subscribe_request(topic, NULL);
@@ -444,7 +462,7 @@ int business_logic_subscribe_topic(business_logic_t *logic, const char *topic) {
 int business_logic_unsubscribe_topic(business_logic_t *logic, const char *topic) {
     if (!logic || !topic || !logic->msg_handler) return -1;
     
-    pthread_mutex_lock(&logic->mutex);
+    logic_lock(logic);
     
     subscription_t *sub = logic->subscriptions;
     while (sub) {
@@ -456,7 +474,7 @@ int business_logic_unsubscribe_topic(business_logic_t *logic, const char *topic)
         sub = sub->next;
     }
     
-    pthread_mutex_unlock(&logic->mutex);
+    logic_unlock(logic);
     
     // 发送取消订阅请求
     cJSON *data = cJSON_CreateObject();
@@ -482,10 +500,10 @@ int business_logic_send_heartbeat(business_logic_t *logic) {
     int result = message_handler_send_notification(logic->msg_handler, "heartbeat", data);
     
     if (result == 0) {
-        pthread_mutex_lock(&logic->mutex);
+        logic_lock(logic);
         logic->stats.heartbeats_sent++;
         logic->last_heartbeat = time(NULL);
-        pthread_mutex_unlock(&logic->mutex);
+        logic_unlock(logic);
     }
     
     free(data);
@@ -6,6 +6,25 @@
  * - 优先级调度
  * - 定时器管理
  * - 线程安全的事件分发
+ *
+ * 事件队列是每个优先级一个有界无锁 MPMC 环形队列（Dmitry Vyukov 算法），
+ * 发布和取出事件都不加锁、不分配队列节点；工作线程只在队列为空时通过
+ * futex 休眠，发布者只在有线程休眠时才发起唤醒系统调用。
+ *
+ * 出队默认从最高优先级取，同一优先级内保持 FIFO；每个线程每取出
+ * starvation_interval 个事件，有一次改为从最低的非空优先级取，
+ * 保证持续的高优先级流量下 LOW 事件也能得到处理。
+ *
+ * 监听器按事件类型存放在写时复制的数组中：订阅和退订在锁内生成新数组，
+ * 分发时无锁读取当前数组。工作线程每次取出一批事件后逐个分发，
+ * 统计信息按线程记录（单写者，不加锁），读取统计时再合并。
+ *
+ * thread_safe 为 false 时是单线程模式：不创建工作线程，发布事件时直接在调用线程分发，
+ * 不入队也不加锁；所有调用都必须在事件循环线程。
+ *
+ * 定时器是 1 毫秒精度的分层时间轮（4 层 × 64 槽，约 4.6 小时，更远的定时器
+ * 逐层下放），由事件循环上的一个 ev_timer 驱动，只在下一个非空槽到期时唤醒。
+ * 创建、销毁、暂停、恢复都是 O(1)；回调在释放锁之后执行。
  */
 
 #include "event_system.h"
@@ -14,22 +33,130 @@
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define CACHE_LINE_SIZE 64
+
+// 工作线程一批最多取出的事件数
+#define EVENT_DISPATCH_BATCH_MAX 256
+
+// 时间轮：每层 64 槽，第 n 层一个槽覆盖 64^n 毫秒
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SPAN ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+// 定时器 ID = 代数 << TIMER_INDEX_BITS | (槽位下标 + 1)，槽位复用后旧 ID 失效
+#define TIMER_INDEX_BITS 20
+#define TIMER_INDEX_MASK ((1u << TIMER_INDEX_BITS) - 1)
+#define TIMER_MAX_COUNT TIMER_INDEX_MASK
+#define TIMER_CHUNK_SIZE 256
+
+// 定时器：公开信息加时间轮链表指针；按块分配，地址不会因扩容而改变
+typedef struct timer_entry {
+    timer_info_t info;
+    uint64_t expires_ms;          // 到期时刻（单调时钟毫秒）
+    uint64_t remaining_ms;        // 暂停时剩余的时间
+    struct timer_entry *prev;     // 所在时间轮槽的双向链表，取消时 O(1) 摘除
+    struct timer_entry *next;
+    int level;                    // 所在层，-1 表示不在时间轮中
+    uint32_t slot;                // 所在槽
+    uint32_t index;               // 在块数组中的下标，用于生成 ID
+    bool in_use;
+    bool firing;                  // 一次性定时器已到期、回调尚未执行
+    uint32_t generation;
+    struct timer_entry *free_next;
+} timer_entry_t;
+
+// 定时器到期后、释放锁之前记下的定时器。ID 含代数，执行回调前重新查找，
+// 已销毁（槽位可能已被复用）或已暂停的定时器不再回调
+typedef struct {
+    uint32_t timer_id;
+} timer_fired_t;
+
+typedef struct {
+    timer_entry_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint32_t level_count[TIMER_WHEEL_LEVELS];
+    uint64_t current_ms;          // 已处理到的时刻
+    timer_entry_t **chunks;
+    uint32_t chunk_count;
+    uint32_t entry_count;         // 已分配的槽位数
+    timer_entry_t *free_list;
+    timer_fired_t *fired;
+    size_t fired_cap;
+} timer_wheel_t;
+
+// 某一事件类型的监听器数组，订阅变化时整体替换。分发线程可能仍在读取旧数组，
+// 旧数组记下替换时的纪元，等所有分发者都空闲或已进入更新的纪元后再释放
+typedef struct listener_table {
+    uint32_t count;
+    uint64_t retired_epoch;
+    struct listener_table *retired_next;
+    struct {
+        event_handler_t handler;
+        void *user_data;
+    } entries[];
+} listener_table_t;
+
+// 单个线程的统计信息，只由该线程写入
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) uint64_t events_processed;
+    uint64_t dispatch_batches;
+    event_latency_histogram_t queue_wait_us;
+    event_latency_histogram_t handler_time_us;
+} event_thread_stats_t;
+
+// 分发者：工作线程，或事件循环线程（单线程模式下为发布线程）
+typedef struct {
+    event_thread_stats_t stats;
+    _Atomic uint64_t listener_epoch;  // 正在分发时进入的监听器纪元，0 表示空闲
+    event_system_t *system;
+    pthread_t thread;
+} event_worker_t;
+
+// 环形队列槽位：sequence 表示槽位当前可写（== pos）还是可读（== pos + 1）
+typedef struct {
+    atomic_size_t sequence;
+    generic_event_t *event;
+} event_ring_cell_t;
+
+// 有界 MPMC 环形队列，入队和出队位置分别独占缓存行，避免生产者和消费者伪共享
+typedef struct {
+    event_ring_cell_t *cells;
+    size_t mask;
+    char pad0[CACHE_LINE_SIZE];
+    atomic_size_t enqueue_pos;
+    char pad1[CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+    atomic_size_t dequeue_pos;
+    char pad2[CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+} event_ring_t;
 
 // 事件系统结构体
 struct event_system {
     event_system_config_t config;
     
-    // 事件队列
-    event_queue_item_t *queue_head;
-    event_queue_item_t *queue_tail;
-    uint32_t queue_size;
-    
-    // 事件监听器
-    event_listener_t *listeners;
-    
-    // 定时器
-    timer_info_t *timers;
-    uint32_t next_timer_id;
+    // 事件队列：启用优先级队列时每个优先级一个环，否则只使用 rings[0]
+    event_ring_t rings[EVENT_PRIORITY_COUNT];
+    // 已入队（含正在入队）的事件数，用于 max_queue_size 限制
+    atomic_uint queue_size;
+    char pad0[CACHE_LINE_SIZE];
+    // 队列为空时的等待：休眠的线程数和 futex 唤醒序号
+    atomic_int sleepers;
+    atomic_uint wake_seq;
+    char pad1[CACHE_LINE_SIZE];
+    
+    // 事件监听器：每个类型一个数组，分发时无锁读取
+    listener_table_t *listeners[EVENT_TYPE_COUNT];
+    listener_table_t *retired_listeners;
+    _Atomic uint64_t listener_epoch;  // 每替换一个监听器数组加 1，从 1 开始
+    
+    // 定时器（由 mutex 保护）
+    timer_wheel_t wheel;
+    atomic_bool timers_changed;   // 其他线程改动了定时器，需要事件循环重新设置 ev_timer
 
     // 事件过滤器
     event_filter_t filter;
@@ -40,7 +167,6 @@ struct event_system {
     
     // 线程安全
     pthread_mutex_t mutex;
-    pthread_cond_t queue_cond;
     
     // 事件循环
     struct ev_loop *loop;
@@ -48,30 +174,192 @@ struct event_system {
     ev_timer timer_watcher;
     
     // 状态
-    bool running;
-    pthread_t *worker_threads;
+    atomic_bool running;
+    event_worker_t *workers;
+    // 工作线程之外（事件循环线程）分发事件时使用的统计和纪元
+    event_worker_t loop_worker;
 };
 
+// 单线程模式下不加锁
+static inline void event_system_lock(event_system_t *system) {
+    if (system->config.thread_safe) {
+        pthread_mutex_lock(&system->mutex);
+    }
+}
+
+static inline void event_system_unlock(event_system_t *system) {
+    if (system->config.thread_safe) {
+        pthread_mutex_unlock(&system->mutex);
+    }
+}
+
+// 初始化环形队列，容量向上取整为 2 的幂
+static int event_ring_init(event_ring_t *ring, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    ring->cells = malloc(size * sizeof(event_ring_cell_t));
+    if (!ring->cells) return -1;
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&ring->cells[i].sequence, i);
+        ring->cells[i].event = NULL;
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->enqueue_pos, 0);
+    atomic_init(&ring->dequeue_pos, 0);
+    return 0;
+}
+
+// 入队，队列满时返回 -1
+static int event_ring_push(event_ring_t *ring, generic_event_t *event) {
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        event_ring_cell_t *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                cell->event = event;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// 出队，队列空时返回 NULL
+static generic_event_t *event_ring_pop(event_ring_t *ring) {
+    size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        event_ring_cell_t *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                generic_event_t *event = cell->event;
+                atomic_store_explicit(&cell->sequence, pos + ring->mask + 1,
+                                      memory_order_release);
+                return event;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+static long futex(atomic_uint *addr, int op, unsigned int val) {
+    return syscall(SYS_futex, (unsigned int *)addr, op, val, NULL, NULL, 0);
+}
+
+// 唤醒休眠的工作线程；没有线程休眠时不发起系统调用
+static void event_queue_wake(event_system_t *system, int count) {
+    if (atomic_load(&system->sleepers) > 0) {
+        atomic_fetch_add(&system->wake_seq, 1);
+        futex(&system->wake_seq, FUTEX_WAKE_PRIVATE, count);
+    }
+}
+
+// 队列为空时休眠，直到有新事件或系统停止。
+// 先登记 sleepers 再复查队列，与发布者的“先入队再检查 sleepers”配对，不会丢失唤醒。
+static void event_queue_wait(event_system_t *system) {
+    unsigned int seq = atomic_load(&system->wake_seq);
+    atomic_fetch_add(&system->sleepers, 1);
+    if (atomic_load(&system->queue_size) == 0 && atomic_load(&system->running)) {
+        futex(&system->wake_seq, FUTEX_WAIT_PRIVATE, seq);
+    }
+    atomic_fetch_sub(&system->sleepers, 1);
+}
+
+// 环中当前的事件数（并发出入队时为近似值）
+static size_t event_ring_depth(event_ring_t *ring) {
+    size_t head = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+// 事件所属的环
+static event_ring_t *event_ring_for(event_system_t *system, const generic_event_t *event) {
+    if (!system->config.enable_priority_queue) {
+        return &system->rings[0];
+    }
+    int priority = event->priority;
+    if (priority < EVENT_PRIORITY_LOW) priority = EVENT_PRIORITY_LOW;
+    if (priority > EVENT_PRIORITY_URGENT) priority = EVENT_PRIORITY_URGENT;
+    return &system->rings[priority];
+}
+
 // 默认配置
 event_system_config_t event_system_config_default(void) {
     event_system_config_t config = {
         .max_queue_size = 10000,
         .worker_thread_count = 2,
         .enable_priority_queue = true,
+        .starvation_interval = 16,
+        .dispatch_batch_size = 32,
         .thread_safe = true,
         .event_timeout_ms = 5000
     };
     return config;
 }
 
+// 事件 ID 按块分配给各线程，避免每个事件都争用同一个原子计数器
+#define EVENT_ID_BLOCK 1024
+
+// 空闲事件对象池的容量，超出部分直接释放
+#define EVENT_POOL_SIZE 16384
+
+// 空闲事件对象池：复用无锁环形队列，可以在任意线程创建和销毁事件
+static event_ring_t g_event_pool;
+static pthread_once_t g_event_pool_once = PTHREAD_ONCE_INIT;
+
+// 事件相关的堆分配次数（对象池未命中 + 非内联载荷）
+static uint64_t g_event_allocations = 0;
+
+static void event_pool_init(void) {
+    if (event_ring_init(&g_event_pool, EVENT_POOL_SIZE) != 0) {
+        g_event_pool.cells = NULL;  // 没有对象池时每次都分配
+    }
+}
+
+static generic_event_t *event_pool_get(void) {
+    pthread_once(&g_event_pool_once, event_pool_init);
+    generic_event_t *event = g_event_pool.cells ? event_ring_pop(&g_event_pool) : NULL;
+    if (!event) {
+        event = malloc(sizeof(generic_event_t));
+        if (event) {
+            __atomic_fetch_add(&g_event_allocations, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return event;
+}
+
+static void event_pool_put(generic_event_t *event) {
+    if (!g_event_pool.cells || event_ring_push(&g_event_pool, event) != 0) {
+        free(event);
+    }
+}
+
 // 生成事件 ID
-char *generate_event_id(void) {
+uint64_t generate_event_id(void) {
     static uint64_t counter = 0;
-    char *id = malloc(32);
-    if (id) {
-        snprintf(id, 32, "evt_%lu_%lu", time(NULL), __sync_add_and_fetch(&counter, 1));
+    static _Thread_local uint64_t next = 0;
+    static _Thread_local uint64_t end = 0;
+    if (next == end) {
+        end = __sync_add_and_fetch(&counter, EVENT_ID_BLOCK) + 1;
+        next = end - EVENT_ID_BLOCK;
     }
-    return id;
+    return next++;
 }
 
 // 获取当前时间戳（微秒）
@@ -87,9 +375,10 @@ generic_event_t *generic_event_create(event_type_t type,
                                      void *data,
                                      size_t data_size,
                                      void (*data_destructor)(void *data)) {
-    generic_event_t *event = calloc(1, sizeof(generic_event_t));
+    generic_event_t *event = event_pool_get();
     if (!event) return NULL;
     
+    // 只初始化头部字段，内联缓冲区按需覆盖
     event->type = type;
     event->priority = priority;
     event->timestamp = get_timestamp_us();
@@ -98,13 +387,17 @@ generic_event_t *generic_event_create(event_type_t type,
     event->data_destructor = data_destructor;
     
     if (data && data_size > 0) {
-        event->data = malloc(data_size);
-        if (event->data) {
-            memcpy(event->data, data, data_size);
+        if (data_size <= EVENT_INLINE_DATA_SIZE) {
+            event->data = event->inline_data;
         } else {
-            generic_event_destroy(event);
-            return NULL;
+            event->data = malloc(data_size);
+            if (!event->data) {
+                event_pool_put(event);
+                return NULL;
+            }
+            __atomic_fetch_add(&g_event_allocations, 1, __ATOMIC_RELAXED);
         }
+        memcpy(event->data, data, data_size);
     } else {
         event->data = data;
     }
@@ -117,13 +410,14 @@ void generic_event_destroy(generic_event_t *event) {
     if (!event) return;
     
     if (event->data && event->data_destructor) {
+        // 内联载荷也要调用析构函数，释放载荷内部引用的资源
         event->data_destructor(event->data);
-    } else if (event->data && event->data_size > 0) {
+    } else if (event->data && event->data_size > 0 && event->data != event->inline_data) {
+        // 内联载荷的缓冲区随事件对象一起回收
         free(event->data);
     }
     
-    free(event->event_id);
-    free(event);
+    event_pool_put(event);
 }
 
 // 复制事件
@@ -135,94 +429,424 @@ generic_event_t *generic_event_clone(const generic_event_t *event) {
                                event->data_destructor);
 }
 
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static timer_entry_t *timer_entry_at(timer_wheel_t *wheel, uint32_t index) {
+    return &wheel->chunks[index / TIMER_CHUNK_SIZE][index % TIMER_CHUNK_SIZE];
+}
+
+// 按 ID 查找定时器，ID 无效或已过期时返回 NULL
+static timer_entry_t *timer_lookup(timer_wheel_t *wheel, uint32_t timer_id) {
+    uint32_t index = (timer_id & TIMER_INDEX_MASK) - 1;
+    if ((timer_id & TIMER_INDEX_MASK) == 0 || index >= wheel->entry_count) {
+        return NULL;
+    }
+    timer_entry_t *entry = timer_entry_at(wheel, index);
+    if (!entry->in_use || entry->info.timer_id != timer_id) {
+        return NULL;
+    }
+    return entry;
+}
+
+static timer_entry_t *timer_entry_alloc(timer_wheel_t *wheel) {
+    if (!wheel->free_list) {
+        if (wheel->entry_count + TIMER_CHUNK_SIZE > TIMER_MAX_COUNT) {
+            return NULL;
+        }
+        timer_entry_t **chunks = realloc(wheel->chunks,
+                                         (wheel->chunk_count + 1) * sizeof(*chunks));
+        if (!chunks) return NULL;
+        wheel->chunks = chunks;
+        timer_entry_t *chunk = calloc(TIMER_CHUNK_SIZE, sizeof(timer_entry_t));
+        if (!chunk) return NULL;
+        wheel->chunks[wheel->chunk_count++] = chunk;
+        for (int i = TIMER_CHUNK_SIZE - 1; i >= 0; i--) {
+            chunk[i].index = wheel->entry_count + i;
+            chunk[i].free_next = wheel->free_list;
+            wheel->free_list = &chunk[i];
+        }
+        wheel->entry_count += TIMER_CHUNK_SIZE;
+    }
+    timer_entry_t *entry = wheel->free_list;
+    wheel->free_list = entry->free_next;
+    entry->in_use = true;
+    entry->firing = false;
+    entry->level = -1;
+    entry->generation = (entry->generation + 1) & (UINT32_MAX >> TIMER_INDEX_BITS);
+    if (entry->generation == 0) {
+        entry->generation = 1;  // 保证 ID 非 0
+    }
+    return entry;
+}
+
+static void timer_entry_free(timer_wheel_t *wheel, timer_entry_t *entry) {
+    entry->in_use = false;
+    entry->info.timer_id = 0;
+    entry->free_next = wheel->free_list;
+    wheel->free_list = entry;
+}
+
+static uint32_t timer_entry_id(const timer_entry_t *entry) {
+    return (entry->generation << TIMER_INDEX_BITS) | (entry->index + 1);
+}
+
+// 按到期时刻放入对应层的槽
+static void timer_wheel_insert(timer_wheel_t *wheel, timer_entry_t *entry) {
+    if (entry->expires_ms <= wheel->current_ms) {
+        entry->expires_ms = wheel->current_ms + 1;
+    }
+    uint64_t delta = entry->expires_ms - wheel->current_ms;
+    // 超出时间轮范围的放在最高层最远的槽，到时再逐层下放
+    uint64_t expires = delta < TIMER_WHEEL_SPAN ? entry->expires_ms
+                                                : wheel->current_ms + TIMER_WHEEL_SPAN - 1;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= ((uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    uint32_t slot = (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+
+    entry->level = level;
+    entry->slot = slot;
+    entry->prev = NULL;
+    entry->next = wheel->slots[level][slot];
+    if (entry->next) {
+        entry->next->prev = entry;
+    }
+    wheel->slots[level][slot] = entry;
+    wheel->level_count[level]++;
+}
+
+static void timer_wheel_remove(timer_wheel_t *wheel, timer_entry_t *entry) {
+    if (entry->level < 0) return;
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        wheel->slots[entry->level][entry->slot] = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    }
+    wheel->level_count[entry->level]--;
+    entry->level = -1;
+    entry->prev = entry->next = NULL;
+}
+
+// 把一个高层槽中的定时器重新分配到更低的层
+static void timer_wheel_cascade(timer_wheel_t *wheel, int level, uint32_t slot) {
+    timer_entry_t *entry = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    while (entry) {
+        timer_entry_t *next = entry->next;
+        wheel->level_count[level]--;
+        timer_wheel_insert(wheel, entry);
+        entry = next;
+    }
+}
+
+static bool timer_fired_push(timer_wheel_t *wheel, size_t *count, timer_entry_t *entry) {
+    if (*count == wheel->fired_cap) {
+        size_t cap = wheel->fired_cap ? wheel->fired_cap * 2 : 64;
+        timer_fired_t *fired = realloc(wheel->fired, cap * sizeof(*fired));
+        if (!fired) return false;  // 内存不足时丢弃本次回调
+        wheel->fired = fired;
+        wheel->fired_cap = cap;
+    }
+    wheel->fired[(*count)++] = (timer_fired_t){entry->info.timer_id};
+    return true;
+}
+
+// 推进时间轮到 now，收集到期的定时器；重复定时器重新放入，
+// 一次性定时器标记为 firing，执行回调时再释放
+static size_t timer_wheel_advance(event_system_t *system, uint64_t now) {
+    timer_wheel_t *wheel = &system->wheel;
+    size_t fired = 0;
+
+    while (wheel->current_ms < now) {
+        if (wheel->level_count[0] == 0) {
+            // 第 0 层为空：直接跳到下一次需要下放高层定时器的时刻
+            uint64_t boundary = wheel->current_ms | TIMER_WHEEL_MASK;
+            if (boundary >= now) {
+                wheel->current_ms = now;
+                break;
+            }
+            wheel->current_ms = boundary;
+        }
+        wheel->current_ms++;
+
+        // 低层转完一圈时，把上一层对应槽的定时器下放
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            uint64_t lower_mask = ((uint64_t)1 << (TIMER_WHEEL_BITS * level)) - 1;
+            if ((wheel->current_ms & lower_mask) != 0) break;
+            uint32_t slot = (wheel->current_ms >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+            timer_wheel_cascade(wheel, level, slot);
+        }
+
+        uint32_t slot = wheel->current_ms & TIMER_WHEEL_MASK;
+        timer_entry_t *entry = wheel->slots[0][slot];
+        wheel->slots[0][slot] = NULL;
+        while (entry) {
+            timer_entry_t *next = entry->next;
+            wheel->level_count[0]--;
+            entry->level = -1;
+            entry->prev = entry->next = NULL;
+            bool pushed = timer_fired_push(wheel, &fired, entry);
+            if (entry->info.repeat) {
+                uint32_t interval = entry->info.interval_ms ? entry->info.interval_ms : 1;
+                entry->expires_ms = wheel->current_ms + interval;
+                timer_wheel_insert(wheel, entry);
+            } else {
+                // 不再计入活动定时器，暂停和恢复对其无效，销毁时回调被跳过
+                entry->info.active = false;
+                entry->firing = true;
+                system->stats.active_timers--;
+                if (!pushed) {
+                    timer_entry_free(wheel, entry);
+                }
+            }
+            entry = next;
+        }
+    }
+    return fired;
+}
+
+// 下一个非空槽的时刻，没有定时器时返回 0
+static uint64_t timer_wheel_next(timer_wheel_t *wheel) {
+    uint64_t next = 0;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        if (wheel->level_count[level] == 0) continue;
+        int shift = TIMER_WHEEL_BITS * level;
+        uint64_t base = wheel->current_ms >> shift;
+        for (uint64_t i = 1; i <= TIMER_WHEEL_SLOTS; i++) {
+            if (wheel->slots[level][(base + i) & TIMER_WHEEL_MASK]) {
+                uint64_t at = (base + i) << shift;
+                if (next == 0 || at < next) next = at;
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+// 根据时间轮设置 ev_timer，只能在事件循环线程调用，调用时持有 mutex
+static void timer_rearm_locked(event_system_t *system, uint64_t now) {
+    ev_timer_stop(system->loop, &system->timer_watcher);
+    uint64_t next = timer_wheel_next(&system->wheel);
+    if (next) {
+        double after = next > now ? (next - now) / 1000.0 : 0.0;
+        ev_timer_set(&system->timer_watcher, after, 0.0);
+        ev_timer_start(system->loop, &system->timer_watcher);
+    }
+}
+
+// 定时器改动后通知事件循环重新设置 ev_timer；单线程模式下已在事件循环线程，直接设置
+static void timer_notify_changed(event_system_t *system) {
+    if (system->loop && !system->config.thread_safe) {
+        timer_rearm_locked(system, monotonic_ms());
+    } else if (system->loop) {
+        atomic_store(&system->timers_changed, true);
+        ev_async_send(system->loop, &system->async_watcher);
+    }
+}
+
 // 异步事件处理回调
 static void async_cb(EV_P_ ev_async *w, int revents) {
     event_system_t *system = (event_system_t *)w->data;
-    if (system) {
-        event_system_process_all(system);
+    if (!system) return;
+    
+    if (atomic_exchange(&system->timers_changed, false)) {
+        event_system_lock(system);
+        timer_rearm_locked(system, monotonic_ms());
+        event_system_unlock(system);
     }
+    event_system_process_all(system);
 }
 
-// 定时器回调
+// 定时器回调：推进时间轮，在锁外执行到期的回调
 static void timer_cb(EV_P_ ev_timer *w, int revents) {
     event_system_t *system = (event_system_t *)w->data;
     if (!system) return;
     
-    pthread_mutex_lock(&system->mutex);
+    uint64_t now = monotonic_ms();
+    event_system_lock(system);
+    size_t count = timer_wheel_advance(system, now);
+    timer_rearm_locked(system, now);
+    event_system_unlock(system);
+    
+    // fired 只在事件循环线程中使用，释放锁后回调可以安全地创建或销毁定时器。
+    // 前面的回调或其他线程可能已销毁、暂停后面的定时器，每个回调前都重新查找
+    for (size_t i = 0; i < count; i++) {
+        event_system_lock(system);
+        timer_entry_t *entry = timer_lookup(&system->wheel, system->wheel.fired[i].timer_id);
+        bool run = entry && (entry->firing || entry->info.active);
+        timer_callback_t callback = run ? entry->info.callback : NULL;
+        void *user_data = run ? entry->info.user_data : NULL;
+        if (entry && entry->firing) {
+            timer_entry_free(&system->wheel, entry);
+        }
+        event_system_unlock(system);
 
-    timer_info_t *timer = system->timers;
-    
-    while (timer) {
-        if (timer->active && timer->callback) {
-            // 触发定时器回调
-            timer->callback(timer->user_data);
-            
-            if (!timer->repeat) {
-                timer->active = false;
-            }
+        if (run) {
+            callback(user_data);
         }
-        timer = (timer_info_t *)timer; // 简化的链表遍历
     }
-    
-    pthread_mutex_unlock(&system->mutex);
 }
 
-// 工作线程函数
-static void *worker_thread_func(void *arg) {
-    event_system_t *system = (event_system_t *)arg;
-    
-    while (system->running) {
-        pthread_mutex_lock(&system->mutex);
-        
-        // 等待事件
-        while (system->running && !system->queue_head) {
-            pthread_cond_wait(&system->queue_cond, &system->mutex);
-        }
-        
-        if (!system->running) {
-            pthread_mutex_unlock(&system->mutex);
-            break;
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 统计字段只有一个写者，读取方可能在其他线程，用原子读写但不需要加锁前缀的指令
+static inline void stat_add(uint64_t *field, uint64_t value) {
+    __atomic_store_n(field, __atomic_load_n(field, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+static size_t latency_bucket(uint64_t value) {
+    if (value > EVENT_LATENCY_MAX_US) value = EVENT_LATENCY_MAX_US;
+    if (value < 16) return value;
+    unsigned shift = 63 - __builtin_clzll(value) - 3;
+    return 16 + (shift - 1) * 8 + ((value >> shift) - 8);
+}
+
+static uint64_t latency_bucket_upper(size_t index) {
+    if (index < 16) return index;
+    unsigned shift = (index - 16) / 8 + 1;
+    uint64_t sub = (index - 16) % 8 + 8;
+    return ((sub + 1) << shift) - 1;
+}
+
+static void latency_record(event_latency_histogram_t *histogram, uint64_t value) {
+    stat_add(&histogram->buckets[latency_bucket(value)], 1);
+    stat_add(&histogram->count, 1);
+    stat_add(&histogram->total_us, value);
+    if (value > __atomic_load_n(&histogram->max_us, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&histogram->max_us, value, __ATOMIC_RELAXED);
+    }
+}
+
+static void latency_merge(event_latency_histogram_t *dst, const event_latency_histogram_t *src) {
+    for (size_t i = 0; i < EVENT_LATENCY_BUCKETS; i++) {
+        dst->buckets[i] += __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+    }
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->total_us += __atomic_load_n(&src->total_us, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&src->max_us, __ATOMIC_RELAXED);
+    if (max > dst->max_us) dst->max_us = max;
+}
+
+// 直方图的百分位数
+uint64_t event_latency_percentile(const event_latency_histogram_t *histogram, double percentile) {
+    if (!histogram || histogram->count == 0) return 0;
+    
+    uint64_t target = (uint64_t)(histogram->count * percentile / 100.0);
+    if (target == 0) target = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < EVENT_LATENCY_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= target) {
+            uint64_t upper = latency_bucket_upper(i);
+            return upper < histogram->max_us ? upper : histogram->max_us;
         }
-        
-        // 取出事件
-        event_queue_item_t *item = system->queue_head;
-        if (item) {
-            system->queue_head = item->next;
-            if (!system->queue_head) {
-                system->queue_tail = NULL;
-            }
-            system->queue_size--;
+    }
+    return histogram->max_us;
+}
+
+// 开始读取监听器数组前进入当前纪元。处理器中嵌套分发时保留外层的纪元，返回值交给 listener_read_end
+static uint64_t listener_read_begin(event_system_t *system, event_worker_t *worker) {
+    uint64_t outer = atomic_load_explicit(&worker->listener_epoch, memory_order_relaxed);
+    if (outer == 0) {
+        // 与 listener_table_replace 配对，都用 seq_cst：回收方看到本线程空闲时，
+        // 本线程随后读到的一定是已替换的新数组
+        atomic_store(&worker->listener_epoch, atomic_load(&system->listener_epoch));
+    }
+    return outer;
+}
+
+static void listener_read_end(event_worker_t *worker, uint64_t outer) {
+    atomic_store_explicit(&worker->listener_epoch, outer, memory_order_release);
+}
+
+// 调用事件类型的所有监听器，调用方须在 listener_read_begin/end 之间
+static void event_dispatch(event_system_t *system, const generic_event_t *event) {
+    if ((unsigned)event->type >= EVENT_TYPE_COUNT) return;
+    
+    listener_table_t *table = __atomic_load_n(&system->listeners[event->type], __ATOMIC_SEQ_CST);
+    if (table) {
+        for (uint32_t i = 0; i < table->count; i++) {
+            table->entries[i].handler(event, table->entries[i].user_data);
         }
+    }
+}
+
+// 单线程模式：在发布线程直接分发，不入队，排队时间记为 0
+static void event_dispatch_inline(event_system_t *system, const generic_event_t *event) {
+    event_thread_stats_t *stats = &system->loop_worker.stats;
+    uint64_t outer = listener_read_begin(system, &system->loop_worker);
+    uint64_t start = monotonic_us();
+    event_dispatch(system, event);
+    listener_read_end(&system->loop_worker, outer);
+    latency_record(&stats->queue_wait_us, 0);
+    latency_record(&stats->handler_time_us, monotonic_us() - start);
+    stat_add(&stats->events_processed, 1);
+    stat_add(&stats->dispatch_batches, 1);
+    stat_add(&system->stats.events_published, 1);
+}
+
+// 分发一批事件并销毁。一次取时间戳同时作为上一个事件的结束和下一个事件的开始，
+// 排队时间包括在同一批中等待前面事件处理的时间。整批分发完再销毁事件，
+// 处理时间不包括载荷析构和归还对象池
+static void event_dispatch_batch(event_system_t *system, generic_event_t **events, size_t count,
+                                 event_worker_t *worker) {
+    event_thread_stats_t *stats = &worker->stats;
+    uint64_t outer = listener_read_begin(system, worker);
+    uint64_t start = monotonic_us();
+    for (size_t i = 0; i < count; i++) {
+        generic_event_t *event = events[i];
+        latency_record(&stats->queue_wait_us,
+                       start > event->enqueue_time_us ? start - event->enqueue_time_us : 0);
         
-        pthread_mutex_unlock(&system->mutex);
+        event_dispatch(system, event);
         
-        if (item && item->event) {
-            // 处理事件
-            event_listener_t *listener = system->listeners;
-            while (listener) {
-                if (listener->active && 
-                    listener->event_type == item->event->type &&
-                    listener->handler) {
-                    
-                    uint64_t start_time = get_timestamp_us();
-                    listener->handler(item->event, listener->user_data);
-                    uint64_t end_time = get_timestamp_us();
-                    
-                    // 更新统计信息
-                    pthread_mutex_lock(&system->mutex);
-                    system->stats.events_processed++;
-                    double processing_time = (end_time - start_time) / 1000.0;
-                    system->stats.avg_processing_time_ms = 
-                        (system->stats.avg_processing_time_ms + processing_time) / 2.0;
-                    pthread_mutex_unlock(&system->mutex);
-                }
-                listener = listener->next;
-            }
-            
-            // 清理事件
-            generic_event_destroy(item->event);
-            free(item);
+        uint64_t end = monotonic_us();
+        latency_record(&stats->handler_time_us, end - start);
+        start = end;
+    }
+    listener_read_end(worker, outer);
+    for (size_t i = 0; i < count; i++) {
+        generic_event_destroy(events[i]);
+    }
+    stat_add(&stats->events_processed, count);
+    stat_add(&stats->dispatch_batches, 1);
+}
+
+static size_t event_queue_dequeue_batch(event_system_t *system, generic_event_t **events,
+                                        size_t max);
+
+// 工作线程函数
+static void *worker_thread_func(void *arg) {
+    event_worker_t *worker = (event_worker_t *)arg;
+    event_system_t *system = worker->system;
+    
+    uint32_t batch_size = system->config.dispatch_batch_size;
+    if (batch_size == 0) batch_size = 1;
+    if (batch_size > EVENT_DISPATCH_BATCH_MAX) batch_size = EVENT_DISPATCH_BATCH_MAX;
+    generic_event_t *batch[EVENT_DISPATCH_BATCH_MAX];
+    
+    while (atomic_load(&system->running)) {
+        // 取出一批事件，队列为空时休眠
+        size_t count = event_queue_dequeue_batch(system, batch, batch_size);
+        if (count == 0) {
+            event_queue_wait(system);
+            continue;
         }
+        
+        event_dispatch_batch(system, batch, count, worker);
     }
     
     return NULL;
@@ -236,27 +860,45 @@ event_system_t *event_system_create(const event_system_config_t *config) {
     if (!system) return NULL;
     
     system->config = *config;
-    system->running = true;
-    system->next_timer_id = 1;
+    atomic_init(&system->running, true);
+    atomic_init(&system->listener_epoch, 1);
+    system->wheel.current_ms = monotonic_ms();
     
     // 初始化同步对象
-    if (pthread_mutex_init(&system->mutex, NULL) != 0 ||
-        pthread_cond_init(&system->queue_cond, NULL) != 0) {
-        event_system_destroy(system);
+    if (pthread_mutex_init(&system->mutex, NULL) != 0) {
+        free(system);
         return NULL;
     }
     
-    // 创建工作线程
-    if (config->worker_thread_count > 0) {
-        system->worker_threads = calloc(config->worker_thread_count, sizeof(pthread_t));
-        if (!system->worker_threads) {
+    // 初始化事件队列，每个环都能容纳 max_queue_size 个事件
+    int ring_count = config->enable_priority_queue ? EVENT_PRIORITY_COUNT : 1;
+    for (int i = 0; i < ring_count; i++) {
+        if (event_ring_init(&system->rings[i], config->max_queue_size) != 0) {
             event_system_destroy(system);
             return NULL;
         }
+    }
+    
+    // 创建工作线程，每个线程的统计信息独占缓存行；单线程模式下不创建
+    if (!config->thread_safe) {
+        system->config.worker_thread_count = 0;
+    }
+    if (system->config.worker_thread_count > 0) {
+        size_t size = system->config.worker_thread_count * sizeof(event_worker_t);
+        system->workers = aligned_alloc(CACHE_LINE_SIZE, size);
+        if (!system->workers) {
+            system->config.worker_thread_count = 0;
+            event_system_destroy(system);
+            return NULL;
+        }
+        memset(system->workers, 0, size);
         
-        for (uint32_t i = 0; i < config->worker_thread_count; i++) {
-            if (pthread_create(&system->worker_threads[i], NULL, 
-                             worker_thread_func, system) != 0) {
+        for (uint32_t i = 0; i < system->config.worker_thread_count; i++) {
+            system->workers[i].system = system;
+            if (pthread_create(&system->workers[i].thread, NULL, 
+                             worker_thread_func, &system->workers[i]) != 0) {
+                // 只等待已创建的线程
+                system->config.worker_thread_count = i;
                 event_system_destroy(system);
                 return NULL;
             }
@@ -274,30 +916,38 @@ void event_system_destroy(event_system_t *system) {
     event_system_stop(system);
     
     // 等待工作线程结束
-    if (system->worker_threads) {
+    if (system->workers) {
         for (uint32_t i = 0; i < system->config.worker_thread_count; i++) {
-            pthread_join(system->worker_threads[i], NULL);
+            pthread_join(system->workers[i].thread, NULL);
         }
-        free(system->worker_threads);
+        free(system->workers);
     }
     
     // 清理事件队列
     event_queue_clear(system);
+    for (int i = 0; i < EVENT_PRIORITY_COUNT; i++) {
+        free(system->rings[i].cells);
+    }
     
     // 清理监听器
-    event_listener_t *listener = system->listeners;
-    while (listener) {
-        event_listener_t *next = listener->next;
-        free(listener);
-        listener = next;
+    for (int i = 0; i < EVENT_TYPE_COUNT; i++) {
+        free(system->listeners[i]);
+    }
+    while (system->retired_listeners) {
+        listener_table_t *next = system->retired_listeners->retired_next;
+        free(system->retired_listeners);
+        system->retired_listeners = next;
     }
     
     // 清理定时器
-    free(system->timers);
+    for (uint32_t i = 0; i < system->wheel.chunk_count; i++) {
+        free(system->wheel.chunks[i]);
+    }
+    free(system->wheel.chunks);
+    free(system->wheel.fired);
     
     // 销毁同步对象
     pthread_mutex_destroy(&system->mutex);
-    pthread_cond_destroy(&system->queue_cond);
     
     free(system);
 }
@@ -306,9 +956,7 @@ void event_system_destroy(event_system_t *system) {
 int event_system_start(event_system_t *system) {
     if (!system) return -1;
     
-    pthread_mutex_lock(&system->mutex);
-    system->running = true;
-    pthread_mutex_unlock(&system->mutex);
+    atomic_store(&system->running, true);
     
     return 0;
 }
@@ -317,10 +965,10 @@ int event_system_start(event_system_t *system) {
 void event_system_stop(event_system_t *system) {
     if (!system) return;
     
-    pthread_mutex_lock(&system->mutex);
-    system->running = false;
-    pthread_cond_broadcast(&system->queue_cond);
-    pthread_mutex_unlock(&system->mutex);
+    atomic_store(&system->running, false);
+    // 唤醒所有休眠的工作线程，让它们看到 running == false 后退出
+    atomic_fetch_add(&system->wake_seq, 1);
+    futex(&system->wake_seq, FUTEX_WAKE_PRIVATE, INT_MAX);
     
     if (system->loop) {
         ev_async_stop(system->loop, &system->async_watcher);
@@ -340,10 +988,12 @@ void event_system_set_event_loop(event_system_t *system, struct ev_loop *loop) {
         system->async_watcher.data = system;
         ev_async_start(loop, &system->async_watcher);
         
-        // 初始化定时器监视器
-        ev_timer_init(&system->timer_watcher, timer_cb, 0.1, 0.1);
+        // 初始化定时器监视器，按时间轮中最近的定时器设置
+        ev_timer_init(&system->timer_watcher, timer_cb, 0.0, 0.0);
         system->timer_watcher.data = system;
-        ev_timer_start(loop, &system->timer_watcher);
+        event_system_lock(system);
+        timer_rearm_locked(system, monotonic_ms());
+        event_system_unlock(system);
     }
 }
 
@@ -351,57 +1001,38 @@ void event_system_set_event_loop(event_system_t *system, struct ev_loop *loop) {
 int event_system_publish(event_system_t *system, const generic_event_t *event) {
     if (!system || !event) return -1;
     
-    pthread_mutex_lock(&system->mutex);
-    
-    // 检查队列是否已满
-    if (system->queue_size >= system->config.max_queue_size) {
-        system->stats.events_dropped++;
-        pthread_mutex_unlock(&system->mutex);
-        return -1;
+    // 单线程模式下同步分发，不需要复制
+    if (!system->config.thread_safe) {
+        event_dispatch_inline(system, event);
+        return 0;
     }
     
-    // 创建队列项
-    event_queue_item_t *item = calloc(1, sizeof(event_queue_item_t));
-    if (!item) {
-        pthread_mutex_unlock(&system->mutex);
+    generic_event_t *copy = generic_event_clone(event);
+    if (!copy) {
         return -1;
     }
     
-    item->event = generic_event_clone(event);
-    if (!item->event) {
-        free(item);
-        pthread_mutex_unlock(&system->mutex);
+    return event_system_publish_move(system, copy);
+}
+
+// 发布事件并转移所有权
+int event_system_publish_move(event_system_t *system, generic_event_t *event) {
+    if (!event) return -1;
+    if (!system) {
+        generic_event_destroy(event);
         return -1;
     }
     
-    // 添加到队列
-    if (system->config.enable_priority_queue) {
-        // 按优先级插入
-        event_queue_item_t **current = &system->queue_head;
-        while (*current && (*current)->event->priority >= event->priority) {
-            current = &(*current)->next;
-        }
-        item->next = *current;
-        *current = item;
-        
-        if (!item->next) {
-            system->queue_tail = item;
-        }
-    } else {
-        // 添加到队列尾部
-        if (system->queue_tail) {
-            system->queue_tail->next = item;
-        } else {
-            system->queue_head = item;
-        }
-        system->queue_tail = item;
+    if (!system->config.thread_safe) {
+        event_dispatch_inline(system, event);
+        generic_event_destroy(event);
+        return 0;
     }
     
-    system->queue_size++;
-    
-    // 通知工作线程
-    pthread_cond_signal(&system->queue_cond);
-    pthread_mutex_unlock(&system->mutex);
+    if (event_queue_enqueue_safe(system, event) != 0) {
+        generic_event_destroy(event);
+        return -1;
+    }
     
     // 通知事件循环
     if (system->loop) {
@@ -421,26 +1052,73 @@ int event_system_publish_urgent(event_system_t *system, const generic_event_t *e
     return event_system_publish(system, &urgent_event);
 }
 
+// 释放没有分发者还可能读取的旧监听器数组：分发者空闲，或进入的纪元不早于数组被替换时的纪元。
+// 调用时持有 mutex
+static void listener_tables_reclaim(event_system_t *system) {
+    uint64_t oldest = atomic_load(&system->loop_worker.listener_epoch);
+    for (uint32_t i = 0; i < system->config.worker_thread_count; i++) {
+        uint64_t epoch = atomic_load(&system->workers[i].listener_epoch);
+        if (epoch != 0 && (oldest == 0 || epoch < oldest)) {
+            oldest = epoch;
+        }
+    }
+    
+    listener_table_t **link = &system->retired_listeners;
+    while (*link) {
+        listener_table_t *table = *link;
+        if (oldest == 0 || table->retired_epoch <= oldest) {
+            *link = table->retired_next;
+            free(table);
+        } else {
+            link = &table->retired_next;
+        }
+    }
+}
+
+// 用新数组替换某一类型的监听器数组，调用时持有 mutex
+static void listener_table_replace(event_system_t *system, event_type_t event_type,
+                                   listener_table_t *table) {
+    listener_table_t *old = system->listeners[event_type];
+    __atomic_store_n(&system->listeners[event_type], table, __ATOMIC_SEQ_CST);
+    if (old) {
+        // 此后进入新纪元的分发者只会读到新数组
+        old->retired_epoch = atomic_fetch_add(&system->listener_epoch, 1) + 1;
+        old->retired_next = system->retired_listeners;
+        system->retired_listeners = old;
+    }
+    listener_tables_reclaim(system);
+}
+
 // 订阅事件类型
 int event_system_subscribe(event_system_t *system,
                           event_type_t event_type,
                           event_handler_t handler,
                           void *user_data) {
-    if (!system || !handler) return -1;
+    if (!system || !handler || (unsigned)event_type >= EVENT_TYPE_COUNT) return -1;
     
-    event_listener_t *listener = calloc(1, sizeof(event_listener_t));
-    if (!listener) return -1;
+    event_system_lock(system);
     
-    listener->event_type = event_type;
-    listener->handler = handler;
-    listener->user_data = user_data;
-    listener->active = true;
+    listener_table_t *old = system->listeners[event_type];
+    uint32_t count = old ? old->count : 0;
+    listener_table_t *table = malloc(sizeof(listener_table_t) +
+                                     (count + 1) * sizeof(table->entries[0]));
+    if (!table) {
+        event_system_unlock(system);
+        return -1;
+    }
     
-    pthread_mutex_lock(&system->mutex);
-    listener->next = system->listeners;
-    system->listeners = listener;
+    // 新监听器放在最前面，与原来链表头插的分发顺序一致
+    table->count = count + 1;
+    table->retired_next = NULL;
+    table->entries[0].handler = handler;
+    table->entries[0].user_data = user_data;
+    if (count > 0) {
+        memcpy(&table->entries[1], old->entries, count * sizeof(table->entries[0]));
+    }
+    listener_table_replace(system, event_type, table);
     system->stats.active_listeners++;
-    pthread_mutex_unlock(&system->mutex);
+    
+    event_system_unlock(system);
     
     return 0;
 }
@@ -449,24 +1127,37 @@ int event_system_subscribe(event_system_t *system,
 void event_system_unsubscribe(event_system_t *system,
                              event_type_t event_type,
                              event_handler_t handler) {
-    if (!system || !handler) return;
-    
-    pthread_mutex_lock(&system->mutex);
-    
-    event_listener_t **current = &system->listeners;
-    while (*current) {
-        if ((*current)->event_type == event_type && 
-            (*current)->handler == handler) {
-            event_listener_t *to_remove = *current;
-            *current = (*current)->next;
-            free(to_remove);
-            system->stats.active_listeners--;
-            break;
+    if (!system || !handler || (unsigned)event_type >= EVENT_TYPE_COUNT) return;
+    
+    event_system_lock(system);
+    
+    listener_table_t *old = system->listeners[event_type];
+    uint32_t index = 0;
+    while (old && index < old->count && old->entries[index].handler != handler) {
+        index++;
+    }
+    if (!old || index == old->count) {
+        event_system_unlock(system);
+        return;
+    }
+    
+    listener_table_t *table = NULL;
+    if (old->count > 1) {
+        table = malloc(sizeof(listener_table_t) + (old->count - 1) * sizeof(table->entries[0]));
+        if (!table) {
+            event_system_unlock(system);
+            return;
         }
-        current = &(*current)->next;
+        table->count = old->count - 1;
+        table->retired_next = NULL;
+        memcpy(table->entries, old->entries, index * sizeof(table->entries[0]));
+        memcpy(&table->entries[index], &old->entries[index + 1],
+               (old->count - index - 1) * sizeof(table->entries[0]));
     }
+    listener_table_replace(system, event_type, table);
+    system->stats.active_listeners--;
     
-    pthread_mutex_unlock(&system->mutex);
+    event_system_unlock(system);
 }
 
 // 创建定时器
@@ -477,38 +1168,35 @@ uint32_t event_system_create_timer(event_system_t *system,
                                   void *user_data) {
     if (!system || !callback) return 0;
 
-    pthread_mutex_lock(&system->mutex);
+    event_system_lock(system);
 
-    // 创建新的定时器信息
-    timer_info_t *timer = calloc(1, sizeof(timer_info_t));
-    if (!timer) {
-        pthread_mutex_unlock(&system->mutex);
+    timer_entry_t *entry = timer_entry_alloc(&system->wheel);
+    if (!entry) {
+        event_system_unlock(system);
         return 0;
     }
 
-    timer->timer_id = system->next_timer_id++;
-    timer->interval_ms = interval_ms;
-    timer->repeat = repeat;
-    timer->callback = callback;
-    timer->user_data = user_data;
-    timer->active = true;
-
-    // 添加到定时器链表
-    timer_info_t *old_head = system->timers;
-    system->timers = timer;
-    if (old_head) {
-        // 简化的链表插入（实际应该使用更好的数据结构）
-        timer_info_t *current = timer;
-        while (current && current != old_head) {
-            current = (timer_info_t *)current; // 简化处理
-        }
+    entry->info.timer_id = timer_entry_id(entry);
+    entry->info.interval_ms = interval_ms;
+    entry->info.repeat = repeat;
+    entry->info.callback = callback;
+    entry->info.user_data = user_data;
+    entry->info.active = true;
+
+    // 时间轮可能很久没有推进（没有定时器时 ev_timer 不运行），先对齐到当前时刻
+    uint64_t now = monotonic_ms();
+    if (system->wheel.current_ms < now && system->stats.active_timers == 0) {
+        system->wheel.current_ms = now;
     }
+    entry->expires_ms = now + interval_ms;
+    timer_wheel_insert(&system->wheel, entry);
 
     system->stats.active_timers++;
 
-    uint32_t timer_id = timer->timer_id;
-    pthread_mutex_unlock(&system->mutex);
+    uint32_t timer_id = entry->info.timer_id;
+    event_system_unlock(system);
 
+    timer_notify_changed(system);
     return timer_id;
 }
 
@@ -516,116 +1204,88 @@ uint32_t event_system_create_timer(event_system_t *system,
 void event_system_destroy_timer(event_system_t *system, uint32_t timer_id) {
     if (!system || timer_id == 0) return;
 
-    pthread_mutex_lock(&system->mutex);
-
-    timer_info_t **current = &system->timers;
-    while (*current) {
-        if ((*current)->timer_id == timer_id) {
-            timer_info_t *to_remove = *current;
-            *current = (timer_info_t *)to_remove; // 简化的链表删除
-
-            if (to_remove->active) {
-                system->stats.active_timers--;
-            }
+    event_system_lock(system);
 
-            free(to_remove);
-            break;
+    timer_entry_t *entry = timer_lookup(&system->wheel, timer_id);
+    if (entry) {
+        if (entry->info.active) {
+            timer_wheel_remove(&system->wheel, entry);
+            system->stats.active_timers--;
         }
-        current = (timer_info_t **)current; // 简化处理
+        timer_entry_free(&system->wheel, entry);
     }
 
-    pthread_mutex_unlock(&system->mutex);
+    event_system_unlock(system);
 }
 
-// 暂停定时器
+// 暂停定时器，记下剩余时间
 void event_system_pause_timer(event_system_t *system, uint32_t timer_id) {
     if (!system || timer_id == 0) return;
 
-    pthread_mutex_lock(&system->mutex);
+    event_system_lock(system);
 
-    timer_info_t *timer = system->timers;
-    while (timer) {
-        if (timer->timer_id == timer_id) {
-            if (timer->active) {
-                timer->active = false;
-                system->stats.active_timers--;
-            }
-            break;
-        }
-        timer = (timer_info_t *)timer; // 简化处理
+    timer_entry_t *entry = timer_lookup(&system->wheel, timer_id);
+    if (entry && entry->info.active) {
+        uint64_t now = monotonic_ms();
+        entry->remaining_ms = entry->expires_ms > now ? entry->expires_ms - now : 0;
+        timer_wheel_remove(&system->wheel, entry);
+        entry->info.active = false;
+        system->stats.active_timers--;
     }
 
-    pthread_mutex_unlock(&system->mutex);
+    event_system_unlock(system);
 }
 
-// 恢复定时器
+// 恢复定时器，按暂停时的剩余时间继续计时
 void event_system_resume_timer(event_system_t *system, uint32_t timer_id) {
     if (!system || timer_id == 0) return;
 
-    pthread_mutex_lock(&system->mutex);
+    event_system_lock(system);
 
-    timer_info_t *timer = system->timers;
-    while (timer) {
-        if (timer->timer_id == timer_id) {
-            if (!timer->active) {
-                timer->active = true;
-                system->stats.active_timers++;
-            }
-            break;
+    timer_entry_t *entry = timer_lookup(&system->wheel, timer_id);
+    bool resumed = false;
+    if (entry && !entry->info.active && !entry->firing) {
+        uint64_t now = monotonic_ms();
+        if (system->wheel.current_ms < now && system->stats.active_timers == 0) {
+            system->wheel.current_ms = now;
         }
-        timer = (timer_info_t *)timer; // 简化处理
+        entry->expires_ms = now + entry->remaining_ms;
+        timer_wheel_insert(&system->wheel, entry);
+        entry->info.active = true;
+        system->stats.active_timers++;
+        resumed = true;
     }
 
-    pthread_mutex_unlock(&system->mutex);
+    event_system_unlock(system);
+
+    if (resumed) {
+        timer_notify_changed(system);
+    }
 }
 
 // 处理事件队列（单次）
 int event_system_process_once(event_system_t *system) {
     if (!system) return -1;
     
-    pthread_mutex_lock(&system->mutex);
-    
-    if (!system->queue_head) {
-        pthread_mutex_unlock(&system->mutex);
+    generic_event_t *event = event_queue_dequeue_safe(system);
+    if (!event) {
         return 0;
     }
     
-    event_queue_item_t *item = system->queue_head;
-    system->queue_head = item->next;
-    if (!system->queue_head) {
-        system->queue_tail = NULL;
-    }
-    system->queue_size--;
-    
-    pthread_mutex_unlock(&system->mutex);
-    
-    if (item && item->event) {
-        // 处理事件
-        event_listener_t *listener = system->listeners;
-        while (listener) {
-            if (listener->active && 
-                listener->event_type == item->event->type &&
-                listener->handler) {
-                listener->handler(item->event, listener->user_data);
-            }
-            listener = listener->next;
-        }
-        
-        generic_event_destroy(item->event);
-        free(item);
-        return 1;
-    }
-    
-    return 0;
+    event_dispatch_batch(system, &event, 1, &system->loop_worker);
+    return 1;
 }
 
 // 处理所有待处理事件
 int event_system_process_all(event_system_t *system) {
     if (!system) return -1;
     
+    generic_event_t *batch[EVENT_DISPATCH_BATCH_MAX];
     int processed = 0;
-    while (event_system_process_once(system) > 0) {
-        processed++;
+    size_t count;
+    while ((count = event_queue_dequeue_batch(system, batch, EVENT_DISPATCH_BATCH_MAX)) > 0) {
+        event_dispatch_batch(system, batch, count, &system->loop_worker);
+        processed += count;
     }
     
     return processed;
@@ -634,32 +1294,165 @@ int event_system_process_all(event_system_t *system) {
 // 获取事件系统统计信息
 const event_system_stats_t *event_system_get_stats(const event_system_t *system) {
     if (!system) return NULL;
-    return &system->stats;
+    
+    // 队列长度是即时值，读取时从各个环刷新；未启用优先级队列时全部计入 NORMAL
+    event_system_t *mutable_system = (event_system_t *)system;
+    event_system_stats_t *stats = &mutable_system->stats;
+    stats->queue_size = atomic_load(&mutable_system->queue_size);
+    if (system->config.enable_priority_queue) {
+        for (int i = 0; i < EVENT_PRIORITY_COUNT; i++) {
+            stats->priority_queue_size[i] = event_ring_depth(&mutable_system->rings[i]);
+        }
+    } else {
+        memset(stats->priority_queue_size, 0, sizeof(stats->priority_queue_size));
+        stats->priority_queue_size[EVENT_PRIORITY_NORMAL] =
+            event_ring_depth(&mutable_system->rings[0]);
+    }
+    stats->event_allocations = __atomic_load_n(&g_event_allocations, __ATOMIC_RELAXED);
+    
+    // 合并各线程的分发统计
+    stats->events_processed = 0;
+    stats->dispatch_batches = 0;
+    memset(&stats->queue_wait_us, 0, sizeof(stats->queue_wait_us));
+    memset(&stats->handler_time_us, 0, sizeof(stats->handler_time_us));
+    for (uint32_t i = 0; i <= system->config.worker_thread_count; i++) {
+        const event_thread_stats_t *thread_stats = i < system->config.worker_thread_count ?
+            &system->workers[i].stats : &system->loop_worker.stats;
+        stats->events_processed += __atomic_load_n(&thread_stats->events_processed,
+                                                   __ATOMIC_RELAXED);
+        stats->dispatch_batches += __atomic_load_n(&thread_stats->dispatch_batches,
+                                                   __ATOMIC_RELAXED);
+        latency_merge(&stats->queue_wait_us, &thread_stats->queue_wait_us);
+        latency_merge(&stats->handler_time_us, &thread_stats->handler_time_us);
+    }
+    stats->avg_processing_time_ms = stats->handler_time_us.count > 0 ?
+        stats->handler_time_us.total_us / 1000.0 / stats->handler_time_us.count : 0.0;
+    uint64_t published = __atomic_load_n(&stats->events_published, __ATOMIC_RELAXED);
+    stats->allocations_per_event = published > 0 ?
+        (double)stats->event_allocations / published : 0.0;
+    return stats;
+}
+
+// 线程安全地入队事件，成功时队列接管事件的所有权
+int event_queue_enqueue_safe(event_system_t *system, generic_event_t *event) {
+    if (!system || !event) return -1;
+    
+    // 先占用名额再入队，保证队列中的事件数不超过 max_queue_size
+    unsigned int size = atomic_fetch_add(&system->queue_size, 1);
+    if (size >= system->config.max_queue_size) {
+        atomic_fetch_sub(&system->queue_size, 1);
+        __atomic_fetch_add(&system->stats.events_dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    
+    // 更新最高水位，只有刷新纪录时才写共享内存
+    uint64_t high = __atomic_load_n(&system->stats.max_queue_size_reached, __ATOMIC_RELAXED);
+    while (size + 1 > high &&
+           !__atomic_compare_exchange_n(&system->stats.max_queue_size_reached, &high, size + 1,
+                                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    
+    // 每个环的容量不小于 max_queue_size，占到名额后入队不会失败
+    event->enqueue_time_us = monotonic_us();
+    if (event_ring_push(event_ring_for(system, event), event) != 0) {
+        atomic_fetch_sub(&system->queue_size, 1);
+        __atomic_fetch_add(&system->stats.events_dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    
+    __atomic_fetch_add(&system->stats.events_published, 1, __ATOMIC_RELAXED);
+    
+    // 通知工作线程
+    event_queue_wake(system, 1);
+    return 0;
+}
+
+// 从最低的非空优先级取一个事件（防饥饿）
+static generic_event_t *event_queue_dequeue_lowest(event_system_t *system) {
+    for (int i = 0; i < EVENT_PRIORITY_COUNT; i++) {
+        generic_event_t *event = event_ring_pop(&system->rings[i]);
+        if (!event) continue;
+        
+        for (int j = i + 1; j < EVENT_PRIORITY_COUNT; j++) {
+            if (event_ring_depth(&system->rings[j]) > 0) {
+                __atomic_fetch_add(&system->stats.starvation_dequeues, 1, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+        return event;
+    }
+    return NULL;
+}
+
+// 按优先级从高到低取一个事件，不更新 queue_size
+static generic_event_t *event_queue_pop(event_system_t *system) {
+    // 计数按线程记录，避免所有消费者争用同一个计数器
+    static _Thread_local uint32_t dequeue_count = 0;
+    uint32_t interval = system->config.starvation_interval;
+    if (system->config.enable_priority_queue && interval > 0 &&
+        ++dequeue_count % interval == 0) {
+        generic_event_t *event = event_queue_dequeue_lowest(system);
+        if (event) {
+            return event;
+        }
+    }
+    
+    int ring_count = system->config.enable_priority_queue ? EVENT_PRIORITY_COUNT : 1;
+    for (int i = ring_count - 1; i >= 0; i--) {
+        generic_event_t *event = event_ring_pop(&system->rings[i]);
+        if (event) {
+            return event;
+        }
+    }
+    return NULL;
+}
+
+// 线程安全地出队事件，按优先级从高到低取，调用者负责销毁返回的事件
+generic_event_t *event_queue_dequeue_safe(event_system_t *system) {
+    if (!system) return NULL;
+    
+    if (atomic_load_explicit(&system->queue_size, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+    
+    generic_event_t *event = event_queue_pop(system);
+    if (event) {
+        atomic_fetch_sub(&system->queue_size, 1);
+    }
+    return event;
+}
+
+// 取出最多 max 个事件，queue_size 只更新一次
+static size_t event_queue_dequeue_batch(event_system_t *system, generic_event_t **events,
+                                        size_t max) {
+    if (atomic_load_explicit(&system->queue_size, memory_order_relaxed) == 0) {
+        return 0;
+    }
+    
+    size_t count = 0;
+    while (count < max) {
+        generic_event_t *event = event_queue_pop(system);
+        if (!event) break;
+        events[count++] = event;
+    }
+    if (count > 0) {
+        atomic_fetch_sub(&system->queue_size, count);
+    }
+    return count;
 }
 
 // 获取队列大小
 uint32_t event_queue_size(const event_system_t *system) {
     if (!system) return 0;
-    return system->queue_size;
+    return atomic_load(&((event_system_t *)system)->queue_size);
 }
 
 // 清空事件队列
 void event_queue_clear(event_system_t *system) {
     if (!system) return;
     
-    pthread_mutex_lock(&system->mutex);
-    
-    event_queue_item_t *item = system->queue_head;
-    while (item) {
-        event_queue_item_t *next = item->next;
-        generic_event_destroy(item->event);
-        free(item);
-        item = next;
+    generic_event_t *event;
+    while ((event = event_queue_dequeue_safe(system)) != NULL) {
+        generic_event_destroy(event);
     }
-    
-    system->queue_head = NULL;
-    system->queue_tail = NULL;
-    system->queue_size = 0;
-    
-    pthread_mutex_unlock(&system->mutex);
 }
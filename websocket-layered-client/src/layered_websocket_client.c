@@ -6,6 +6,10 @@
  * - 提供简化的客户端接口
  * - 管理客户端生命周期
  * - 处理状态转换和事件分发
+ *
+ * config.worker_threads 为 0 时是单线程模式：各层都在事件循环线程中同步执行，
+ * 收到的消息直接经消息层、业务层交给回调，回调中发送的消息立即发出，
+ * 中间没有队列、工作线程和锁。此时所有 API 都必须在事件循环线程调用。
  */
 
 #include "layered_websocket_client.h"
@@ -44,12 +48,28 @@ struct layered_websocket_client {
     // 线程安全
     pthread_mutex_t mutex;
     
+    // 单线程模式（worker_threads == 0）
+    bool inline_mode;
+    
     // 运行控制
     bool running;
     bool should_reconnect;
     uint32_t reconnect_attempts;
 };
 
+// 单线程模式下不加锁
+static inline void client_lock(layered_websocket_client_t *client) {
+    if (!client->inline_mode) {
+        pthread_mutex_lock(&client->mutex);
+    }
+}
+
+static inline void client_unlock(layered_websocket_client_t *client) {
+    if (!client->inline_mode) {
+        pthread_mutex_unlock(&client->mutex);
+    }
+}
+
 // 默认配置
 client_config_t layered_client_config_default(void) {
     client_config_t config = {
@@ -183,7 +203,24 @@ static void on_websocket_event(const ws_event_t *event, void *user_data) {
     layered_websocket_client_t *client = (layered_websocket_client_t *)user_data;
     if (!client) return;
     
-    pthread_mutex_lock(&client->mutex);
+    if (event->type == WS_EVENT_MESSAGE_RECEIVED) {
+        client_lock(client);
+        client->stats.messages_received++;
+        client->stats.bytes_received += event->message.length;
+        client->stats.last_message_at = time(NULL);
+        client_unlock(client);
+        
+        // 转发给消息处理器时不持有客户端锁，上层回调中可以调用客户端 API（如 layered_client_stop）
+        if (client->msg_handler) {
+            message_handler_on_websocket_message(client->msg_handler,
+                                               event->message.data,
+                                               event->message.length,
+                                               event->message.frame_type);
+        }
+        return;
+    }
+    
+    client_lock(client);
     
     client_state_t old_state = client->state;
     
@@ -228,20 +265,6 @@ static void on_websocket_event(const ws_event_t *event, void *user_data) {
             }
             break;
             
-        case WS_EVENT_MESSAGE_RECEIVED:
-            client->stats.messages_received++;
-            client->stats.bytes_received += event->message.length;
-            client->stats.last_message_at = time(NULL);
-            
-            // 转发给消息处理器
-            if (client->msg_handler) {
-                message_handler_on_websocket_message(client->msg_handler,
-                                                   event->message.data,
-                                                   event->message.length,
-                                                   event->message.frame_type);
-            }
-            break;
-            
         case WS_EVENT_ERROR:
             client->state = CLIENT_STATE_ERROR;
             client->stats.errors_count++;
@@ -265,7 +288,7 @@ static void on_websocket_event(const ws_event_t *event, void *user_data) {
         }
     }
     
-    pthread_mutex_unlock(&client->mutex);
+    client_unlock(client);
 }
 
 // 消息事件处理器
@@ -362,6 +385,7 @@ layered_websocket_client_t *layered_client_create(const client_config_t *config,
     client->user_data = user_data;
     client->state = CLIENT_STATE_DISCONNECTED;
     client->running = true;
+    client->inline_mode = config->worker_threads == 0;
     
     // 初始化互斥锁
     if (pthread_mutex_init(&client->mutex, NULL) != 0) {
@@ -383,6 +407,7 @@ layered_websocket_client_t *layered_client_create(const client_config_t *config,
     event_system_config_t event_config = event_system_config_default();
     event_config.worker_thread_count = config->worker_threads;
     event_config.enable_priority_queue = config->enable_priority_queue;
+    event_config.thread_safe = !client->inline_mode;
     client->event_system = event_system_create(&event_config);
     if (!client->event_system) {
         printf("❌ 事件系统创建失败\n");
@@ -401,6 +426,7 @@ layered_websocket_client_t *layered_client_create(const client_config_t *config,
     ws_config.connect_timeout_ms = config->connect_timeout_ms;
     ws_config.ping_interval_ms = config->heartbeat_interval_ms;
     ws_config.auto_reconnect = false; // 由客户端层管理重连
+    ws_config.thread_safe = !client->inline_mode;
 
     client->ws_conn = ws_connection_create(&ws_config, on_websocket_event, client);
     if (!client->ws_conn) {
@@ -415,6 +441,7 @@ layered_websocket_client_t *layered_client_create(const client_config_t *config,
     message_handler_config_t msg_config = message_handler_config_default();
     msg_config.max_queue_size = config->message_queue_size;
     msg_config.default_timeout_ms = config->response_timeout_ms;
+    msg_config.thread_safe = !client->inline_mode;
 
     client->msg_handler = message_handler_create(&msg_config, on_message_event, client);
     if (!client->msg_handler) {
@@ -433,6 +460,7 @@ layered_websocket_client_t *layered_client_create(const client_config_t *config,
     biz_config.response_timeout_ms = config->response_timeout_ms;
     biz_config.auto_reconnect = config->auto_reconnect;
     biz_config.enable_logging = config->enable_logging;
+    biz_config.thread_safe = !client->inline_mode;
 
     client->business_logic = business_logic_create(&biz_config, on_business_event, client);
     if (!client->business_logic) {
@@ -502,17 +530,17 @@ void layered_client_destroy(layered_websocket_client_t *client) {
 int layered_client_connect(layered_websocket_client_t *client) {
     if (!client) return -1;
     
-    pthread_mutex_lock(&client->mutex);
+    client_lock(client);
     
     if (client->state != CLIENT_STATE_DISCONNECTED) {
-        pthread_mutex_unlock(&client->mutex);
+        client_unlock(client);
         return -1; // 已连接或正在连接
     }
     
     client->state = CLIENT_STATE_CONNECTING;
     client->stats.total_connections++;
     
-    pthread_mutex_unlock(&client->mutex);
+    client_unlock(client);
     
     // 启动事件系统
     event_system_start(client->event_system);
@@ -525,9 +553,9 @@ int layered_client_connect(layered_websocket_client_t *client) {
 void layered_client_disconnect(layered_websocket_client_t *client) {
     if (!client) return;
     
-    pthread_mutex_lock(&client->mutex);
+    client_lock(client);
     client->should_reconnect = false;
-    pthread_mutex_unlock(&client->mutex);
+    client_unlock(client);
     
     // 停止定时器
     if (client->loop) {
@@ -551,9 +579,9 @@ int layered_client_run(layered_websocket_client_t *client) {
     ev_run(client->loop, 0);
     
     // 更新运行时间统计
-    pthread_mutex_lock(&client->mutex);
+    client_lock(client);
     client->stats.uptime_ms = (time(NULL) - start_time) * 1000;
-    pthread_mutex_unlock(&client->mutex);
+    client_unlock(client);
     
     return 0;
 }
@@ -562,10 +590,10 @@ int layered_client_run(layered_websocket_client_t *client) {
 void layered_client_stop(layered_websocket_client_t *client) {
     if (!client) return;
     
-    pthread_mutex_lock(&client->mutex);
+    client_lock(client);
     client->running = false;
     client->state = CLIENT_STATE_SHUTTING_DOWN;
-    pthread_mutex_unlock(&client->mutex);
+    client_unlock(client);
     
     // 断开连接
     layered_client_disconnect(client);
@@ -653,10 +681,10 @@ int layered_client_publish(layered_websocket_client_t *client,
 int layered_client_reconnect(layered_websocket_client_t *client) {
     if (!client) return -1;
 
-    pthread_mutex_lock(&client->mutex);
+    client_lock(client);
 
     if (client->state == CLIENT_STATE_CONNECTED) {
-        pthread_mutex_unlock(&client->mutex);
+        client_unlock(client);
         return 0; // 已连接
     }
 
@@ -665,11 +693,11 @@ int layered_client_reconnect(layered_websocket_client_t *client) {
 
     if (client->reconnect_attempts > client->config.max_reconnect_attempts) {
         client->should_reconnect = false;
-        pthread_mutex_unlock(&client->mutex);
+        client_unlock(client);
         return -1; // 超过最大重连次数
     }
 
-    pthread_mutex_unlock(&client->mutex);
+    client_unlock(client);
 
     // 重新连接
     return ws_connection_connect(client->ws_conn);
@@ -701,9 +729,9 @@ const subscription_t *layered_client_get_subscriptions(const layered_websocket_c
 void layered_client_set_auto_reconnect(layered_websocket_client_t *client, bool enable) {
     if (!client) return;
 
-    pthread_mutex_lock(&client->mutex);
+    client_lock(client);
     client->config.auto_reconnect = enable;
-    pthread_mutex_unlock(&client->mutex);
+    client_unlock(client);
 }
 
 // 导出客户端统计信息为 JSON
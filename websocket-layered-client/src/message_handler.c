@@ -6,6 +6,9 @@
  * - 消息队列管理
  * - 超时和重试机制
  * - 消息路由和分发
+ *
+ * config.thread_safe 为 false 时不启动发送线程：消息在调用线程（事件循环线程）
+ * 直接序列化并发送，不入队、不加锁。
  */
 
 #include "message_handler.h"
@@ -45,6 +48,19 @@ struct message_handler {
     pthread_t worker_thread;
 };
 
+// 单线程模式下不加锁
+static inline void handler_lock(message_handler_t *handler) {
+    if (handler->config.thread_safe) {
+        pthread_mutex_lock(&handler->mutex);
+    }
+}
+
+static inline void handler_unlock(message_handler_t *handler) {
+    if (handler->config.thread_safe) {
+        pthread_mutex_unlock(&handler->mutex);
+    }
+}
+
 // 默认配置
 message_handler_config_t message_handler_config_default(void) {
     message_handler_config_t config = {
@@ -53,7 +69,8 @@ message_handler_config_t message_handler_config_default(void) {
         .max_retry_count = 3,
         .heartbeat_interval_ms = 30000,
         .enable_compression = false,
-        .enable_encryption = false
+        .enable_encryption = false,
+        .thread_safe = true
     };
     return config;
 }
@@ -198,12 +215,55 @@ json_message_t *json_message_deserialize(const char *json_str) {
     return msg;
 }
 
+// 序列化并通过 WebSocket 发送消息，触发发送成功或失败事件。成功写入时返回 0，否则返回 -1
+static int message_handler_deliver(message_handler_t *handler, const json_message_t *message) {
+    char *json_str = json_message_serialize(message);
+    if (!json_str) return -1;
+    
+    int result = -1;
+    if (handler->ws_conn) {
+        result = ws_connection_send_text(handler->ws_conn, json_str, strlen(json_str));
+        
+        // 更新统计信息
+        handler_lock(handler);
+        if (result == 0) {
+            handler->stats.messages_sent++;
+            
+            // 触发发送成功事件
+            message_event_t event = {
+                .type = MSG_EVENT_SENT,
+                .message = (json_message_t *)message
+            };
+            if (handler->callback) {
+                handler->callback(&event, handler->user_data);
+            }
+        } else {
+            handler->stats.messages_error++;
+            
+            // 触发发送失败事件
+            message_event_t event = {
+                .type = MSG_EVENT_ERROR,
+                .message = (json_message_t *)message,
+                .error_code = result,
+                .error_description = "Failed to send message"
+            };
+            if (handler->callback) {
+                handler->callback(&event, handler->user_data);
+            }
+        }
+        handler_unlock(handler);
+    }
+    
+    free(json_str);
+    return result == 0 ? 0 : -1;
+}
+
 // 工作线程函数
 static void *worker_thread_func(void *arg) {
     message_handler_t *handler = (message_handler_t *)arg;
     
     while (handler->running) {
-        pthread_mutex_lock(&handler->mutex);
+        handler_lock(handler);
         
         // 等待队列中有消息
         while (handler->running && !handler->send_queue_head) {
@@ -211,7 +271,7 @@ static void *worker_thread_func(void *arg) {
         }
         
         if (!handler->running) {
-            pthread_mutex_unlock(&handler->mutex);
+            handler_unlock(handler);
             break;
         }
         
@@ -225,48 +285,10 @@ static void *worker_thread_func(void *arg) {
             handler->queue_size--;
         }
         
-        pthread_mutex_unlock(&handler->mutex);
+        handler_unlock(handler);
         
         if (item && item->message) {
-            // 序列化消息
-            char *json_str = json_message_serialize(item->message);
-            if (json_str) {
-                // 通过 WebSocket 发送
-                if (handler->ws_conn) {
-                    int result = ws_connection_send_text(handler->ws_conn, json_str, strlen(json_str));
-                    
-                    // 更新统计信息
-                    pthread_mutex_lock(&handler->mutex);
-                    if (result == 0) {
-                        handler->stats.messages_sent++;
-                        
-                        // 触发发送成功事件
-                        message_event_t event = {
-                            .type = MSG_EVENT_SENT,
-                            .message = item->message
-                        };
-                        if (handler->callback) {
-                            handler->callback(&event, handler->user_data);
-                        }
-                    } else {
-                        handler->stats.messages_error++;
-                        
-                        // 触发发送失败事件
-                        message_event_t event = {
-                            .type = MSG_EVENT_ERROR,
-                            .message = item->message,
-                            .error_code = result,
-                            .error_description = "Failed to send message"
-                        };
-                        if (handler->callback) {
-                            handler->callback(&event, handler->user_data);
-                        }
-                    }
-                    pthread_mutex_unlock(&handler->mutex);
-                }
-                
-                free(json_str);
-            }
+            message_handler_deliver(handler, item->message);
             
             // 清理消息项
             json_message_destroy(item->message);
@@ -298,8 +320,9 @@ message_handler_t *message_handler_create(const message_handler_config_t *config
         return NULL;
     }
     
-    // 启动工作线程
-    if (pthread_create(&handler->worker_thread, NULL, worker_thread_func, handler) != 0) {
+    // 启动工作线程，单线程模式下直接在调用线程发送
+    if (handler->config.thread_safe &&
+        pthread_create(&handler->worker_thread, NULL, worker_thread_func, handler) != 0) {
         message_handler_destroy(handler);
         return NULL;
     }
@@ -313,8 +336,12 @@ void message_handler_destroy(message_handler_t *handler) {
     
     // 停止工作线程
     handler->running = false;
-    pthread_cond_signal(&handler->queue_cond);
-    pthread_join(handler->worker_thread, NULL);
+    if (handler->config.thread_safe) {
+        pthread_mutex_lock(&handler->mutex);
+        pthread_cond_signal(&handler->queue_cond);
+        pthread_mutex_unlock(&handler->mutex);
+        pthread_join(handler->worker_thread, NULL);
+    }
     
     // 清理队列
     message_queue_item_t *item = handler->send_queue_head;
@@ -345,20 +372,25 @@ void message_handler_destroy(message_handler_t *handler) {
 void message_handler_set_connection(message_handler_t *handler, ws_connection_t *conn) {
     if (!handler) return;
     
-    pthread_mutex_lock(&handler->mutex);
+    handler_lock(handler);
     handler->ws_conn = conn;
-    pthread_mutex_unlock(&handler->mutex);
+    handler_unlock(handler);
 }
 
 // 发送 JSON 消息
 int message_handler_send(message_handler_t *handler, const json_message_t *message) {
     if (!handler || !message) return -1;
     
-    pthread_mutex_lock(&handler->mutex);
+    // 单线程模式：不复制、不入队，直接发送，返回是否已写入连接
+    if (!handler->config.thread_safe) {
+        return message_handler_deliver(handler, message);
+    }
+    
+    handler_lock(handler);
     
     // 检查队列是否已满
     if (handler->queue_size >= handler->config.max_queue_size) {
-        pthread_mutex_unlock(&handler->mutex);
+        handler_unlock(handler);
         
         // 触发队列满事件
         message_event_t event = {
@@ -375,7 +407,7 @@ int message_handler_send(message_handler_t *handler, const json_message_t *messa
     // 创建队列项
     message_queue_item_t *item = calloc(1, sizeof(message_queue_item_t));
     if (!item) {
-        pthread_mutex_unlock(&handler->mutex);
+        handler_unlock(handler);
         return -1;
     }
     
@@ -383,7 +415,7 @@ int message_handler_send(message_handler_t *handler, const json_message_t *messa
     item->message = json_message_create_with_id(message->type, message->id, message->data);
     if (!item->message) {
         free(item);
-        pthread_mutex_unlock(&handler->mutex);
+        handler_unlock(handler);
         return -1;
     }
     
@@ -403,7 +435,7 @@ int message_handler_send(message_handler_t *handler, const json_message_t *messa
     
     // 通知工作线程
     pthread_cond_signal(&handler->queue_cond);
-    pthread_mutex_unlock(&handler->mutex);
+    handler_unlock(handler);
     
     return 0;
 }
@@ -506,9 +538,9 @@ void message_handler_on_websocket_message(message_handler_t *handler,
     if (!msg) return;
     
     // 更新统计信息
-    pthread_mutex_lock(&handler->mutex);
+    handler_lock(handler);
     handler->stats.messages_received++;
-    pthread_mutex_unlock(&handler->mutex);
+    handler_unlock(handler);
     
     // 触发消息接收事件
     message_event_t event = {
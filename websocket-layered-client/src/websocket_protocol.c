@@ -6,6 +6,9 @@
  * - 帧解析和构造
  * - 心跳检测
  * - 自动重连
+ *
+ * config.thread_safe 为 false 时所有调用都在事件循环线程，不加锁，
+ * 收到数据包和发送后都立即处理 QUIC 连接，而不是等到下一次 QUIC 定时器。
  */
 
 #include "websocket_protocol.h"
@@ -20,6 +23,7 @@
 #include <pthread.h>
 #include <time.h>
 #include <fcntl.h>
+#include <sys/random.h>
 #include <sys/types.h>
 #include "tquic.h"
 #include "openssl/ssl.h"
@@ -28,6 +32,7 @@
 static void ping_timer_cb(EV_P_ ev_timer *w, int revents);
 static void socket_cb(EV_P_ ev_io *w, int revents);
 static void timeout_callback(EV_P_ ev_timer *w, int revents);
+static void ws_random_bytes(uint8_t *buf, size_t len);
 
 // TQUIC 回调函数
 static void client_on_conn_created(void *tctx, struct quic_conn_t *conn);
@@ -97,6 +102,10 @@ struct ws_connection {
     // WebSocket 状态
     bool websocket_handshake_done;
 
+    // 正在处理 QUIC 连接，期间又有数据要发出
+    bool flushing;
+    bool flush_pending;
+
     // 重连状态
     uint32_t reconnect_attempts;
     bool auto_reconnect_enabled;
@@ -105,6 +114,19 @@ struct ws_connection {
     pthread_mutex_t mutex;
 };
 
+// 单线程模式下不加锁
+static inline void ws_lock(ws_connection_t *conn) {
+    if (conn->config.thread_safe) {
+        pthread_mutex_lock(&conn->mutex);
+    }
+}
+
+static inline void ws_unlock(ws_connection_t *conn) {
+    if (conn->config.thread_safe) {
+        pthread_mutex_unlock(&conn->mutex);
+    }
+}
+
 // 默认配置
 ws_config_t ws_config_default(void) {
     ws_config_t config = {
@@ -118,7 +140,8 @@ ws_config_t ws_config_default(void) {
         .pong_timeout_ms = 5000,
         .auto_reconnect = true,
         .max_reconnect_attempts = 5,
-        .reconnect_delay_ms = 1000
+        .reconnect_delay_ms = 1000,
+        .thread_safe = true
     };
     return config;
 }
@@ -206,10 +229,10 @@ static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
         }
 
         // 更新统计信息
-        pthread_mutex_lock(&ws_conn->mutex);
+        ws_lock(ws_conn);
         ws_conn->stats.bytes_received += len;
         ws_conn->stats.last_activity = time(NULL);
-        pthread_mutex_unlock(&ws_conn->mutex);
+        ws_unlock(ws_conn);
     }
 }
 
@@ -262,9 +285,7 @@ static void client_on_conn_established(void *tctx, struct quic_conn_t *conn) {
 
     // 生成随机 WebSocket 密钥
     uint8_t nonce[16];
-    for (int i = 0; i < 16; i++) {
-        nonce[i] = rand() & 0xFF;
-    }
+    ws_random_bytes(nonce, sizeof(nonce));
 
     // Base64 编码密钥
     char websocket_key[25]; // 16字节 -> 24字符 + null terminator
@@ -323,7 +344,7 @@ static void client_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
     ws_connection_t *ws_conn = (ws_connection_t *)tctx;
     printf("QUIC connection closed\n");
 
-    pthread_mutex_lock(&ws_conn->mutex);
+    ws_lock(ws_conn);
     ws_conn->state = WS_STATE_CLOSED;
 
     // 触发断开连接事件
@@ -334,7 +355,7 @@ static void client_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
     if (ws_conn->callback) {
         ws_conn->callback(&event, ws_conn->user_data);
     }
-    pthread_mutex_unlock(&ws_conn->mutex);
+    ws_unlock(ws_conn);
 }
 
 static void client_on_stream_created(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
@@ -399,10 +420,10 @@ static void client_on_stream_readable(void *tctx, struct quic_conn_t *conn, uint
         }
 
         // 更新统计信息
-        pthread_mutex_lock(&ws_conn->mutex);
+        ws_lock(ws_conn);
         ws_conn->stats.bytes_received += len;
         ws_conn->stats.last_activity = time(NULL);
-        pthread_mutex_unlock(&ws_conn->mutex);
+        ws_unlock(ws_conn);
     } else if (len == -1) {
         // HTTP3_ERR_DONE - 没有更多数据可读，这是正常情况
         // 不需要打印错误信息，静默处理
@@ -436,15 +457,47 @@ static int quic_packet_send(void *psctx, struct quic_packet_out_spec_t *pkts, un
             }
 
             // 更新统计信息
-            pthread_mutex_lock(&ws_conn->mutex);
+            ws_lock(ws_conn);
             ws_conn->stats.bytes_sent += sent;
-            pthread_mutex_unlock(&ws_conn->mutex);
+            ws_unlock(ws_conn);
         }
     }
 
     return count;
 }
 
+// 处理 QUIC 连接（触发流回调、发出待发送的数据包）并按新的超时时间重设定时器，
+// 只能在事件循环线程调用。流回调中发送消息时会再次调用，此时只做标记，
+// 由外层在本轮处理结束后再处理一次，不重入 quic_endpoint_process_connections
+static void ws_connection_flush(ws_connection_t *conn) {
+    if (!conn->quic_endpoint) return;
+
+    if (conn->flushing) {
+        conn->flush_pending = true;
+        return;
+    }
+    conn->flushing = true;
+    do {
+        conn->flush_pending = false;
+        quic_endpoint_process_connections(conn->quic_endpoint);
+    } while (conn->flush_pending);
+    conn->flushing = false;
+
+    if (!conn->loop) return;
+
+    uint64_t timeout_us = quic_endpoint_timeout(conn->quic_endpoint);
+    if (timeout_us == UINT64_MAX) {
+        ev_timer_stop(conn->loop, &conn->connect_timer);
+    } else {
+        double timeout_sec = (double)timeout_us / 1000000.0;
+        if (timeout_sec < 0.0001) {
+            timeout_sec = 0.0001;
+        }
+        conn->connect_timer.repeat = timeout_sec;
+        ev_timer_again(conn->loop, &conn->connect_timer);
+    }
+}
+
 // 套接字事件处理
 static void socket_cb(EV_P_ ev_io *w, int revents) {
     ws_connection_t *ws_conn = (ws_connection_t *)w->data;
@@ -467,6 +520,10 @@ static void socket_cb(EV_P_ ev_io *w, int revents) {
                     .dst_len = ws_conn->local_addr_len,
                 };
                 quic_endpoint_recv(ws_conn->quic_endpoint, buffer, len, &pkt_info);
+                // 单线程模式下立即处理收到的数据，不等 QUIC 定时器
+                if (!ws_conn->config.thread_safe) {
+                    ws_connection_flush(ws_conn);
+                }
             }
         } else if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
             perror("recvfrom failed");
@@ -641,10 +698,10 @@ static int create_socket(const char *host, const char *port, ws_connection_t *co
 int ws_connection_connect(ws_connection_t *conn) {
     if (!conn) return -1;
 
-    pthread_mutex_lock(&conn->mutex);
+    ws_lock(conn);
 
     if (conn->state != WS_STATE_CONNECTING && conn->state != WS_STATE_CLOSED) {
-        pthread_mutex_unlock(&conn->mutex);
+        ws_unlock(conn);
         return -1; // 已连接或正在连接
     }
 
@@ -653,7 +710,7 @@ int ws_connection_connect(ws_connection_t *conn) {
     // 创建套接字
     if (create_socket(conn->config.host, conn->config.port, conn) < 0) {
         conn->state = WS_STATE_ERROR;
-        pthread_mutex_unlock(&conn->mutex);
+        ws_unlock(conn);
         return -1;
     }
 
@@ -672,7 +729,7 @@ int ws_connection_connect(ws_connection_t *conn) {
     if (!conn->tls_config) {
         fprintf(stderr, "Failed to create TLS config\n");
         close(conn->sock);
-        pthread_mutex_unlock(&conn->mutex);
+        ws_unlock(conn);
         return -1;
     }
 
@@ -688,7 +745,7 @@ int ws_connection_connect(ws_connection_t *conn) {
     if (!conn->quic_endpoint) {
         fprintf(stderr, "Failed to create QUIC endpoint\n");
         close(conn->sock);
-        pthread_mutex_unlock(&conn->mutex);
+        ws_unlock(conn);
         return -1;
     }
 
@@ -697,7 +754,7 @@ int ws_connection_connect(ws_connection_t *conn) {
     if (getsockname(conn->sock, (struct sockaddr *)&conn->local_addr, &conn->local_addr_len) != 0) {
         fprintf(stderr, "Failed to get local address\n");
         close(conn->sock);
-        pthread_mutex_unlock(&conn->mutex);
+        ws_unlock(conn);
         return -1;
     }
 
@@ -738,7 +795,7 @@ int ws_connection_connect(ws_connection_t *conn) {
     if (ret < 0) {
         fprintf(stderr, "Failed to connect to server\n");
         close(conn->sock);
-        pthread_mutex_unlock(&conn->mutex);
+        ws_unlock(conn);
         return -1;
     }
 
@@ -753,7 +810,7 @@ int ws_connection_connect(ws_connection_t *conn) {
         ev_timer_start(conn->loop, &conn->ping_timer);
     }
 
-    pthread_mutex_unlock(&conn->mutex);
+    ws_unlock(conn);
     return 0;
 }
 
@@ -761,10 +818,10 @@ int ws_connection_connect(ws_connection_t *conn) {
 void ws_connection_close(ws_connection_t *conn, uint16_t code, const char *reason) {
     if (!conn) return;
 
-    pthread_mutex_lock(&conn->mutex);
+    ws_lock(conn);
 
     if (conn->state == WS_STATE_CLOSED) {
-        pthread_mutex_unlock(&conn->mutex);
+        ws_unlock(conn);
         return;
     }
 
@@ -815,7 +872,7 @@ void ws_connection_close(ws_connection_t *conn, uint16_t code, const char *reaso
         conn->callback(&event, conn->user_data);
     }
 
-    pthread_mutex_unlock(&conn->mutex);
+    ws_unlock(conn);
 }
 
 // 发送文本消息
@@ -842,11 +899,15 @@ int ws_connection_send_text(ws_connection_t *conn, const char *data, size_t leng
     }
 
     // 更新统计信息
-    pthread_mutex_lock(&conn->mutex);
+    ws_lock(conn);
     conn->stats.messages_sent++;
     conn->stats.bytes_sent += sent;
     conn->stats.last_activity = time(NULL);
-    pthread_mutex_unlock(&conn->mutex);
+    ws_unlock(conn);
+
+    if (!conn->config.thread_safe) {
+        ws_connection_flush(conn);
+    }
 
     return 0;
 }
@@ -875,11 +936,15 @@ int ws_connection_send_binary(ws_connection_t *conn, const uint8_t *data, size_t
     }
 
     // 更新统计信息
-    pthread_mutex_lock(&conn->mutex);
+    ws_lock(conn);
     conn->stats.messages_sent++;
     conn->stats.bytes_sent += sent;
     conn->stats.last_activity = time(NULL);
-    pthread_mutex_unlock(&conn->mutex);
+    ws_unlock(conn);
+
+    if (!conn->config.thread_safe) {
+        ws_connection_flush(conn);
+    }
 
     return 0;
 }
@@ -913,10 +978,14 @@ int ws_connection_send_ping(ws_connection_t *conn, const uint8_t *data, size_t l
     }
 
     // 更新统计信息
-    pthread_mutex_lock(&conn->mutex);
+    ws_lock(conn);
     conn->stats.ping_count++;
     conn->stats.last_activity = time(NULL);
-    pthread_mutex_unlock(&conn->mutex);
+    ws_unlock(conn);
+
+    if (!conn->config.thread_safe) {
+        ws_connection_flush(conn);
+    }
 
     return 0;
 }
@@ -943,7 +1012,7 @@ void ws_connection_set_event_loop(ws_connection_t *conn, struct ev_loop *loop) {
 void ws_connection_process_events(ws_connection_t *conn) {
     if (!conn) return;
 
-    pthread_mutex_lock(&conn->mutex);
+    ws_lock(conn);
 
     // 处理 QUIC 端点事件
     if (conn->quic_endpoint) {
@@ -985,7 +1054,7 @@ void ws_connection_process_events(ws_connection_t *conn) {
         }
     }
 
-    pthread_mutex_unlock(&conn->mutex);
+    ws_unlock(conn);
 }
 
 // QUIC 超时定时器回调
@@ -993,21 +1062,8 @@ static void timeout_callback(EV_P_ ev_timer *w, int revents) {
     ws_connection_t *conn = (ws_connection_t *)w->data;
     if (!conn || !conn->quic_endpoint) return;
 
-    // 处理 QUIC 连接状态
-    quic_endpoint_process_connections(conn->quic_endpoint);
-
-    // 获取下一个超时时间
-    uint64_t timeout_us = quic_endpoint_timeout(conn->quic_endpoint);
-    if (timeout_us == UINT64_MAX) {
-        ev_timer_stop(EV_A_ w);
-    } else {
-        double timeout_sec = (double)timeout_us / 1000000.0;
-        if (timeout_sec < 0.0001) {
-            timeout_sec = 0.0001;
-        }
-        w->repeat = timeout_sec;
-        ev_timer_again(EV_A_ w);
-    }
+    // 处理 QUIC 连接状态并设置下一个超时时间
+    ws_connection_flush(conn);
 }
 
 // 心跳定时器回调
@@ -1018,6 +1074,83 @@ static void ping_timer_cb(EV_P_ ev_timer *w, int revents) {
     }
 }
 
+// 掩码随机数池
+//
+// RFC 6455 要求客户端掩码不可预测，rand() 不满足要求；每帧调用一次 getrandom
+// 的开销又比给小消息加掩码还大，所以每个线程一次取 WS_RANDOM_POOL_SIZE 字节，
+// 每帧从池中取 4 字节。
+#define WS_RANDOM_POOL_SIZE 1024
+
+static _Thread_local struct {
+    uint8_t bytes[WS_RANDOM_POOL_SIZE];
+    size_t pos;
+} random_pool = {.pos = WS_RANDOM_POOL_SIZE};
+
+static void random_pool_refill(void) {
+    size_t off = 0;
+    while (off < sizeof(random_pool.bytes)) {
+        ssize_t n = getrandom(random_pool.bytes + off, sizeof(random_pool.bytes) - off, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            break;
+        }
+        off += n;
+    }
+    if (off < sizeof(random_pool.bytes)) {
+        // 内核不支持 getrandom 时退回 /dev/urandom
+        int fd = open("/dev/urandom", O_RDONLY);
+        while (fd >= 0 && off < sizeof(random_pool.bytes)) {
+            ssize_t n = read(fd, random_pool.bytes + off, sizeof(random_pool.bytes) - off);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            off += n;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (off < sizeof(random_pool.bytes)) {
+        // 可预测的掩码失去了意义，不能继续发送帧
+        fprintf(stderr, "No random source available for WebSocket masking keys\n");
+        abort();
+    }
+    random_pool.pos = 0;
+}
+
+// 从随机数池取 len 字节（不超过 WS_RANDOM_POOL_SIZE）
+static void ws_random_bytes(uint8_t *buf, size_t len) {
+    if (random_pool.pos + len > sizeof(random_pool.bytes)) {
+        random_pool_refill();
+    }
+    memcpy(buf, random_pool.bytes + random_pool.pos, len);
+    random_pool.pos += len;
+}
+
+// 复制并加/解掩码，一次遍历完成：dst[i] = src[i] ^ key[i % 4]
+// 每次处理 8 字节，编译器在 -O2 以上会将其向量化；dst 可以等于 src
+static void ws_mask_copy(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t key[4]) {
+    uint8_t pattern[8] = {key[0], key[1], key[2], key[3], key[0], key[1], key[2], key[3]};
+    uint64_t word_key;
+    memcpy(&word_key, pattern, 8);
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, src + i, 8);
+        word ^= word_key;
+        memcpy(dst + i, &word, 8);
+    }
+    for (; i < len; i++) {
+        dst[i] = src[i] ^ pattern[i & 7];
+    }
+}
+
 // WebSocket 帧解析（完整实现）
 int ws_frame_parse(const uint8_t *data, size_t length, ws_frame_t *frame) {
     if (!data || !frame || length < 2) {
@@ -1107,20 +1240,12 @@ int ws_frame_parse(const uint8_t *data, size_t length, ws_frame_t *frame) {
         frame->payload = malloc(frame->payload_len);
         if (!frame->payload) return -1;
 
-        memcpy(frame->payload, data + header_len, frame->payload_len);
-
-        // 解掩码
+        // 复制并解掩码
         if (frame->mask) {
-            uint8_t mask_bytes[4] = {
-                (frame->masking_key >> 24) & 0xFF,
-                (frame->masking_key >> 16) & 0xFF,
-                (frame->masking_key >> 8) & 0xFF,
-                frame->masking_key & 0xFF
-            };
-
-            for (uint64_t i = 0; i < frame->payload_len; i++) {
-                frame->payload[i] ^= mask_bytes[i % 4];
-            }
+            ws_mask_copy(frame->payload, data + header_len, frame->payload_len,
+                         data + header_len - 4);
+        } else {
+            memcpy(frame->payload, data + header_len, frame->payload_len);
         }
     }
 
@@ -1184,34 +1309,16 @@ int ws_frame_create(ws_frame_type_t frame_type, const uint8_t *data, size_t leng
         }
     }
 
-    // 掩码处理
-    uint32_t masking_key = 0;
+    // 掩码处理：掩码密钥紧挨在载荷之前
     if (mask) {
         output[1] |= 0x80; // 设置掩码位
-
-        // 生成随机掩码密钥
-        masking_key = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
-
-        size_t mask_offset = (length < 126) ? 2 : (length < 65536) ? 4 : 10;
-        output[mask_offset] = (masking_key >> 24) & 0xFF;
-        output[mask_offset + 1] = (masking_key >> 16) & 0xFF;
-        output[mask_offset + 2] = (masking_key >> 8) & 0xFF;
-        output[mask_offset + 3] = masking_key & 0xFF;
+        ws_random_bytes(output + header_len - 4, 4);
     }
 
     // 复制和掩码载荷数据
     if (data && length > 0) {
         if (mask) {
-            uint8_t mask_bytes[4] = {
-                (masking_key >> 24) & 0xFF,
-                (masking_key >> 16) & 0xFF,
-                (masking_key >> 8) & 0xFF,
-                masking_key & 0xFF
-            };
-
-            for (size_t i = 0; i < length; i++) {
-                output[header_len + i] = data[i] ^ mask_bytes[i % 4];
-            }
+            ws_mask_copy(output + header_len, data, length, output + header_len - 4);
         } else {
             memcpy(output + header_len, data, length);
         }
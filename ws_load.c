@@ -0,0 +1,1504 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Multi-session WebSocket over HTTP/3 load generator.
+//
+// Runs thousands of WebSocket sessions against tquic_websocket_server in
+// one process. Every thread owns one quic_endpoint_t, one ev_loop and a
+// few UDP sockets, and drives its share of the connections; no QUIC state
+// is shared between threads.
+//
+// Connections are opened at a fixed ramp rate. Most of them subscribe to
+// one of a set of topics ("SUB t<n>", see ws_topics.h) and only listen;
+// the rest publish ("PUB t<n> <body>") to random topics at a fixed total
+// rate, open loop like h3_load: a message that can't be written on time
+// waits in its connection's send backlog and its latency still counts
+// from the time it was due. Every body starts with that due time, so a
+// subscriber can measure publish-to-delivery latency no matter which
+// thread published it. With -E the publishers send plain messages and
+// measure the echo instead, for servers without topic support.
+//
+// The report covers connection setup (failures, connect latency up to the
+// WebSocket upgrade response), message rates, delivery ratio and latency
+// percentiles, plus the spread of per-connection delivery counts. Per
+// connection statistics can be written as CSV.
+
+#include <errno.h>
+#include <ev.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hdr_histogram.h"
+#include "openssl/ssl.h"
+#include "tquic.h"
+#include "ws_mask.h"
+#include "ws_topics.h"
+
+#define READ_BUF_SIZE 65536
+#define MAX_DATAGRAM_SIZE 1200
+#define MAX_THREADS 64
+#define MAX_SOCKETS 64
+#define TIMESTAMP_LEN 16
+// Seconds to wait for deliveries after the last publish, then for the
+// connections to close
+#define DRAIN_TIMEOUT 2.0
+#define CLOSE_TIMEOUT 3.0
+
+#define WS_FRAME_TEXT 0x1
+#define WS_FRAME_CLOSE 0x8
+#define WS_FRAME_PING 0x9
+#define WS_FRAME_PONG 0xA
+
+enum conn_role {
+    ROLE_SUBSCRIBER,
+    ROLE_PUBLISHER,
+};
+
+enum conn_state {
+    CONN_IDLE,
+    CONN_CONNECTING,  // QUIC handshake or WebSocket upgrade in progress
+    CONN_OPEN,
+    CONN_CLOSED,
+};
+
+struct ws_thread;
+
+struct ws_conn {
+    struct ws_thread *thread;
+    size_t index;  // Global
+    enum conn_role role;
+    enum conn_state state;
+    uint32_t topic;  // Subscribers only
+    size_t sock;
+    bool subscribed;
+    bool failed;        // Closed before the upgrade completed
+    bool closed_early;  // Closed by the peer before the end of the run
+    struct quic_conn_t *conn;
+    struct http3_conn_t *h3_conn;
+    uint64_t stream_id;
+    int status;
+    double connect_start;
+    double connect_time;    // Until the upgrade response, 0 if never
+    double subscribe_time;  // Until the SUBSCRIBED answer, 0 if never
+    uint64_t sent;
+    uint64_t received;
+    uint64_t latency_sum_us;
+    uint64_t latency_max_us;
+    // Frames split across reads, and writes blocked by flow control.
+    // Both are only allocated when needed.
+    uint8_t *rx_buf;
+    size_t rx_len;
+    size_t rx_cap;
+    uint8_t *tx_buf;
+    size_t tx_len;
+    size_t tx_cap;
+};
+
+struct ws_socket {
+    struct ws_thread *thread;
+    int fd;
+    struct sockaddr_storage local_addr;
+    socklen_t local_addr_len;
+    ev_io watcher;
+};
+
+// Counters read by the progress reporter while the thread runs.
+struct ws_thread_stats {
+    atomic_uint_fast64_t open;
+    atomic_uint_fast64_t failed;
+    atomic_uint_fast64_t closed_early;
+    atomic_uint_fast64_t subscribed;
+    atomic_uint_fast64_t published;  // All, including the warm-up
+    atomic_uint_fast64_t delivered;  // All, including the warm-up
+};
+
+struct ws_load;
+
+struct ws_thread {
+    struct ws_load *load;
+    size_t index;
+    pthread_t thread;
+    bool started;
+
+    quic_config_t *config;
+    struct quic_tls_config_t *tls_config;
+    struct http3_config_t *h3_config;
+    struct quic_endpoint_t *quic_endpoint;
+    struct ev_loop *loop;
+    ev_timer timer;
+    ev_timer ramp_timer;
+    ev_timer arrival_timer;
+    ev_timer stop_timer;
+    int stop_stage;
+    struct ws_socket socks[MAX_SOCKETS];
+    size_t sock_count;
+
+    struct ws_conn *conns;  // Slice of the global array
+    size_t conn_count;
+    size_t next_connect;
+    size_t closed_count;
+    struct ws_conn *connecting;  // Set while quic_endpoint_connect runs
+    size_t *publishers;          // Indexes into `conns`
+    size_t publisher_count;
+    size_t next_publisher;
+
+    double rate;  // Share of the publish rate
+    double next_arrival;
+    bool stopping;
+    uint64_t rng;
+
+    struct ws_thread_stats stats;
+    uint64_t measured_published;
+    uint64_t measured_delivered;
+    uint64_t unsent;  // Due with no open publisher
+    uint64_t errors;  // Malformed or unexpected messages
+    uint64_t bytes_in;
+    struct hdr_histogram *latency;          // Microseconds, measured
+    struct hdr_histogram *connect_latency;  // Microseconds
+
+    uint8_t buf[READ_BUF_SIZE];
+    uint8_t *frame;  // Outgoing frame scratch
+    size_t frame_cap;
+};
+
+struct ws_load {
+    // Settings
+    size_t conn_count;
+    size_t thread_count;
+    size_t sock_count;  // Per thread
+    double ramp;        // Connections per second, 0 for all at once
+    double sub_fraction;
+    uint32_t topic_count;
+    double rate;
+    bool poisson;
+    bool echo;
+    size_t size;  // Message body
+    double warmup;
+    double duration;
+    const char *json_path;
+    const char *csv_path;
+    const char *authority;
+    struct addrinfo *peer;
+
+    struct ws_conn *conns;
+    struct ws_thread threads[MAX_THREADS];
+    size_t publisher_total;
+    // Measured publishes and acknowledged subscribers per topic, for the
+    // expected number of deliveries
+    atomic_uint_fast64_t *topic_published;
+    atomic_uint_fast64_t *topic_subscribers;
+
+    double start;          // First connection
+    double run_start;      // End of the ramp, first publish
+    double measure_start;  // End of the warm-up
+    double end;            // No publishes from here on
+    uint64_t measure_start_ns;
+    uint64_t end_ns;
+    atomic_int running;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define STAT_ADD(t, field, n) \
+    atomic_fetch_add_explicit(&(t)->stats.field, (n), memory_order_relaxed)
+#define STAT_GET(t, field) atomic_load_explicit(&(t)->stats.field, memory_order_relaxed)
+
+// xorshift64*
+static uint64_t rng_next(struct ws_thread *t) {
+    t->rng ^= t->rng >> 12;
+    t->rng ^= t->rng << 25;
+    t->rng ^= t->rng >> 27;
+    return t->rng * 2685821657736338717ULL;
+}
+
+// Uniform in (0, 1]
+static double rng_uniform(struct ws_thread *t) {
+    return ((rng_next(t) >> 11) + 1) / 9007199254740992.0;
+}
+
+static double next_interval(struct ws_thread *t) {
+    if (t->load->poisson) {
+        return -log(rng_uniform(t)) / t->rate;
+    }
+    return 1.0 / t->rate;
+}
+
+// Forward declarations for HTTP/3 event handlers
+static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
+                                    const struct http3_headers_t *headers,
+                                    bool fin);
+static void http3_on_stream_data(void *ctx, uint64_t stream_id);
+static void http3_on_stream_finished(void *ctx, uint64_t stream_id);
+static void http3_on_stream_reset(void *ctx, uint64_t stream_id,
+                                  uint64_t error_code);
+static void http3_on_stream_priority_update(void *ctx, uint64_t stream_id);
+static void http3_on_conn_goaway(void *ctx, uint64_t stream_id);
+
+static const struct http3_methods_t http3_methods = {
+    .on_stream_headers = http3_on_stream_headers,
+    .on_stream_data = http3_on_stream_data,
+    .on_stream_finished = http3_on_stream_finished,
+    .on_stream_reset = http3_on_stream_reset,
+    .on_stream_priority_update = http3_on_stream_priority_update,
+    .on_conn_goaway = http3_on_conn_goaway,
+};
+
+static int buffer_append(uint8_t **buf, size_t *len, size_t *cap, const uint8_t *data,
+                         size_t data_len) {
+    if (*len + data_len > *cap) {
+        size_t new_cap = *cap ? *cap : 1024;
+        while (new_cap < *len + data_len) {
+            new_cap *= 2;
+        }
+        uint8_t *new_buf = realloc(*buf, new_cap);
+        if (new_buf == NULL) {
+            return -1;
+        }
+        *buf = new_buf;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, data, data_len);
+    *len += data_len;
+    return 0;
+}
+
+static void close_conn(struct ws_conn *wc, const char *reason) {
+    if (wc->conn != NULL && wc->state != CONN_CLOSED) {
+        quic_conn_close(wc->conn, true, 0, (const uint8_t *)reason, strlen(reason));
+    }
+}
+
+// Write as much of `data` as the stream takes. Returns the number of
+// bytes written or -1 on error.
+static ssize_t send_body(struct ws_conn *wc, const uint8_t *data, size_t len) {
+    size_t offset = 0;
+    while (offset < len) {
+        ssize_t written = http3_send_body(wc->h3_conn, wc->conn, wc->stream_id, data + offset,
+                                          len - offset, false);
+        if (written == HTTP3_ERR_DONE || written == 0) {
+            break;
+        }
+        if (written < 0) {
+            return -1;
+        }
+        offset += written;
+    }
+    return offset;
+}
+
+static void flush_tx(struct ws_conn *wc) {
+    ssize_t written = send_body(wc, wc->tx_buf, wc->tx_len);
+    if (written < 0) {
+        close_conn(wc, "send failed");
+        return;
+    }
+    memmove(wc->tx_buf, wc->tx_buf + written, wc->tx_len - written);
+    wc->tx_len -= written;
+    quic_stream_wantwrite(wc->conn, wc->stream_id, wc->tx_len > 0);
+}
+
+// Send a complete frame in order: straight to the stream if nothing is
+// backlogged, with whatever doesn't fit appended to the backlog.
+static void write_frame(struct ws_conn *wc, const uint8_t *frame, size_t len) {
+    ssize_t written = 0;
+    if (wc->tx_len == 0) {
+        written = send_body(wc, frame, len);
+        if (written < 0) {
+            close_conn(wc, "send failed");
+            return;
+        }
+    }
+    if ((size_t)written < len) {
+        if (buffer_append(&wc->tx_buf, &wc->tx_len, &wc->tx_cap, frame + written,
+                          len - written) != 0) {
+            close_conn(wc, "out of memory");
+            return;
+        }
+        quic_stream_wantwrite(wc->conn, wc->stream_id, true);
+    }
+}
+
+// Build a masked client frame whose payload is `prefix` followed by
+// `body` into the thread's scratch buffer. Returns its length.
+static size_t build_frame(struct ws_thread *t, uint8_t opcode, const char *prefix,
+                          size_t prefix_len, const uint8_t *body, size_t body_len) {
+    size_t payload_len = prefix_len + body_len;
+    size_t need = payload_len + 14;
+    if (need > t->frame_cap) {
+        uint8_t *frame = realloc(t->frame, need);
+        if (frame == NULL) {
+            return 0;
+        }
+        t->frame = frame;
+        t->frame_cap = need;
+    }
+
+    uint8_t *out = t->frame;
+    size_t header_len = 2;
+    out[0] = 0x80 | opcode;
+    if (payload_len < 126) {
+        out[1] = 0x80 | payload_len;
+    } else if (payload_len < 65536) {
+        out[1] = 0x80 | 126;
+        out[2] = payload_len >> 8;
+        out[3] = payload_len & 0xFF;
+        header_len = 4;
+    } else {
+        out[1] = 0x80 | 127;
+        for (int i = 0; i < 8; i++) {
+            out[2 + i] = (uint64_t)payload_len >> (56 - 8 * i);
+        }
+        header_len = 10;
+    }
+    uint8_t *key = out + header_len;
+    ws_mask_key(key);
+    uint8_t *payload = key + 4;
+    ws_mask_copy(payload, (const uint8_t *)prefix, prefix_len, key, 0);
+    ws_mask_copy(payload + prefix_len, body, body_len, key, prefix_len);
+    return header_len + 4 + payload_len;
+}
+
+// Parse one unmasked server frame. Returns its total length, or -1 if
+// `data` doesn't hold a complete frame yet.
+static ssize_t parse_frame(const uint8_t *data, size_t len, uint8_t *opcode,
+                          const uint8_t **payload, uint64_t *payload_len) {
+    if (len < 2) {
+        return -1;
+    }
+    *opcode = data[0] & 0x0F;
+    size_t header_len = 2;
+    uint64_t plen = data[1] & 0x7F;
+    if (plen == 126) {
+        if (len < 4) {
+            return -1;
+        }
+        plen = (data[2] << 8) | data[3];
+        header_len = 4;
+    } else if (plen == 127) {
+        if (len < 10) {
+            return -1;
+        }
+        plen = 0;
+        for (int i = 0; i < 8; i++) {
+            plen = (plen << 8) | data[2 + i];
+        }
+        header_len = 10;
+    }
+    if (data[1] & 0x80) {
+        header_len += 4;  // Servers don't mask; skip a key if present anyway
+    }
+    if (len < header_len || len - header_len < plen) {
+        return -1;
+    }
+    *payload = data + header_len;
+    *payload_len = plen;
+    return header_len + plen;
+}
+
+// Publish (or, with -E, send for echo) one message due at `due`.
+static void publish(struct ws_thread *t, struct ws_conn *wc, double due) {
+    struct ws_load *load = t->load;
+    uint8_t *body = t->buf;  // Not in use outside of read callbacks
+    uint64_t due_ns = (uint64_t)(due * 1e9);
+    char stamp[TIMESTAMP_LEN + 1];
+    snprintf(stamp, sizeof(stamp), "%016" PRIx64, due_ns);
+    memcpy(body, stamp, TIMESTAMP_LEN);
+    memset(body + TIMESTAMP_LEN, 'x', load->size - TIMESTAMP_LEN);
+
+    char prefix[32];
+    size_t prefix_len = 0;
+    uint32_t topic = 0;
+    if (!load->echo) {
+        topic = rng_next(t) % load->topic_count;
+        prefix_len = snprintf(prefix, sizeof(prefix), "PUB t%" PRIu32 " ", topic);
+    }
+    size_t len = build_frame(t, WS_FRAME_TEXT, prefix, prefix_len, body, load->size);
+    if (len == 0) {
+        return;
+    }
+    write_frame(wc, t->frame, len);
+    wc->sent++;
+    STAT_ADD(t, published, 1);
+    if (due >= load->measure_start) {
+        t->measured_published++;
+        if (!load->echo) {
+            atomic_fetch_add_explicit(&load->topic_published[topic], 1, memory_order_relaxed);
+        }
+    }
+}
+
+// Hand a due message to the next open publisher of this thread.
+static void schedule_publish(struct ws_thread *t, double due) {
+    for (size_t i = 0; i < t->publisher_count; i++) {
+        struct ws_conn *wc = &t->conns[t->publishers[t->next_publisher]];
+        t->next_publisher = (t->next_publisher + 1) % t->publisher_count;
+        if (wc->state == CONN_OPEN) {
+            publish(t, wc, due);
+            return;
+        }
+    }
+    t->unsent++;
+}
+
+// A message arrived: a subscription answer, a delivery or an echo.
+static void on_message(struct ws_conn *wc, const uint8_t *payload, uint64_t len) {
+    struct ws_thread *t = wc->thread;
+    struct ws_load *load = t->load;
+    const size_t ack_len = sizeof(WS_TOPIC_ACK) - 1;
+
+    if (len >= ack_len && memcmp(payload, WS_TOPIC_ACK, ack_len) == 0) {
+        if (!wc->subscribed && wc->role == ROLE_SUBSCRIBER) {
+            wc->subscribed = true;
+            wc->subscribe_time = now_seconds() - wc->connect_start;
+            STAT_ADD(t, subscribed, 1);
+            atomic_fetch_add_explicit(&load->topic_subscribers[wc->topic], 1,
+                                      memory_order_relaxed);
+        }
+        return;
+    }
+
+    struct ws_topic_command cmd;
+    const uint8_t *body = payload;
+    size_t body_len = len;
+    if (!load->echo) {
+        if (ws_topic_command_parse(payload, len, &cmd) != WS_TOPIC_PUB) {
+            t->errors++;
+            return;
+        }
+        body = cmd.body;
+        body_len = cmd.body_len;
+    }
+    if (body == NULL || body_len < TIMESTAMP_LEN) {
+        t->errors++;
+        return;
+    }
+
+    char stamp[TIMESTAMP_LEN + 1];
+    memcpy(stamp, body, TIMESTAMP_LEN);
+    stamp[TIMESTAMP_LEN] = '\0';
+    uint64_t due_ns = strtoull(stamp, NULL, 16);
+    uint64_t now = now_ns();
+    uint64_t us = now > due_ns ? (now - due_ns) / 1000 : 0;
+
+    wc->received++;
+    wc->latency_sum_us += us;
+    if (us > wc->latency_max_us) {
+        wc->latency_max_us = us;
+    }
+    STAT_ADD(t, delivered, 1);
+    if (due_ns >= load->measure_start_ns && due_ns < load->end_ns) {
+        t->measured_delivered++;
+        hdr_histogram_record(t->latency, us);
+    }
+}
+
+static void on_open(struct ws_conn *wc) {
+    struct ws_thread *t = wc->thread;
+    wc->state = CONN_OPEN;
+    wc->connect_time = now_seconds() - wc->connect_start;
+    hdr_histogram_record(t->connect_latency, (uint64_t)(wc->connect_time * 1e6));
+    STAT_ADD(t, open, 1);
+
+    if (wc->role == ROLE_SUBSCRIBER && !t->load->echo) {
+        char cmd[32];
+        size_t cmd_len = snprintf(cmd, sizeof(cmd), "SUB t%" PRIu32, wc->topic);
+        size_t len = build_frame(t, WS_FRAME_TEXT, cmd, cmd_len, NULL, 0);
+        if (len > 0) {
+            write_frame(wc, t->frame, len);
+        }
+    }
+}
+
+static void send_upgrade(struct ws_conn *wc) {
+    struct ws_load *load = wc->thread->load;
+    int64_t stream_id = http3_stream_new(wc->h3_conn, wc->conn);
+    if (stream_id < 0) {
+        close_conn(wc, "no stream");
+        return;
+    }
+    wc->stream_id = stream_id;
+
+    struct http3_header_t headers[] = {
+        {.name = (uint8_t *)":method", .name_len = 7,
+         .value = (uint8_t *)"GET", .value_len = 3},
+        {.name = (uint8_t *)":path", .name_len = 5,
+         .value = (uint8_t *)"/", .value_len = 1},
+        {.name = (uint8_t *)":scheme", .name_len = 7,
+         .value = (uint8_t *)"https", .value_len = 5},
+        {.name = (uint8_t *)":authority", .name_len = 10,
+         .value = (uint8_t *)load->authority, .value_len = strlen(load->authority)},
+        {.name = (uint8_t *)"upgrade", .name_len = 7,
+         .value = (uint8_t *)"websocket", .value_len = 9},
+        {.name = (uint8_t *)"connection", .name_len = 10,
+         .value = (uint8_t *)"Upgrade", .value_len = 7},
+        {.name = (uint8_t *)"sec-websocket-key", .name_len = 17,
+         .value = (uint8_t *)"dGhlIHNhbXBsZSBub25jZQ==", .value_len = 24},
+        {.name = (uint8_t *)"sec-websocket-version", .name_len = 21,
+         .value = (uint8_t *)"13", .value_len = 2},
+    };
+    if (http3_send_headers(wc->h3_conn, wc->conn, stream_id, headers,
+                           sizeof(headers) / sizeof(headers[0]), false) < 0) {
+        close_conn(wc, "upgrade failed");
+    }
+}
+
+void client_on_conn_created(void *tctx, struct quic_conn_t *conn) {
+    struct ws_thread *t = tctx;
+    struct ws_conn *wc = t->connecting;
+    if (wc != NULL) {
+        wc->conn = conn;
+        quic_conn_set_context(conn, wc);
+    }
+}
+
+void client_on_conn_established(void *tctx, struct quic_conn_t *conn) {
+    struct ws_thread *t = tctx;
+    struct ws_conn *wc = quic_conn_context(conn);
+    if (wc == NULL) {
+        return;
+    }
+    wc->h3_conn = http3_conn_new(conn, t->h3_config);
+    if (wc->h3_conn == NULL) {
+        close_conn(wc, "h3 failed");
+        return;
+    }
+    http3_conn_set_events_handler(wc->h3_conn, &http3_methods, wc);
+    send_upgrade(wc);
+}
+
+void client_on_conn_closed(void *tctx, struct quic_conn_t *conn) {
+    struct ws_thread *t = tctx;
+    struct ws_conn *wc = quic_conn_context(conn);
+    if (wc == NULL) {
+        return;
+    }
+    if (wc->state == CONN_OPEN) {
+        atomic_fetch_sub_explicit(&t->stats.open, 1, memory_order_relaxed);
+        if (!t->stopping) {
+            wc->closed_early = true;
+            STAT_ADD(t, closed_early, 1);
+        }
+        if (wc->subscribed) {
+            atomic_fetch_sub_explicit(&t->load->topic_subscribers[wc->topic], 1,
+                                      memory_order_relaxed);
+        }
+    } else {
+        wc->failed = true;
+        STAT_ADD(t, failed, 1);
+    }
+    wc->state = CONN_CLOSED;
+    wc->conn = NULL;
+    if (wc->h3_conn != NULL) {
+        http3_conn_free(wc->h3_conn);
+        wc->h3_conn = NULL;
+    }
+    free(wc->rx_buf);
+    free(wc->tx_buf);
+    wc->rx_buf = wc->tx_buf = NULL;
+    wc->rx_len = wc->rx_cap = wc->tx_len = wc->tx_cap = 0;
+
+    t->closed_count++;
+    if (t->closed_count == t->conn_count && t->next_connect == t->conn_count) {
+        ev_break(t->loop, EVBREAK_ALL);
+    }
+}
+
+void client_on_stream_created(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {}
+
+void client_on_stream_readable(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
+    struct ws_conn *wc = quic_conn_context(conn);
+    if (wc != NULL && wc->h3_conn != NULL) {
+        http3_conn_process_streams(wc->h3_conn, conn);
+    }
+}
+
+void client_on_stream_writable(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {
+    struct ws_conn *wc = quic_conn_context(conn);
+    if (wc != NULL && wc->h3_conn != NULL && stream_id == wc->stream_id && wc->tx_len > 0) {
+        flush_tx(wc);
+        return;
+    }
+    quic_stream_wantwrite(conn, stream_id, false);
+}
+
+void client_on_stream_closed(void *tctx, struct quic_conn_t *conn, uint64_t stream_id) {}
+
+static bool same_address(const struct sockaddr *a, const struct sockaddr_storage *b) {
+    if (a->sa_family != b->ss_family) {
+        return false;
+    }
+    if (a->sa_family == AF_INET) {
+        return ((const struct sockaddr_in *)a)->sin_port ==
+               ((const struct sockaddr_in *)b)->sin_port;
+    }
+    return ((const struct sockaddr_in6 *)a)->sin6_port ==
+           ((const struct sockaddr_in6 *)b)->sin6_port;
+}
+
+int client_on_packets_send(void *psctx, struct quic_packet_out_spec_t *pkts,
+                           unsigned int count) {
+    struct ws_thread *t = psctx;
+
+    unsigned int sent_count = 0;
+    int i, j = 0;
+    for (i = 0; i < count; i++) {
+        struct quic_packet_out_spec_t *pkt = pkts + i;
+        // Send from the socket the connection was opened on
+        int fd = t->socks[0].fd;
+        for (size_t s = 0; s < t->sock_count; s++) {
+            if (same_address(pkt->src_addr, &t->socks[s].local_addr)) {
+                fd = t->socks[s].fd;
+                break;
+            }
+        }
+        for (j = 0; j < (*pkt).iovlen; j++) {
+            const struct iovec *iov = pkt->iov + j;
+            ssize_t sent =
+                sendto(fd, iov->iov_base, iov->iov_len, 0,
+                       (struct sockaddr *)pkt->dst_addr, pkt->dst_addr_len);
+
+            if (sent != iov->iov_len) {
+                if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+                    return sent_count;
+                }
+                return -1;
+            }
+            sent_count++;
+        }
+    }
+
+    return sent_count;
+}
+
+const struct quic_transport_methods_t quic_transport_methods = {
+    .on_conn_created = client_on_conn_created,
+    .on_conn_established = client_on_conn_established,
+    .on_conn_closed = client_on_conn_closed,
+    .on_stream_created = client_on_stream_created,
+    .on_stream_readable = client_on_stream_readable,
+    .on_stream_writable = client_on_stream_writable,
+    .on_stream_closed = client_on_stream_closed,
+};
+
+const struct quic_packet_send_methods_t quic_packet_send_methods = {
+    .on_packets_send = client_on_packets_send,
+};
+
+static int status_callback(const uint8_t *name, size_t name_len,
+                           const uint8_t *value, size_t value_len, void *argp) {
+    struct ws_conn *wc = argp;
+    if (name_len == 7 && memcmp(name, ":status", 7) == 0) {
+        char buf[8];
+        size_t len = value_len < sizeof(buf) - 1 ? value_len : sizeof(buf) - 1;
+        memcpy(buf, value, len);
+        buf[len] = '\0';
+        wc->status = atoi(buf);
+    }
+    return 0;
+}
+
+static void http3_on_stream_headers(void *ctx, uint64_t stream_id,
+                                    const struct http3_headers_t *headers,
+                                    bool fin) {
+    struct ws_conn *wc = ctx;
+    if (stream_id != wc->stream_id || wc->state != CONN_CONNECTING) {
+        return;
+    }
+    http3_for_each_header(headers, status_callback, wc);
+    // tquic_websocket_server answers 101, RFC 9220 servers 200
+    if (wc->status == 101 || (wc->status >= 200 && wc->status < 300)) {
+        on_open(wc);
+    } else {
+        close_conn(wc, "upgrade rejected");
+    }
+}
+
+static void http3_on_stream_data(void *ctx, uint64_t stream_id) {
+    struct ws_conn *wc = ctx;
+    struct ws_thread *t = wc->thread;
+
+    while (wc->h3_conn != NULL) {
+        ssize_t read = http3_recv_body(wc->h3_conn, wc->conn, stream_id, t->buf,
+                                       sizeof(t->buf));
+        if (read <= 0) {
+            break;
+        }
+        t->bytes_in += read;
+        if (stream_id != wc->stream_id || wc->state != CONN_OPEN) {
+            continue;
+        }
+
+        // Parse straight from the read buffer unless a partial frame is
+        // pending, and keep only what is left over
+        const uint8_t *data = t->buf;
+        size_t len = read;
+        if (wc->rx_len > 0) {
+            if (buffer_append(&wc->rx_buf, &wc->rx_len, &wc->rx_cap, t->buf, read) != 0) {
+                close_conn(wc, "out of memory");
+                return;
+            }
+            data = wc->rx_buf;
+            len = wc->rx_len;
+        }
+        size_t offset = 0;
+        while (offset < len) {
+            uint8_t opcode;
+            const uint8_t *payload;
+            uint64_t payload_len;
+            ssize_t frame_len = parse_frame(data + offset, len - offset, &opcode, &payload,
+                                            &payload_len);
+            if (frame_len < 0) {
+                break;
+            }
+            offset += frame_len;
+            if (opcode == WS_FRAME_TEXT) {
+                on_message(wc, payload, payload_len);
+            } else if (opcode == WS_FRAME_PING) {
+                size_t pong_len = build_frame(t, WS_FRAME_PONG, NULL, 0, payload, payload_len);
+                if (pong_len > 0) {
+                    write_frame(wc, t->frame, pong_len);
+                }
+            } else if (opcode == WS_FRAME_CLOSE) {
+                close_conn(wc, "websocket closed");
+            }
+        }
+
+        size_t rest = len - offset;
+        if (data == wc->rx_buf) {
+            memmove(wc->rx_buf, wc->rx_buf + offset, rest);
+            wc->rx_len = rest;
+        } else if (rest > 0 &&
+                   buffer_append(&wc->rx_buf, &wc->rx_len, &wc->rx_cap, data + offset,
+                                 rest) != 0) {
+            close_conn(wc, "out of memory");
+            return;
+        }
+    }
+}
+
+static void http3_on_stream_finished(void *ctx, uint64_t stream_id) {
+    struct ws_conn *wc = ctx;
+    if (stream_id == wc->stream_id && !wc->thread->stopping) {
+        close_conn(wc, "stream finished");
+    }
+}
+
+static void http3_on_stream_reset(void *ctx, uint64_t stream_id, uint64_t error_code) {
+    struct ws_conn *wc = ctx;
+    if (stream_id == wc->stream_id) {
+        close_conn(wc, "stream reset");
+    }
+}
+
+static void http3_on_stream_priority_update(void *ctx, uint64_t stream_id) {}
+
+static void http3_on_conn_goaway(void *ctx, uint64_t stream_id) {}
+
+static void process_connections(struct ws_thread *t) {
+    quic_endpoint_process_connections(t->quic_endpoint);
+    double timeout = quic_endpoint_timeout(t->quic_endpoint) / 1e3f;
+    if (timeout < 0.0001) {
+        timeout = 0.0001;
+    }
+    t->timer.repeat = timeout;
+    ev_timer_again(t->loop, &t->timer);
+}
+
+static void read_callback(EV_P_ ev_io *w, int revents) {
+    struct ws_socket *sock = w->data;
+    struct ws_thread *t = sock->thread;
+
+    while (true) {
+        struct sockaddr_storage peer_addr;
+        socklen_t peer_addr_len = sizeof(peer_addr);
+        memset(&peer_addr, 0, peer_addr_len);
+
+        ssize_t read = recvfrom(sock->fd, t->buf, sizeof(t->buf), 0,
+                                (struct sockaddr *)&peer_addr, &peer_addr_len);
+        if (read < 0) {
+            if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+                break;
+            }
+            fprintf(stderr, "failed to read\n");
+            return;
+        }
+
+        quic_packet_info_t quic_packet_info = {
+            .src = (struct sockaddr *)&peer_addr,
+            .src_len = peer_addr_len,
+            .dst = (struct sockaddr *)&sock->local_addr,
+            .dst_len = sock->local_addr_len,
+        };
+        int r = quic_endpoint_recv(t->quic_endpoint, t->buf, read, &quic_packet_info);
+        if (r != 0) {
+            fprintf(stderr, "recv failed %d\n", r);
+        }
+    }
+
+    process_connections(t);
+}
+
+static void timeout_callback(EV_P_ ev_timer *w, int revents) {
+    struct ws_thread *t = w->data;
+    quic_endpoint_on_timeout(t->quic_endpoint);
+    process_connections(t);
+}
+
+// When the k-th connection of thread `t` is due. Connections of all
+// threads are interleaved on one ramp.
+static double connect_due(struct ws_thread *t, size_t k) {
+    struct ws_load *load = t->load;
+    if (load->ramp <= 0) {
+        return load->start;
+    }
+    return load->start + (k * load->thread_count + t->index) / load->ramp;
+}
+
+// Open every connection that is due, then sleep until the next one.
+static void ramp_callback(EV_P_ ev_timer *w, int revents) {
+    struct ws_thread *t = w->data;
+    double now = now_seconds();
+    while (t->next_connect < t->conn_count && connect_due(t, t->next_connect) <= now) {
+        struct ws_conn *wc = &t->conns[t->next_connect++];
+        struct ws_socket *sock = &t->socks[wc->sock];
+        wc->state = CONN_CONNECTING;
+        wc->connect_start = now;
+        t->connecting = wc;
+        int r = quic_endpoint_connect(
+            t->quic_endpoint, (struct sockaddr *)&sock->local_addr, sock->local_addr_len,
+            t->load->peer->ai_addr, t->load->peer->ai_addrlen, NULL /* server_name */,
+            NULL /* session */, 0 /* session_len */, NULL /* token */, 0 /* token_len */,
+            NULL /* config */, NULL /* index */);
+        t->connecting = NULL;
+        if (r < 0) {
+            wc->state = CONN_CLOSED;
+            wc->failed = true;
+            STAT_ADD(t, failed, 1);
+            t->closed_count++;
+        }
+    }
+    if (t->next_connect < t->conn_count) {
+        ev_timer_set(w, connect_due(t, t->next_connect) - now, 0);
+        ev_timer_start(t->loop, w);
+    }
+    process_connections(t);
+}
+
+// Hand out every publish that is due, then sleep until the next one.
+static void arrival_callback(EV_P_ ev_timer *w, int revents) {
+    struct ws_thread *t = w->data;
+    struct ws_load *load = t->load;
+    double now = now_seconds();
+    while (t->next_arrival <= now && t->next_arrival < load->end) {
+        schedule_publish(t, t->next_arrival);
+        t->next_arrival += next_interval(t);
+    }
+    if (t->next_arrival < load->end) {
+        ev_timer_set(w, t->next_arrival - now, 0);
+        ev_timer_start(t->loop, w);
+    }
+    process_connections(t);
+}
+
+// At the end of the run: stop publishing, wait for deliveries in flight,
+// close the connections, and give up on them if they don't close.
+static void stop_callback(EV_P_ ev_timer *w, int revents) {
+    struct ws_thread *t = w->data;
+    switch (t->stop_stage++) {
+        case 0:
+            t->stopping = true;
+            ev_timer_stop(t->loop, &t->arrival_timer);
+            ev_timer_set(w, DRAIN_TIMEOUT, 0);
+            ev_timer_start(t->loop, w);
+            break;
+        case 1:
+            for (size_t i = 0; i < t->conn_count; i++) {
+                close_conn(&t->conns[i], "done");
+            }
+            ev_timer_set(w, CLOSE_TIMEOUT, 0);
+            ev_timer_start(t->loop, w);
+            process_connections(t);
+            break;
+        default:
+            fprintf(stderr, "thread %zu: %zu connections did not close\n", t->index,
+                    t->conn_count - t->closed_count);
+            ev_break(t->loop, EVBREAK_ALL);
+            break;
+    }
+}
+
+static void *thread_main(void *arg) {
+    struct ws_thread *t = arg;
+    struct ws_load *load = t->load;
+    double now = now_seconds();
+
+    ev_init(&t->timer, timeout_callback);
+    t->timer.data = t;
+    ev_timer_init(&t->ramp_timer, ramp_callback, connect_due(t, 0) - now, 0);
+    t->ramp_timer.data = t;
+    ev_timer_start(t->loop, &t->ramp_timer);
+    if (t->publisher_count > 0 && load->rate > 0) {
+        t->rate = load->rate * t->publisher_count / load->publisher_total;
+        t->next_arrival = load->run_start;
+        ev_timer_init(&t->arrival_timer, arrival_callback, load->run_start - now, 0);
+        t->arrival_timer.data = t;
+        ev_timer_start(t->loop, &t->arrival_timer);
+    }
+    ev_timer_init(&t->stop_timer, stop_callback, load->end - now, 0);
+    t->stop_timer.data = t;
+    ev_timer_start(t->loop, &t->stop_timer);
+    for (size_t i = 0; i < t->sock_count; i++) {
+        struct ws_socket *sock = &t->socks[i];
+        ev_io_init(&sock->watcher, read_callback, sock->fd, EV_READ);
+        sock->watcher.data = sock;
+        ev_io_start(t->loop, &sock->watcher);
+    }
+
+    ev_run(t->loop, 0);
+    atomic_fetch_sub(&load->running, 1);
+    return NULL;
+}
+
+// Set up the endpoint, loop and sockets of one thread.
+static int thread_init(struct ws_load *load, struct ws_thread *t) {
+    for (size_t i = 0; i < MAX_SOCKETS; i++) {
+        t->socks[i].fd = -1;
+    }
+    t->latency = hdr_histogram_new();
+    t->connect_latency = hdr_histogram_new();
+    t->publishers = calloc(t->conn_count, sizeof(size_t));
+    if (t->latency == NULL || t->connect_latency == NULL || t->publishers == NULL) {
+        return -1;
+    }
+    t->rng = (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ULL ^ (t->index + 1) * 0xBF58476D1CE4E5B9ULL;
+    t->rng |= 1;
+
+    t->sock_count = load->sock_count < t->conn_count ? load->sock_count : t->conn_count;
+    for (size_t i = 0; i < t->sock_count; i++) {
+        struct ws_socket *sock = &t->socks[i];
+        sock->thread = t;
+        sock->fd = socket(load->peer->ai_family, SOCK_DGRAM, 0);
+        if (sock->fd < 0) {
+            fprintf(stderr, "failed to create socket\n");
+            return -1;
+        }
+        if (fcntl(sock->fd, F_SETFL, O_NONBLOCK) != 0) {
+            fprintf(stderr, "failed to make socket non-blocking\n");
+            return -1;
+        }
+
+        // Bind to an ephemeral port so sockets can be told apart by address
+        struct sockaddr_storage any;
+        memset(&any, 0, sizeof(any));
+        any.ss_family = load->peer->ai_family;
+        socklen_t any_len = any.ss_family == AF_INET ? sizeof(struct sockaddr_in)
+                                                     : sizeof(struct sockaddr_in6);
+        if (bind(sock->fd, (struct sockaddr *)&any, any_len) != 0) {
+            fprintf(stderr, "failed to bind socket: %s\n", strerror(errno));
+            return -1;
+        }
+        sock->local_addr_len = sizeof(sock->local_addr);
+        if (getsockname(sock->fd, (struct sockaddr *)&sock->local_addr,
+                        &sock->local_addr_len) != 0) {
+            fprintf(stderr, "failed to get local address of socket\n");
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < t->conn_count; i++) {
+        struct ws_conn *wc = &t->conns[i];
+        wc->thread = t;
+        wc->sock = i % t->sock_count;
+        if (wc->role == ROLE_PUBLISHER) {
+            t->publishers[t->publisher_count++] = i;
+        }
+    }
+
+    t->config = quic_config_new();
+    if (t->config == NULL) {
+        return -1;
+    }
+    quic_config_set_max_idle_timeout(t->config, 120000);
+    quic_config_set_recv_udp_payload_size(t->config, MAX_DATAGRAM_SIZE);
+    // Sessions carry small messages; keep the per-connection windows
+    // modest so tens of thousands of them fit in memory
+    quic_config_set_initial_max_data(t->config, 1024 * 1024);
+    quic_config_set_initial_max_stream_data_bidi_local(t->config, 256 * 1024);
+    quic_config_set_initial_max_stream_data_bidi_remote(t->config, 256 * 1024);
+
+    const char *const protos[1] = {"h3"};
+    t->tls_config = quic_tls_config_new_client_config(protos, 1, true);
+    if (t->tls_config == NULL) {
+        return -1;
+    }
+    quic_config_set_tls_config(t->config, t->tls_config);
+
+    t->h3_config = http3_config_new();
+    if (t->h3_config == NULL) {
+        return -1;
+    }
+    t->quic_endpoint = quic_endpoint_new(t->config, false, &quic_transport_methods, t,
+                                         &quic_packet_send_methods, t);
+    if (t->quic_endpoint == NULL) {
+        fprintf(stderr, "failed to create quic endpoint\n");
+        return -1;
+    }
+    t->loop = ev_loop_new(EVFLAG_AUTO);
+    return t->loop != NULL ? 0 : -1;
+}
+
+static void thread_free(struct ws_thread *t) {
+    for (size_t i = 0; i < t->conn_count; i++) {
+        free(t->conns[i].rx_buf);
+        free(t->conns[i].tx_buf);
+    }
+    if (t->quic_endpoint != NULL) {
+        quic_endpoint_free(t->quic_endpoint);
+    }
+    if (t->h3_config != NULL) {
+        http3_config_free(t->h3_config);
+    }
+    if (t->tls_config != NULL) {
+        quic_tls_config_free(t->tls_config);
+    }
+    if (t->config != NULL) {
+        quic_config_free(t->config);
+    }
+    for (size_t i = 0; i < t->sock_count; i++) {
+        if (t->socks[i].fd >= 0) {
+            close(t->socks[i].fd);
+        }
+    }
+    if (t->loop != NULL) {
+        ev_loop_destroy(t->loop);
+    }
+    free(t->publishers);
+    free(t->frame);
+    free(t->latency);
+    free(t->connect_latency);
+}
+
+// Print one progress line per second until the threads are done.
+static void report_progress(struct ws_load *load) {
+    uint64_t last_published = 0;
+    uint64_t last_delivered = 0;
+    double last = now_seconds();
+    while (atomic_load(&load->running) > 0) {
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
+        nanosleep(&ts, NULL);
+        double now = now_seconds();
+        if (now - last < 1.0) {
+            continue;
+        }
+
+        uint64_t open = 0, failed = 0, closed_early = 0, published = 0, delivered = 0;
+        for (size_t i = 0; i < load->thread_count; i++) {
+            struct ws_thread *t = &load->threads[i];
+            open += STAT_GET(t, open);
+            failed += STAT_GET(t, failed);
+            closed_early += STAT_GET(t, closed_early);
+            published += STAT_GET(t, published);
+            delivered += STAT_GET(t, delivered);
+        }
+        const char *phase = now < load->run_start       ? "ramp"
+                            : now < load->measure_start ? "warm-up"
+                            : now < load->end           ? "measure"
+                                                        : "drain";
+        fprintf(stderr,
+                "[%6.1f s %-7s] open %7" PRIu64 "/%zu  failed %5" PRIu64 "  dropped %5" PRIu64
+                "  publish %8.1f/s  deliver %9.1f/s\n",
+                now - load->start, phase, open, load->conn_count, failed, closed_early,
+                (published - last_published) / (now - last),
+                (delivered - last_delivered) / (now - last));
+        last_published = published;
+        last_delivered = delivered;
+        last = now;
+    }
+}
+
+struct ws_totals {
+    uint64_t open;  // Reached the upgrade response
+    uint64_t failed;
+    uint64_t closed_early;
+    uint64_t subscribed;
+    uint64_t published;  // Measured
+    uint64_t delivered;  // Measured
+    uint64_t expected;
+    uint64_t unsent;
+    uint64_t errors;
+    uint64_t bytes_in;
+    // Spread of delivered messages per listening connection
+    uint64_t per_conn_min;
+    uint64_t per_conn_median;
+    uint64_t per_conn_max;
+    struct hdr_histogram *latency;
+    struct hdr_histogram *connect_latency;
+};
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int collect_totals(struct ws_load *load, struct ws_totals *tot) {
+    memset(tot, 0, sizeof(*tot));
+    tot->latency = hdr_histogram_new();
+    tot->connect_latency = hdr_histogram_new();
+    uint64_t *counts = calloc(load->conn_count, sizeof(uint64_t));
+    if (tot->latency == NULL || tot->connect_latency == NULL || counts == NULL) {
+        free(counts);
+        return -1;
+    }
+    for (size_t i = 0; i < load->thread_count; i++) {
+        struct ws_thread *t = &load->threads[i];
+        tot->failed += STAT_GET(t, failed);
+        tot->closed_early += STAT_GET(t, closed_early);
+        tot->subscribed += STAT_GET(t, subscribed);
+        tot->published += t->measured_published;
+        tot->delivered += t->measured_delivered;
+        tot->unsent += t->unsent;
+        tot->errors += t->errors;
+        tot->bytes_in += t->bytes_in;
+        hdr_histogram_merge(tot->latency, t->latency);
+        hdr_histogram_merge(tot->connect_latency, t->connect_latency);
+    }
+
+    // Deliveries are expected by subscribers or, with -E, by publishers
+    size_t n = 0;
+    for (size_t i = 0; i < load->conn_count; i++) {
+        struct ws_conn *wc = &load->conns[i];
+        if (wc->connect_time > 0) {
+            tot->open++;
+        }
+        if ((wc->role == ROLE_SUBSCRIBER) != load->echo && wc->connect_time > 0) {
+            counts[n++] = wc->received;
+        }
+    }
+    if (n > 0) {
+        qsort(counts, n, sizeof(uint64_t), compare_u64);
+        tot->per_conn_min = counts[0];
+        tot->per_conn_median = counts[n / 2];
+        tot->per_conn_max = counts[n - 1];
+    }
+    free(counts);
+
+    // Approximate: subscribers that dropped out count as not subscribed
+    if (load->echo) {
+        tot->expected = tot->published;
+    } else {
+        for (uint32_t k = 0; k < load->topic_count; k++) {
+            tot->expected += atomic_load(&load->topic_published[k]) *
+                             atomic_load(&load->topic_subscribers[k]);
+        }
+    }
+    return 0;
+}
+
+static void print_report(struct ws_load *load, const struct ws_totals *tot, FILE *out) {
+    fprintf(out,
+            "ws_load: %zu connections (%zu publishers, %zu %s), %" PRIu32 " topics, "
+            "%zu threads x %zu sockets\n",
+            load->conn_count, load->publisher_total, load->conn_count - load->publisher_total,
+            load->echo ? "idle" : "subscribers", load->topic_count, load->thread_count,
+            load->sock_count);
+    fprintf(out,
+            "settings:   ramp %.0f conn/s over %.1f s, %.1f msg/s %s, %zu byte bodies, "
+            "warm-up %.1f s, measured %.1f s\n",
+            load->ramp, load->run_start - load->start, load->rate,
+            load->poisson ? "poisson" : "constant", load->size, load->warmup, load->duration);
+    fprintf(out,
+            "sessions:   open=%" PRIu64 " failed=%" PRIu64 " dropped=%" PRIu64
+            " subscribed=%" PRIu64 "\n",
+            tot->open, tot->failed, tot->closed_early, tot->subscribed);
+    hdr_histogram_print(out, "connect", tot->connect_latency, 1e-3, "ms");
+    fprintf(out,
+            "messages:   published=%" PRIu64 " unsent=%" PRIu64 " delivered=%" PRIu64
+            " expected=%" PRIu64 " (%.2f%%) errors=%" PRIu64 "\n",
+            tot->published, tot->unsent, tot->delivered, tot->expected,
+            tot->expected ? 100.0 * tot->delivered / tot->expected : 0.0, tot->errors);
+    fprintf(out, "throughput: publish %.1f msg/s, deliver %.1f msg/s\n",
+            tot->published / load->duration, tot->delivered / load->duration);
+    fprintf(out,
+            "per conn:   delivered min=%" PRIu64 " median=%" PRIu64 " max=%" PRIu64
+            " (whole run)\n",
+            tot->per_conn_min, tot->per_conn_median, tot->per_conn_max);
+    hdr_histogram_print(out, load->echo ? "echo rtt" : "delivery", tot->latency, 1e-3, "ms");
+}
+
+static int write_json(struct ws_load *load, const struct ws_totals *tot, const char *file) {
+    FILE *out = strcmp(file, "-") == 0 ? stdout : fopen(file, "w");
+    if (out == NULL) {
+        fprintf(stderr, "failed to open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    fprintf(out,
+            "{\"connections\": %zu, \"publishers\": %zu, \"topics\": %" PRIu32
+            ", \"threads\": %zu, \"sockets\": %zu, \"ramp\": %.3f, \"rate\": %.3f, "
+            "\"arrival\": \"%s\", \"mode\": \"%s\", \"size\": %zu, \"warmup_s\": %.3f, "
+            "\"duration_s\": %.3f,\n",
+            load->conn_count, load->publisher_total, load->topic_count, load->thread_count,
+            load->sock_count, load->ramp, load->rate, load->poisson ? "poisson" : "constant",
+            load->echo ? "echo" : "pubsub", load->size, load->warmup, load->duration);
+    fprintf(out,
+            " \"sessions\": {\"open\": %" PRIu64 ", \"failed\": %" PRIu64 ", \"dropped\": %" PRIu64
+            ", \"subscribed\": %" PRIu64 ", \"connect_us\": ",
+            tot->open, tot->failed, tot->closed_early, tot->subscribed);
+    hdr_histogram_print_json(out, tot->connect_latency);
+    fprintf(out,
+            "},\n \"messages\": {\"published\": %" PRIu64 ", \"unsent\": %" PRIu64
+            ", \"delivered\": %" PRIu64 ", \"expected\": %" PRIu64 ", \"errors\": %" PRIu64
+            "},\n",
+            tot->published, tot->unsent, tot->delivered, tot->expected, tot->errors);
+    fprintf(out,
+            " \"per_conn_delivered\": {\"min\": %" PRIu64 ", \"median\": %" PRIu64
+            ", \"max\": %" PRIu64 "},\n",
+            tot->per_conn_min, tot->per_conn_median, tot->per_conn_max);
+    fprintf(out, " \"latency_us\": ");
+    hdr_histogram_print_json(out, tot->latency);
+    fprintf(out, "}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
+
+// One line per connection, for spotting unfair or stuck sessions.
+static int write_csv(struct ws_load *load, const char *file) {
+    FILE *out = fopen(file, "w");
+    if (out == NULL) {
+        fprintf(stderr, "failed to open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    fprintf(out, "conn,thread,role,topic,state,connect_ms,subscribe_ms,sent,received,"
+                 "mean_latency_ms,max_latency_ms\n");
+    for (size_t i = 0; i < load->conn_count; i++) {
+        struct ws_conn *wc = &load->conns[i];
+        const char *state = wc->failed         ? "failed"
+                            : wc->closed_early ? "dropped"
+                            : wc->connect_time > 0 ? "ok"
+                                                   : "idle";
+        fprintf(out, "%zu,%zu,%s,%" PRIu32 ",%s,%.3f,%.3f,%" PRIu64 ",%" PRIu64 ",%.3f,%.3f\n",
+                wc->index, wc->thread->index,
+                wc->role == ROLE_PUBLISHER ? "publisher" : "subscriber", wc->topic, state,
+                wc->connect_time * 1e3, wc->subscribe_time * 1e3, wc->sent, wc->received,
+                wc->received ? wc->latency_sum_us / 1e3 / wc->received : 0.0,
+                wc->latency_max_us / 1e3);
+    }
+    fclose(out);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] <dest_addr> <dest_port>\n", prog);
+    fprintf(stderr, "  -c <n>     WebSocket sessions (default: 100)\n");
+    fprintf(stderr, "  -t <n>     threads, one QUIC endpoint and ev_loop each (default: 1, max %d)\n",
+            MAX_THREADS);
+    fprintf(stderr, "  -u <n>     UDP sockets per thread (default: 4, max %d)\n", MAX_SOCKETS);
+    fprintf(stderr, "  -R <cps>   connect ramp in sessions per second, 0 for all at once "
+                    "(default: 500)\n");
+    fprintf(stderr, "  -s <frac>  fraction of sessions that subscribe, the rest publish "
+                    "(default: 0.9)\n");
+    fprintf(stderr, "  -T <n>     topics (default: 10)\n");
+    fprintf(stderr, "  -r <mps>   total publish rate (default: 100)\n");
+    fprintf(stderr, "  -p         Poisson arrivals instead of constant spacing\n");
+    fprintf(stderr, "  -z <n>     message body size in bytes (default: 64, min %d)\n",
+            TIMESTAMP_LEN);
+    fprintf(stderr, "  -E         echo mode: publishers measure the echo, others stay idle\n");
+    fprintf(stderr, "  -w <s>     warm-up after the ramp, not measured (default: 2)\n");
+    fprintf(stderr, "  -d <s>     measured duration (default: 30)\n");
+    fprintf(stderr, "  -j <file>  also write the results as JSON (\"-\" for stdout)\n");
+    fprintf(stderr, "  -C <file>  write per-session statistics as CSV\n");
+}
+
+int main(int argc, char *argv[]) {
+    static struct ws_load load;
+    load.conn_count = 100;
+    load.thread_count = 1;
+    load.sock_count = 4;
+    load.ramp = 500;
+    load.sub_fraction = 0.9;
+    load.topic_count = 10;
+    load.rate = 100;
+    load.size = 64;
+    load.warmup = 2;
+    load.duration = 30;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:u:R:s:T:r:pz:Ew:d:j:C:h")) != -1) {
+        switch (opt) {
+            case 'c': load.conn_count = strtoul(optarg, NULL, 10); break;
+            case 't': load.thread_count = strtoul(optarg, NULL, 10); break;
+            case 'u': load.sock_count = strtoul(optarg, NULL, 10); break;
+            case 'R': load.ramp = atof(optarg); break;
+            case 's': load.sub_fraction = atof(optarg); break;
+            case 'T': load.topic_count = strtoul(optarg, NULL, 10); break;
+            case 'r': load.rate = atof(optarg); break;
+            case 'p': load.poisson = true; break;
+            case 'z': load.size = strtoul(optarg, NULL, 10); break;
+            case 'E': load.echo = true; break;
+            case 'w': load.warmup = atof(optarg); break;
+            case 'd': load.duration = atof(optarg); break;
+            case 'j': load.json_path = optarg; break;
+            case 'C': load.csv_path = optarg; break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+    if (argc - optind < 2 || load.conn_count == 0 || load.thread_count == 0 ||
+        load.thread_count > MAX_THREADS || load.sock_count == 0 ||
+        load.sock_count > MAX_SOCKETS || load.ramp < 0 || load.sub_fraction < 0 ||
+        load.sub_fraction > 1 || load.topic_count == 0 || load.rate < 0 ||
+        load.size < TIMESTAMP_LEN || load.size > READ_BUF_SIZE || load.warmup < 0 ||
+        load.duration <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    if (load.thread_count > load.conn_count) {
+        load.thread_count = load.conn_count;
+    }
+
+    const char *host = argv[optind];
+    const char *port = argv[optind + 1];
+    load.authority = host;
+    int ret = 0;
+    struct ws_totals totals;
+    memset(&totals, 0, sizeof(totals));
+
+    const struct addrinfo hints = {.ai_family = PF_UNSPEC,
+                                   .ai_socktype = SOCK_DGRAM,
+                                   .ai_protocol = IPPROTO_UDP};
+    if (getaddrinfo(host, port, &hints, &load.peer) != 0) {
+        fprintf(stderr, "failed to resolve host\n");
+        return -1;
+    }
+
+    load.conns = calloc(load.conn_count, sizeof(struct ws_conn));
+    load.topic_published = calloc(load.topic_count, sizeof(atomic_uint_fast64_t));
+    load.topic_subscribers = calloc(load.topic_count, sizeof(atomic_uint_fast64_t));
+    if (load.conns == NULL || load.topic_published == NULL || load.topic_subscribers == NULL) {
+        ret = -1;
+        goto EXIT;
+    }
+
+    // Spread the publishers evenly over the index range, and so over the
+    // threads; subscribers take the topics round-robin
+    double pub_fraction = 1 - load.sub_fraction;
+    for (size_t i = 0; i < load.conn_count; i++) {
+        struct ws_conn *wc = &load.conns[i];
+        wc->index = i;
+        bool publisher = floor((i + 1) * pub_fraction) > floor(i * pub_fraction);
+        wc->role = publisher ? ROLE_PUBLISHER : ROLE_SUBSCRIBER;
+        wc->topic = i % load.topic_count;
+        load.publisher_total += publisher;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < load.thread_count; i++) {
+        struct ws_thread *t = &load.threads[i];
+        t->load = &load;
+        t->index = i;
+        t->conns = load.conns + offset;
+        t->conn_count = load.conn_count / load.thread_count +
+                        (i < load.conn_count % load.thread_count);
+        offset += t->conn_count;
+        if (thread_init(&load, t) != 0) {
+            ret = -1;
+            goto EXIT;
+        }
+    }
+
+    // One schedule for all threads: the ramp, the warm-up, then the
+    // measured run
+    load.start = now_seconds() + 0.1;
+    load.run_start = load.start;
+    if (load.ramp > 0) {
+        load.run_start += load.conn_count / load.ramp;
+    }
+    load.measure_start = load.run_start + load.warmup;
+    load.end = load.measure_start + load.duration;
+    load.measure_start_ns = (uint64_t)(load.measure_start * 1e9);
+    load.end_ns = (uint64_t)(load.end * 1e9);
+    fprintf(stderr,
+            "%zu sessions (%zu publishers) on %zu threads, ramp %.1f s, warm-up %.1f s, "
+            "measuring %.1f s\n",
+            load.conn_count, load.publisher_total, load.thread_count,
+            load.run_start - load.start, load.warmup, load.duration);
+
+    atomic_store(&load.running, (int)load.thread_count);
+    for (size_t i = 0; i < load.thread_count; i++) {
+        struct ws_thread *t = &load.threads[i];
+        if (pthread_create(&t->thread, NULL, thread_main, t) != 0) {
+            fprintf(stderr, "failed to start thread %zu\n", i);
+            atomic_fetch_sub(&load.running, 1);
+            ret = -1;
+            continue;
+        }
+        t->started = true;
+    }
+    report_progress(&load);
+    for (size_t i = 0; i < load.thread_count; i++) {
+        if (load.threads[i].started) {
+            pthread_join(load.threads[i].thread, NULL);
+        }
+    }
+
+    if (collect_totals(&load, &totals) != 0) {
+        ret = -1;
+        goto EXIT;
+    }
+    print_report(&load, &totals, stdout);
+    if (load.json_path != NULL && write_json(&load, &totals, load.json_path) != 0) {
+        ret = -1;
+    }
+    if (load.csv_path != NULL && write_csv(&load, load.csv_path) != 0) {
+        ret = -1;
+    }
+
+EXIT:
+    for (size_t i = 0; i < load.thread_count; i++) {
+        thread_free(&load.threads[i]);
+    }
+    if (load.peer != NULL) {
+        freeaddrinfo(load.peer);
+    }
+    free(load.conns);
+    free(load.topic_published);
+    free(load.topic_subscribers);
+    free(totals.latency);
+    free(totals.connect_latency);
+
+    return ret;
+}
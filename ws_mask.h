@@ -0,0 +1,128 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// WebSocket client frame masking.
+//
+// RFC 6455 requires client masking keys to be unpredictable, so keys come
+// from the kernel CSPRNG (getrandom, falling back to /dev/urandom) instead
+// of rand(). A syscall per frame would cost more than masking a small
+// message, so each thread draws WS_MASK_POOL_SIZE bytes at a time and hands
+// out four of them per frame.
+//
+// ws_mask_copy() copies and masks the payload in one pass, eight bytes per
+// step, which compilers turn into vector loads and XORs at -O2 and above.
+
+#ifndef WS_MASK_H
+#define WS_MASK_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+#define WS_MASK_POOL_SIZE 1024
+
+struct ws_mask_pool {
+    uint8_t bytes[WS_MASK_POOL_SIZE];
+    size_t pos;
+};
+
+static _Thread_local struct ws_mask_pool ws_mask_pool = {.pos = WS_MASK_POOL_SIZE};
+
+static inline int ws_mask_urandom(uint8_t *buf, size_t len) {
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = read(fd, buf + off, len - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        off += n;
+    }
+    close(fd);
+    return off == len ? 0 : -1;
+}
+
+static inline void ws_mask_refill(struct ws_mask_pool *pool) {
+    size_t off = 0;
+    while (off < sizeof(pool->bytes)) {
+        ssize_t n = getrandom(pool->bytes + off, sizeof(pool->bytes) - off, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            break;
+        }
+        off += n;
+    }
+    if (off < sizeof(pool->bytes) &&
+        ws_mask_urandom(pool->bytes + off, sizeof(pool->bytes) - off) != 0) {
+        // Predictable masks would defeat their purpose; don't send frames.
+        fprintf(stderr, "ws_mask: no random source available\n");
+        abort();
+    }
+    pool->pos = 0;
+}
+
+// Fill `len` bytes (at most WS_MASK_POOL_SIZE) from the pool, e.g. for a
+// Sec-WebSocket-Key nonce.
+static inline void ws_mask_random(uint8_t *buf, size_t len) {
+    struct ws_mask_pool *pool = &ws_mask_pool;
+    if (pool->pos + len > sizeof(pool->bytes)) {
+        ws_mask_refill(pool);
+    }
+    memcpy(buf, pool->bytes + pool->pos, len);
+    pool->pos += len;
+}
+
+// Write a fresh masking key to key[0..3].
+static inline void ws_mask_key(uint8_t key[4]) {
+    ws_mask_random(key, 4);
+}
+
+// dst[i] = src[i] ^ key[(phase + i) % 4]. `phase` is the payload offset of
+// src[0], for payloads assembled from several pieces. dst == src masks in
+// place (which also unmasks); other overlaps are not allowed.
+static inline void ws_mask_copy(uint8_t *dst, const uint8_t *src, size_t len,
+                                const uint8_t key[4], size_t phase) {
+    uint8_t pattern[8];
+    for (size_t i = 0; i < 8; i++) {
+        pattern[i] = key[(phase + i) & 3];
+    }
+    uint64_t word_key;
+    memcpy(&word_key, pattern, 8);
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, src + i, 8);
+        word ^= word_key;
+        memcpy(dst + i, &word, 8);
+    }
+    for (; i < len; i++) {
+        dst[i] = src[i] ^ pattern[i & 7];
+    }
+}
+
+#endif  // WS_MASK_H
@@ -0,0 +1,252 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Topic subscriptions for the WebSocket echo server.
+//
+// A text message that starts with a command keyword is handled by the
+// server instead of being echoed:
+//
+//   SUB <topic>            subscribe; answered with "SUBSCRIBED <topic>"
+//   UNSUB <topic>          unsubscribe; no answer
+//   PUB <topic> <body>     the whole message is sent to every subscriber
+//                          of <topic>, including the publisher if it is
+//                          subscribed; no answer
+//
+// The registry is a fixed hash table of topics, each with a doubly linked
+// list of subscriptions, so subscribing, unsubscribing and dropping all
+// subscriptions of a closing session are O(1) per subscription and a
+// publish only visits the subscribers of its topic. It is not thread-safe
+// and is meant to be used from the loop thread only, since fan-out writes
+// to QUIC streams.
+
+#ifndef WS_TOPICS_H
+#define WS_TOPICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WS_TOPIC_MAX_NAME 64
+#define WS_TOPIC_BUCKETS 1024
+#define WS_TOPIC_ACK "SUBSCRIBED "
+
+enum ws_topic_command_kind {
+    WS_TOPIC_NONE = 0,  // Not a command, an ordinary message
+    WS_TOPIC_SUB,
+    WS_TOPIC_UNSUB,
+    WS_TOPIC_PUB,
+};
+
+struct ws_topic_command {
+    enum ws_topic_command_kind kind;
+    const uint8_t *topic;
+    size_t topic_len;
+    const uint8_t *body;  // PUB only
+    size_t body_len;
+};
+
+struct ws_topic;
+
+struct ws_subscription {
+    void *session;
+    struct ws_topic *topic;
+    struct ws_subscription *prev;  // Links in the topic's subscriber list
+    struct ws_subscription *next;
+    struct ws_subscription *session_next;  // Link in the session's list
+};
+
+struct ws_topic {
+    char name[WS_TOPIC_MAX_NAME + 1];
+    size_t name_len;
+    struct ws_subscription *subscribers;
+    size_t subscriber_count;
+    uint64_t published;
+    struct ws_topic *next;  // Hash chain
+};
+
+struct ws_topics {
+    struct ws_topic *buckets[WS_TOPIC_BUCKETS];
+    size_t topic_count;
+    size_t subscription_count;
+};
+
+// Parse a text message. Returns the command kind, WS_TOPIC_NONE for
+// ordinary messages. Malformed commands (empty or too long topic) are
+// treated as ordinary messages.
+static inline enum ws_topic_command_kind ws_topic_command_parse(const uint8_t *data, size_t len,
+                                                                struct ws_topic_command *cmd) {
+    memset(cmd, 0, sizeof(*cmd));
+    size_t skip;
+    if (len >= 4 && memcmp(data, "SUB ", 4) == 0) {
+        cmd->kind = WS_TOPIC_SUB;
+        skip = 4;
+    } else if (len >= 6 && memcmp(data, "UNSUB ", 6) == 0) {
+        cmd->kind = WS_TOPIC_UNSUB;
+        skip = 6;
+    } else if (len >= 4 && memcmp(data, "PUB ", 4) == 0) {
+        cmd->kind = WS_TOPIC_PUB;
+        skip = 4;
+    } else {
+        return WS_TOPIC_NONE;
+    }
+
+    cmd->topic = data + skip;
+    const uint8_t *end = data + len;
+    const uint8_t *space = memchr(cmd->topic, ' ', end - cmd->topic);
+    cmd->topic_len = (space ? space : end) - cmd->topic;
+    if (cmd->kind == WS_TOPIC_PUB && space != NULL) {
+        cmd->body = space + 1;
+        cmd->body_len = end - cmd->body;
+    }
+    if (cmd->topic_len == 0 || cmd->topic_len > WS_TOPIC_MAX_NAME) {
+        memset(cmd, 0, sizeof(*cmd));
+    }
+    return cmd->kind;
+}
+
+static inline void ws_topics_init(struct ws_topics *topics) {
+    memset(topics, 0, sizeof(*topics));
+}
+
+// FNV-1a
+static inline size_t ws_topics_bucket(const uint8_t *name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ name[i]) * 16777619u;
+    }
+    return hash % WS_TOPIC_BUCKETS;
+}
+
+// Look up a topic, creating it if `create` is set. Returns NULL if it does
+// not exist (or allocation failed).
+static inline struct ws_topic *ws_topics_find(struct ws_topics *topics, const uint8_t *name,
+                                              size_t len, bool create) {
+    if (len == 0 || len > WS_TOPIC_MAX_NAME) {
+        return NULL;
+    }
+    size_t bucket = ws_topics_bucket(name, len);
+    for (struct ws_topic *t = topics->buckets[bucket]; t != NULL; t = t->next) {
+        if (t->name_len == len && memcmp(t->name, name, len) == 0) {
+            return t;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    struct ws_topic *t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return NULL;
+    }
+    memcpy(t->name, name, len);
+    t->name_len = len;
+    t->next = topics->buckets[bucket];
+    topics->buckets[bucket] = t;
+    topics->topic_count++;
+    return t;
+}
+
+// Subscribe `session` to a topic. `session_subs` is the head of the
+// session's own subscription list. Returns 1 if subscribed, 0 if it
+// already was and -1 on error.
+static inline int ws_topics_subscribe(struct ws_topics *topics, void *session,
+                                      struct ws_subscription **session_subs,
+                                      const uint8_t *name, size_t len) {
+    struct ws_topic *topic = ws_topics_find(topics, name, len, true);
+    if (topic == NULL) {
+        return -1;
+    }
+    for (struct ws_subscription *s = *session_subs; s != NULL; s = s->session_next) {
+        if (s->topic == topic) {
+            return 0;
+        }
+    }
+    struct ws_subscription *sub = calloc(1, sizeof(*sub));
+    if (sub == NULL) {
+        return -1;
+    }
+    sub->session = session;
+    sub->topic = topic;
+    sub->next = topic->subscribers;
+    if (topic->subscribers != NULL) {
+        topic->subscribers->prev = sub;
+    }
+    topic->subscribers = sub;
+    topic->subscriber_count++;
+    sub->session_next = *session_subs;
+    *session_subs = sub;
+    topics->subscription_count++;
+    return 1;
+}
+
+static inline void ws_topics_unlink(struct ws_topics *topics, struct ws_subscription *sub) {
+    if (sub->prev != NULL) {
+        sub->prev->next = sub->next;
+    } else {
+        sub->topic->subscribers = sub->next;
+    }
+    if (sub->next != NULL) {
+        sub->next->prev = sub->prev;
+    }
+    sub->topic->subscriber_count--;
+    topics->subscription_count--;
+}
+
+static inline void ws_topics_unsubscribe(struct ws_topics *topics,
+                                         struct ws_subscription **session_subs,
+                                         const uint8_t *name, size_t len) {
+    struct ws_topic *topic = ws_topics_find(topics, name, len, false);
+    for (struct ws_subscription **link = session_subs; topic != NULL && *link != NULL;
+         link = &(*link)->session_next) {
+        struct ws_subscription *sub = *link;
+        if (sub->topic == topic) {
+            *link = sub->session_next;
+            ws_topics_unlink(topics, sub);
+            free(sub);
+            return;
+        }
+    }
+}
+
+// Drop every subscription of a session, e.g. when its connection closes.
+static inline void ws_topics_unsubscribe_all(struct ws_topics *topics,
+                                             struct ws_subscription **session_subs) {
+    while (*session_subs != NULL) {
+        struct ws_subscription *sub = *session_subs;
+        *session_subs = sub->session_next;
+        ws_topics_unlink(topics, sub);
+        free(sub);
+    }
+}
+
+// Free the topics and any subscriptions left on them. Sessions still
+// holding subscription lists must not use them afterwards.
+static inline void ws_topics_free(struct ws_topics *topics) {
+    for (size_t i = 0; i < WS_TOPIC_BUCKETS; i++) {
+        while (topics->buckets[i] != NULL) {
+            struct ws_topic *t = topics->buckets[i];
+            topics->buckets[i] = t->next;
+            while (t->subscribers != NULL) {
+                struct ws_subscription *sub = t->subscribers;
+                t->subscribers = sub->next;
+                free(sub);
+            }
+            free(t);
+        }
+    }
+    topics->topic_count = 0;
+    topics->subscription_count = 0;
+}
+
+#endif  // WS_TOPICS_H
@@ -0,0 +1,472 @@
+// Copyright (c) 2023 The TQUIC Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Fixed worker pool for application message handlers.
+//
+// The QUIC endpoint is driven from a single ev_loop thread, so a slow
+// message handler stalls ACKs and packet processing of every connection.
+// Jobs posted here run on worker threads instead:
+//
+//   loop thread --post--> worker FIFO --handler--> MPSC done queue
+//                                                      |
+//   loop thread <--complete-- ev_async <---------------+
+//
+// Every job carries a session id and all jobs of a session go to the same
+// worker, so they are handled and completed in the order they were posted.
+// Completed jobs travel back through an intrusive lock-free MPSC queue
+// (Vyukov) and an ev_async wakeup; the complete callback, which may touch
+// QUIC state, therefore only ever runs on the loop thread.
+//
+// With zero workers the pool runs handler and complete inline, which keeps
+// a single code path in the caller.
+
+#ifndef WS_WORKER_POOL_H
+#define WS_WORKER_POOL_H
+
+#include <ev.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WS_WORKER_POOL_ENV_WORKERS "TQUIC_WS_WORKERS"
+#define WS_WORKER_POOL_ENV_QUEUE_LIMIT "TQUIC_WS_QUEUE_LIMIT"
+#define WS_WORKER_POOL_DEFAULT_WORKERS 4
+#define WS_WORKER_POOL_DEFAULT_QUEUE_LIMIT 1024
+#define WS_WORKER_POOL_HIST_BUCKETS 32
+
+struct ws_job {
+    _Atomic(struct ws_job *) done_next;  // Link in the MPSC done queue
+    struct ws_job *next;                 // Link in a worker FIFO
+
+    void *session;
+    uint64_t session_id;
+    uint8_t opcode;
+
+    // Filled in by the handler. `result` is freed with the job unless it
+    // points into the payload.
+    uint8_t *result;
+    size_t result_len;
+
+    double posted_at;
+    double started_at;
+    double finished_at;
+
+    // Points just past the job, in the same allocation.
+    uint8_t *payload;
+    size_t payload_len;
+};
+
+// Runs on a worker thread. Must not touch QUIC or libev state.
+typedef void (*ws_job_handler_fn)(struct ws_job *job, void *ctx);
+
+// Runs on the loop thread for every finished job, in per-session order.
+// The pool frees the job after it returns.
+typedef void (*ws_job_complete_fn)(struct ws_job *job, void *ctx);
+
+// Called once after a batch of completions, so the owner can process
+// connections and rearm its QUIC timer.
+typedef void (*ws_job_flush_fn)(void *ctx);
+
+struct ws_mpsc_queue {
+    _Atomic(struct ws_job *) head;  // Producers push here
+    struct ws_job *tail;            // Consumer pops here
+    struct ws_job stub;
+};
+
+// Log2 histogram of latencies in microseconds.
+struct ws_latency_stats {
+    uint64_t count;
+    double sum;
+    double max;
+    uint64_t buckets[WS_WORKER_POOL_HIST_BUCKETS];
+};
+
+struct ws_worker_pool_stats {
+    uint64_t posted;
+    uint64_t completed;
+    uint64_t rejected;
+    size_t max_depth;
+    struct ws_latency_stats queue_wait;  // posted -> picked up by a worker
+    struct ws_latency_stats service;     // handler run time
+    struct ws_latency_stats handoff;     // handler done -> completed on loop
+};
+
+struct ws_worker_pool;
+
+struct ws_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct ws_job *head;
+    struct ws_job *tail;
+    size_t depth;
+    bool stop;
+    struct ws_worker_pool *pool;
+};
+
+struct ws_worker_pool {
+    struct ev_loop *loop;
+    ev_async async;
+    struct ws_worker *workers;
+    size_t num_workers;
+    size_t queue_limit;
+    struct ws_mpsc_queue done;
+    ws_job_handler_fn handler;
+    ws_job_complete_fn complete;
+    ws_job_flush_fn flush;
+    void *ctx;
+    struct ws_worker_pool_stats stats;
+};
+
+static inline double ws_worker_pool_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void ws_latency_record(struct ws_latency_stats *s,
+                                     double seconds) {
+    double us = seconds * 1e6;
+    size_t bucket = 0;
+    while (bucket < WS_WORKER_POOL_HIST_BUCKETS - 1 &&
+           (double)(1ULL << bucket) < us) {
+        bucket++;
+    }
+    s->buckets[bucket]++;
+    s->count++;
+    s->sum += seconds;
+    if (seconds > s->max) {
+        s->max = seconds;
+    }
+}
+
+// Upper bound of the histogram bucket holding the p-th percentile, in
+// seconds.
+static inline double ws_latency_percentile(const struct ws_latency_stats *s,
+                                           double p) {
+    if (s->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p / 100.0 * s->count + 0.5);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < WS_WORKER_POOL_HIST_BUCKETS; i++) {
+        seen += s->buckets[i];
+        if (seen >= rank && seen > 0) {
+            double bound = (double)(1ULL << i) / 1e6;
+            return bound < s->max ? bound : s->max;
+        }
+    }
+    return s->max;
+}
+
+static inline void ws_mpsc_init(struct ws_mpsc_queue *q) {
+    atomic_init(&q->stub.done_next, NULL);
+    atomic_init(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
+
+// Safe to call from any number of threads concurrently.
+static inline void ws_mpsc_push(struct ws_mpsc_queue *q, struct ws_job *job) {
+    atomic_store_explicit(&job->done_next, NULL, memory_order_relaxed);
+    struct ws_job *prev =
+        atomic_exchange_explicit(&q->head, job, memory_order_acq_rel);
+    atomic_store_explicit(&prev->done_next, job, memory_order_release);
+}
+
+// Single consumer only. Returns NULL when the queue is empty or a producer
+// is halfway through a push; that producer signals the ev_async afterwards,
+// so the remaining job is picked up on the next wakeup.
+static inline struct ws_job *ws_mpsc_pop(struct ws_mpsc_queue *q) {
+    struct ws_job *tail = q->tail;
+    struct ws_job *next =
+        atomic_load_explicit(&tail->done_next, memory_order_acquire);
+
+    if (tail == &q->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->done_next, memory_order_acquire);
+    }
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+
+    struct ws_job *head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail != head) {
+        return NULL;
+    }
+    ws_mpsc_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->done_next, memory_order_acquire);
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+// Allocate a job holding a copy of `payload`.
+static inline struct ws_job *ws_job_new(void *session, uint64_t session_id,
+                                        uint8_t opcode, const uint8_t *payload,
+                                        size_t payload_len) {
+    struct ws_job *job = malloc(sizeof(*job) + payload_len);
+    if (job == NULL) {
+        return NULL;
+    }
+    memset(job, 0, sizeof(*job));
+    job->session = session;
+    job->session_id = session_id;
+    job->opcode = opcode;
+    job->payload = (uint8_t *)(job + 1);
+    job->payload_len = payload_len;
+    if (payload_len > 0) {
+        memcpy(job->payload, payload, payload_len);
+    }
+    return job;
+}
+
+static inline void ws_job_free(struct ws_job *job) {
+    if (job->result != NULL && job->result != job->payload) {
+        free(job->result);
+    }
+    free(job);
+}
+
+static inline void ws_worker_pool_finish(struct ws_worker_pool *pool,
+                                         struct ws_job *job) {
+    double now = ws_worker_pool_now();
+    pool->stats.completed++;
+    ws_latency_record(&pool->stats.queue_wait,
+                      job->started_at - job->posted_at);
+    ws_latency_record(&pool->stats.service,
+                      job->finished_at - job->started_at);
+    ws_latency_record(&pool->stats.handoff, now - job->finished_at);
+
+    pool->complete(job, pool->ctx);
+    ws_job_free(job);
+}
+
+static inline void ws_worker_pool_async_cb(EV_P_ ev_async *w, int revents) {
+    struct ws_worker_pool *pool = w->data;
+    struct ws_job *job;
+    bool any = false;
+    while ((job = ws_mpsc_pop(&pool->done)) != NULL) {
+        ws_worker_pool_finish(pool, job);
+        any = true;
+    }
+    if (any && pool->flush != NULL) {
+        pool->flush(pool->ctx);
+    }
+}
+
+static inline void *ws_worker_main(void *arg) {
+    struct ws_worker *worker = arg;
+    struct ws_worker_pool *pool = worker->pool;
+
+    while (true) {
+        pthread_mutex_lock(&worker->lock);
+        while (worker->head == NULL && !worker->stop) {
+            pthread_cond_wait(&worker->cond, &worker->lock);
+        }
+        if (worker->stop) {
+            pthread_mutex_unlock(&worker->lock);
+            break;
+        }
+        struct ws_job *job = worker->head;
+        worker->head = job->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+        worker->depth--;
+        pthread_mutex_unlock(&worker->lock);
+
+        job->started_at = ws_worker_pool_now();
+        pool->handler(job, pool->ctx);
+        job->finished_at = ws_worker_pool_now();
+
+        ws_mpsc_push(&pool->done, job);
+        ev_async_send(pool->loop, &pool->async);
+    }
+    return NULL;
+}
+
+static inline size_t ws_worker_pool_env(const char *name, size_t fallback) {
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') {
+        return fallback;
+    }
+    char *end = NULL;
+    unsigned long long n = strtoull(value, &end, 10);
+    if (end == value || *end != '\0') {
+        fprintf(stderr, "%s: invalid value \"%s\", using %zu\n", name, value,
+                fallback);
+        return fallback;
+    }
+    return (size_t)n;
+}
+
+// Start `num_workers` threads. Each worker queues at most `queue_limit` jobs
+// (0 means unbounded). Returns 0 on success.
+static inline int ws_worker_pool_init(struct ws_worker_pool *pool,
+                                      struct ev_loop *loop, size_t num_workers,
+                                      size_t queue_limit,
+                                      ws_job_handler_fn handler,
+                                      ws_job_complete_fn complete,
+                                      ws_job_flush_fn flush, void *ctx) {
+    memset(pool, 0, sizeof(*pool));
+    pool->loop = loop;
+    pool->queue_limit = queue_limit;
+    pool->handler = handler;
+    pool->complete = complete;
+    pool->flush = flush;
+    pool->ctx = ctx;
+    ws_mpsc_init(&pool->done);
+
+    if (num_workers == 0) {
+        return 0;
+    }
+
+    ev_async_init(&pool->async, ws_worker_pool_async_cb);
+    pool->async.data = pool;
+    ev_async_start(loop, &pool->async);
+
+    pool->workers = calloc(num_workers, sizeof(struct ws_worker));
+    if (pool->workers == NULL) {
+        fprintf(stderr, "worker pool: out of memory\n");
+        return -1;
+    }
+    for (size_t i = 0; i < num_workers; i++) {
+        struct ws_worker *worker = &pool->workers[i];
+        worker->pool = pool;
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+        if (pthread_create(&worker->thread, NULL, ws_worker_main, worker) !=
+            0) {
+            fprintf(stderr, "worker pool: failed to start worker %zu\n", i);
+            pthread_mutex_destroy(&worker->lock);
+            pthread_cond_destroy(&worker->cond);
+            break;
+        }
+        pool->num_workers++;
+    }
+    return pool->num_workers == num_workers ? 0 : -1;
+}
+
+// Post a job from the loop thread. Returns -1 if the session's worker queue
+// is full; the job is not consumed in that case.
+static inline int ws_worker_pool_post(struct ws_worker_pool *pool,
+                                      struct ws_job *job) {
+    job->posted_at = ws_worker_pool_now();
+
+    if (pool->num_workers == 0) {
+        pool->stats.posted++;
+        job->started_at = job->posted_at;
+        pool->handler(job, pool->ctx);
+        job->finished_at = ws_worker_pool_now();
+        ws_worker_pool_finish(pool, job);
+        return 0;
+    }
+
+    struct ws_worker *worker =
+        &pool->workers[job->session_id % pool->num_workers];
+    pthread_mutex_lock(&worker->lock);
+    if (pool->queue_limit > 0 && worker->depth >= pool->queue_limit) {
+        pthread_mutex_unlock(&worker->lock);
+        pool->stats.rejected++;
+        return -1;
+    }
+    job->next = NULL;
+    if (worker->tail != NULL) {
+        worker->tail->next = job;
+    } else {
+        worker->head = job;
+    }
+    worker->tail = job;
+    worker->depth++;
+    if (worker->depth > pool->stats.max_depth) {
+        pool->stats.max_depth = worker->depth;
+    }
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->lock);
+
+    pool->stats.posted++;
+    return 0;
+}
+
+static inline void ws_latency_print(const char *name,
+                                    const struct ws_latency_stats *s) {
+    fprintf(stderr,
+            "  %-10s avg=%.3fms p50<=%.3fms p99<=%.3fms max=%.3fms\n", name,
+            s->count ? s->sum / s->count * 1e3 : 0,
+            ws_latency_percentile(s, 50) * 1e3,
+            ws_latency_percentile(s, 99) * 1e3, s->max * 1e3);
+}
+
+static inline void ws_worker_pool_print_stats(const struct ws_worker_pool *pool,
+                                              const char *label) {
+    const struct ws_worker_pool_stats *s = &pool->stats;
+    fprintf(stderr,
+            "worker pool [%s]: workers=%zu posted=%" PRIu64
+            " completed=%" PRIu64 " rejected=%" PRIu64 " max_depth=%zu\n",
+            label, pool->num_workers, s->posted, s->completed, s->rejected,
+            s->max_depth);
+    if (s->completed > 0) {
+        ws_latency_print("queue", &s->queue_wait);
+        ws_latency_print("service", &s->service);
+        ws_latency_print("handoff", &s->handoff);
+    }
+}
+
+// Stop the workers and drop any job that has not completed yet.
+static inline void ws_worker_pool_free(struct ws_worker_pool *pool) {
+    for (size_t i = 0; i < pool->num_workers; i++) {
+        struct ws_worker *worker = &pool->workers[i];
+        pthread_mutex_lock(&worker->lock);
+        worker->stop = true;
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->lock);
+    }
+    for (size_t i = 0; i < pool->num_workers; i++) {
+        struct ws_worker *worker = &pool->workers[i];
+        pthread_join(worker->thread, NULL);
+        while (worker->head != NULL) {
+            struct ws_job *job = worker->head;
+            worker->head = job->next;
+            ws_job_free(job);
+        }
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->cond);
+    }
+
+    struct ws_job *job;
+    while ((job = ws_mpsc_pop(&pool->done)) != NULL) {
+        ws_job_free(job);
+    }
+    if (pool->workers != NULL) {
+        ev_async_stop(pool->loop, &pool->async);
+        free(pool->workers);
+        pool->workers = NULL;
+    }
+    pool->num_workers = 0;
+}
+
+#endif  // WS_WORKER_POOL_H